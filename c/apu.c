@@ -0,0 +1,622 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "nes.h"
+
+// https://www.nesdev.org/wiki/APU_Frame_Counter
+/* NTSC 4-step sequence: the frame IRQ is raised 29829 cycles after the sequence starts, and the sequence repeats every
+    * 29830 cycles. The 5-step sequence never raises it, and neither does the 4-step one with bit 6 of $4017 set.
+*/
+#define FRAME_IRQ_CYCLE 29829
+#define FRAME_SEQUENCE_LENGTH 29830
+#define FIVE_STEP_SEQUENCE_LENGTH 37282
+
+#define FRAME_COUNTER_FIVE_STEP 0x80
+#define FRAME_COUNTER_IRQ_INHIBIT 0x40
+
+/* Quarter-frame clocks (envelopes, triangle linear counter) of each sequence; the second and last also clock half
+    * frames (length counters, sweeps)
+*/
+static const uint16_t fourStepClocks[4] = { 7457, 14913, 22371, 29829 };
+static const uint16_t fiveStepClocks[4] = { 7457, 14913, 22371, 37281 };
+
+// https://www.nesdev.org/wiki/APU_Length_Counter
+static const uint8_t lengthTable[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+// https://www.nesdev.org/wiki/APU_Pulse
+static const uint8_t dutyTable[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+// https://www.nesdev.org/wiki/APU_Triangle
+static const uint8_t triangleTable[32] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// https://www.nesdev.org/wiki/APU_Noise
+static const uint16_t noisePeriods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+// https://www.nesdev.org/wiki/APU_DMC
+static const uint16_t dmcRates[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+/* Cycles a sample fetch takes from the CPU */
+#define DMC_STALL 4
+
+#define CONTROL_HALT 0x20
+#define CONTROL_CONSTANT 0x10
+#define TRIANGLE_CONTROL 0x80
+#define NOISE_SHORT_MODE 0x80
+#define DMC_IRQ_ENABLE 0x80
+#define DMC_LOOP 0x40
+#define SWEEP_ENABLE 0x80
+#define SWEEP_NEGATE 0x08
+
+/* The noise shift register is linear over GF(2), so n steps are one 15x15 bit matrix: jumps[mode][k] holds the columns
+    * of the matrix for 2^k steps, and any count is at most 64 matrix-vector products instead of n shifts.
+*/
+static uint16_t jumps[2][64][15];
+static pthread_once_t jumpsOnce = PTHREAD_ONCE_INIT;
+
+static inline uint16_t shiftNoise(uint16_t lfsr, int mode) {
+    uint16_t feedback = (lfsr ^ (lfsr >> (mode ? 6 : 1))) & 0x01;
+    return (lfsr >> 1) | (feedback << 14);
+}
+
+static uint16_t applyJump(const uint16_t* columns, uint16_t lfsr) {
+    uint16_t result = 0;
+    for (int bit = 0; bit < 15; bit++) {
+        if (lfsr & (1 << bit)) {
+            result ^= columns[bit];
+        }
+    }
+    return result;
+}
+
+static void buildJumps(void) {
+    for (int mode = 0; mode < 2; mode++) {
+        for (int bit = 0; bit < 15; bit++) {
+            jumps[mode][0][bit] = shiftNoise(1 << bit, mode);
+        }
+        for (int k = 1; k < 64; k++) {
+            for (int bit = 0; bit < 15; bit++) {
+                jumps[mode][k][bit] = applyJump(jumps[mode][k - 1], jumps[mode][k - 1][bit]);
+            }
+        }
+    }
+}
+
+static uint16_t advanceNoise(uint16_t lfsr, int mode, uint64_t steps) {
+    if (steps <= 16) {
+        while (steps--) {
+            lfsr = shiftNoise(lfsr, mode);
+        }
+        return lfsr;
+    }
+    pthread_once(&jumpsOnce, buildJumps);
+    for (int k = 0; steps; k++, steps >>= 1) {
+        if (steps & 1) {
+            lfsr = applyJump(jumps[mode][k], lfsr);
+        }
+    }
+    return lfsr;
+}
+
+/* Timers. Each moves its channel `cycles` forward: the counter runs down, and every time it expires the sequencer
+    * steps and the counter reloads from the period, which only takes effect on that reload. Moving forward by a and
+    * then b cycles is exactly moving forward by a + b, so the APU can be caught up at any points in between.
+*/
+static void runPulse(Pulse* pulse, uint64_t cycles) {
+    if (cycles < pulse->counter) {
+        pulse->counter -= cycles;
+        return;
+    }
+    cycles -= pulse->counter;
+    uint32_t period = (pulse->period + 1) * 2;
+    pulse->step = (pulse->step + 1 + cycles / period) & 0x07;
+    pulse->counter = period - cycles % period;
+}
+
+/* The sequencer only steps while both the linear and the length counter are non-zero */
+static void runTriangle(Triangle* triangle, uint64_t cycles) {
+    if (cycles < triangle->counter) {
+        triangle->counter -= cycles;
+        return;
+    }
+    cycles -= triangle->counter;
+    uint32_t period = triangle->period + 1;
+    if (triangle->linear && triangle->length) {
+        triangle->step = (triangle->step + 1 + cycles / period) & 0x1F;
+    }
+    triangle->counter = period - cycles % period;
+}
+
+static void runNoise(Noise* noise, uint64_t cycles) {
+    if (cycles < noise->counter) {
+        noise->counter -= cycles;
+        return;
+    }
+    cycles -= noise->counter;
+    uint32_t period = noisePeriods[noise->period & 0x0F];
+    noise->lfsr = advanceNoise(noise->lfsr, (noise->period & NOISE_SHORT_MODE) != 0, 1 + cycles / period);
+    noise->counter = period - cycles % period;
+}
+
+static void restartDmc(Dmc* dmc) {
+    dmc->address = 0xC000 + dmc->sampleAddress * 64;
+    dmc->bytesRemaining = dmc->sampleLength * 16 + 1;
+}
+
+/* The memory reader: refills an empty sample buffer while bytes remain, stalling the CPU for the read */
+static void fetchDmc(CPU* cpu) {
+    Dmc* dmc = &cpu->apu.dmc;
+    if (dmc->bufferFull || !dmc->bytesRemaining) {
+        return;
+    }
+    dmc->buffer = readByte(cpu, dmc->address);
+    dmc->bufferFull = 1;
+    dmc->address = dmc->address == 0xFFFF ? 0x8000 : dmc->address + 1;
+    cpu->clock.cycles += DMC_STALL;
+    if (--dmc->bytesRemaining == 0) {
+        if (dmc->control & DMC_LOOP) {
+            restartDmc(dmc);
+        } else if (dmc->control & DMC_IRQ_ENABLE) {
+            cpu->irq |= IRQ_DMC;
+        }
+    }
+}
+
+/* One timer clock of the output unit: shift a bit into the level, and after every 8th take the next byte */
+static void clockDmc(CPU* cpu, Dmc* dmc) {
+    if (!dmc->silence) {
+        if (dmc->shift & 0x01) {
+            if (dmc->level <= 125) {
+                dmc->level += 2;
+            }
+        } else if (dmc->level >= 2) {
+            dmc->level -= 2;
+        }
+        dmc->shift >>= 1;
+    }
+    if (--dmc->bitsRemaining == 0) {
+        dmc->bitsRemaining = 8;
+        dmc->silence = !dmc->bufferFull;
+        if (dmc->bufferFull) {
+            dmc->shift = dmc->buffer;
+            dmc->bufferFull = 0;
+            fetchDmc(cpu);
+        }
+    }
+}
+
+static inline int dmcIdle(const Dmc* dmc) {
+    return dmc->silence && !dmc->bufferFull && !dmc->bytesRemaining;
+}
+
+/* Clocks one at a time while there is a sample to play; once idle only the bit counter moves */
+static void runDmc(CPU* cpu, uint64_t cycles) {
+    Dmc* dmc = &cpu->apu.dmc;
+    uint16_t rate = dmcRates[dmc->control & 0x0F];
+    while (cycles >= dmc->counter) {
+        cycles -= dmc->counter;
+        dmc->counter = rate;
+        clockDmc(cpu, dmc);
+        if (dmcIdle(dmc)) {
+            uint64_t clocks = cycles / rate;
+            cycles %= rate;
+            dmc->bitsRemaining = (uint8_t)((dmc->bitsRemaining - 1 + 8 - clocks % 8) % 8 + 1);
+            break;
+        }
+    }
+    dmc->counter -= cycles;
+}
+
+// https://www.nesdev.org/wiki/APU_Sweep
+static uint16_t sweepTarget(const Pulse* pulse, int channel) {
+    uint16_t change = pulse->period >> (pulse->sweep & 0x07);
+    if (pulse->sweep & SWEEP_NEGATE) {
+        /* Pulse 1 negates with one's complement */
+        return pulse->period - change - (channel == 0);
+    }
+    return pulse->period + change;
+}
+
+/* The sweep unit mutes the channel whether or not it is enabled */
+static inline int sweepMutes(const Pulse* pulse, int channel) {
+    return pulse->period < 8 || sweepTarget(pulse, channel) > 0x7FF;
+}
+
+static inline int pulseMuted(const Pulse* pulse, int channel) {
+    return !pulse->length || sweepMutes(pulse, channel);
+}
+
+static inline uint8_t envelopeVolume(uint8_t control, uint8_t decay) {
+    return (control & CONTROL_CONSTANT) ? (control & 0x0F) : decay;
+}
+
+/* Outputs (0-15, DMC 0-127). A triangle with a period below 2 is ultrasonic and held at its midpoint. */
+static inline int pulseOutput(const Pulse* pulse, int channel) {
+    if (pulseMuted(pulse, channel) || !dutyTable[pulse->control >> 6][pulse->step]) {
+        return 0;
+    }
+    return envelopeVolume(pulse->control, pulse->envelopeDecay);
+}
+
+static inline int triangleOutput(const Triangle* triangle) {
+    return triangle->period < 2 ? 7 : triangleTable[triangle->step];
+}
+
+static inline int noiseOutput(const Noise* noise) {
+    if (!noise->length || (noise->lfsr & 0x01)) {
+        return 0;
+    }
+    return envelopeVolume(noise->control, noise->envelopeDecay);
+}
+
+static void updateAudio(CPU* cpu) {
+    APU* apu = &cpu->apu;
+    mixAudio(cpu->audio, apu->cycles, pulseOutput(&apu->pulse[0], 0) + pulseOutput(&apu->pulse[1], 1),
+        3 * triangleOutput(&apu->triangle) + 2 * noiseOutput(&apu->noise) + apu->dmc.level);
+}
+
+/* Moves every channel to `end`, which no frame counter clock lies before. Nobody listening: one step per channel.
+    * Otherwise the channels whose output can change are stepped from one timer expiry to the next and the mix is
+    * handed to the synthesiser at the cycle each change happens; the rest still take one step.
+*/
+static void runChannels(CPU* cpu, uint64_t end) {
+    APU* apu = &cpu->apu;
+    if (!cpu->audio) {
+        uint64_t cycles = end - apu->cycles;
+        runPulse(&apu->pulse[0], cycles);
+        runPulse(&apu->pulse[1], cycles);
+        runTriangle(&apu->triangle, cycles);
+        runNoise(&apu->noise, cycles);
+        runDmc(cpu, cycles);
+        apu->cycles = end;
+        return;
+    }
+
+    int pulses[2];
+    for (int i = 0; i < 2; i++) {
+        pulses[i] = !pulseMuted(&apu->pulse[i], i) && envelopeVolume(apu->pulse[i].control, apu->pulse[i].envelopeDecay);
+        if (!pulses[i]) {
+            runPulse(&apu->pulse[i], end - apu->cycles);
+        }
+    }
+    int triangle = apu->triangle.linear && apu->triangle.length && apu->triangle.period >= 2;
+    if (!triangle) {
+        runTriangle(&apu->triangle, end - apu->cycles);
+    }
+    int noise = apu->noise.length && envelopeVolume(apu->noise.control, apu->noise.envelopeDecay);
+    if (!noise) {
+        runNoise(&apu->noise, end - apu->cycles);
+    }
+
+    while (apu->cycles < end) {
+        uint64_t cycles = end - apu->cycles;
+        for (int i = 0; i < 2; i++) {
+            if (pulses[i] && apu->pulse[i].counter < cycles) {
+                cycles = apu->pulse[i].counter;
+            }
+        }
+        if (triangle && apu->triangle.counter < cycles) {
+            cycles = apu->triangle.counter;
+        }
+        if (noise && apu->noise.counter < cycles) {
+            cycles = apu->noise.counter;
+        }
+        int dmc = !dmcIdle(&apu->dmc);
+        if (dmc && apu->dmc.counter < cycles) {
+            cycles = apu->dmc.counter;
+        }
+        /* Outputs only change when a timer expires; a step that just reaches `end` leaves the mix alone */
+        int expires = (pulses[0] && apu->pulse[0].counter == cycles) || (pulses[1] && apu->pulse[1].counter == cycles) ||
+            (triangle && apu->triangle.counter == cycles) || (noise && apu->noise.counter == cycles) ||
+            (dmc && apu->dmc.counter == cycles);
+        for (int i = 0; i < 2; i++) {
+            if (pulses[i]) {
+                runPulse(&apu->pulse[i], cycles);
+            }
+        }
+        if (triangle) {
+            runTriangle(&apu->triangle, cycles);
+        }
+        if (noise) {
+            runNoise(&apu->noise, cycles);
+        }
+        runDmc(cpu, cycles);
+        apu->cycles += cycles;
+        if (expires) {
+            updateAudio(cpu);
+        }
+    }
+}
+
+// https://www.nesdev.org/wiki/APU_Envelope
+static void clockEnvelope(uint8_t control, uint8_t* start, uint8_t* divider, uint8_t* decay) {
+    if (*start) {
+        *start = 0;
+        *decay = 15;
+        *divider = control & 0x0F;
+    } else if (*divider == 0) {
+        *divider = control & 0x0F;
+        if (*decay) {
+            (*decay)--;
+        } else if (control & CONTROL_HALT) {
+            *decay = 15;
+        }
+    } else {
+        (*divider)--;
+    }
+}
+
+static void clockQuarterFrame(APU* apu) {
+    for (int i = 0; i < 2; i++) {
+        Pulse* pulse = &apu->pulse[i];
+        clockEnvelope(pulse->control, &pulse->envelopeStart, &pulse->envelopeDivider, &pulse->envelopeDecay);
+    }
+    clockEnvelope(apu->noise.control, &apu->noise.envelopeStart, &apu->noise.envelopeDivider, &apu->noise.envelopeDecay);
+    Triangle* triangle = &apu->triangle;
+    if (triangle->linearReload) {
+        triangle->linear = triangle->control & 0x7F;
+    } else if (triangle->linear) {
+        triangle->linear--;
+    }
+    if (!(triangle->control & TRIANGLE_CONTROL)) {
+        triangle->linearReload = 0;
+    }
+}
+
+static void clockHalfFrame(APU* apu) {
+    for (int i = 0; i < 2; i++) {
+        Pulse* pulse = &apu->pulse[i];
+        if (pulse->length && !(pulse->control & CONTROL_HALT)) {
+            pulse->length--;
+        }
+        if (pulse->sweepDivider == 0 && (pulse->sweep & SWEEP_ENABLE) && (pulse->sweep & 0x07) && !sweepMutes(pulse, i)) {
+            pulse->period = sweepTarget(pulse, i);
+        }
+        if (pulse->sweepDivider == 0 || pulse->sweepReload) {
+            pulse->sweepDivider = (pulse->sweep >> 4) & 0x07;
+            pulse->sweepReload = 0;
+        } else {
+            pulse->sweepDivider--;
+        }
+    }
+    if (apu->triangle.length && !(apu->triangle.control & TRIANGLE_CONTROL)) {
+        apu->triangle.length--;
+    }
+    if (apu->noise.length && !(apu->noise.control & CONTROL_HALT)) {
+        apu->noise.length--;
+    }
+}
+
+/* The cycle of the first frame counter clock after the APU's position, and which clock it is. The position in the
+    * sequence is taken modulo its length: frameCounterEvent moves frameSequenceStart on by whole 4-step sequences and
+    * may already have moved it past the APU.
+*/
+static uint64_t nextFrameClock(CPU* cpu, int* index) {
+    APU* apu = &cpu->apu;
+    int fiveStep = cpu->ioRegisters[0x17] & FRAME_COUNTER_FIVE_STEP;
+    const uint16_t* clocks = fiveStep ? fiveStepClocks : fourStepClocks;
+    int64_t length = fiveStep ? FIVE_STEP_SEQUENCE_LENGTH : FRAME_SEQUENCE_LENGTH;
+    int64_t position = ((int64_t)(apu->cycles - apu->frameSequenceStart) % length + length) % length;
+    for (int i = 0; i < 4; i++) {
+        if (clocks[i] > position) {
+            *index = i;
+            return apu->cycles + (clocks[i] - position);
+        }
+    }
+    *index = 0;
+    return apu->cycles + (length - position) + clocks[0];
+}
+
+/* The next time the DMC takes a byte out of its buffer, which is when the memory reader next fetches */
+static void scheduleDmc(CPU* cpu) {
+    Dmc* dmc = &cpu->apu.dmc;
+    uint64_t cycle = NO_EVENT;
+    if (dmc->bytesRemaining) {
+        cycle = cpu->apu.cycles + dmc->counter + (uint64_t)(dmc->bitsRemaining - 1) * dmcRates[dmc->control & 0x0F];
+    }
+    scheduleEvent(cpu, EVENT_DMC, cycle);
+}
+
+/* Advances the APU to the CPU's clock, stopping at every frame counter clock on the way */
+void apuCatchUp(CPU* cpu) {
+    APU* apu = &cpu->apu;
+    uint64_t target = cpu->clock.cycles;
+    PROFILE_ENTER(cpu, PROFILE_APU);
+    while (apu->cycles < target) {
+        int index;
+        uint64_t clock = nextFrameClock(cpu, &index);
+        if (clock > target) {
+            runChannels(cpu, target);
+            break;
+        }
+        runChannels(cpu, clock);
+        clockQuarterFrame(apu);
+        if (index & 1) {
+            clockHalfFrame(apu);
+        }
+        if (cpu->audio) {
+            updateAudio(cpu);
+        }
+    }
+    scheduleDmc(cpu);
+    PROFILE_LEAVE(cpu);
+}
+
+/* EVENT_DMC: the byte the output unit takes now is replaced from memory, which may end the sample and raise IRQ */
+void dmcEvent(CPU* cpu) {
+    apuCatchUp(cpu);
+}
+
+/* Raises any frame IRQ that is due and schedules the next one */
+void frameCounterEvent(CPU* cpu) {
+    APU* apu = &cpu->apu;
+    apuCatchUp(cpu);
+    if (cpu->ioRegisters[0x17] & (FRAME_COUNTER_FIVE_STEP | FRAME_COUNTER_IRQ_INHIBIT)) {
+        scheduleEvent(cpu, EVENT_FRAME_COUNTER, NO_EVENT);
+        return;
+    }
+    while (apu->frameSequenceStart + FRAME_IRQ_CYCLE <= cpu->clock.cycles) {
+        cpu->irq |= IRQ_FRAME_COUNTER;
+        apu->frameSequenceStart += FRAME_SEQUENCE_LENGTH;
+    }
+    scheduleEvent(cpu, EVENT_FRAME_COUNTER, apu->frameSequenceStart + FRAME_IRQ_CYCLE);
+}
+
+/* $4017: restarts the sequence; setting the inhibit bit also acknowledges a pending frame IRQ, and the 5-step sequence
+    * clocks everything once straight away
+*/
+void writeFrameCounter(CPU* cpu, uint8_t value) {
+    apuCatchUp(cpu);
+    cpu->ioRegisters[0x17] = value;
+    cpu->apu.frameSequenceStart = cpu->clock.cycles;
+    if (value & FRAME_COUNTER_IRQ_INHIBIT) {
+        cpu->irq &= ~IRQ_FRAME_COUNTER;
+    }
+    if (value & FRAME_COUNTER_FIVE_STEP) {
+        clockQuarterFrame(&cpu->apu);
+        clockHalfFrame(&cpu->apu);
+    }
+    frameCounterEvent(cpu);
+}
+
+static inline void loadLength(const APU* apu, int channel, uint8_t* length, uint8_t value) {
+    if (apu->enabled & (1 << channel)) {
+        *length = lengthTable[value >> 3];
+    }
+}
+
+// https://www.nesdev.org/wiki/APU_registers
+/* $4000-$4013 and $4015 */
+void writeApuRegister(CPU* cpu, uint16_t address, uint8_t value) {
+    APU* apu = &cpu->apu;
+    apuCatchUp(cpu);
+    switch (address) {
+        case 0x4000:
+        case 0x4004:
+            apu->pulse[(address >> 2) & 1].control = value;
+            break;
+        case 0x4001:
+        case 0x4005:
+            apu->pulse[(address >> 2) & 1].sweep = value;
+            apu->pulse[(address >> 2) & 1].sweepReload = 1;
+            break;
+        case 0x4002:
+        case 0x4006:
+            apu->pulse[(address >> 2) & 1].period = (apu->pulse[(address >> 2) & 1].period & 0x0700) | value;
+            break;
+        case 0x4003:
+        case 0x4007: {
+            Pulse* pulse = &apu->pulse[(address >> 2) & 1];
+            pulse->period = (pulse->period & 0x00FF) | ((value & 0x07) << 8);
+            loadLength(apu, (address >> 2) & 1, &pulse->length, value);
+            pulse->step = 0;
+            pulse->envelopeStart = 1;
+            break;
+        }
+        case 0x4008:
+            apu->triangle.control = value;
+            break;
+        case 0x400A:
+            apu->triangle.period = (apu->triangle.period & 0x0700) | value;
+            break;
+        case 0x400B:
+            apu->triangle.period = (apu->triangle.period & 0x00FF) | ((value & 0x07) << 8);
+            loadLength(apu, 2, &apu->triangle.length, value);
+            apu->triangle.linearReload = 1;
+            break;
+        case 0x400C:
+            apu->noise.control = value;
+            break;
+        case 0x400E:
+            apu->noise.period = value & (NOISE_SHORT_MODE | 0x0F);
+            break;
+        case 0x400F:
+            loadLength(apu, 3, &apu->noise.length, value);
+            apu->noise.envelopeStart = 1;
+            break;
+        case 0x4010:
+            apu->dmc.control = value;
+            if (!(value & DMC_IRQ_ENABLE)) {
+                cpu->irq &= ~IRQ_DMC;
+            }
+            break;
+        case 0x4011:
+            apu->dmc.level = value & 0x7F;
+            break;
+        case 0x4012:
+            apu->dmc.sampleAddress = value;
+            break;
+        case 0x4013:
+            apu->dmc.sampleLength = value;
+            break;
+        case 0x4015:
+            /* Disabling a channel silences it at once; enabling the DMC restarts a finished sample */
+            apu->enabled = value & 0x1F;
+            if (!(value & 0x01)) {
+                apu->pulse[0].length = 0;
+            }
+            if (!(value & 0x02)) {
+                apu->pulse[1].length = 0;
+            }
+            if (!(value & 0x04)) {
+                apu->triangle.length = 0;
+            }
+            if (!(value & 0x08)) {
+                apu->noise.length = 0;
+            }
+            if (!(value & 0x10)) {
+                apu->dmc.bytesRemaining = 0;
+            } else if (!apu->dmc.bytesRemaining) {
+                restartDmc(&apu->dmc);
+            }
+            cpu->irq &= ~IRQ_DMC;
+            fetchDmc(cpu);
+            break;
+    }
+    if (cpu->audio) {
+        updateAudio(cpu);
+    }
+    scheduleDmc(cpu);
+}
+
+// https://www.nesdev.org/wiki/APU#Status_($4015)
+/* Which channels are still playing, and the DMC and frame interrupt flags; reading clears the frame one */
+uint8_t readApuStatus(CPU* cpu) {
+    APU* apu = &cpu->apu;
+    apuCatchUp(cpu);
+    uint8_t status = (apu->pulse[0].length ? 0x01 : 0) | (apu->pulse[1].length ? 0x02 : 0) |
+        (apu->triangle.length ? 0x04 : 0) | (apu->noise.length ? 0x08 : 0) | (apu->dmc.bytesRemaining ? 0x10 : 0) |
+        ((cpu->irq & IRQ_FRAME_COUNTER) ? 0x40 : 0) | ((cpu->irq & IRQ_DMC) ? 0x80 : 0);
+    cpu->irq &= ~IRQ_FRAME_COUNTER;
+    return status;
+}
+
+// https://www.nesdev.org/wiki/APU#Power_up
+/* Pairs with resetCPU, which restarts the CPU clock */
+void resetAPU(CPU* cpu) {
+    APU* apu = &cpu->apu;
+    memset(apu, 0, sizeof(*apu));
+    apu->frameSequenceStart = cpu->clock.cycles;
+    apu->cycles = cpu->clock.cycles;
+    apu->pulse[0].counter = apu->pulse[1].counter = 2;
+    apu->triangle.counter = 1;
+    apu->noise.lfsr = 1;
+    apu->noise.counter = noisePeriods[0];
+    apu->dmc.counter = dmcRates[0];
+    apu->dmc.bitsRemaining = 8;
+    apu->dmc.silence = 1;
+}
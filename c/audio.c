@@ -0,0 +1,394 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+/* Audio output.
+    *
+    * The APU never produces samples. It reports the mixed level each time a channel's output changes (mixAudio), and
+    * each change is added to the synthesis buffer as a band-limited step: a delta spread over BLIP_TAPS samples by a
+    * windowed-sinc kernel chosen by where between two samples it happened. Integrating the buffer gives the output
+    * with no aliasing from the square edges and no per-cycle work, so the cost follows the number of level changes.
+    *
+    * submitAudioFrame (after runFrame) turns the finished part of the buffer into 16-bit samples and pushes them into
+    * a single-producer single-consumer ring that a writer thread drains into a WAV file or stdout. A dynamic output
+    * is for a consumer that plays in real time: the resampling ratio is nudged by up to RATE_CONTROL_PPM to keep the
+    * ring half full, and samples that don't fit are dropped. Otherwise the rate is exact and the emulator waits.
+    *
+*/
+// https://www.nesdev.org/wiki/Cycle_reference_chart
+#define CPU_CLOCK_RATE 1789773
+
+#define BLIP_SIZE 8192
+#define BLIP_TAPS 16
+#define BLIP_PHASE_BITS 6
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_UNIT_BITS 13
+/* Full scale of the mixed output, before the DC blocker centres it */
+#define AUDIO_SCALE 24000
+#define AUDIO_RING 65536
+#define RATE_CONTROL_PPM 5000
+
+struct audio_output {
+    /* Sample ring: written by the emulation thread, drained by the writer */
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    int16_t ring[AUDIO_RING];
+    /* Posted once per submitted frame and once by closeAudio; drained once per pass of the writer */
+    sem_t ready;
+    sem_t drained;
+    pthread_t thread;
+    atomic_int closing;
+
+    FILE* out;
+    uint32_t rate;
+    int dynamic;
+
+    /* Synthesis: buffer[0] is the sample at `offset` (32.32 fixed point) past CPU cycle `start` */
+    int32_t buffer[BLIP_SIZE + BLIP_TAPS];
+    int32_t kernel[BLIP_PHASES][BLIP_TAPS];
+    uint64_t start;
+    uint64_t offset;
+    uint64_t factor;
+    uint64_t baseFactor;
+    int started;
+    int32_t level;
+    int32_t integrator;
+    int64_t dc;
+    int16_t samples[BLIP_SIZE];
+    int32_t pulseTable[31];
+    int32_t tndTable[203];
+
+    /* Counted by the emulation thread */
+    uint64_t produced;
+    uint64_t dropped;
+    uint32_t maxDepth;
+    int32_t rateAdjust;
+    /* Counted by the writer */
+    atomic_ullong written;
+    atomic_int failed;
+};
+
+// https://www.nesdev.org/wiki/APU_Mixer
+/* The lookup-table approximation of the nonlinear mixer, indexed by pulse1 + pulse2 and 3 * triangle + 2 * noise + dmc */
+static void buildMixer(AudioOutput* audio) {
+    audio->pulseTable[0] = audio->tndTable[0] = 0;
+    for (int i = 1; i < 31; i++) {
+        audio->pulseTable[i] = (int32_t) lround(AUDIO_SCALE * 95.52 / (8128.0 / i + 100));
+    }
+    for (int i = 1; i < 203; i++) {
+        audio->tndTable[i] = (int32_t) lround(AUDIO_SCALE * 163.67 / (24329.0 / i + 100));
+    }
+}
+
+/* One Blackman-windowed sinc per phase, cut off at 90% of Nyquist and scaled so every phase sums to exactly one unit */
+static void buildKernel(AudioOutput* audio) {
+    const double cutoff = 0.45;
+    for (int phase = 0; phase < BLIP_PHASES; phase++) {
+        double taps[BLIP_TAPS];
+        double sum = 0;
+        for (int i = 0; i < BLIP_TAPS; i++) {
+            double t = i - (BLIP_TAPS / 2 - 1) - (double) phase / BLIP_PHASES;
+            double x = 2 * cutoff * t;
+            double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+            double w = t / (BLIP_TAPS / 2);
+            double window = fabs(w) >= 1 ? 0 : 0.42 + 0.5 * cos(M_PI * w) + 0.08 * cos(2 * M_PI * w);
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+        int32_t total = 0;
+        int peak = 0;
+        for (int i = 0; i < BLIP_TAPS; i++) {
+            audio->kernel[phase][i] = (int32_t) lround(taps[i] / sum * (1 << BLIP_UNIT_BITS));
+            total += audio->kernel[phase][i];
+            if (audio->kernel[phase][i] > audio->kernel[phase][peak]) {
+                peak = i;
+            }
+        }
+        audio->kernel[phase][peak] += (1 << BLIP_UNIT_BITS) - total;
+    }
+}
+
+/* Changes before the buffer's start (a state load went back in time) land on its first sample; changes too far
+    * ahead of it for the buffer to hold (nobody called submitAudioFrame) are lost.
+*/
+static void addDelta(AudioOutput* audio, uint64_t cycle, int32_t delta) {
+    if (!audio->started) {
+        audio->start = cycle;
+        audio->started = 1;
+    }
+    uint64_t elapsed = cycle > audio->start ? cycle - audio->start : 0;
+    if (elapsed >= (uint64_t) BLIP_SIZE * (CPU_CLOCK_RATE / audio->rate)) {
+        return;
+    }
+    uint64_t fixed = audio->offset + elapsed * audio->factor;
+    uint64_t index = fixed >> 32;
+    if (index >= BLIP_SIZE) {
+        return;
+    }
+    const int32_t* kernel = audio->kernel[(fixed >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+    int32_t* out = audio->buffer + index;
+    for (int i = 0; i < BLIP_TAPS; i++) {
+        out[i] += kernel[i] * delta;
+    }
+}
+
+/* From the APU, each time a channel's output changes: pulse is pulse 1 + pulse 2, tnd 3 * triangle + 2 * noise + DMC */
+void mixAudio(AudioOutput* audio, uint64_t cycle, int pulse, int tnd) {
+    int32_t level = audio->pulseTable[pulse] + audio->tndTable[tnd];
+    if (level != audio->level) {
+        addDelta(audio, cycle, level - audio->level);
+        audio->level = level;
+    }
+}
+
+/* Integrates the samples before CPU cycle `end`, whose deltas are all in, and moves the rest to the front */
+static uint32_t readSamples(AudioOutput* audio, uint64_t end) {
+    if (!audio->started) {
+        audio->start = end;
+        audio->started = 1;
+    }
+    uint64_t elapsed = end > audio->start ? end - audio->start : 0;
+    uint64_t fixed = audio->offset + elapsed * audio->factor;
+    uint64_t count = fixed >> 32;
+    if (count > BLIP_SIZE) {
+        count = BLIP_SIZE;
+        fixed = (uint64_t) BLIP_SIZE << 32;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        audio->integrator += audio->buffer[i];
+        int32_t sample = (audio->integrator >> BLIP_UNIT_BITS) - (int32_t)(audio->dc >> 16);
+        audio->dc += (int64_t) sample * 128;
+        audio->samples[i] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+    }
+    memmove(audio->buffer, audio->buffer + count, BLIP_TAPS * sizeof(int32_t));
+    memset(audio->buffer + BLIP_TAPS, 0, count * sizeof(int32_t));
+    audio->start = end;
+    audio->offset = fixed & 0xFFFFFFFFULL;
+    return (uint32_t) count;
+}
+
+// http://soundfile.sapp.org/doc/WaveFormat/
+static int writeWavHeader(FILE* out, uint32_t rate, uint32_t dataBytes) {
+    uint8_t header[44];
+    uint32_t fields[] = { 0x46464952, dataBytes + 36, 0x45564157, 0x20746D66, 16, 0x00010001, rate, rate * 2,
+        0x00100002, 0x61746164, dataBytes };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        for (int byte = 0; byte < 4; byte++) {
+            header[i * 4 + byte] = fields[i] >> (byte * 8);
+        }
+    }
+    return fwrite(header, sizeof(header), 1, out) == 1 ? 0 : -1;
+}
+
+static uint32_t ringDepth(AudioOutput* audio) {
+    return atomic_load_explicit(&audio->tail, memory_order_acquire) -
+        atomic_load_explicit(&audio->head, memory_order_acquire);
+}
+
+/* Drains whatever is in the ring as little-endian PCM on every post; the post from closeAudio ends it */
+static void* runAudioWriter(void* argument) {
+    AudioOutput* audio = (AudioOutput*) argument;
+    uint8_t bytes[4096 * 2];
+    while (1) {
+        sem_wait(&audio->ready);
+        int closing = atomic_load_explicit(&audio->closing, memory_order_acquire);
+        unsigned head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(&audio->tail, memory_order_acquire);
+        while (head != tail) {
+            uint32_t count = 0;
+            while (head != tail && count < sizeof(bytes) / 2) {
+                int16_t sample = audio->ring[head++ % AUDIO_RING];
+                bytes[count * 2] = (uint16_t) sample & 0xFF;
+                bytes[count * 2 + 1] = (uint16_t) sample >> 8;
+                count++;
+            }
+            if (!atomic_load_explicit(&audio->failed, memory_order_relaxed) && fwrite(bytes, 2, count, audio->out) != count) {
+                atomic_store_explicit(&audio->failed, 1, memory_order_relaxed);
+            }
+            atomic_store_explicit(&audio->head, head, memory_order_release);
+            atomic_fetch_add_explicit(&audio->written, count, memory_order_relaxed);
+        }
+        sem_post(&audio->drained);
+        if (closing) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* `path` is a WAV file or "-" for a WAV stream on stdout (whose sizes are left at their maximum, as for any stream).
+    * Returns NULL if the output can't be opened.
+*/
+AudioOutput* openAudio(const char* path, uint32_t rate, int dynamic) {
+    AudioOutput* audio = (AudioOutput*) aligned_alloc(64, (sizeof(AudioOutput) + 63) & ~(size_t) 63);
+    if (!audio) {
+        return NULL;
+    }
+    memset(audio, 0, sizeof(AudioOutput));
+    audio->rate = rate;
+    audio->dynamic = dynamic;
+    audio->baseFactor = audio->factor = (((uint64_t) rate << 32) + CPU_CLOCK_RATE / 2) / CPU_CLOCK_RATE;
+    buildMixer(audio);
+    buildKernel(audio);
+
+    audio->out = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (!audio->out) {
+        free(audio);
+        return NULL;
+    }
+    if (writeWavHeader(audio->out, rate, audio->out == stdout ? 0xFFFFFFFF - 36 : 0) != 0) {
+        if (audio->out != stdout) {
+            fclose(audio->out);
+        }
+        free(audio);
+        return NULL;
+    }
+    sem_init(&audio->ready, 0, 0);
+    sem_init(&audio->drained, 0, 0);
+    if (pthread_create(&audio->thread, NULL, runAudioWriter, audio) != 0) {
+        sem_destroy(&audio->ready);
+        sem_destroy(&audio->drained);
+        if (audio->out != stdout) {
+            fclose(audio->out);
+        }
+        free(audio);
+        return NULL;
+    }
+    return audio;
+}
+
+/* Called after runFrame on a machine whose cpu->audio is `audio`: hands everything up to the end of the frame to the
+    * writer, then retunes the rate for the next frame from how full the ring is
+*/
+void submitAudioFrame(AudioOutput* audio, CPU* cpu) {
+    apuCatchUp(cpu);
+    uint32_t count = readSamples(audio, cpu->apu.cycles);
+    audio->produced += count;
+
+    unsigned tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+    uint32_t space = AUDIO_RING - ringDepth(audio);
+    if (!audio->dynamic) {
+        while (space < count) {
+            sem_post(&audio->ready);
+            /* The machine's thread may be taking profiler signals */
+            while (sem_wait(&audio->drained) != 0 && errno == EINTR) {
+            }
+            space = AUDIO_RING - ringDepth(audio);
+        }
+    } else if (space < count) {
+        audio->dropped += count - space;
+        count = space;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        audio->ring[(tail + i) % AUDIO_RING] = audio->samples[i];
+    }
+    atomic_store_explicit(&audio->tail, tail + count, memory_order_release);
+    sem_post(&audio->ready);
+
+    uint32_t depth = ringDepth(audio);
+    if (depth > audio->maxDepth) {
+        audio->maxDepth = depth;
+    }
+    if (audio->dynamic) {
+        audio->rateAdjust = (int32_t)((int64_t) RATE_CONTROL_PPM * ((int64_t) AUDIO_RING / 2 - depth) / (AUDIO_RING / 2));
+        audio->factor = audio->baseFactor + (int64_t) audio->baseFactor / 1000000 * audio->rateAdjust;
+    }
+}
+
+/* From the emulation thread */
+void getAudioStats(AudioOutput* audio, AudioStats* stats) {
+    stats->samples = audio->produced;
+    stats->written = atomic_load_explicit(&audio->written, memory_order_relaxed);
+    stats->dropped = audio->dropped;
+    stats->depth = ringDepth(audio);
+    stats->maxDepth = audio->maxDepth;
+    stats->rateAdjust = audio->rateAdjust;
+}
+
+/* Writes out everything still queued, fills in the WAV sizes when the output is seekable and closes it. Returns -1 if
+    * any write failed. Detach the machine (cpu->audio = NULL) first.
+*/
+int closeAudio(AudioOutput* audio) {
+    atomic_store_explicit(&audio->closing, 1, memory_order_release);
+    sem_post(&audio->ready);
+    pthread_join(audio->thread, NULL);
+    sem_destroy(&audio->ready);
+    sem_destroy(&audio->drained);
+
+    int failed = atomic_load(&audio->failed);
+    if (audio->out == stdout) {
+        failed |= fflush(stdout) != 0;
+    } else {
+        uint64_t bytes = atomic_load(&audio->written) * 2;
+        if (fseek(audio->out, 0, SEEK_SET) == 0) {
+            failed |= writeWavHeader(audio->out, audio->rate, bytes > 0xFFFFFFFF - 36 ? 0xFFFFFFFF - 36 : bytes) != 0;
+        }
+        failed |= fclose(audio->out) != 0;
+    }
+    free(audio);
+    return failed ? -1 : 0;
+}
+
+/* Runs the same ROM headless without and with audio (written to /dev/null) and prints the time per frame of each.
+    * Listening must not change what the machine does, so the run also checks that both end every frame in the same
+    * state.
+*/
+int benchmarkAudio(const GameInformation* game, uint64_t frames) {
+    CPU* machines[2] = { createCPU(), createCPU() };
+    AudioOutput* audio = openAudio("/dev/null", 48000, 0);
+    if (!machines[0] || !machines[1] || !audio || loadROM(machines[0], game) != 0 || loadROM(machines[1], game) != 0) {
+        destroyCPU(machines[0]);
+        destroyCPU(machines[1]);
+        if (audio) {
+            closeAudio(audio);
+        }
+        return -1;
+    }
+    machines[0]->headless = machines[1]->headless = 1;
+    machines[1]->audio = audio;
+
+    uint64_t elapsed[2] = { 0, 0 };
+    uint64_t diverged = 0;
+    MachineState states[2];
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < 2; i++) {
+            uint64_t start = nowNanoseconds();
+            runFrame(machines[i]);
+            if (machines[i]->audio) {
+                submitAudioFrame(audio, machines[i]);
+            }
+            elapsed[i] += nowNanoseconds() - start;
+        }
+        /* The listened-to APU is always caught up to the end of the frame; the other one only as far as it was asked */
+        apuCatchUp(machines[0]);
+        captureState(machines[0], &states[0]);
+        captureState(machines[1], &states[1]);
+        if (!diverged && memcmp(&states[0], &states[1], sizeof(MachineState)) != 0) {
+            diverged = frame + 1;
+        }
+    }
+
+    AudioStats stats;
+    getAudioStats(audio, &stats);
+    machines[1]->audio = NULL;
+    closeAudio(audio);
+    double silent = (double) elapsed[0] / frames;
+    double listened = (double) elapsed[1] / frames;
+    printf("headless         %10.0f ns/frame\n", silent);
+    printf("headless + audio %10.0f ns/frame  %+.1f%%  %.1f samples/frame%s\n", listened,
+        100.0 * (listened - silent) / silent, (double) stats.samples / frames, diverged ? "  MISMATCH" : "");
+    if (diverged) {
+        printf("                 state diverged in frame %llu\n", (unsigned long long) diverged);
+    }
+    destroyCPU(machines[0]);
+    destroyCPU(machines[1]);
+    return diverged ? -1 : 0;
+}
@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nes.h"
+
+/* Batch runner: many independent machines in one process.
+    *
+    * The job file has one instance per line: `<rom path> [frames] [seed]`, blank lines and `#` comments are skipped.
+    * Jobs are dealt round-robin to one queue per worker thread. A worker takes the job at the front of its own queue,
+    * runs one frame and puts it back at the end, so all of its instances advance frame by frame. A worker whose
+    * queue is empty steals from the back of another worker's queue. A frame is long (tens of microseconds) compared
+    * to a queue operation, so a mutex per queue is plenty.
+    *
+*/
+
+typedef struct batch_job {
+    char romPath[1024];
+    GameInformation* game;
+    int ownsGame;
+    uint64_t frames;
+    uint64_t seed;
+    uint64_t framesDone;
+    uint64_t ramHash;
+    uint64_t cycles;
+    uint64_t skipCycles;
+    BlockStats blocks;
+    JitStats jit;
+    CPU* cpu;
+    int failed;
+} BatchJob;
+
+typedef struct job_queue {
+    pthread_mutex_t lock;
+    int* jobs;
+    int head;
+    int count;
+    int capacity;
+} JobQueue;
+
+typedef struct batch Batch;
+
+typedef struct batch_worker {
+    Batch* batch;
+    int index;
+    JobQueue queue;
+    uint64_t frames;
+    uint64_t steals;
+    uint64_t busyNanoseconds;
+    pthread_t thread;
+} BatchWorker;
+
+struct batch {
+    BatchJob* jobs;
+    int jobCount;
+    BatchWorker* workers;
+    int workerCount;
+    atomic_int remaining;
+    int jit;
+    int headless;
+};
+
+static int pushJob(JobQueue* queue, int job) {
+    pthread_mutex_lock(&queue->lock);
+    queue->jobs[(queue->head + queue->count) % queue->capacity] = job;
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+static int popFront(JobQueue* queue) {
+    int job = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0) {
+        job = queue->jobs[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+static int popBack(JobQueue* queue) {
+    int job = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0) {
+        queue->count--;
+        job = queue->jobs[(queue->head + queue->count) % queue->capacity];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+static int stealJob(BatchWorker* worker) {
+    Batch* batch = worker->batch;
+    for (int i = 1; i < batch->workerCount; i++) {
+        BatchWorker* victim = &batch->workers[(worker->index + i) % batch->workerCount];
+        int job = popBack(&victim->queue);
+        if (job >= 0) {
+            worker->steals++;
+            return job;
+        }
+    }
+    return -1;
+}
+
+/* Machines are created by the first worker that runs them, so their memory is first touched on that core */
+static int startJob(Batch* batch, BatchJob* job) {
+    job->cpu = createCPU();
+    if (!job->cpu) {
+        return -1;
+    }
+    if (batch->jit && enableJit(job->cpu, batch->jit > 1) != 0) {
+        destroyCPU(job->cpu);
+        job->cpu = NULL;
+        return -1;
+    }
+    job->cpu->headless = batch->headless;
+    seedRAM(job->cpu, job->seed);
+    if (loadROM(job->cpu, job->game) != 0) {
+        destroyCPU(job->cpu);
+        job->cpu = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void finishJob(Batch* batch, BatchJob* job) {
+    if (job->cpu) {
+        job->ramHash = hashBytes(job->cpu->ram, sizeof(job->cpu->ram));
+        job->cycles = job->cpu->clock.cycles;
+        job->skipCycles = job->cpu->clock.skipCycles;
+        if (job->cpu->blocks) {
+            job->blocks = job->cpu->blocks->stats;
+        }
+        getJitStats(job->cpu, &job->jit);
+        destroyCPU(job->cpu);
+        job->cpu = NULL;
+    }
+    atomic_fetch_sub_explicit(&batch->remaining, 1, memory_order_release);
+}
+
+static void pinToCore(int index) {
+#ifdef __linux__
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % cores, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+}
+
+static void* runWorker(void* arg) {
+    BatchWorker* worker = (BatchWorker*) arg;
+    Batch* batch = worker->batch;
+    pinToCore(worker->index);
+
+    while (atomic_load_explicit(&batch->remaining, memory_order_acquire) > 0) {
+        int index = popFront(&worker->queue);
+        if (index < 0) {
+            index = stealJob(worker);
+        }
+        if (index < 0) {
+            sched_yield();
+            continue;
+        }
+
+        BatchJob* job = &batch->jobs[index];
+        if (!job->cpu && startJob(batch, job) != 0) {
+            job->failed = 1;
+            finishJob(batch, job);
+            continue;
+        }
+
+        uint64_t start = nowNanoseconds();
+        runFrame(job->cpu);
+        worker->busyNanoseconds += nowNanoseconds() - start;
+        worker->frames++;
+
+        if (++job->framesDone >= job->frames) {
+            finishJob(batch, job);
+        } else {
+            pushJob(&worker->queue, index);
+        }
+    }
+    return NULL;
+}
+
+static int parseJobs(Batch* batch, const char* jobFile, uint64_t defaultFrames) {
+    FILE* file = fopen(jobFile, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open job file %s\n", jobFile);
+        return -1;
+    }
+
+    int capacity = 64;
+    batch->jobs = (BatchJob*) calloc(capacity, sizeof(BatchJob));
+    char line[2048];
+    while (batch->jobs && fgets(line, sizeof(line), file)) {
+        char* start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0') {
+            continue;
+        }
+        if (batch->jobCount == capacity) {
+            capacity *= 2;
+            BatchJob* grown = (BatchJob*) realloc(batch->jobs, capacity * sizeof(BatchJob));
+            if (!grown) {
+                /* Running only the jobs read so far would look like a whole batch */
+                free(batch->jobs);
+                batch->jobs = NULL;
+                batch->jobCount = 0;
+                break;
+            }
+            batch->jobs = grown;
+        }
+
+        BatchJob* job = &batch->jobs[batch->jobCount];
+        memset(job, 0, sizeof(*job));
+        unsigned long long frames = defaultFrames, seed = batch->jobCount;
+        if (sscanf(start, "%1023s %llu %llu", job->romPath, &frames, &seed) < 1) {
+            continue;
+        }
+        job->frames = frames;
+        job->seed = seed;
+        batch->jobCount++;
+    }
+    fclose(file);
+
+    if (!batch->jobs) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    /* Each distinct ROM is mapped once and shared read-only by every job that uses it */
+    for (int i = 0; i < batch->jobCount; i++) {
+        BatchJob* job = &batch->jobs[i];
+        for (int j = 0; j < i && !job->game; j++) {
+            if (batch->jobs[j].game && strcmp(batch->jobs[j].romPath, job->romPath) == 0) {
+                job->game = batch->jobs[j].game;
+            }
+        }
+        if (!job->game) {
+            job->game = (GameInformation*) malloc(sizeof(GameInformation));
+            if (job->game && openROM(job->romPath, job->game) == 0) {
+                job->ownsGame = 1;
+            } else {
+                free(job->game);
+                job->game = NULL;
+            }
+        }
+        if (!job->game) {
+            fprintf(stderr, "Could not load %s\n", job->romPath);
+            job->failed = 1;
+        }
+    }
+    return 0;
+}
+
+/* jit: 0 interprets, 1 translates hot blocks to native code, 2 also replays every native run to check it. Jobs only
+    * report RAM, so headless machines skip drawing.
+*/
+int runBatch(const char* jobFile, int threads, uint64_t defaultFrames, int jit, int headless) {
+    Batch batch = { .jit = jit, .headless = headless };
+    if (jit) {
+        CPU* probe = createCPU();
+        int available = probe && enableJit(probe, 0) == 0;
+        destroyCPU(probe);
+        if (!available) {
+            fprintf(stderr, "The JIT is not available on this host\n");
+            return -1;
+        }
+    }
+    if (parseJobs(&batch, jobFile, defaultFrames) != 0) {
+        return -1;
+    }
+    if (batch.jobCount == 0) {
+        fprintf(stderr, "%s has no jobs\n", jobFile);
+        free(batch.jobs);
+        return -1;
+    }
+
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int) cores : 1;
+    }
+    batch.workerCount = threads < batch.jobCount ? threads : batch.jobCount;
+    batch.workers = (BatchWorker*) calloc(batch.workerCount, sizeof(BatchWorker));
+    int* queueStorage = (int*) calloc((size_t) batch.workerCount * batch.jobCount, sizeof(int));
+    if (!batch.workers || !queueStorage) {
+        fprintf(stderr, "Out of memory\n");
+        free(batch.workers);
+        free(queueStorage);
+        free(batch.jobs);
+        return -1;
+    }
+
+    int runnable = 0;
+    for (int i = 0; i < batch.workerCount; i++) {
+        BatchWorker* worker = &batch.workers[i];
+        worker->batch = &batch;
+        worker->index = i;
+        worker->queue.jobs = queueStorage + (size_t) i * batch.jobCount;
+        worker->queue.capacity = batch.jobCount;
+        pthread_mutex_init(&worker->queue.lock, NULL);
+    }
+    for (int i = 0; i < batch.jobCount; i++) {
+        if (!batch.jobs[i].failed && batch.jobs[i].frames > 0) {
+            pushJob(&batch.workers[runnable++ % batch.workerCount].queue, i);
+        }
+    }
+    atomic_init(&batch.remaining, runnable);
+
+    uint64_t start = nowNanoseconds();
+    for (int i = 0; i < batch.workerCount; i++) {
+        pthread_create(&batch.workers[i].thread, NULL, runWorker, &batch.workers[i]);
+    }
+    for (int i = 0; i < batch.workerCount; i++) {
+        pthread_join(batch.workers[i].thread, NULL);
+    }
+    double wall = (nowNanoseconds() - start) / 1e9;
+
+    int failures = 0;
+    for (int i = 0; i < batch.jobCount; i++) {
+        BatchJob* job = &batch.jobs[i];
+        if (job->failed) {
+            failures++;
+            printf("job %d %s seed=%llu FAILED\n", i, job->romPath, (unsigned long long) job->seed);
+        } else {
+            uint64_t lookups = job->blocks.hits + job->blocks.misses + job->blocks.uncached;
+            printf("job %d %s seed=%llu frames=%llu ram=%016llx idle=%.1f%% blocks=%.2f%% hit, %llu invalidated\n", i,
+                job->romPath, (unsigned long long) job->seed, (unsigned long long) job->framesDone,
+                (unsigned long long) job->ramHash, job->cycles ? 100.0 * job->skipCycles / job->cycles : 0.0,
+                lookups ? 100.0 * job->blocks.hits / lookups : 0.0, (unsigned long long) job->blocks.invalidations);
+            if (jit) {
+                printf("    jit: %llu compiled, %llu rejected, %llu entries, %.1f instructions/entry, %llu fallbacks, "
+                    "%llu flushes, %llu checked\n", (unsigned long long) job->jit.compiled,
+                    (unsigned long long) job->jit.rejected, (unsigned long long) job->jit.entries,
+                    job->jit.entries ? (double) job->jit.instructions / job->jit.entries : 0.0,
+                    (unsigned long long) job->jit.fallbacks, (unsigned long long) job->jit.flushes,
+                    (unsigned long long) job->jit.checked);
+            }
+        }
+    }
+
+    uint64_t totalFrames = 0;
+    for (int i = 0; i < batch.workerCount; i++) {
+        BatchWorker* worker = &batch.workers[i];
+        double busy = worker->busyNanoseconds / 1e9;
+        printf("worker %d: %llu frames, %.1f frames/s busy, %llu steals\n", i, (unsigned long long) worker->frames,
+            busy > 0 ? worker->frames / busy : 0.0, (unsigned long long) worker->steals);
+        totalFrames += worker->frames;
+        pthread_mutex_destroy(&worker->queue.lock);
+    }
+    printf("total: %d jobs on %d workers, %llu frames in %.3fs, %.1f frames/s\n", batch.jobCount, batch.workerCount,
+        (unsigned long long) totalFrames, wall, wall > 0 ? totalFrames / wall : 0.0);
+
+    for (int i = 0; i < batch.jobCount; i++) {
+        if (batch.jobs[i].ownsGame) {
+            closeROM(batch.jobs[i].game);
+            free(batch.jobs[i].game);
+        }
+    }
+    free(queueStorage);
+    free(batch.workers);
+    free(batch.jobs);
+    return failures == 0 ? 0 : -1;
+}
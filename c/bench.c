@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "nes.h"
+
+/* Benchmark suite (--bench-suite, make bench).
+    *
+    * Two kinds of runs, each printed as a table and written as JSON so that successive builds can be compared:
+    *
+    * Kernels are small 6502 loops with a fixed instruction mix, stepped one executeInstruction at a time with nothing
+    * else scheduled, so they measure the interpreter's handlers and dispatch alone.
+    *
+    * Frame runs play a ROM headless through the same slices runFrame uses and time every frame. Besides the ROMs given
+    * on the command line there is always the built-in one below, a small homebrew-style program with the background
+    * and all 64 sprites on and an NMI handler doing OAM DMA and scrolling, so the suite means something on a machine
+    * without any ROMs.
+    *
+    * With `counters`, every run is also measured with the host's hardware counters (Linux perf_event); where they
+    * can't be opened the JSON says null.
+    *
+*/
+
+#define BENCH_CHUNK 1000000
+#define BENCH_WARMUP_FRAMES 60
+
+// https://www.nesdev.org/wiki/INES
+#define IMAGE_PRG_SIZE 0x4000
+#define IMAGE_CHR_SIZE 0x2000
+
+typedef struct bench_kernel {
+    const char* name;
+    const uint8_t* code;
+    size_t length;
+} BenchKernel;
+
+/* Arithmetic, logic and shifts on A, with a register transfer or two */
+static const uint8_t aluKernel[] = {
+    0x18,             // C000 CLC
+    0xA9, 0x37,       // C001 LDA #$37
+    0x69, 0x55,       // C003 ADC #$55
+    0x29, 0xF7,       // C005 AND #$F7
+    0x09, 0x21,       // C007 ORA #$21
+    0x49, 0x5A,       // C009 EOR #$5A
+    0x0A,             // C00B ASL A
+    0x2A,             // C00C ROL A
+    0x65, 0x10,       // C00D ADC $10
+    0x85, 0x10,       // C00F STA $10
+    0xE9, 0x03,       // C011 SBC #$03
+    0x4A,             // C013 LSR A
+    0xAA,             // C014 TAX
+    0xE8,             // C015 INX
+    0x8A,             // C016 TXA
+    0xC9, 0x80,       // C017 CMP #$80
+    0x88,             // C019 DEY
+    0xD0, 0xE4,       // C01A BNE $C000
+    0x4C, 0x00, 0xC0, // C01C JMP $C000
+};
+
+/* Every indexed and indirect addressing mode over the RAM at $0200-$07FF, plus read-modify-writes */
+static const uint8_t memoryKernel[] = {
+    0xA9, 0x00,       // C000 LDA #$00
+    0x85, 0x20,       // C002 STA $20
+    0x85, 0x22,       // C004 STA $22
+    0xA9, 0x02,       // C006 LDA #$02
+    0x85, 0x21,       // C008 STA $21
+    0xA9, 0x06,       // C00A LDA #$06
+    0x85, 0x23,       // C00C STA $23
+    0xA2, 0x00,       // C00E LDX #$00
+    0xBD, 0x00, 0x02, // C010 LDA $0200,X
+    0x7D, 0x00, 0x03, // C013 ADC $0300,X
+    0x9D, 0x00, 0x04, // C016 STA $0400,X
+    0x99, 0x00, 0x05, // C019 STA $0500,Y
+    0xB1, 0x20,       // C01C LDA ($20),Y
+    0x91, 0x22,       // C01E STA ($22),Y
+    0xE6, 0x30,       // C020 INC $30
+    0xCE, 0x00, 0x07, // C022 DEC $0700
+    0xB5, 0x40,       // C025 LDA $40,X
+    0x9D, 0x00, 0x07, // C027 STA $0700,X
+    0xE8,             // C02A INX
+    0xD0, 0xE3,       // C02B BNE $C010
+    0xC8,             // C02D INY
+    0x4C, 0x0E, 0xC0, // C02E JMP $C00E
+};
+
+/* Branches decided by an 8-bit LFSR, so neither the guest's nor the host's branches settle into a short pattern */
+static const uint8_t branchKernel[] = {
+    0xA9, 0x01,       // C000 LDA #$01
+    0x85, 0x00,       // C002 STA $00
+    0xA5, 0x00,       // C004 LDA $00
+    0x0A,             // C006 ASL A
+    0x90, 0x02,       // C007 BCC $C00B
+    0x49, 0x1D,       // C009 EOR #$1D
+    0x85, 0x00,       // C00B STA $00
+    0x30, 0x02,       // C00D BMI $C011
+    0xE8,             // C00F INX
+    0xEA,             // C010 NOP
+    0x29, 0x03,       // C011 AND #$03
+    0xF0, 0x02,       // C013 BEQ $C017
+    0xC8,             // C015 INY
+    0xEA,             // C016 NOP
+    0xA5, 0x00,       // C017 LDA $00
+    0x4A,             // C019 LSR A
+    0xB0, 0x02,       // C01A BCS $C01E
+    0xC6, 0x01,       // C01C DEC $01
+    0x4C, 0x04, 0xC0, // C01E JMP $C004
+};
+
+/* Subroutine calls and pushes and pulls of every kind */
+static const uint8_t stackKernel[] = {
+    0x20, 0x10, 0xC0, // C000 JSR $C010
+    0x08,             // C003 PHP
+    0x48,             // C004 PHA
+    0x20, 0x10, 0xC0, // C005 JSR $C010
+    0x68,             // C008 PLA
+    0x28,             // C009 PLP
+    0xE8,             // C00A INX
+    0x4C, 0x00, 0xC0, // C00B JMP $C000
+    0xEA, 0xEA,       // C00E
+    0x48,             // C010 PHA
+    0x8A,             // C011 TXA
+    0x48,             // C012 PHA
+    0x69, 0x01,       // C013 ADC #$01
+    0x68,             // C015 PLA
+    0xAA,             // C016 TAX
+    0x68,             // C017 PLA
+    0x60,             // C018 RTS
+};
+
+/* An 8x8 shift-and-add multiply, the kind of zero-page arithmetic game logic is made of */
+static const uint8_t multiplyKernel[] = {
+    0xA5, 0x02,       // C000 LDA $02
+    0x85, 0x00,       // C002 STA $00
+    0xA9, 0x00,       // C004 LDA #$00
+    0xA2, 0x08,       // C006 LDX #$08
+    0x46, 0x01,       // C008 LSR $01
+    0x90, 0x03,       // C00A BCC $C00F
+    0x18,             // C00C CLC
+    0x65, 0x00,       // C00D ADC $00
+    0x6A,             // C00F ROR A
+    0x66, 0x03,       // C010 ROR $03
+    0xCA,             // C012 DEX
+    0xD0, 0xF3,       // C013 BNE $C008
+    0x85, 0x04,       // C015 STA $04
+    0xE6, 0x02,       // C017 INC $02
+    0xA5, 0x03,       // C019 LDA $03
+    0x85, 0x01,       // C01B STA $01
+    0x4C, 0x00, 0xC0, // C01D JMP $C000
+};
+
+static const BenchKernel benchKernels[] = {
+    { "alu", aluKernel, sizeof(aluKernel) },
+    { "memory", memoryKernel, sizeof(memoryKernel) },
+    { "branch", branchKernel, sizeof(branchKernel) },
+    { "stack", stackKernel, sizeof(stackKernel) },
+    { "multiply", multiplyKernel, sizeof(multiplyKernel) },
+};
+
+/* The built-in frame ROM: waits out the PPU warm-up, fills a nametable, the palette and OAM, turns on NMI and
+    * rendering and spins in a busy main loop; every NMI DMAs the sprites, scrolls and moves every sprite right by one.
+*/
+static const uint8_t frameProgram[] = {
+    0x78,             // C000 SEI
+    0xD8,             // C001 CLD
+    0xA2, 0xFF,       // C002 LDX #$FF
+    0x9A,             // C004 TXS
+    0x2C, 0x02, 0x20, // C005 BIT $2002
+    0x10, 0xFB,       // C008 BPL $C005
+    0x2C, 0x02, 0x20, // C00A BIT $2002
+    0x10, 0xFB,       // C00D BPL $C00A
+    0xA9, 0x20,       // C00F LDA #$20
+    0x8D, 0x06, 0x20, // C011 STA $2006
+    0xA9, 0x00,       // C014 LDA #$00
+    0x8D, 0x06, 0x20, // C016 STA $2006
+    0xA0, 0x04,       // C019 LDY #$04
+    0xA2, 0x00,       // C01B LDX #$00
+    0x8E, 0x07, 0x20, // C01D STX $2007
+    0xE8,             // C020 INX
+    0xD0, 0xFA,       // C021 BNE $C01D
+    0x88,             // C023 DEY
+    0xD0, 0xF5,       // C024 BNE $C01B
+    0xA9, 0x3F,       // C026 LDA #$3F
+    0x8D, 0x06, 0x20, // C028 STA $2006
+    0xA9, 0x00,       // C02B LDA #$00
+    0x8D, 0x06, 0x20, // C02D STA $2006
+    0xA2, 0x00,       // C030 LDX #$00
+    0x8E, 0x07, 0x20, // C032 STX $2007
+    0xE8,             // C035 INX
+    0xE0, 0x20,       // C036 CPX #$20
+    0xD0, 0xF8,       // C038 BNE $C032
+    0xA2, 0x00,       // C03A LDX #$00
+    0x8A,             // C03C TXA
+    0x9D, 0x00, 0x02, // C03D STA $0200,X
+    0xE8,             // C040 INX
+    0xD0, 0xF9,       // C041 BNE $C03C
+    0xA9, 0x80,       // C043 LDA #$80
+    0x8D, 0x00, 0x20, // C045 STA $2000
+    0xA9, 0x1E,       // C048 LDA #$1E
+    0x8D, 0x01, 0x20, // C04A STA $2001
+    0xE6, 0x10,       // C04D INC $10
+    0xA5, 0x10,       // C04F LDA $10
+    0x65, 0x11,       // C051 ADC $11
+    0x85, 0x11,       // C053 STA $11
+    0x4C, 0x4D, 0xC0, // C055 JMP $C04D
+    0x48,             // C058 PHA (NMI)
+    0x8A,             // C059 TXA
+    0x48,             // C05A PHA
+    0xA9, 0x02,       // C05B LDA #$02
+    0x8D, 0x14, 0x40, // C05D STA $4014
+    0xE6, 0x12,       // C060 INC $12
+    0xA5, 0x12,       // C062 LDA $12
+    0x8D, 0x05, 0x20, // C064 STA $2005
+    0x8D, 0x05, 0x20, // C067 STA $2005
+    0xA2, 0x00,       // C06A LDX #$00
+    0xFE, 0x03, 0x02, // C06C INC $0203,X
+    0xE8,             // C06F INX
+    0xE8,             // C070 INX
+    0xE8,             // C071 INX
+    0xE8,             // C072 INX
+    0xD0, 0xF7,       // C073 BNE $C06C
+    0x68,             // C075 PLA
+    0xAA,             // C076 TAX
+    0x68,             // C077 PLA
+    0x40,             // C078 RTI
+};
+
+#define FRAME_PROGRAM_NMI 0xC058
+
+typedef struct bench_counters {
+    int fds[4];
+    int open;
+} BenchCounters;
+
+typedef struct bench_result {
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t nanoseconds;
+    int counted;
+    uint64_t counts[4];
+} BenchResult;
+
+static const char* const counterNames[4] = { "host_cycles", "host_instructions", "branch_misses", "cache_misses" };
+
+/* Builds an NROM-128 image with `code` at $C000 (the reset vector) and an RTI at $FFF0 for whichever of NMI and IRQ
+    * has no handler. With `chr`, there is a CHR-ROM bank of varied tiles, otherwise the board has CHR-RAM.
+*/
+static uint8_t* buildImage(const uint8_t* code, size_t length, uint16_t nmi, int chr, size_t* size) {
+    *size = 16 + IMAGE_PRG_SIZE + (chr ? IMAGE_CHR_SIZE : 0);
+    uint8_t* image = (uint8_t*) calloc(1, *size);
+    if (!image) {
+        return NULL;
+    }
+    memcpy(image, "NES\x1A", 4);
+    image[4] = 1;
+    image[5] = chr ? 1 : 0;
+    uint8_t* prg = image + 16;
+    memcpy(prg, code, length);
+    prg[0x3FF0] = 0x40;
+    uint16_t vectors[3] = { nmi ? nmi : 0xFFF0, 0xC000, 0xFFF0 };
+    for (int i = 0; i < 3; i++) {
+        prg[0x3FFA + i * 2] = vectors[i] & 0xFF;
+        prg[0x3FFB + i * 2] = vectors[i] >> 8;
+    }
+    for (size_t i = 0; chr && i < IMAGE_CHR_SIZE; i++) {
+        prg[IMAGE_PRG_SIZE + i] = (uint8_t)(i * 0x9D) ^ (uint8_t)(i >> 4);
+    }
+    return image;
+}
+
+// https://man7.org/linux/man-pages/man2/perf_event_open.2.html
+/* One group, so all four are scheduled together and read in a single call; user space only, which is all an
+    * unprivileged process may count under the usual perf_event_paranoid setting
+*/
+static void openCounters(BenchCounters* counters) {
+    memset(counters, 0, sizeof(*counters));
+    for (int i = 0; i < 4; i++) {
+        counters->fds[i] = -1;
+    }
+#ifdef __linux__
+    static const uint64_t configs[4] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES,
+    };
+    for (int i = 0; i < 4; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : counters->fds[0], 0);
+        if (fd < 0) {
+            for (int j = 0; j < i; j++) {
+                close(counters->fds[j]);
+                counters->fds[j] = -1;
+            }
+            return;
+        }
+        counters->fds[i] = fd;
+    }
+    counters->open = 1;
+#endif
+}
+
+static void closeCounters(BenchCounters* counters) {
+#ifdef __linux__
+    for (int i = 0; i < 4; i++) {
+        if (counters->fds[i] >= 0) {
+            close(counters->fds[i]);
+        }
+    }
+#endif
+    counters->open = 0;
+}
+
+static void startCounters(BenchCounters* counters) {
+#ifdef __linux__
+    if (counters->open) {
+        ioctl(counters->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(counters->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+static void stopCounters(BenchCounters* counters, BenchResult* result) {
+#ifdef __linux__
+    uint64_t values[5];
+    if (counters->open) {
+        ioctl(counters->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        if (read(counters->fds[0], values, sizeof(values)) == (ssize_t) sizeof(values) && values[0] == 4) {
+            memcpy(result->counts, values + 1, sizeof(result->counts));
+            result->counted = 1;
+        }
+    }
+#endif
+}
+
+/* Steps the kernel `instructions` instructions (rounded up to whole chunks) after one chunk of warm-up */
+static int runKernel(const BenchKernel* kernel, uint64_t instructions, BenchCounters* counters, BenchResult* result) {
+    size_t size;
+    uint8_t* image = buildImage(kernel->code, kernel->length, 0, 0, &size);
+    GameInformation game;
+    CPU* cpu = createCPU();
+    if (!image || !cpu || parseROM(image, size, &game) != 0 || loadROM(cpu, &game) != 0) {
+        destroyCPU(cpu);
+        free(image);
+        return -1;
+    }
+    for (int i = 0; i < BENCH_CHUNK; i++) {
+        executeInstruction(readByte(cpu, cpu->registers.pc), cpu);
+    }
+
+    memset(result, 0, sizeof(*result));
+    uint64_t chunks = (instructions + BENCH_CHUNK - 1) / BENCH_CHUNK;
+    uint64_t cycles = cpu->clock.cycles;
+    startCounters(counters);
+    uint64_t start = nowNanoseconds();
+    for (uint64_t chunk = 0; chunk < chunks; chunk++) {
+        for (int i = 0; i < BENCH_CHUNK; i++) {
+            executeInstruction(readByte(cpu, cpu->registers.pc), cpu);
+        }
+    }
+    result->nanoseconds = nowNanoseconds() - start;
+    stopCounters(counters, result);
+    result->instructions = chunks * BENCH_CHUNK;
+    result->cycles = cpu->clock.cycles - cycles;
+    destroyCPU(cpu);
+    free(image);
+    return 0;
+}
+
+static int compareTimes(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted `times` */
+static uint64_t percentile(const uint64_t* times, uint64_t count, int percent) {
+    uint64_t rank = (count * percent + 99) / 100;
+    return times[rank ? rank - 1 : 0];
+}
+
+/* Plays `frames` frames headless after BENCH_WARMUP_FRAMES unmeasured ones. The slices are runFrame's, with the
+    * instructions they executed added up. Fills `times` with each frame's nanoseconds, sorted.
+*/
+static int runFrames(const GameInformation* game, uint64_t frames, BenchCounters* counters, BenchResult* result,
+    uint64_t* times) {
+    CPU* cpu = createCPU();
+    if (!cpu || loadROM(cpu, game) != 0) {
+        destroyCPU(cpu);
+        return -1;
+    }
+    cpu->headless = 1;
+    for (int frame = 0; frame < BENCH_WARMUP_FRAMES; frame++) {
+        runFrame(cpu);
+    }
+
+    memset(result, 0, sizeof(*result));
+    uint64_t cycles = cpu->clock.cycles;
+    startCounters(counters);
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        uint64_t start = nowNanoseconds();
+        uint64_t current = cpu->ppu.frame;
+        while (cpu->ppu.frame == current) {
+            result->instructions += runUntil(cpu, NO_EVENT);
+            runEvents(cpu);
+        }
+        times[frame] = nowNanoseconds() - start;
+        result->nanoseconds += times[frame];
+    }
+    stopCounters(counters, result);
+    result->cycles = cpu->clock.cycles - cycles;
+    destroyCPU(cpu);
+    qsort(times, frames, sizeof(uint64_t), compareTimes);
+    return 0;
+}
+
+static void writeJsonString(FILE* file, const char* text) {
+    fputc('"', file);
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char) *c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void writeJsonCounters(FILE* file, const BenchResult* result) {
+    if (!result->counted) {
+        fprintf(file, "null");
+        return;
+    }
+    fprintf(file, "{");
+    for (int i = 0; i < 4; i++) {
+        fprintf(file, "\"%s\": %llu, ", counterNames[i], (unsigned long long) result->counts[i]);
+    }
+    fprintf(file, "\"ipc\": %.3f}", result->counts[0] ? (double) result->counts[1] / result->counts[0] : 0.0);
+}
+
+static void printCounters(FILE* out, const BenchResult* result) {
+    if (result->counted) {
+        fprintf(out, "  IPC %.2f, %.2f branch misses/Kinstr, %.2f cache misses/Kinstr",
+            result->counts[0] ? (double) result->counts[1] / result->counts[0] : 0.0,
+            result->counts[1] ? 1000.0 * result->counts[2] / result->counts[1] : 0.0,
+            result->counts[1] ? 1000.0 * result->counts[3] / result->counts[1] : 0.0);
+    }
+    fprintf(out, "\n");
+}
+
+/* What this binary was built with, so results from different configurations aren't compared by accident */
+static void writeJsonBuild(FILE* file) {
+    fprintf(file, "  \"build\": {\"compiler\": ");
+#ifdef __VERSION__
+    writeJsonString(file, __VERSION__);
+#else
+    fprintf(file, "null");
+#endif
+#ifdef NES_BLOCK_CACHE
+    fprintf(file, ", \"block_cache\": true");
+#else
+    fprintf(file, ", \"block_cache\": false");
+#endif
+#ifdef NES_JIT
+    fprintf(file, ", \"jit_available\": true");
+#else
+    fprintf(file, ", \"jit_available\": false");
+#endif
+#ifdef NES_IDLE_SKIP
+    fprintf(file, ", \"idle_skip\": true");
+#else
+    fprintf(file, ", \"idle_skip\": false");
+#endif
+#ifdef NES_LAZY_FLAGS
+    fprintf(file, ", \"lazy_flags\": true");
+#else
+    fprintf(file, ", \"lazy_flags\": false");
+#endif
+#ifdef NES_NO_TILE_CACHE
+    fprintf(file, ", \"tile_cache\": false");
+#else
+    fprintf(file, ", \"tile_cache\": true");
+#endif
+    fprintf(file, "},\n");
+}
+
+/* Runs every kernel for `instructions` instructions and every ROM (the built-in one first) for `frames` frames.
+    * The table goes to stdout, or to stderr when the JSON does ("-"); `json` may also be NULL for the table alone.
+    * Returns -1 if a ROM can't be run or the JSON can't be written.
+*/
+int runBenchSuite(const char* const* roms, int romCount, uint64_t frames, uint64_t instructions, int counted,
+    const char* json) {
+    FILE* file = NULL;
+    if (json) {
+        file = strcmp(json, "-") == 0 ? stdout : fopen(json, "w");
+        if (!file) {
+            fprintf(stderr, "Can't write %s\n", json);
+            return -1;
+        }
+    }
+    FILE* out = file == stdout ? stderr : stdout;
+    if (frames == 0) {
+        frames = 1;
+    }
+
+    BenchCounters counters;
+    if (counted) {
+        openCounters(&counters);
+        if (!counters.open) {
+            fprintf(out, "Hardware counters are not available here\n");
+        }
+    } else {
+        memset(&counters, 0, sizeof(counters));
+    }
+
+    int failed = 0;
+    int entries = 0;
+    if (file) {
+        fprintf(file, "{\n  \"version\": 1,\n");
+        writeJsonBuild(file);
+        fprintf(file, "  \"kernels\": [");
+    }
+    for (size_t i = 0; i < sizeof(benchKernels) / sizeof(benchKernels[0]); i++) {
+        const BenchKernel* kernel = &benchKernels[i];
+        BenchResult result;
+        if (runKernel(kernel, instructions, &counters, &result) != 0) {
+            fprintf(out, "%-24s can't be run\n", kernel->name);
+            failed = 1;
+            continue;
+        }
+        double seconds = result.nanoseconds / 1e9;
+        fprintf(out, "%-24s %8.2f M instr/s  %7.2f MHz  %5.2f ns/instr", kernel->name,
+            result.instructions / seconds / 1e6, result.cycles / seconds / 1e6,
+            (double) result.nanoseconds / result.instructions);
+        printCounters(out, &result);
+        if (file) {
+            fprintf(file, "%s\n    {\"name\": ", entries++ ? "," : "");
+            writeJsonString(file, kernel->name);
+            fprintf(file, ", \"instructions\": %llu, \"cycles\": %llu, \"nanoseconds\": %llu, "
+                "\"instructions_per_second\": %.0f, \"cycles_per_second\": %.0f, \"counters\": ",
+                (unsigned long long) result.instructions, (unsigned long long) result.cycles,
+                (unsigned long long) result.nanoseconds, result.instructions / seconds, result.cycles / seconds);
+            writeJsonCounters(file, &result);
+            fprintf(file, "}");
+        }
+    }
+    if (file) {
+        fprintf(file, "\n  ],\n  \"frames\": [");
+    }
+    entries = 0;
+
+    uint64_t* times = (uint64_t*) malloc(frames * sizeof(uint64_t));
+    size_t builtinSize;
+    uint8_t* builtin = buildImage(frameProgram, sizeof(frameProgram), FRAME_PROGRAM_NMI, 1, &builtinSize);
+    if (!times || !builtin) {
+        fprintf(stderr, "Out of memory\n");
+        failed = 1;
+        romCount = -1;
+    }
+    for (int i = -1; i < romCount; i++) {
+        const char* name = i < 0 ? "builtin:sprites" : roms[i];
+        GameInformation game;
+        BenchResult result;
+        int opened = i < 0 ? parseROM(builtin, builtinSize, &game) : openROM(name, &game);
+        if (opened != 0 || runFrames(&game, frames, &counters, &result, times) != 0) {
+            fprintf(out, "%-24s can't be run\n", name);
+            if (opened == 0 && i >= 0) {
+                closeROM(&game);
+            }
+            failed = 1;
+            continue;
+        }
+        if (i >= 0) {
+            closeROM(&game);
+        }
+        double seconds = result.nanoseconds / 1e9;
+        const char* base = strrchr(name, '/');
+        fprintf(out, "%-24s %8.1f frames/s  %7.2fx  p50 %8llu  p90 %8llu  p99 %8llu  max %8llu ns/frame  %6.2f M instr/s",
+            base ? base + 1 : name, frames / seconds, frames / seconds / 60.0988,
+            (unsigned long long) percentile(times, frames, 50), (unsigned long long) percentile(times, frames, 90),
+            (unsigned long long) percentile(times, frames, 99), (unsigned long long) times[frames - 1],
+            result.instructions / seconds / 1e6);
+        printCounters(out, &result);
+        if (file) {
+            fprintf(file, "%s\n    {\"rom\": ", entries++ ? "," : "");
+            writeJsonString(file, name);
+            fprintf(file, ", \"frames\": %llu, \"instructions\": %llu, \"cycles\": %llu, \"nanoseconds\": %llu, "
+                "\"frames_per_second\": %.2f, \"instructions_per_second\": %.0f, \"ns_per_frame\": {\"mean\": %.0f, "
+                "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"min\": %llu, \"max\": %llu}, \"counters\": ",
+                (unsigned long long) frames, (unsigned long long) result.instructions,
+                (unsigned long long) result.cycles, (unsigned long long) result.nanoseconds, frames / seconds,
+                result.instructions / seconds, (double) result.nanoseconds / frames,
+                (unsigned long long) percentile(times, frames, 50), (unsigned long long) percentile(times, frames, 90),
+                (unsigned long long) percentile(times, frames, 99), (unsigned long long) times[0],
+                (unsigned long long) times[frames - 1]);
+            writeJsonCounters(file, &result);
+            fprintf(file, "}");
+        }
+    }
+    free(times);
+    free(builtin);
+    closeCounters(&counters);
+
+    if (file) {
+        fprintf(file, "\n  ]\n}\n");
+        if (file == stdout ? fflush(file) != 0 : fclose(file) != 0) {
+            fprintf(stderr, "Can't write %s\n", json);
+            failed = 1;
+        }
+    }
+    return failed ? -1 : 0;
+}
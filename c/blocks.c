@@ -0,0 +1,273 @@
+#include <string.h>
+
+#include "nes.h"
+
+/* Instructions that leave straight-line code end their block; the next one starts wherever PC ends up */
+static int endsBlock(uint8_t opcode) {
+    if (opcodeTable[opcode].mode == RELATIVE) {
+        return 1;
+    }
+    switch (opcode) {
+        case 0x00: /* BRK */
+        case 0x20: /* JSR */
+        case 0x40: /* RTI */
+        case 0x4C: /* JMP */
+        case 0x60: /* RTS */
+        case 0x6C: /* JMP (ind) */
+        case 0x02: case 0x12: case 0x22: case 0x32: case 0x42: case 0x52:
+        case 0x62: case 0x72: case 0x92: case 0xB2: case 0xD2: case 0xF2: /* JAM */
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Bit index of a byte of writable memory in codeBytes, or -1 for memory code is never cached from. The stack page is
+    * left out because pushes write it directly rather than through the bus.
+*/
+static int codeIndex(CPU* cpu, const uint8_t* byte) {
+    if (byte >= cpu->ram && byte < cpu->ram + sizeof(cpu->ram)) {
+        return (byte >= cpu->ram + 0x100 && byte < cpu->ram + 0x200) ? -1 : (int)(byte - cpu->ram);
+    }
+    if (cpu->prgRam && byte >= cpu->prgRam && byte < cpu->prgRam + PRG_RAM_SIZE) {
+        return 0x800 + (int)(byte - cpu->prgRam);
+    }
+    return -1;
+}
+
+static void markCode(BlockCache* cache, int index, int set) {
+    if (set) {
+        cache->codeBytes[index >> 3] |= 1 << (index & 7);
+    } else {
+        cache->codeBytes[index >> 3] &= ~(1 << (index & 7));
+    }
+}
+
+static void dropBlock(CPU* cpu, Block* block) {
+    BlockCache* cache = cpu->blocks;
+    if (block->host && codeIndex(cpu, block->host) >= 0) {
+        cache->writableBlocks--;
+    }
+    block->host = NULL;
+    block->native = NULL;
+    for (int i = 0; i <= BLOCK_OPS; i++) {
+        block->ops[i].index = BLOCK_END;
+    }
+    cache->stats.invalidations++;
+}
+
+static void writeCode(CPU* cpu, uint16_t address, uint8_t value);
+
+/* Takes the fast write pointer away from every page that aliases `page` (RAM is mirrored four times) */
+static void guardPage(CPU* cpu, uint8_t* page) {
+    for (int i = 0; i < 0x100; i++) {
+        if (cpu->bus.writePages[i] == page) {
+            cpu->blocks->codeWrites[i] = page;
+            cpu->bus.writePages[i] = NULL;
+            cpu->bus.writeHandlers[i] = writeCode;
+        }
+    }
+}
+
+static void unguardPage(CPU* cpu, const uint8_t* page) {
+    for (int i = 0; i < 0x100; i++) {
+        if (cpu->blocks->codeWrites[i] == page) {
+            cpu->bus.writePages[i] = cpu->blocks->codeWrites[i];
+            cpu->blocks->codeWrites[i] = NULL;
+        }
+    }
+}
+
+/* Drops the blocks covering `byte`, then rebuilds the page's bits from the blocks left on it */
+static void invalidateCode(CPU* cpu, const uint8_t* page, const uint8_t* byte) {
+    BlockCache* cache = cpu->blocks;
+    int base = codeIndex(cpu, page);
+    memset(&cache->codeBytes[base >> 3], 0, 0x100 / 8);
+
+    int remaining = 0;
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        Block* block = &cache->blocks[i];
+        if (block->host != page) {
+            continue;
+        }
+        const uint8_t* start = page + (block->pc & 0xFF);
+        if (byte >= start && byte < start + block->length) {
+            dropBlock(cpu, block);
+            continue;
+        }
+        for (int j = 0; j < block->length; j++) {
+            markCode(cache, base + (block->pc & 0xFF) + j, 1);
+        }
+        remaining++;
+    }
+    if (!remaining) {
+        unguardPage(cpu, page);
+    }
+}
+
+/* Write handler of guarded pages */
+static void writeCode(CPU* cpu, uint16_t address, uint8_t value) {
+    uint8_t* page = cpu->blocks->codeWrites[address >> 8];
+    uint8_t* byte = page + (address & 0xFF);
+    *byte = value;
+    int index = codeIndex(cpu, byte);
+    if (cpu->blocks->codeBytes[index >> 3] & (1 << (index & 7))) {
+        invalidateCode(cpu, page, byte);
+    }
+}
+
+/* Decodes the block at `pc` into `block`, replacing whatever was in that slot. Returns NULL when the first instruction
+    * cannot be cached (it straddles a page, or the page is the stack or not plain memory).
+*/
+Block* decodeBlock(CPU* cpu, Block* block, uint16_t pc, const uint8_t* host) {
+    BlockCache* cache = cpu->blocks;
+    uint8_t* writable = cpu->bus.writePages[pc >> 8] ? cpu->bus.writePages[pc >> 8] : cache->codeWrites[pc >> 8];
+    if (writable != host) {
+        writable = NULL;
+    } else if (codeIndex(cpu, host) < 0) {
+        return NULL;
+    }
+
+    uint16_t address = pc;
+    int count = 0;
+    while (count < BLOCK_OPS) {
+        /* Falling through into the next page leaves `host`, which only covers this one */
+        if ((address ^ pc) & 0xFF00) {
+            break;
+        }
+        uint8_t offset = address & 0xFF;
+        uint8_t opcode = host[offset];
+        const Opcode* info = &opcodeTable[opcode];
+        if (offset + info->length > 0x100) {
+            break;
+        }
+
+        uint16_t operand = 0;
+        switch (info->mode) {
+            case IMMEDIATE:
+                operand = address + 1;
+                break;
+            case RELATIVE:
+                operand = address + 2 + (int8_t) host[offset + 1];
+                break;
+            case ABSOLUTE:
+            case ABSOLUTE_X:
+            case ABSOLUTE_Y:
+            case INDIRECT:
+                operand = host[offset + 1] | (host[offset + 2] << 8);
+                break;
+            case ZERO_PAGE:
+            case ZERO_PAGE_X:
+            case ZERO_PAGE_Y:
+            case INDIRECT_X:
+            case INDIRECT_Y:
+                operand = host[offset + 1];
+                break;
+            default:
+                break;
+        }
+        address += info->length;
+        block->ops[count++] = (DecodedOp) { opcode, operand, address };
+        if (endsBlock(opcode)) {
+            break;
+        }
+    }
+    if (count == 0) {
+        return NULL;
+    }
+
+    if (block->host && codeIndex(cpu, block->host) >= 0) {
+        cache->writableBlocks--;
+    }
+    if (codeIndex(cpu, host) >= 0) {
+        cache->writableBlocks++;
+    }
+    block->host = host;
+    block->native = NULL;
+    block->pc = pc;
+    block->length = (uint16_t)(address - pc);
+    block->heat = 0;
+    for (int i = count; i <= BLOCK_OPS; i++) {
+        block->ops[i].index = BLOCK_END;
+    }
+    if (writable) {
+        int base = codeIndex(cpu, host) + (pc & 0xFF);
+        for (int i = 0; i < block->length; i++) {
+            markCode(cache, base + i, 1);
+        }
+        guardPage(cpu, writable);
+    }
+    cache->stats.misses++;
+    return block;
+}
+
+/* Drops every block decoded from [memory, memory + size), for callers that replace memory wholesale (state loads).
+    * Without blocks from writable memory there is nothing to find, which saves state loads (run-ahead does one a frame)
+    * the scan of the whole cache.
+*/
+void invalidateBlocks(CPU* cpu, const uint8_t* memory, size_t size) {
+    BlockCache* cache = cpu->blocks;
+    if (!cache) {
+        return;
+    }
+    for (int i = 0; i < BLOCK_CACHE_SIZE && cache->writableBlocks; i++) {
+        Block* block = &cache->blocks[i];
+        if (block->host && block->host >= memory && block->host < memory + size) {
+            dropBlock(cpu, block);
+        }
+    }
+    for (int i = 0; i < 0x100; i++) {
+        uint8_t* page = cache->codeWrites[i];
+        if (page && page >= memory && page < memory + size) {
+            int base = codeIndex(cpu, page);
+            memset(&cache->codeBytes[base >> 3], 0, 0x100 / 8);
+            unguardPage(cpu, page);
+        }
+    }
+}
+
+/* Empties the cache, for a new ROM whose image may be mapped where the old one was */
+void flushBlocks(CPU* cpu) {
+    BlockCache* cache = cpu->blocks;
+    if (!cache) {
+        return;
+    }
+    for (int i = 0; i < 0x100; i++) {
+        if (cache->codeWrites[i]) {
+            unguardPage(cpu, cache->codeWrites[i]);
+        }
+    }
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        cache->blocks[i].host = NULL;
+        cache->blocks[i].native = NULL;
+    }
+    memset(cache->codeBytes, 0, sizeof(cache->codeBytes));
+    cache->writableBlocks = 0;
+    cache->running = NULL;
+}
+
+/* Called after pages in [start, end] were remapped. A running block whose page moved ends after the current
+    * instruction; guarded pages that were mapped back to their memory are guarded again.
+*/
+void remapBlocks(CPU* cpu, uint16_t start, uint16_t end) {
+    BlockCache* cache = cpu->blocks;
+    if (!cache) {
+        return;
+    }
+    Block* running = cache->running;
+    if (running && running->host && cpu->bus.readPages[running->pc >> 8] != running->host) {
+        dropBlock(cpu, running);
+    }
+    for (uint32_t page = start >> 8; page <= (uint32_t)(end >> 8); page++) {
+        uint8_t* code = cache->codeWrites[page];
+        if (!code) {
+            continue;
+        }
+        if (cpu->bus.writePages[page] == code) {
+            cpu->bus.writePages[page] = NULL;
+            cpu->bus.writeHandlers[page] = writeCode;
+        } else if (cpu->bus.writePages[page] || cpu->bus.writeHandlers[page] != writeCode) {
+            cache->codeWrites[page] = NULL;
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#include "nes.h"
+
+/* Point every page in [start, end] at `memory`, mirrored every `size` bytes (a multiple of 256) */
+void mapPages(CPU* cpu, uint16_t start, uint16_t end, uint8_t* memory, uint32_t size, int writable) {
+    for (uint32_t page = start >> 8; page <= (uint32_t)(end >> 8); page++) {
+        uint8_t* host = memory + (((page << 8) - start) % size);
+        cpu->bus.readPages[page] = host;
+        cpu->bus.writePages[page] = writable ? host : NULL;
+    }
+    remapBlocks(cpu, start, end);
+}
+
+/* Hand every page in [start, end] to I/O handlers; a NULL handler keeps whatever is already mapped for that direction */
+void mapHandlers(CPU* cpu, uint16_t start, uint16_t end, readHandler read, writeHandler write) {
+    for (uint32_t page = start >> 8; page <= (uint32_t)(end >> 8); page++) {
+        if (read) {
+            cpu->bus.readPages[page] = NULL;
+            cpu->bus.readHandlers[page] = read;
+        }
+        if (write) {
+            cpu->bus.writePages[page] = NULL;
+            cpu->bus.writeHandlers[page] = write;
+        }
+    }
+    remapBlocks(cpu, start, end);
+}
+
+/* Nothing drives the data bus, so the last byte on it (usually the high byte of the address) is read back */
+static uint8_t readOpenBus(CPU* cpu, uint16_t address) {
+    return address >> 8;
+}
+
+static void writeIgnored(CPU* cpu, uint16_t address, uint8_t value) {
+}
+
+// https://www.nesdev.org/wiki/Standard_controller
+/* While $4016 bit 0 is set the controllers keep reloading, so every read returns A. Once the shift register is
+    * empty an official controller reports 1s. Only bit 0 is driven; the rest is open bus ($40).
+*/
+static uint8_t readController(CPU* cpu, int port) {
+    if (cpu->ioRegisters[0x16] & 0x01) {
+        cpu->controllers[port] = cpu->buttons[port];
+    }
+    uint8_t bit = cpu->controllers[port] & 0x01;
+    cpu->controllers[port] = (cpu->controllers[port] >> 1) | 0x80;
+    return 0x40 | bit;
+}
+
+// https://www.nesdev.org/wiki/2A03
+/* $4000-$4017 live in page $40; the rest of that page is open bus */
+static uint8_t readIORegister(CPU* cpu, uint16_t address) {
+    uint8_t value;
+    PROFILE_ENTER(cpu, PROFILE_IO);
+    if (address == 0x4015) {
+        cpu->idle.clean = 0;
+        value = readApuStatus(cpu);
+    } else if (address == 0x4016 || address == 0x4017) {
+        /* Every read shifts, so a loop polling the pad is never a clean repeat */
+        cpu->idle.clean = 0;
+        value = readController(cpu, address - 0x4016);
+    } else if (address < 0x4018) {
+        value = cpu->ioRegisters[address - 0x4000];
+    } else {
+        value = readOpenBus(cpu, address);
+    }
+    PROFILE_LEAVE(cpu);
+    return value;
+}
+
+static void writeIORegister(CPU* cpu, uint16_t address, uint8_t value) {
+    PROFILE_ENTER(cpu, PROFILE_IO);
+    if (address == 0x4014) {
+        writeOamDma(cpu, value);
+    } else if (address == 0x4016 && ((cpu->ioRegisters[0x16] | value) & 0x01)) {
+        /* Latched while the strobe is high, so also on the write that lowers it */
+        cpu->controllers[0] = cpu->buttons[0];
+        cpu->controllers[1] = cpu->buttons[1];
+    } else if (address == 0x4017) {
+        writeFrameCounter(cpu, value);
+    } else if (address <= 0x4013 || address == 0x4015) {
+        writeApuRegister(cpu, address, value);
+    }
+    if (address < 0x4018) {
+        cpu->ioRegisters[address - 0x4000] = value;
+    }
+    PROFILE_LEAVE(cpu);
+}
+
+/* Builds the fixed part of the memory map, again on every loadROM; PRG-ROM is mapped by the cartridge's mapper, and
+    * $6000-$7FFF stays open bus on boards without PRG-RAM
+*/
+void initBus(CPU* cpu) {
+    mapHandlers(cpu, 0x0000, 0xFFFF, readOpenBus, writeIgnored);
+    mapPages(cpu, 0x0000, 0x1FFF, cpu->ram, sizeof(cpu->ram), 1);
+    /* $2000-$2007, mirrored every 8 bytes up to $3FFF */
+    mapHandlers(cpu, 0x2000, 0x3FFF, readPPURegister, writePPURegister);
+    mapHandlers(cpu, 0x4000, 0x40FF, readIORegister, writeIORegister);
+    if (cpu->prgRam) {
+        mapPages(cpu, 0x6000, 0x7FFF, cpu->prgRam, PRG_RAM_SIZE, 1);
+    }
+    cpu->bus.prgRamAccess = PRG_RAM_READ_WRITE;
+}
+
+/* For boards that can switch PRG-RAM off (open bus) or make it read-only. Nothing happens unless the access changes;
+    * when it does, the blocks decoded from PRG-RAM go first, since code decoded while it was read-only isn't guarded.
+*/
+void mapPrgRam(CPU* cpu, uint8_t access) {
+    if (!cpu->prgRam || access == cpu->bus.prgRamAccess) {
+        return;
+    }
+    invalidateBlocks(cpu, cpu->prgRam, PRG_RAM_SIZE);
+    cpu->bus.prgRamAccess = access;
+    if (access == PRG_RAM_OFF) {
+        mapHandlers(cpu, 0x6000, 0x7FFF, readOpenBus, writeIgnored);
+        return;
+    }
+    mapPages(cpu, 0x6000, 0x7FFF, cpu->prgRam, PRG_RAM_SIZE, access == PRG_RAM_READ_WRITE);
+    if (access == PRG_RAM_READ_ONLY) {
+        mapHandlers(cpu, 0x6000, 0x7FFF, NULL, writeIgnored);
+    }
+}
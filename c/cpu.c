@@ -0,0 +1,1169 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nes.h"
+
+#define PC (cpu->registers.pc)
+
+/* Computed-goto dispatch is a GNU extension; other compilers use the switch in executeInstruction */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NES_NO_THREADED_DISPATCH)
+#define NES_THREADED_DISPATCH 1
+#endif
+
+#ifdef NES_LAZY_FLAGS_CHECK
+static void verifyLazyFlags(CPU* cpu, const char* mnemonic) {
+    uint8_t lazy = getStatus(cpu) & 0b11000011;
+    uint8_t eager = cpu->registers.shadowStatus & 0b11000011;
+    if (lazy != eager) {
+        fprintf(stderr, "Lazy flags diverged after %s (next PC $%04X): lazy $%02X, eager $%02X\n",
+            mnemonic, cpu->registers.pc, lazy, eager);
+        abort();
+    }
+}
+#define VERIFY_FLAGS(cpu, mnemonic) verifyLazyFlags(cpu, mnemonic)
+#else
+#define VERIFY_FLAGS(cpu, mnemonic) ((void) 0)
+#endif
+
+/* Stack */
+#define pushStack(cpu, value) \
+    _Generic((value), \
+        uint8_t: pushStack_u8, \
+        uint16_t: pushStack_u16 \
+    )(cpu, value)
+
+/* The stack always lives in page $01 of internal RAM, so it skips the bus */
+static inline void pushStack_u8(CPU* cpu, uint8_t value) {
+    cpu->idle.clean = 0;
+    cpu->ram[0x100 + cpu->registers.s] = value;
+    cpu->registers.s--;
+}
+
+static inline void pushStack_u16(CPU* cpu, uint16_t value) {
+    pushStack_u8(cpu, (value >> 8) & 0xFF);
+    pushStack_u8(cpu, value & 0xFF);
+}
+
+static inline uint8_t popStack(CPU* cpu) {
+    cpu->registers.s++;
+    return cpu->ram[0x100 + cpu->registers.s];
+}
+
+static inline uint16_t popStackWord(CPU* cpu) {
+    uint8_t low = popStack(cpu);
+    return low | (popStack(cpu) << 8);
+}
+
+// https://www.nesdev.org/wiki/CPU_addressing_modes
+/* Each helper takes the address of the operand bytes (the byte after the opcode) and returns the effective address */
+static inline uint16_t getImmediate(CPU* cpu, uint16_t address) {
+    return address;
+}
+
+static inline uint16_t getRelative(CPU* cpu, uint16_t address) {
+    int8_t offset = (int8_t) readByte(cpu, address);
+    return (uint16_t)(address + 1 + offset);
+}
+
+static inline uint16_t getAbsolute(CPU* cpu, uint16_t address) {
+    return readWord(cpu, address);
+}
+
+/* Indexed reads take an extra cycle when the index carries into the high byte */
+static inline uint16_t indexAddress(CPU* cpu, uint16_t base, uint8_t index, uint8_t pageCycle) {
+    uint16_t effective = base + index;
+    if (pageCycle && ((base ^ effective) & 0xFF00)) {
+        cpu->clock.cycles++;
+    }
+    return effective;
+}
+
+/* JMP ($xxFF) fetches the high byte from $xx00, not the next page */
+static inline uint16_t readPointer(CPU* cpu, uint16_t pointer) {
+    uint8_t low = readByte(cpu, pointer);
+    uint8_t high = readByte(cpu, (pointer & 0xFF00) | ((pointer + 1) & 0x00FF));
+    return low | (high << 8);
+}
+
+/* Zero-page pointers always resolve to internal RAM */
+static inline uint16_t readZeroPagePointer(CPU* cpu, uint8_t pointer) {
+    return cpu->ram[pointer] | (cpu->ram[(uint8_t)(pointer + 1)] << 8);
+}
+
+static inline uint16_t getAbsoluteX(CPU* cpu, uint16_t address, uint8_t pageCycle) {
+    return indexAddress(cpu, readWord(cpu, address), cpu->registers.x, pageCycle);
+}
+
+static inline uint16_t getAbsoluteY(CPU* cpu, uint16_t address, uint8_t pageCycle) {
+    return indexAddress(cpu, readWord(cpu, address), cpu->registers.y, pageCycle);
+}
+
+static inline uint16_t getIndirect(CPU* cpu, uint16_t address) {
+    return readPointer(cpu, readWord(cpu, address));
+}
+
+static inline uint16_t getZeroPage(CPU* cpu, uint16_t address) {
+    return readByte(cpu, address);
+}
+
+static inline uint16_t getZeroPageX(CPU* cpu, uint16_t address) {
+    return (readByte(cpu, address) + cpu->registers.x) & 0xFF;
+}
+
+static inline uint16_t getZeroPageY(CPU* cpu, uint16_t address) {
+    return (readByte(cpu, address) + cpu->registers.y) & 0xFF;
+}
+
+static inline uint16_t getIndirectX(CPU* cpu, uint16_t address) {
+    return readZeroPagePointer(cpu, readByte(cpu, address) + cpu->registers.x);
+}
+
+static inline uint16_t getIndirectY(CPU* cpu, uint16_t address, uint8_t pageCycle) {
+    return indexAddress(cpu, readZeroPagePointer(cpu, readByte(cpu, address)), cpu->registers.y, pageCycle);
+}
+
+/* The mode is a compile-time constant at every call site, so this folds down to a single helper */
+static inline uint16_t resolveAddress(CPU* cpu, enum AddressingMode mode, uint8_t pageCycle) {
+    uint16_t operand = PC + 1;
+    switch (mode) {
+        case IMMEDIATE: return getImmediate(cpu, operand);
+        case RELATIVE: return getRelative(cpu, operand);
+        case ABSOLUTE: return getAbsolute(cpu, operand);
+        case ABSOLUTE_X: return getAbsoluteX(cpu, operand, pageCycle);
+        case ABSOLUTE_Y: return getAbsoluteY(cpu, operand, pageCycle);
+        case INDIRECT: return getIndirect(cpu, operand);
+        case ZERO_PAGE: return getZeroPage(cpu, operand);
+        case ZERO_PAGE_X: return getZeroPageX(cpu, operand);
+        case ZERO_PAGE_Y: return getZeroPageY(cpu, operand);
+        case INDIRECT_X: return getIndirectX(cpu, operand);
+        case INDIRECT_Y: return getIndirectY(cpu, operand, pageCycle);
+        default: return 0;
+    }
+}
+
+/* Shared ALU helpers */
+static inline void addWithCarry(CPU* cpu, uint8_t value) {
+    uint16_t result = cpu->registers.acc + value + FLAG_C(cpu);
+    SET_FLAG_C(cpu, result >> 8);
+    SET_FLAG_V(cpu, (cpu->registers.acc ^ result) & (value ^ result));
+    cpu->registers.acc = result & 0xFF;
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void compare(CPU* cpu, uint8_t reg, uint8_t value) {
+    uint8_t result = reg - value;
+    SET_FLAG_C(cpu, reg >= value);
+    SET_FLAGS_ZN(cpu, result);
+}
+
+static inline uint8_t shiftLeft(CPU* cpu, uint8_t value) {
+    SET_FLAG_C(cpu, value >> 7);
+    value <<= 1;
+    SET_FLAGS_ZN(cpu, value);
+    return value;
+}
+
+static inline uint8_t shiftRight(CPU* cpu, uint8_t value) {
+    SET_FLAG_C(cpu, value & 0x01);
+    value >>= 1;
+    SET_FLAGS_ZN(cpu, value);
+    return value;
+}
+
+static inline uint8_t rotateLeft(CPU* cpu, uint8_t value) {
+    uint8_t carry = FLAG_C(cpu);
+    SET_FLAG_C(cpu, value >> 7);
+    value = (value << 1) | carry;
+    SET_FLAGS_ZN(cpu, value);
+    return value;
+}
+
+static inline uint8_t rotateRight(CPU* cpu, uint8_t value) {
+    uint8_t carry = FLAG_C(cpu);
+    SET_FLAG_C(cpu, value & 0x01);
+    value = (value >> 1) | (carry << 7);
+    SET_FLAGS_ZN(cpu, value);
+    return value;
+}
+
+// https://www.nesdev.org/wiki/Cycle_counting
+/* Called with the clock at the moment the CPU lands on `head`. A clean repeat visit with the same registers proves
+    * the loop is a fixed point, so whole passes that would all start and finish before both the slice target and the
+    * next $2002 change are skipped; what is left of the slice runs normally and reaches the event on the same cycle
+    * and in the same state as running every pass would.
+*/
+void idleLoop(CPU* cpu, uint16_t head) {
+    IdleLoop* idle = &cpu->idle;
+    Clock* clock = &cpu->clock;
+    uint8_t p = getStatus(cpu);
+    if (idle->head == head && idle->clean && idle->acc == cpu->registers.acc && idle->x == cpu->registers.x &&
+        idle->y == cpu->registers.y && idle->s == cpu->registers.s && idle->p == p &&
+        !cpu->nmi && !(cpu->irq && !GET_INTERRUPT(p))) {
+        uint64_t length = clock->cycles - idle->cycles;
+        uint64_t limit = clock->target;
+        if (idle->polledStatus) {
+            uint64_t stable = ppuStatusStableUntil(cpu);
+            limit = cpu->ppu.status == idle->status ? (stable < limit ? stable : limit) : 0;
+        }
+        if (length > 0 && limit > clock->cycles) {
+            uint64_t skip = (limit - 1 - clock->cycles) / length * length;
+            clock->cycles += skip;
+            clock->skipCycles += skip;
+            idle->skips += skip > 0;
+        }
+    }
+    idle->head = head;
+    idle->clean = 1;
+    idle->polledStatus = 0;
+    idle->cycles = clock->cycles;
+    idle->acc = cpu->registers.acc;
+    idle->x = cpu->registers.x;
+    idle->y = cpu->registers.y;
+    idle->s = cpu->registers.s;
+    idle->p = p;
+}
+
+#ifdef NES_IDLE_SKIP
+#define WATCH_LOOP(cpu, head) \
+    do { \
+        if ((uint16_t)(PC - (head) - 1) < IDLE_LOOP_BYTES) idleLoop(cpu, head); \
+    } while (0)
+#else
+#define WATCH_LOOP(cpu, head) ((void) 0)
+#endif
+
+/* Taken branches cost one extra cycle, two if the target is on another page */
+static inline void branch(CPU* cpu, uint16_t address, int condition) {
+    if (condition) {
+        cpu->clock.cycles += ((PC ^ address) & 0xFF00) ? 2 : 1;
+        WATCH_LOOP(cpu, address);
+        PC = address;
+    }
+}
+
+// Instructions: https://www.masswerk.at/6502/6502_instruction_set.html#SLO
+static inline void ADC(CPU* cpu, uint16_t address) {
+    addWithCarry(cpu, readByte(cpu, address));
+}
+
+static inline void AND(CPU* cpu, uint16_t address) {
+    cpu->registers.acc &= readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void ASL(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, shiftLeft(cpu, readByte(cpu, address)));
+}
+
+static inline void ASL_A(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = shiftLeft(cpu, cpu->registers.acc);
+}
+
+static inline void BCC(CPU* cpu, uint16_t address) {
+    branch(cpu, address, !FLAG_C(cpu));
+}
+
+static inline void BCS(CPU* cpu, uint16_t address) {
+    branch(cpu, address, FLAG_C(cpu));
+}
+
+static inline void BEQ(CPU* cpu, uint16_t address) {
+    branch(cpu, address, FLAG_Z(cpu));
+}
+
+static inline void BIT(CPU* cpu, uint16_t address) {
+    uint8_t value = readByte(cpu, address);
+    SET_FLAG_Z(cpu, cpu->registers.acc & value);
+    SET_FLAG_V(cpu, value << 1);
+    SET_FLAG_N(cpu, value);
+}
+
+static inline void BMI(CPU* cpu, uint16_t address) {
+    branch(cpu, address, FLAG_N(cpu));
+}
+
+static inline void BNE(CPU* cpu, uint16_t address) {
+    branch(cpu, address, !FLAG_Z(cpu));
+}
+
+static inline void BPL(CPU* cpu, uint16_t address) {
+    branch(cpu, address, !FLAG_N(cpu));
+}
+
+/* From: http://www.6502.org/users/obelisk/6502/reference.html
+    *
+    * BRK - Break
+    * Description: The BRK instruction forces the generation of an interrupt request.
+    * The program counter and processor status are pushed on the stack then the IRQ interrupt vector at $FFFE/F is loaded into the PC
+    * and the break flag in the status set to one.
+    *
+*/
+static inline void BRK(CPU* cpu, uint16_t address) {
+    pushStack(cpu, cpu->registers.pc);
+    pushStack(cpu, (uint8_t)(getStatus(cpu) | STACK_FLAGS));
+    SET_INTERRUPT(cpu->registers.p, 1);
+    cpu->registers.pc = readWord(cpu, 0xFFFE);
+}
+
+static inline void BVC(CPU* cpu, uint16_t address) {
+    branch(cpu, address, !FLAG_V(cpu));
+}
+
+static inline void BVS(CPU* cpu, uint16_t address) {
+    branch(cpu, address, FLAG_V(cpu));
+}
+
+static inline void CLC(CPU* cpu, uint16_t address) {
+    SET_FLAG_C(cpu, 0);
+}
+
+static inline void CLD(CPU* cpu, uint16_t address) {
+    SET_DECIMAL(cpu->registers.p, 0);
+}
+
+static inline void CLI(CPU* cpu, uint16_t address) {
+    SET_INTERRUPT(cpu->registers.p, 0);
+}
+
+static inline void CLV(CPU* cpu, uint16_t address) {
+    SET_FLAG_V(cpu, 0);
+}
+
+static inline void CMP(CPU* cpu, uint16_t address) {
+    compare(cpu, cpu->registers.acc, readByte(cpu, address));
+}
+
+static inline void CPX(CPU* cpu, uint16_t address) {
+    compare(cpu, cpu->registers.x, readByte(cpu, address));
+}
+
+static inline void CPY(CPU* cpu, uint16_t address) {
+    compare(cpu, cpu->registers.y, readByte(cpu, address));
+}
+
+static inline void DEC(CPU* cpu, uint16_t address) {
+    uint8_t value = readByte(cpu, address) - 1;
+    writeByte(cpu, address, value);
+    SET_FLAGS_ZN(cpu, value);
+}
+
+static inline void DEX(CPU* cpu, uint16_t address) {
+    cpu->registers.x--;
+    SET_FLAGS_ZN(cpu, cpu->registers.x);
+}
+
+static inline void DEY(CPU* cpu, uint16_t address) {
+    cpu->registers.y--;
+    SET_FLAGS_ZN(cpu, cpu->registers.y);
+}
+
+static inline void EOR(CPU* cpu, uint16_t address) {
+    cpu->registers.acc ^= readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void INC(CPU* cpu, uint16_t address) {
+    uint8_t value = readByte(cpu, address) + 1;
+    writeByte(cpu, address, value);
+    SET_FLAGS_ZN(cpu, value);
+}
+
+static inline void INX(CPU* cpu, uint16_t address) {
+    cpu->registers.x++;
+    SET_FLAGS_ZN(cpu, cpu->registers.x);
+}
+
+static inline void INY(CPU* cpu, uint16_t address) {
+    cpu->registers.y++;
+    SET_FLAGS_ZN(cpu, cpu->registers.y);
+}
+
+static inline void JMP(CPU* cpu, uint16_t address) {
+    WATCH_LOOP(cpu, address);
+    cpu->registers.pc = address;
+}
+
+/* PC already points past the operand, so the pushed return address is the last byte of JSR */
+static inline void JSR(CPU* cpu, uint16_t address) {
+    pushStack(cpu, (uint16_t)(cpu->registers.pc - 1));
+    cpu->registers.pc = address;
+}
+
+static inline void LDA(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void LDX(CPU* cpu, uint16_t address) {
+    cpu->registers.x = readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.x);
+}
+
+static inline void LDY(CPU* cpu, uint16_t address) {
+    cpu->registers.y = readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.y);
+}
+
+static inline void LSR(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, shiftRight(cpu, readByte(cpu, address)));
+}
+
+static inline void LSR_A(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = shiftRight(cpu, cpu->registers.acc);
+}
+
+/* Also covers the unofficial NOPs; the ones with operands still perform the read */
+static inline void NOP(CPU* cpu, uint16_t address) {
+    // No operation
+}
+
+/* From: http://www.6502.org/users/obelisk/6502/reference.html
+    *
+    * ORA - Logical inclusive OR
+    * An inclusive OR is performed, bit by bit, on the accumulator contents using the contents of a byte of memory.
+    * A, Z, N = A | M
+    *
+*/
+static inline void ORA(CPU* cpu, uint16_t address) {
+    cpu->registers.acc |= readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void PHA(CPU* cpu, uint16_t address) {
+    pushStack(cpu, cpu->registers.acc);
+}
+
+static inline void PHP(CPU* cpu, uint16_t address) {
+    pushStack(cpu, (uint8_t)(getStatus(cpu) | STACK_FLAGS));
+}
+
+static inline void PLA(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = popStack(cpu);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void PLP(CPU* cpu, uint16_t address) {
+    setStatus(cpu, (popStack(cpu) & ~STACK_FLAGS) | 0b00100000);
+}
+
+static inline void ROL(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, rotateLeft(cpu, readByte(cpu, address)));
+}
+
+static inline void ROL_A(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = rotateLeft(cpu, cpu->registers.acc);
+}
+
+static inline void ROR(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, rotateRight(cpu, readByte(cpu, address)));
+}
+
+static inline void ROR_A(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = rotateRight(cpu, cpu->registers.acc);
+}
+
+static inline void RTI(CPU* cpu, uint16_t address) {
+    setStatus(cpu, (popStack(cpu) & ~STACK_FLAGS) | 0b00100000);
+    cpu->registers.pc = popStackWord(cpu);
+}
+
+static inline void RTS(CPU* cpu, uint16_t address) {
+    cpu->registers.pc = popStackWord(cpu) + 1;
+}
+
+/* The NES 2A03 has no decimal mode, so SBC is ADC of the inverted operand */
+static inline void SBC(CPU* cpu, uint16_t address) {
+    addWithCarry(cpu, ~readByte(cpu, address));
+}
+
+static inline void SEC(CPU* cpu, uint16_t address) {
+    SET_FLAG_C(cpu, 1);
+}
+
+static inline void SED(CPU* cpu, uint16_t address) {
+    SET_DECIMAL(cpu->registers.p, 1);
+}
+
+static inline void SEI(CPU* cpu, uint16_t address) {
+    SET_INTERRUPT(cpu->registers.p, 1);
+}
+
+static inline void STA(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, cpu->registers.acc);
+}
+
+static inline void STX(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, cpu->registers.x);
+}
+
+static inline void STY(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, cpu->registers.y);
+}
+
+static inline void TAX(CPU* cpu, uint16_t address) {
+    cpu->registers.x = cpu->registers.acc;
+    SET_FLAGS_ZN(cpu, cpu->registers.x);
+}
+
+static inline void TAY(CPU* cpu, uint16_t address) {
+    cpu->registers.y = cpu->registers.acc;
+    SET_FLAGS_ZN(cpu, cpu->registers.y);
+}
+
+static inline void TSX(CPU* cpu, uint16_t address) {
+    cpu->registers.x = cpu->registers.s;
+    SET_FLAGS_ZN(cpu, cpu->registers.x);
+}
+
+static inline void TXA(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = cpu->registers.x;
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void TXS(CPU* cpu, uint16_t address) {
+    cpu->registers.s = cpu->registers.x;
+}
+
+static inline void TYA(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = cpu->registers.y;
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+/* Unofficial opcodes: https://www.nesdev.org/wiki/CPU_unofficial_opcodes */
+static inline void ALR(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = shiftRight(cpu, cpu->registers.acc & readByte(cpu, address));
+}
+
+static inline void ANC(CPU* cpu, uint16_t address) {
+    AND(cpu, address);
+    SET_FLAG_C(cpu, cpu->registers.acc >> 7);
+}
+
+/* "Magic" constant taken as $EE, which matches most 2A03s */
+static inline void ANE(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = (cpu->registers.acc | 0xEE) & cpu->registers.x & readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void ARR(CPU* cpu, uint16_t address) {
+    uint8_t value = cpu->registers.acc & readByte(cpu, address);
+    cpu->registers.acc = (value >> 1) | (FLAG_C(cpu) << 7);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+    SET_FLAG_C(cpu, (cpu->registers.acc >> 6) & 0x01);
+    SET_FLAG_V(cpu, (cpu->registers.acc << 1) ^ (cpu->registers.acc << 2));
+}
+
+static inline void DCP(CPU* cpu, uint16_t address) {
+    uint8_t value = readByte(cpu, address) - 1;
+    writeByte(cpu, address, value);
+    compare(cpu, cpu->registers.acc, value);
+}
+
+static inline void ISC(CPU* cpu, uint16_t address) {
+    uint8_t value = readByte(cpu, address) + 1;
+    writeByte(cpu, address, value);
+    addWithCarry(cpu, ~value);
+}
+
+/* The CPU locks up; keep PC on the opcode so it is fetched again forever */
+static inline void JAM(CPU* cpu, uint16_t address) {
+    cpu->registers.pc--;
+}
+
+static inline void LAS(CPU* cpu, uint16_t address) {
+    uint8_t value = readByte(cpu, address) & cpu->registers.s;
+    cpu->registers.acc = cpu->registers.x = cpu->registers.s = value;
+    SET_FLAGS_ZN(cpu, value);
+}
+
+static inline void LAX(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = cpu->registers.x = readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+/* LAX #imm (LXA) uses the same "magic" OR as ANE */
+static inline void LXA(CPU* cpu, uint16_t address) {
+    cpu->registers.acc = cpu->registers.x = (cpu->registers.acc | 0xEE) & readByte(cpu, address);
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void RLA(CPU* cpu, uint16_t address) {
+    uint8_t value = rotateLeft(cpu, readByte(cpu, address));
+    writeByte(cpu, address, value);
+    cpu->registers.acc &= value;
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void RRA(CPU* cpu, uint16_t address) {
+    uint8_t value = rotateRight(cpu, readByte(cpu, address));
+    writeByte(cpu, address, value);
+    addWithCarry(cpu, value);
+}
+
+static inline void SAX(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, cpu->registers.acc & cpu->registers.x);
+}
+
+static inline void SBX(CPU* cpu, uint16_t address) {
+    uint8_t value = readByte(cpu, address);
+    uint8_t ax = cpu->registers.acc & cpu->registers.x;
+    cpu->registers.x = ax - value;
+    SET_FLAG_C(cpu, ax >= value);
+    SET_FLAGS_ZN(cpu, cpu->registers.x);
+}
+
+/* SHA/SHX/SHY/TAS store a register ANDed with the high byte of the base address plus one */
+static inline uint8_t unstableHigh(uint16_t address, uint8_t index) {
+    return (uint8_t)(((address - index) >> 8) + 1);
+}
+
+static inline void SHA(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, cpu->registers.acc & cpu->registers.x & unstableHigh(address, cpu->registers.y));
+}
+
+static inline void SHX(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, cpu->registers.x & unstableHigh(address, cpu->registers.y));
+}
+
+static inline void SHY(CPU* cpu, uint16_t address) {
+    writeByte(cpu, address, cpu->registers.y & unstableHigh(address, cpu->registers.x));
+}
+
+static inline void SLO(CPU* cpu, uint16_t address) {
+    uint8_t value = shiftLeft(cpu, readByte(cpu, address));
+    writeByte(cpu, address, value);
+    cpu->registers.acc |= value;
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void SRE(CPU* cpu, uint16_t address) {
+    uint8_t value = shiftRight(cpu, readByte(cpu, address));
+    writeByte(cpu, address, value);
+    cpu->registers.acc ^= value;
+    SET_FLAGS_ZN(cpu, cpu->registers.acc);
+}
+
+static inline void TAS(CPU* cpu, uint16_t address) {
+    cpu->registers.s = cpu->registers.acc & cpu->registers.x;
+    writeByte(cpu, address, cpu->registers.s & unstableHigh(address, cpu->registers.y));
+}
+
+/* Opcode matrix: https://www.masswerk.at/6502/6502_instruction_set.html
+    *
+    * X(opcode, mnemonic, handler, addressing mode, length, base cycles, page-cross cycle)
+    * This single list generates the descriptor table, the switch in executeInstruction and the threaded dispatcher,
+    * so the three can never disagree.
+    *
+*/
+#define OPCODE_LIST(X) \
+    X(0x00, BRK, BRK, IMPLIED, 2, 7, 0) \
+    X(0x01, ORA, ORA, INDIRECT_X, 2, 6, 0) \
+    X(0x02, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x03, SLO, SLO, INDIRECT_X, 2, 8, 0) \
+    X(0x04, NOP, NOP, ZERO_PAGE, 2, 3, 0) \
+    X(0x05, ORA, ORA, ZERO_PAGE, 2, 3, 0) \
+    X(0x06, ASL, ASL, ZERO_PAGE, 2, 5, 0) \
+    X(0x07, SLO, SLO, ZERO_PAGE, 2, 5, 0) \
+    X(0x08, PHP, PHP, IMPLIED, 1, 3, 0) \
+    X(0x09, ORA, ORA, IMMEDIATE, 2, 2, 0) \
+    X(0x0A, ASL, ASL_A, ACCUMULATOR, 1, 2, 0) \
+    X(0x0B, ANC, ANC, IMMEDIATE, 2, 2, 0) \
+    X(0x0C, NOP, NOP, ABSOLUTE, 3, 4, 0) \
+    X(0x0D, ORA, ORA, ABSOLUTE, 3, 4, 0) \
+    X(0x0E, ASL, ASL, ABSOLUTE, 3, 6, 0) \
+    X(0x0F, SLO, SLO, ABSOLUTE, 3, 6, 0) \
+    X(0x10, BPL, BPL, RELATIVE, 2, 2, 0) \
+    X(0x11, ORA, ORA, INDIRECT_Y, 2, 5, 1) \
+    X(0x12, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x13, SLO, SLO, INDIRECT_Y, 2, 8, 0) \
+    X(0x14, NOP, NOP, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x15, ORA, ORA, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x16, ASL, ASL, ZERO_PAGE_X, 2, 6, 0) \
+    X(0x17, SLO, SLO, ZERO_PAGE_X, 2, 6, 0) \
+    X(0x18, CLC, CLC, IMPLIED, 1, 2, 0) \
+    X(0x19, ORA, ORA, ABSOLUTE_Y, 3, 4, 1) \
+    X(0x1A, NOP, NOP, IMPLIED, 1, 2, 0) \
+    X(0x1B, SLO, SLO, ABSOLUTE_Y, 3, 7, 0) \
+    X(0x1C, NOP, NOP, ABSOLUTE_X, 3, 4, 1) \
+    X(0x1D, ORA, ORA, ABSOLUTE_X, 3, 4, 1) \
+    X(0x1E, ASL, ASL, ABSOLUTE_X, 3, 7, 0) \
+    X(0x1F, SLO, SLO, ABSOLUTE_X, 3, 7, 0) \
+    X(0x20, JSR, JSR, ABSOLUTE, 3, 6, 0) \
+    X(0x21, AND, AND, INDIRECT_X, 2, 6, 0) \
+    X(0x22, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x23, RLA, RLA, INDIRECT_X, 2, 8, 0) \
+    X(0x24, BIT, BIT, ZERO_PAGE, 2, 3, 0) \
+    X(0x25, AND, AND, ZERO_PAGE, 2, 3, 0) \
+    X(0x26, ROL, ROL, ZERO_PAGE, 2, 5, 0) \
+    X(0x27, RLA, RLA, ZERO_PAGE, 2, 5, 0) \
+    X(0x28, PLP, PLP, IMPLIED, 1, 4, 0) \
+    X(0x29, AND, AND, IMMEDIATE, 2, 2, 0) \
+    X(0x2A, ROL, ROL_A, ACCUMULATOR, 1, 2, 0) \
+    X(0x2B, ANC, ANC, IMMEDIATE, 2, 2, 0) \
+    X(0x2C, BIT, BIT, ABSOLUTE, 3, 4, 0) \
+    X(0x2D, AND, AND, ABSOLUTE, 3, 4, 0) \
+    X(0x2E, ROL, ROL, ABSOLUTE, 3, 6, 0) \
+    X(0x2F, RLA, RLA, ABSOLUTE, 3, 6, 0) \
+    X(0x30, BMI, BMI, RELATIVE, 2, 2, 0) \
+    X(0x31, AND, AND, INDIRECT_Y, 2, 5, 1) \
+    X(0x32, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x33, RLA, RLA, INDIRECT_Y, 2, 8, 0) \
+    X(0x34, NOP, NOP, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x35, AND, AND, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x36, ROL, ROL, ZERO_PAGE_X, 2, 6, 0) \
+    X(0x37, RLA, RLA, ZERO_PAGE_X, 2, 6, 0) \
+    X(0x38, SEC, SEC, IMPLIED, 1, 2, 0) \
+    X(0x39, AND, AND, ABSOLUTE_Y, 3, 4, 1) \
+    X(0x3A, NOP, NOP, IMPLIED, 1, 2, 0) \
+    X(0x3B, RLA, RLA, ABSOLUTE_Y, 3, 7, 0) \
+    X(0x3C, NOP, NOP, ABSOLUTE_X, 3, 4, 1) \
+    X(0x3D, AND, AND, ABSOLUTE_X, 3, 4, 1) \
+    X(0x3E, ROL, ROL, ABSOLUTE_X, 3, 7, 0) \
+    X(0x3F, RLA, RLA, ABSOLUTE_X, 3, 7, 0) \
+    X(0x40, RTI, RTI, IMPLIED, 1, 6, 0) \
+    X(0x41, EOR, EOR, INDIRECT_X, 2, 6, 0) \
+    X(0x42, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x43, SRE, SRE, INDIRECT_X, 2, 8, 0) \
+    X(0x44, NOP, NOP, ZERO_PAGE, 2, 3, 0) \
+    X(0x45, EOR, EOR, ZERO_PAGE, 2, 3, 0) \
+    X(0x46, LSR, LSR, ZERO_PAGE, 2, 5, 0) \
+    X(0x47, SRE, SRE, ZERO_PAGE, 2, 5, 0) \
+    X(0x48, PHA, PHA, IMPLIED, 1, 3, 0) \
+    X(0x49, EOR, EOR, IMMEDIATE, 2, 2, 0) \
+    X(0x4A, LSR, LSR_A, ACCUMULATOR, 1, 2, 0) \
+    X(0x4B, ALR, ALR, IMMEDIATE, 2, 2, 0) \
+    X(0x4C, JMP, JMP, ABSOLUTE, 3, 3, 0) \
+    X(0x4D, EOR, EOR, ABSOLUTE, 3, 4, 0) \
+    X(0x4E, LSR, LSR, ABSOLUTE, 3, 6, 0) \
+    X(0x4F, SRE, SRE, ABSOLUTE, 3, 6, 0) \
+    X(0x50, BVC, BVC, RELATIVE, 2, 2, 0) \
+    X(0x51, EOR, EOR, INDIRECT_Y, 2, 5, 1) \
+    X(0x52, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x53, SRE, SRE, INDIRECT_Y, 2, 8, 0) \
+    X(0x54, NOP, NOP, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x55, EOR, EOR, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x56, LSR, LSR, ZERO_PAGE_X, 2, 6, 0) \
+    X(0x57, SRE, SRE, ZERO_PAGE_X, 2, 6, 0) \
+    X(0x58, CLI, CLI, IMPLIED, 1, 2, 0) \
+    X(0x59, EOR, EOR, ABSOLUTE_Y, 3, 4, 1) \
+    X(0x5A, NOP, NOP, IMPLIED, 1, 2, 0) \
+    X(0x5B, SRE, SRE, ABSOLUTE_Y, 3, 7, 0) \
+    X(0x5C, NOP, NOP, ABSOLUTE_X, 3, 4, 1) \
+    X(0x5D, EOR, EOR, ABSOLUTE_X, 3, 4, 1) \
+    X(0x5E, LSR, LSR, ABSOLUTE_X, 3, 7, 0) \
+    X(0x5F, SRE, SRE, ABSOLUTE_X, 3, 7, 0) \
+    X(0x60, RTS, RTS, IMPLIED, 1, 6, 0) \
+    X(0x61, ADC, ADC, INDIRECT_X, 2, 6, 0) \
+    X(0x62, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x63, RRA, RRA, INDIRECT_X, 2, 8, 0) \
+    X(0x64, NOP, NOP, ZERO_PAGE, 2, 3, 0) \
+    X(0x65, ADC, ADC, ZERO_PAGE, 2, 3, 0) \
+    X(0x66, ROR, ROR, ZERO_PAGE, 2, 5, 0) \
+    X(0x67, RRA, RRA, ZERO_PAGE, 2, 5, 0) \
+    X(0x68, PLA, PLA, IMPLIED, 1, 4, 0) \
+    X(0x69, ADC, ADC, IMMEDIATE, 2, 2, 0) \
+    X(0x6A, ROR, ROR_A, ACCUMULATOR, 1, 2, 0) \
+    X(0x6B, ARR, ARR, IMMEDIATE, 2, 2, 0) \
+    X(0x6C, JMP, JMP, INDIRECT, 3, 5, 0) \
+    X(0x6D, ADC, ADC, ABSOLUTE, 3, 4, 0) \
+    X(0x6E, ROR, ROR, ABSOLUTE, 3, 6, 0) \
+    X(0x6F, RRA, RRA, ABSOLUTE, 3, 6, 0) \
+    X(0x70, BVS, BVS, RELATIVE, 2, 2, 0) \
+    X(0x71, ADC, ADC, INDIRECT_Y, 2, 5, 1) \
+    X(0x72, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x73, RRA, RRA, INDIRECT_Y, 2, 8, 0) \
+    X(0x74, NOP, NOP, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x75, ADC, ADC, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x76, ROR, ROR, ZERO_PAGE_X, 2, 6, 0) \
+    X(0x77, RRA, RRA, ZERO_PAGE_X, 2, 6, 0) \
+    X(0x78, SEI, SEI, IMPLIED, 1, 2, 0) \
+    X(0x79, ADC, ADC, ABSOLUTE_Y, 3, 4, 1) \
+    X(0x7A, NOP, NOP, IMPLIED, 1, 2, 0) \
+    X(0x7B, RRA, RRA, ABSOLUTE_Y, 3, 7, 0) \
+    X(0x7C, NOP, NOP, ABSOLUTE_X, 3, 4, 1) \
+    X(0x7D, ADC, ADC, ABSOLUTE_X, 3, 4, 1) \
+    X(0x7E, ROR, ROR, ABSOLUTE_X, 3, 7, 0) \
+    X(0x7F, RRA, RRA, ABSOLUTE_X, 3, 7, 0) \
+    X(0x80, NOP, NOP, IMMEDIATE, 2, 2, 0) \
+    X(0x81, STA, STA, INDIRECT_X, 2, 6, 0) \
+    X(0x82, NOP, NOP, IMMEDIATE, 2, 2, 0) \
+    X(0x83, SAX, SAX, INDIRECT_X, 2, 6, 0) \
+    X(0x84, STY, STY, ZERO_PAGE, 2, 3, 0) \
+    X(0x85, STA, STA, ZERO_PAGE, 2, 3, 0) \
+    X(0x86, STX, STX, ZERO_PAGE, 2, 3, 0) \
+    X(0x87, SAX, SAX, ZERO_PAGE, 2, 3, 0) \
+    X(0x88, DEY, DEY, IMPLIED, 1, 2, 0) \
+    X(0x89, NOP, NOP, IMMEDIATE, 2, 2, 0) \
+    X(0x8A, TXA, TXA, IMPLIED, 1, 2, 0) \
+    X(0x8B, ANE, ANE, IMMEDIATE, 2, 2, 0) \
+    X(0x8C, STY, STY, ABSOLUTE, 3, 4, 0) \
+    X(0x8D, STA, STA, ABSOLUTE, 3, 4, 0) \
+    X(0x8E, STX, STX, ABSOLUTE, 3, 4, 0) \
+    X(0x8F, SAX, SAX, ABSOLUTE, 3, 4, 0) \
+    X(0x90, BCC, BCC, RELATIVE, 2, 2, 0) \
+    X(0x91, STA, STA, INDIRECT_Y, 2, 6, 0) \
+    X(0x92, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0x93, SHA, SHA, INDIRECT_Y, 2, 6, 0) \
+    X(0x94, STY, STY, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x95, STA, STA, ZERO_PAGE_X, 2, 4, 0) \
+    X(0x96, STX, STX, ZERO_PAGE_Y, 2, 4, 0) \
+    X(0x97, SAX, SAX, ZERO_PAGE_Y, 2, 4, 0) \
+    X(0x98, TYA, TYA, IMPLIED, 1, 2, 0) \
+    X(0x99, STA, STA, ABSOLUTE_Y, 3, 5, 0) \
+    X(0x9A, TXS, TXS, IMPLIED, 1, 2, 0) \
+    X(0x9B, TAS, TAS, ABSOLUTE_Y, 3, 5, 0) \
+    X(0x9C, SHY, SHY, ABSOLUTE_X, 3, 5, 0) \
+    X(0x9D, STA, STA, ABSOLUTE_X, 3, 5, 0) \
+    X(0x9E, SHX, SHX, ABSOLUTE_Y, 3, 5, 0) \
+    X(0x9F, SHA, SHA, ABSOLUTE_Y, 3, 5, 0) \
+    X(0xA0, LDY, LDY, IMMEDIATE, 2, 2, 0) \
+    X(0xA1, LDA, LDA, INDIRECT_X, 2, 6, 0) \
+    X(0xA2, LDX, LDX, IMMEDIATE, 2, 2, 0) \
+    X(0xA3, LAX, LAX, INDIRECT_X, 2, 6, 0) \
+    X(0xA4, LDY, LDY, ZERO_PAGE, 2, 3, 0) \
+    X(0xA5, LDA, LDA, ZERO_PAGE, 2, 3, 0) \
+    X(0xA6, LDX, LDX, ZERO_PAGE, 2, 3, 0) \
+    X(0xA7, LAX, LAX, ZERO_PAGE, 2, 3, 0) \
+    X(0xA8, TAY, TAY, IMPLIED, 1, 2, 0) \
+    X(0xA9, LDA, LDA, IMMEDIATE, 2, 2, 0) \
+    X(0xAA, TAX, TAX, IMPLIED, 1, 2, 0) \
+    X(0xAB, LXA, LXA, IMMEDIATE, 2, 2, 0) \
+    X(0xAC, LDY, LDY, ABSOLUTE, 3, 4, 0) \
+    X(0xAD, LDA, LDA, ABSOLUTE, 3, 4, 0) \
+    X(0xAE, LDX, LDX, ABSOLUTE, 3, 4, 0) \
+    X(0xAF, LAX, LAX, ABSOLUTE, 3, 4, 0) \
+    X(0xB0, BCS, BCS, RELATIVE, 2, 2, 0) \
+    X(0xB1, LDA, LDA, INDIRECT_Y, 2, 5, 1) \
+    X(0xB2, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0xB3, LAX, LAX, INDIRECT_Y, 2, 5, 1) \
+    X(0xB4, LDY, LDY, ZERO_PAGE_X, 2, 4, 0) \
+    X(0xB5, LDA, LDA, ZERO_PAGE_X, 2, 4, 0) \
+    X(0xB6, LDX, LDX, ZERO_PAGE_Y, 2, 4, 0) \
+    X(0xB7, LAX, LAX, ZERO_PAGE_Y, 2, 4, 0) \
+    X(0xB8, CLV, CLV, IMPLIED, 1, 2, 0) \
+    X(0xB9, LDA, LDA, ABSOLUTE_Y, 3, 4, 1) \
+    X(0xBA, TSX, TSX, IMPLIED, 1, 2, 0) \
+    X(0xBB, LAS, LAS, ABSOLUTE_Y, 3, 4, 1) \
+    X(0xBC, LDY, LDY, ABSOLUTE_X, 3, 4, 1) \
+    X(0xBD, LDA, LDA, ABSOLUTE_X, 3, 4, 1) \
+    X(0xBE, LDX, LDX, ABSOLUTE_Y, 3, 4, 1) \
+    X(0xBF, LAX, LAX, ABSOLUTE_Y, 3, 4, 1) \
+    X(0xC0, CPY, CPY, IMMEDIATE, 2, 2, 0) \
+    X(0xC1, CMP, CMP, INDIRECT_X, 2, 6, 0) \
+    X(0xC2, NOP, NOP, IMMEDIATE, 2, 2, 0) \
+    X(0xC3, DCP, DCP, INDIRECT_X, 2, 8, 0) \
+    X(0xC4, CPY, CPY, ZERO_PAGE, 2, 3, 0) \
+    X(0xC5, CMP, CMP, ZERO_PAGE, 2, 3, 0) \
+    X(0xC6, DEC, DEC, ZERO_PAGE, 2, 5, 0) \
+    X(0xC7, DCP, DCP, ZERO_PAGE, 2, 5, 0) \
+    X(0xC8, INY, INY, IMPLIED, 1, 2, 0) \
+    X(0xC9, CMP, CMP, IMMEDIATE, 2, 2, 0) \
+    X(0xCA, DEX, DEX, IMPLIED, 1, 2, 0) \
+    X(0xCB, SBX, SBX, IMMEDIATE, 2, 2, 0) \
+    X(0xCC, CPY, CPY, ABSOLUTE, 3, 4, 0) \
+    X(0xCD, CMP, CMP, ABSOLUTE, 3, 4, 0) \
+    X(0xCE, DEC, DEC, ABSOLUTE, 3, 6, 0) \
+    X(0xCF, DCP, DCP, ABSOLUTE, 3, 6, 0) \
+    X(0xD0, BNE, BNE, RELATIVE, 2, 2, 0) \
+    X(0xD1, CMP, CMP, INDIRECT_Y, 2, 5, 1) \
+    X(0xD2, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0xD3, DCP, DCP, INDIRECT_Y, 2, 8, 0) \
+    X(0xD4, NOP, NOP, ZERO_PAGE_X, 2, 4, 0) \
+    X(0xD5, CMP, CMP, ZERO_PAGE_X, 2, 4, 0) \
+    X(0xD6, DEC, DEC, ZERO_PAGE_X, 2, 6, 0) \
+    X(0xD7, DCP, DCP, ZERO_PAGE_X, 2, 6, 0) \
+    X(0xD8, CLD, CLD, IMPLIED, 1, 2, 0) \
+    X(0xD9, CMP, CMP, ABSOLUTE_Y, 3, 4, 1) \
+    X(0xDA, NOP, NOP, IMPLIED, 1, 2, 0) \
+    X(0xDB, DCP, DCP, ABSOLUTE_Y, 3, 7, 0) \
+    X(0xDC, NOP, NOP, ABSOLUTE_X, 3, 4, 1) \
+    X(0xDD, CMP, CMP, ABSOLUTE_X, 3, 4, 1) \
+    X(0xDE, DEC, DEC, ABSOLUTE_X, 3, 7, 0) \
+    X(0xDF, DCP, DCP, ABSOLUTE_X, 3, 7, 0) \
+    X(0xE0, CPX, CPX, IMMEDIATE, 2, 2, 0) \
+    X(0xE1, SBC, SBC, INDIRECT_X, 2, 6, 0) \
+    X(0xE2, NOP, NOP, IMMEDIATE, 2, 2, 0) \
+    X(0xE3, ISC, ISC, INDIRECT_X, 2, 8, 0) \
+    X(0xE4, CPX, CPX, ZERO_PAGE, 2, 3, 0) \
+    X(0xE5, SBC, SBC, ZERO_PAGE, 2, 3, 0) \
+    X(0xE6, INC, INC, ZERO_PAGE, 2, 5, 0) \
+    X(0xE7, ISC, ISC, ZERO_PAGE, 2, 5, 0) \
+    X(0xE8, INX, INX, IMPLIED, 1, 2, 0) \
+    X(0xE9, SBC, SBC, IMMEDIATE, 2, 2, 0) \
+    X(0xEA, NOP, NOP, IMPLIED, 1, 2, 0) \
+    X(0xEB, SBC, SBC, IMMEDIATE, 2, 2, 0) \
+    X(0xEC, CPX, CPX, ABSOLUTE, 3, 4, 0) \
+    X(0xED, SBC, SBC, ABSOLUTE, 3, 4, 0) \
+    X(0xEE, INC, INC, ABSOLUTE, 3, 6, 0) \
+    X(0xEF, ISC, ISC, ABSOLUTE, 3, 6, 0) \
+    X(0xF0, BEQ, BEQ, RELATIVE, 2, 2, 0) \
+    X(0xF1, SBC, SBC, INDIRECT_Y, 2, 5, 1) \
+    X(0xF2, JAM, JAM, IMPLIED, 1, 2, 0) \
+    X(0xF3, ISC, ISC, INDIRECT_Y, 2, 8, 0) \
+    X(0xF4, NOP, NOP, ZERO_PAGE_X, 2, 4, 0) \
+    X(0xF5, SBC, SBC, ZERO_PAGE_X, 2, 4, 0) \
+    X(0xF6, INC, INC, ZERO_PAGE_X, 2, 6, 0) \
+    X(0xF7, ISC, ISC, ZERO_PAGE_X, 2, 6, 0) \
+    X(0xF8, SED, SED, IMPLIED, 1, 2, 0) \
+    X(0xF9, SBC, SBC, ABSOLUTE_Y, 3, 4, 1) \
+    X(0xFA, NOP, NOP, IMPLIED, 1, 2, 0) \
+    X(0xFB, ISC, ISC, ABSOLUTE_Y, 3, 7, 0) \
+    X(0xFC, NOP, NOP, ABSOLUTE_X, 3, 4, 1) \
+    X(0xFD, SBC, SBC, ABSOLUTE_X, 3, 4, 1) \
+    X(0xFE, INC, INC, ABSOLUTE_X, 3, 7, 0) \
+    X(0xFF, ISC, ISC, ABSOLUTE_X, 3, 7, 0)
+
+#define OPCODE_DESCRIPTOR(code, mnemonic, handler, mode, length, cycles, pageCycle) \
+    [code] = { #mnemonic, handler, mode, length, cycles, pageCycle },
+
+const Opcode opcodeTable[256] = {
+    OPCODE_LIST(OPCODE_DESCRIPTOR)
+};
+
+#ifdef NES_PROFILE
+#define PROFILE_BEGIN(code) profileInstruction(cpu, code)
+#else
+#define PROFILE_BEGIN(code) ((void) 0)
+#endif
+
+/* Operands are resolved before PC moves past the instruction, so handlers see PC pointing at the next opcode */
+#define EXECUTE_OPCODE(code, handler, mode, length, baseCycles, pageCycle) \
+    do { \
+        PROFILE_BEGIN(code); \
+        uint16_t address = resolveAddress(cpu, mode, pageCycle); \
+        PC += length; \
+        cpu->clock.cycles += baseCycles; \
+        handler(cpu, address); \
+        VERIFY_FLAGS(cpu, #handler); \
+    } while (0)
+
+/* The same for a decoded op, whose operand bytes were read when its block was decoded */
+#define EXECUTE_DECODED(code, handler, mode, baseCycles, pageCycle) \
+    do { \
+        PROFILE_BEGIN(code); \
+        uint16_t address = decodedAddress(cpu, mode, op->operand, pageCycle); \
+        PC = op->next; \
+        cpu->clock.cycles += baseCycles; \
+        handler(cpu, address); \
+        VERIFY_FLAGS(cpu, #handler); \
+    } while (0)
+
+#define OPCODE_CASE(code, mnemonic, handler, mode, length, cycles, pageCycle) \
+    case code: { EXECUTE_OPCODE(code, handler, mode, length, cycles, pageCycle); break; }
+
+void executeInstruction(uint8_t opcode, CPU* cpu) {
+    switch (opcode) {
+        OPCODE_LIST(OPCODE_CASE)
+    }
+}
+
+// https://www.nesdev.org/wiki/NMI
+// https://www.nesdev.org/wiki/IRQ
+/* Polled between instructions. NMI is edge-triggered, so it is consumed here; IRQ is a level held by its sources
+    * (cpu->irq) until they are acknowledged, and is masked by I. Both push P with B clear and take 7 cycles. Returns
+    * whether one was taken.
+*/
+int serviceInterrupts(CPU* cpu) {
+    uint16_t vector;
+    if (cpu->nmi) {
+        cpu->nmi = 0;
+        vector = 0xFFFA;
+    } else if (cpu->irq && !GET_INTERRUPT(cpu->registers.p)) {
+        vector = 0xFFFE;
+    } else {
+        return 0;
+    }
+#ifdef NES_PROFILE
+    profileSettle(cpu);
+#endif
+    pushStack(cpu, cpu->registers.pc);
+    pushStack(cpu, (uint8_t)((getStatus(cpu) | STACK_FLAGS) & ~0b00010000));
+    SET_INTERRUPT(cpu->registers.p, 1);
+    cpu->registers.pc = readWord(cpu, vector);
+    cpu->clock.cycles += 7;
+#ifdef NES_PROFILE
+    profileRestart(cpu);
+#endif
+    return 1;
+}
+
+#ifdef NES_BLOCK_CACHE
+/* Decoded counterpart of resolveAddress: the operand bytes were read when the block was decoded, so only indexing
+    * and pointer reads are left
+*/
+static inline uint16_t decodedAddress(CPU* cpu, enum AddressingMode mode, uint16_t operand, uint8_t pageCycle) {
+    switch (mode) {
+        case ABSOLUTE_X: return indexAddress(cpu, operand, cpu->registers.x, pageCycle);
+        case ABSOLUTE_Y: return indexAddress(cpu, operand, cpu->registers.y, pageCycle);
+        case INDIRECT: return readPointer(cpu, operand);
+        case ZERO_PAGE_X: return (operand + cpu->registers.x) & 0xFF;
+        case ZERO_PAGE_Y: return (operand + cpu->registers.y) & 0xFF;
+        case INDIRECT_X: return readZeroPagePointer(cpu, operand + cpu->registers.x);
+        case INDIRECT_Y: return indexAddress(cpu, readZeroPagePointer(cpu, operand), cpu->registers.y, pageCycle);
+        default: return operand;
+    }
+}
+
+static inline uint32_t blockSlot(uint16_t pc, const uint8_t* host) {
+    return ((uint32_t)((uintptr_t) host >> 8) * 0x9E3779B1u + pc) & (BLOCK_CACHE_SIZE - 1);
+}
+
+/* The block starting at PC, decoding it on a miss; NULL means run one instruction uncached. The cache is allocated on
+    * the first lookup, and a machine that can't get one runs uncached.
+*/
+static inline Block* findBlock(CPU* cpu) {
+    BlockCache* cache = cpu->blocks;
+    if (__builtin_expect(!cache, 0) && !(cache = cpu->blocks = (BlockCache*) calloc(1, sizeof(BlockCache)))) {
+        return NULL;
+    }
+    const uint8_t* host = cpu->bus.readPages[PC >> 8];
+    Block* block = &cache->blocks[blockSlot(PC, host)];
+    if (__builtin_expect(block->pc != PC || block->host != host || !host, 0)) {
+        block = host ? decodeBlock(cpu, block, PC, host) : NULL;
+        if (!block) {
+            cache->stats.uncached++;
+            return NULL;
+        }
+    } else {
+        cache->stats.hits++;
+    }
+    cache->running = block;
+    return block;
+}
+#endif
+
+/* Runs instructions until the clock reaches `cycle` or the next scheduled event, whichever comes first, and returns
+    * how many were executed. The limit lives in cpu->clock.target so that scheduling an earlier event from inside an
+    * instruction ends the slice there; due events are left for the caller to run (runEvents).
+    *
+    * With computed gotos every handler ends in its own indirect jump to the next one, so the host branch predictor
+    * learns opcode-to-opcode transitions instead of funnelling everything through the single switch jump. With the
+    * block cache on top, the jump goes through the next decoded op rather than a fetch and decode of the opcode, and
+    * only a block boundary goes back to the cache; interrupts and the slice target are still checked between every two
+    * instructions, in the same order as the plain interpreter. A traced machine runs the plain interpreter itself
+    * (runTraced), so tracing costs the untraced one a single test per slice.
+    *
+*/
+#ifdef NES_PROFILE
+static uint64_t runSlice(CPU* cpu, uint64_t cycle);
+
+uint64_t runUntil(CPU* cpu, uint64_t cycle) {
+    PROFILE_ENTER(cpu, PROFILE_CPU);
+    profileRestart(cpu);
+    uint64_t executed = runSlice(cpu, cycle);
+    profileSettle(cpu);
+    PROFILE_LEAVE(cpu);
+    return executed;
+}
+
+static uint64_t runSlice(CPU* cpu, uint64_t cycle) {
+#else
+uint64_t runUntil(CPU* cpu, uint64_t cycle) {
+#endif
+    uint64_t executed = 0;
+    cpu->clock.target = cycle < cpu->clock.nextEvent ? cycle : cpu->clock.nextEvent;
+    /* Events that ran since the last slice may have changed anything a watched loop reads */
+    cpu->idle.clean = 0;
+    if (cpu->trace) {
+        return runTraced(cpu);
+    }
+
+#if defined(NES_BLOCK_CACHE)
+    #define OPCODE_LABEL(code, mnemonic, handler, mode, length, cycles, pageCycle) [code] = &&op_##code,
+    #define NEXT_OP() \
+        do { \
+            if (cpu->clock.cycles >= cpu->clock.target) return executed; \
+            if (__builtin_expect(cpu->irq | cpu->nmi, 0) && serviceInterrupts(cpu)) goto lookup; \
+            goto *blockTable[(++op)->index]; \
+        } while (0)
+    #define OPCODE_DECODED(code, mnemonic, handler, mode, length, cycles, pageCycle) \
+        op_##code: EXECUTE_DECODED(code, handler, mode, cycles, pageCycle); executed++; NEXT_OP();
+
+    static void* const blockTable[BLOCK_END + 1] = {
+        OPCODE_LIST(OPCODE_LABEL)
+        [BLOCK_END] = &&lookup,
+    };
+    /* Stands in for a block around an instruction that ran uncached, so the checks after it lead back to lookup */
+    static const DecodedOp uncached[2] = { { 0, 0, 0 }, { BLOCK_END, 0, 0 } };
+    const DecodedOp* op;
+
+    if (cpu->clock.cycles >= cpu->clock.target) return executed;
+    if (cpu->irq | cpu->nmi) serviceInterrupts(cpu);
+
+lookup: {
+        Block* block = findBlock(cpu);
+        if (!block) {
+            executeInstruction(readByte(cpu, PC), cpu);
+            executed++;
+            op = uncached;
+            NEXT_OP();
+        }
+#ifdef NES_JIT
+        if (cpu->jit && !PROFILE_ACTIVE(cpu)) {
+            int exit = runNative(cpu, block, &executed);
+            if (exit == JIT_EXIT_FALLBACK) {
+                executeInstruction(readByte(cpu, PC), cpu);
+                executed++;
+            }
+            if (exit != JIT_EXIT_NONE) {
+                op = uncached;
+                NEXT_OP();
+            }
+        }
+#endif
+        op = block->ops;
+        goto *blockTable[op->index];
+    }
+    OPCODE_LIST(OPCODE_DECODED)
+
+    #undef OPCODE_DECODED
+    #undef NEXT_OP
+    #undef OPCODE_LABEL
+#elif defined(NES_THREADED_DISPATCH)
+    #define OPCODE_LABEL(code, mnemonic, handler, mode, length, cycles, pageCycle) [code] = &&op_##code,
+    #define DISPATCH() \
+        do { \
+            if (cpu->clock.cycles >= cpu->clock.target) return executed; \
+            if (__builtin_expect(cpu->irq | cpu->nmi, 0)) serviceInterrupts(cpu); \
+            executed++; \
+            goto *dispatchTable[readByte(cpu, PC)]; \
+        } while (0)
+    #define OPCODE_THREADED(code, mnemonic, handler, mode, length, cycles, pageCycle) \
+        op_##code: EXECUTE_OPCODE(code, handler, mode, length, cycles, pageCycle); DISPATCH();
+
+    static void* const dispatchTable[256] = {
+        OPCODE_LIST(OPCODE_LABEL)
+    };
+
+    DISPATCH();
+    OPCODE_LIST(OPCODE_THREADED)
+
+    #undef OPCODE_THREADED
+    #undef DISPATCH
+    #undef OPCODE_LABEL
+#else
+    while (cpu->clock.cycles < cpu->clock.target) {
+        if (cpu->irq | cpu->nmi) {
+            serviceInterrupts(cpu);
+        }
+        executeInstruction(readByte(cpu, PC), cpu);
+        executed++;
+    }
+    return executed;
+#endif
+}
+
+// https://www.nesdev.org/wiki/CPU_power_up_state
+void resetCPU(CPU* cpu) {
+    cpu->registers.acc = 0;
+    cpu->registers.x = 0;
+    cpu->registers.y = 0;
+    cpu->registers.s = 0xFD;
+    setStatus(cpu, 0b00100100);
+    cpu->registers.pc = readWord(cpu, 0xFFFC);
+    cpu->clock.cycles = 7;
+    cpu->clock.skipCycles = 0;
+    cpu->idle = (IdleLoop) { 0 };
+    cpu->irq = 0;
+    cpu->nmi = 0;
+}
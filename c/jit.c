@@ -0,0 +1,1204 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes.h"
+
+#ifdef NES_JIT
+#include <sys/mman.h>
+
+/* x86-64 translation of hot blocks.
+    *
+    * A block that has been entered JIT_HOT times is compiled once into the code buffer, and from then on the
+    * dispatcher runs the native code instead of its decoded ops. While native code runs the 6502 registers live in
+    * host registers: A/X/Y in r12d/r13d/r14d, the clock in r15, the CPU in rbx and a JitFrame in rdi. P is split the
+    * way the lazy-flag build splits it (carry 0/1 in r8d, the last Z and N results in r9d/r10d, V as bit 6 in r11d);
+    * I, D and the unused bits stay in registers.p. rsi counts instructions and rax/rcx/rdx/rbp are scratch.
+    *
+    * Native code never calls back into C. Loads and stores go through the bus page tables inline, and an access whose
+    * page has no pointer (I/O registers, mapper writes, pages guarded for decoded code) leaves native code before
+    * that instruction has changed anything, so the interpreter runs it (a fallback). Every instruction is followed
+    * by the slice target check, and irq/nmi cannot change without a C call, so interrupts are taken at exactly the
+    * instructions the interpreter would take them at. Taken branches and jumps to constant targets chain straight
+    * into the target's native code when the slot still holds that block. Idle-loop bookkeeping is done inline; a
+    * loop that comes round clean with the same registers leaves native code so idleLoop can fast-forward it.
+    *
+    * Translations are invalidated with their block: dropBlock clears `native`, so self-modifying writes and bank
+    * switches need nothing else. A full code buffer is simply thrown away and blocks heat up again.
+    *
+*/
+
+#define JIT_HOT 16
+#define JIT_CODE_SIZE (1 << 20)
+#define JIT_MAX_EXITS 256
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* Group 1 ALU operations: the /digit of the immediate forms, and the register forms are (digit << 3) | 1 */
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+enum { SHIFT_SHL = 4, SHIFT_SHR = 5 };
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5 };
+
+enum JitExit {
+    JIT_EXIT_WATCH = JIT_EXIT_FALLBACK + 1
+};
+
+#define REG_A R12
+#define REG_X R13
+#define REG_Y R14
+#define REG_CYCLES R15
+#define REG_CARRY R8
+#define REG_ZERO R9
+#define REG_NEGATIVE R10
+#define REG_OVERFLOW R11
+#define REG_EXECUTED RSI
+
+/* What native code reads on entry and writes back on exit */
+typedef struct jit_frame {
+    uint64_t cycles;
+    uint64_t target;
+    uint64_t executed;
+    uint32_t acc;
+    uint32_t x;
+    uint32_t y;
+    uint32_t carry;
+    uint32_t zeroResult;
+    uint32_t negativeResult;
+    uint32_t overflow;
+} JitFrame;
+
+typedef int (*JitEntry)(CPU* cpu, JitFrame* frame, const void* code);
+
+/* The machine state a check compares, taken before native code runs and replayed from */
+typedef struct jit_snapshot {
+    regs registers;
+    uint8_t p;
+    uint64_t cycles;
+    uint64_t skipCycles;
+    IdleLoop idle;
+    uint8_t ram[0x800];
+    uint8_t prgRam[PRG_RAM_SIZE];
+} JitSnapshot;
+
+struct jit {
+    uint8_t* code;
+    size_t used;
+    size_t stubs;
+    size_t exitStub;
+    JitEntry enter;
+    int check;
+    JitStats stats;
+    JitSnapshot before;
+    JitSnapshot after;
+};
+
+typedef struct jit_exit_site {
+    size_t at;
+    uint16_t pc;
+    uint8_t code;
+    uint8_t executed;
+} JitExitSite;
+
+typedef struct emitter {
+    uint8_t* code;
+    size_t used;
+    size_t size;
+    int full;
+    int done;
+    int checked;
+    size_t start;
+    uint16_t pc;
+    size_t exitStub;
+    JitExitSite exits[JIT_MAX_EXITS];
+    int exitCount;
+} Emitter;
+
+#define OFF(member) ((int32_t) offsetof(CPU, member))
+#define FRAME(member) ((int32_t) offsetof(JitFrame, member))
+
+static void byte(Emitter* e, uint8_t value) {
+    if (e->used < e->size) {
+        e->code[e->used++] = value;
+    } else {
+        e->full = 1;
+    }
+}
+
+static void imm16(Emitter* e, uint16_t value) {
+    byte(e, value);
+    byte(e, value >> 8);
+}
+
+static void imm32(Emitter* e, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        byte(e, value >> (i * 8));
+    }
+}
+
+static void imm64(Emitter* e, uint64_t value) {
+    imm32(e, (uint32_t) value);
+    imm32(e, (uint32_t)(value >> 32));
+}
+
+static void opcode(Emitter* e, uint16_t op) {
+    if (op > 0xFF) {
+        byte(e, op >> 8);
+    }
+    byte(e, op);
+}
+
+/* reg, [base + index * scale + disp32]; index < 0 for none. `bytes` marks an 8-bit reg operand (SPL-DIL need REX) */
+static void memOp(Emitter* e, int wide, int bytes, uint16_t op, int reg, int base, int index, int scale, int32_t disp) {
+    uint8_t rex = 0x40 | (wide << 3) | ((reg & 8) >> 1) | (index >= 0 ? (index & 8) >> 2 : 0) | ((base & 8) >> 3);
+    if (rex != 0x40 || (bytes && reg >= 4 && reg < 8)) {
+        byte(e, rex);
+    }
+    opcode(e, op);
+    if (index < 0 && (base & 7) != RSP) {
+        byte(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+    } else {
+        byte(e, 0x84 | ((reg & 7) << 3));
+        int shift = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+        byte(e, (shift << 6) | (((index < 0 ? RSP : index) & 7) << 3) | (base & 7));
+    }
+    imm32(e, (uint32_t) disp);
+}
+
+/* reg, rm with both operands registers */
+static void regOp(Emitter* e, int wide, int bytes, uint16_t op, int reg, int rm) {
+    uint8_t rex = 0x40 | (wide << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+    if (rex != 0x40 || (bytes && ((reg >= 4 && reg < 8) || (rm >= 4 && rm < 8)))) {
+        byte(e, rex);
+    }
+    opcode(e, op);
+    byte(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void mov32(Emitter* e, int dst, int src) {
+    regOp(e, 0, 0, 0x89, src, dst);
+}
+
+static void alu32(Emitter* e, int alu, int dst, int src) {
+    regOp(e, 0, 0, (alu << 3) | 1, src, dst);
+}
+
+static void aluImm(Emitter* e, int wide, int alu, int dst, int32_t value) {
+    if (value >= -128 && value <= 127) {
+        regOp(e, wide, 0, 0x83, alu, dst);
+        byte(e, value);
+    } else {
+        regOp(e, wide, 0, 0x81, alu, dst);
+        imm32(e, value);
+    }
+}
+
+static void test32(Emitter* e, int a, int b) {
+    regOp(e, 0, 0, 0x85, b, a);
+}
+
+static void testImm32(Emitter* e, int reg, uint32_t value) {
+    regOp(e, 0, 0, 0xF7, 0, reg);
+    imm32(e, value);
+}
+
+static void shift32(Emitter* e, int shift, int reg, uint8_t count) {
+    regOp(e, 0, 0, 0xC1, shift, reg);
+    byte(e, count);
+}
+
+static void movImm32(Emitter* e, int reg, uint32_t value) {
+    if (reg & 8) {
+        byte(e, 0x41);
+    }
+    byte(e, 0xB8 + (reg & 7));
+    imm32(e, value);
+}
+
+static void movImm64(Emitter* e, int reg, uint64_t value) {
+    byte(e, 0x48 | (reg >> 3));
+    byte(e, 0xB8 + (reg & 7));
+    imm64(e, value);
+}
+
+static void movzx8(Emitter* e, int dst, int src) {
+    regOp(e, 0, 1, 0x0FB6, dst, src);
+}
+
+static void setcc(Emitter* e, int cc, int reg) {
+    regOp(e, 0, 1, 0x0F90 | cc, 0, reg);
+}
+
+static void load8(Emitter* e, int dst, int base, int index, int32_t disp) {
+    memOp(e, 0, 0, 0x0FB6, dst, base, index, 1, disp);
+}
+
+static void store8(Emitter* e, int src, int base, int index, int32_t disp) {
+    memOp(e, 0, 1, 0x88, src, base, index, 1, disp);
+}
+
+static void store8Imm(Emitter* e, int base, int index, int32_t disp, uint8_t value) {
+    memOp(e, 0, 0, 0xC6, 0, base, index, 1, disp);
+    byte(e, value);
+}
+
+static void store16(Emitter* e, int src, int base, int32_t disp) {
+    byte(e, 0x66);
+    memOp(e, 0, 0, 0x89, src, base, -1, 1, disp);
+}
+
+static void store16Imm(Emitter* e, int base, int32_t disp, uint16_t value) {
+    byte(e, 0x66);
+    memOp(e, 0, 0, 0xC7, 0, base, -1, 1, disp);
+    imm16(e, value);
+}
+
+static void load32(Emitter* e, int dst, int base, int32_t disp) {
+    memOp(e, 0, 0, 0x8B, dst, base, -1, 1, disp);
+}
+
+static void store32(Emitter* e, int src, int base, int32_t disp) {
+    memOp(e, 0, 0, 0x89, src, base, -1, 1, disp);
+}
+
+static void load64(Emitter* e, int dst, int base, int index, int scale, int32_t disp) {
+    memOp(e, 1, 0, 0x8B, dst, base, index, scale, disp);
+}
+
+static void store64(Emitter* e, int src, int base, int32_t disp) {
+    memOp(e, 1, 0, 0x89, src, base, -1, 1, disp);
+}
+
+#ifdef NES_IDLE_SKIP
+/* cmp byte [base + disp], reg8; only the idle-loop bookkeeping compares bytes */
+static void cmp8(Emitter* e, int reg, int base, int32_t disp) {
+    memOp(e, 0, 1, 0x38, reg, base, -1, 1, disp);
+}
+
+static void cmp8Imm(Emitter* e, int base, int32_t disp, uint8_t value) {
+    memOp(e, 0, 0, 0x80, ALU_CMP, base, -1, 1, disp);
+    byte(e, value);
+}
+#endif
+
+static void cmp16Imm(Emitter* e, int base, int32_t disp, uint16_t value) {
+    byte(e, 0x66);
+    memOp(e, 0, 0, 0x81, ALU_CMP, base, -1, 1, disp);
+    imm16(e, value);
+}
+
+/* cmp reg64, qword [base + disp] */
+static void cmp64(Emitter* e, int reg, int base, int32_t disp) {
+    memOp(e, 1, 0, 0x3B, reg, base, -1, 1, disp);
+}
+
+static void alu8Imm(Emitter* e, int alu, int base, int32_t disp, uint8_t value) {
+    memOp(e, 0, 0, 0x80, alu, base, -1, 1, disp);
+    byte(e, value);
+}
+
+static void push(Emitter* e, int reg) {
+    if (reg & 8) {
+        byte(e, 0x41);
+    }
+    byte(e, 0x50 + (reg & 7));
+}
+
+static void pop(Emitter* e, int reg) {
+    if (reg & 8) {
+        byte(e, 0x41);
+    }
+    byte(e, 0x58 + (reg & 7));
+}
+
+/* Jumps are emitted with a rel32 to patch later; these return where the rel32 is */
+static size_t jcc(Emitter* e, int cc) {
+    byte(e, 0x0F);
+    byte(e, 0x80 | cc);
+    imm32(e, 0);
+    return e->used - 4;
+}
+
+static size_t jmp(Emitter* e) {
+    byte(e, 0xE9);
+    imm32(e, 0);
+    return e->used - 4;
+}
+
+static void jmpReg(Emitter* e, int reg) {
+    regOp(e, 0, 0, 0xFF, 4, reg);
+}
+
+static void patch(Emitter* e, size_t at, size_t target) {
+    if (!e->full) {
+        int32_t rel = (int32_t)(target - (at + 4));
+        memcpy(e->code + at, &rel, sizeof(rel));
+    }
+}
+
+static void exitAt(Emitter* e, size_t at, uint16_t pc, uint8_t code) {
+    if (e->exitCount == JIT_MAX_EXITS) {
+        e->full = 1;
+        return;
+    }
+    e->exits[e->exitCount++] = (JitExitSite) { at, pc, code, e->done };
+}
+
+/* Leaves native code with PC = pc when the condition holds */
+static void exitIf(Emitter* e, int cc, uint16_t pc, uint8_t code) {
+    exitAt(e, jcc(e, cc), pc, code);
+}
+
+static void exitAlways(Emitter* e, uint16_t pc, uint8_t code) {
+    exitAt(e, jmp(e), pc, code);
+}
+
+static void setZN(Emitter* e, int reg) {
+    mov32(e, REG_ZERO, reg);
+    mov32(e, REG_NEGATIVE, reg);
+}
+
+static void addCycles(Emitter* e, int cycles) {
+    aluImm(e, 1, ALU_ADD, REG_CYCLES, cycles);
+}
+
+/* The instruction is complete: stop at the slice target like NEXT_OP does, unless the block was entered far enough
+    * from the target that it cannot come up before the end
+*/
+static void finishOp(Emitter* e, uint16_t next) {
+    e->done++;
+    if (e->checked) {
+        cmp64(e, REG_CYCLES, RDI, FRAME(target));
+        exitIf(e, CC_AE, next, JIT_EXIT_DONE);
+    }
+}
+
+/* Instructions are counted where native code leaves the block rather than one by one */
+static void countDone(Emitter* e, int done) {
+    if (done) {
+        aluImm(e, 1, ALU_ADD, REG_EXECUTED, done);
+    }
+}
+
+/* Assembles P into EAX the way getStatus does; clobbers EDX */
+static void composeStatus(Emitter* e) {
+    load8(e, RAX, RBX, -1, OFF(registers.p));
+    aluImm(e, 0, ALU_AND, RAX, 0b00111100);
+    alu32(e, ALU_OR, RAX, REG_CARRY);
+    alu32(e, ALU_OR, RAX, REG_OVERFLOW);
+    mov32(e, RDX, REG_NEGATIVE);
+    aluImm(e, 0, ALU_AND, RDX, 0x80);
+    alu32(e, ALU_OR, RAX, RDX);
+    alu32(e, ALU_XOR, RDX, RDX);
+    test32(e, REG_ZERO, REG_ZERO);
+    setcc(e, CC_E, RDX);
+    alu32(e, ALU_ADD, RDX, RDX);
+    alu32(e, ALU_OR, RAX, RDX);
+}
+
+static int indexRegister(enum AddressingMode mode) {
+    return (mode == ABSOLUTE_X || mode == ZERO_PAGE_X || mode == INDIRECT_X) ? REG_X : REG_Y;
+}
+
+/* Effective address into EAX, as decodedAddress computes it. Zero-page pointers are read straight from RAM, which
+    * is never remapped. For (zp),Y the base is left in ECX for the page-cross test.
+*/
+static void emitAddress(Emitter* e, enum AddressingMode mode, uint16_t operand) {
+    switch (mode) {
+        case ZERO_PAGE_X:
+        case ZERO_PAGE_Y:
+            mov32(e, RAX, indexRegister(mode));
+            aluImm(e, 0, ALU_ADD, RAX, operand);
+            aluImm(e, 0, ALU_AND, RAX, 0xFF);
+            break;
+        case ABSOLUTE_X:
+        case ABSOLUTE_Y:
+            mov32(e, RAX, indexRegister(mode));
+            aluImm(e, 0, ALU_ADD, RAX, operand);
+            aluImm(e, 0, ALU_AND, RAX, 0xFFFF);
+            break;
+        case INDIRECT_X:
+            mov32(e, RCX, REG_X);
+            aluImm(e, 0, ALU_ADD, RCX, operand);
+            aluImm(e, 0, ALU_AND, RCX, 0xFF);
+            load8(e, RAX, RBX, RCX, OFF(ram));
+            aluImm(e, 0, ALU_ADD, RCX, 1);
+            aluImm(e, 0, ALU_AND, RCX, 0xFF);
+            load8(e, RDX, RBX, RCX, OFF(ram));
+            shift32(e, SHIFT_SHL, RDX, 8);
+            alu32(e, ALU_OR, RAX, RDX);
+            break;
+        case INDIRECT_Y:
+            load8(e, RCX, RBX, -1, OFF(ram) + operand);
+            load8(e, RDX, RBX, -1, OFF(ram) + ((operand + 1) & 0xFF));
+            shift32(e, SHIFT_SHL, RDX, 8);
+            alu32(e, ALU_OR, RCX, RDX);
+            mov32(e, RAX, RCX);
+            alu32(e, ALU_ADD, RAX, REG_Y);
+            aluImm(e, 0, ALU_AND, RAX, 0xFFFF);
+            break;
+        default:
+            movImm32(e, RAX, operand);
+            break;
+    }
+}
+
+/* Page pointer for the address in EAX into `reg`; a NULL page falls back to the interpreter */
+static void emitPage(Emitter* e, int reg, int write, uint16_t pc) {
+    int32_t pages = write ? OFF(bus.writePages) : OFF(bus.readPages);
+    mov32(e, reg, RAX);
+    shift32(e, SHIFT_SHR, reg, 8);
+    load64(e, reg, RBX, reg, 8, pages);
+    regOp(e, 1, 0, 0x85, reg, reg);
+    exitIf(e, CC_E, pc, JIT_EXIT_FALLBACK);
+}
+
+/* The page-cross cycle of indexed reads: the address and its base differ in bit 8 exactly when they are on
+    * different pages, since the index is at most $FF
+*/
+static void emitPageCycle(Emitter* e, enum AddressingMode mode, uint16_t operand) {
+    if (mode == ABSOLUTE_X || mode == ABSOLUTE_Y) {
+        movImm32(e, RCX, operand);
+    } else if (mode != INDIRECT_Y) {
+        return;
+    }
+    alu32(e, ALU_XOR, RCX, RAX);
+    shift32(e, SHIFT_SHR, RCX, 8);
+    aluImm(e, 0, ALU_AND, RCX, 1);
+    regOp(e, 1, 0, 0x01, RCX, REG_CYCLES);
+}
+
+static int isMemory(enum AddressingMode mode) {
+    return mode != IMPLIED && mode != ACCUMULATOR && mode != IMMEDIATE && mode != RELATIVE && mode != INDIRECT;
+}
+
+static int is(const char* mnemonic, const char* name) {
+    return strcmp(mnemonic, name) == 0;
+}
+
+static int isOneOf(const char* mnemonic, const char* const* names) {
+    for (; *names; names++) {
+        if (is(mnemonic, *names)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static const char* const readOps[] = { "LDA", "LDX", "LDY", "ADC", "SBC", "AND", "ORA", "EOR", "CMP", "CPX", "CPY",
+    "BIT", NULL };
+static const char* const storeOps[] = { "STA", "STX", "STY", NULL };
+static const char* const modifyOps[] = { "ASL", "LSR", "ROL", "ROR", "INC", "DEC", NULL };
+static const char* const impliedOps[] = { "TAX", "TAY", "TXA", "TYA", "TSX", "TXS", "INX", "INY", "DEX", "DEY",
+    "CLC", "SEC", "CLV", "CLD", "SED", "SEI", "NOP", "PHA", "PLA", "PHP", "JSR", "RTS", NULL };
+static const char* const branchOps[] = { "BPL", "BMI", "BVC", "BVS", "BCC", "BCS", "BNE", "BEQ", NULL };
+
+/* Instructions with a translation. Everything that can enable interrupts (CLI, PLP, RTI), BRK, JMP (ind) and the
+    * unofficial read-modify-write combinations stay with the interpreter.
+*/
+static int translatable(uint8_t code) {
+    const Opcode* info = &opcodeTable[code];
+    const char* m = info->mnemonic;
+    if (isOneOf(m, readOps)) {
+        return info->mode == IMMEDIATE || isMemory(info->mode);
+    }
+    if (isOneOf(m, storeOps)) {
+        return isMemory(info->mode);
+    }
+    if (isOneOf(m, modifyOps)) {
+        return info->mode == ACCUMULATOR || isMemory(info->mode);
+    }
+    if (is(m, "JMP")) {
+        return info->mode == ABSOLUTE;
+    }
+    return isOneOf(m, impliedOps) || isOneOf(m, branchOps);
+}
+
+/* A constant operand address on a page with no pointer (an I/O register, a mapper write) would fall back every
+    * time, so the block stops there instead
+*/
+static int directOperand(CPU* cpu, const DecodedOp* op) {
+    const Opcode* info = &opcodeTable[op->index];
+    const char* m = info->mnemonic;
+    if ((info->mode != ZERO_PAGE && info->mode != ABSOLUTE) || is(m, "NOP") || is(m, "JMP") || is(m, "JSR")) {
+        return 1;
+    }
+    int write = isOneOf(m, storeOps) || isOneOf(m, modifyOps);
+    int read = !isOneOf(m, storeOps);
+    return (!write || cpu->bus.writePages[op->operand >> 8]) && (!read || cpu->bus.readPages[op->operand >> 8]);
+}
+
+static int registerNamed(char name) {
+    return name == 'X' ? REG_X : name == 'Y' ? REG_Y : REG_A;
+}
+
+/* The operation of a read instruction on the operand in ECX */
+static void emitRead(Emitter* e, const char* m) {
+    if (m[0] == 'L') {
+        int reg = registerNamed(m[2]);
+        mov32(e, reg, RCX);
+        setZN(e, reg);
+    } else if (is(m, "ADC") || is(m, "SBC")) {
+        if (is(m, "SBC")) {
+            aluImm(e, 0, ALU_XOR, RCX, 0xFF);
+        }
+        mov32(e, RDX, REG_A);
+        alu32(e, ALU_ADD, RDX, RCX);
+        alu32(e, ALU_ADD, RDX, REG_CARRY);
+        mov32(e, REG_CARRY, RDX);
+        shift32(e, SHIFT_SHR, REG_CARRY, 8);
+        mov32(e, REG_OVERFLOW, REG_A);
+        alu32(e, ALU_XOR, REG_OVERFLOW, RDX);
+        alu32(e, ALU_XOR, RCX, RDX);
+        alu32(e, ALU_AND, REG_OVERFLOW, RCX);
+        shift32(e, SHIFT_SHR, REG_OVERFLOW, 1);
+        aluImm(e, 0, ALU_AND, REG_OVERFLOW, 0x40);
+        movzx8(e, REG_A, RDX);
+        setZN(e, REG_A);
+    } else if (is(m, "AND") || is(m, "ORA") || is(m, "EOR")) {
+        alu32(e, is(m, "AND") ? ALU_AND : is(m, "ORA") ? ALU_OR : ALU_XOR, REG_A, RCX);
+        setZN(e, REG_A);
+    } else if (m[0] == 'C') {
+        alu32(e, ALU_XOR, REG_CARRY, REG_CARRY);
+        mov32(e, RDX, registerNamed(m[2] == 'P' ? 'A' : m[2]));
+        alu32(e, ALU_SUB, RDX, RCX);
+        setcc(e, CC_AE, REG_CARRY);
+        aluImm(e, 0, ALU_AND, RDX, 0xFF);
+        setZN(e, RDX);
+    } else {
+        /* BIT */
+        mov32(e, REG_NEGATIVE, RCX);
+        mov32(e, REG_OVERFLOW, RCX);
+        aluImm(e, 0, ALU_AND, REG_OVERFLOW, 0x40);
+        mov32(e, REG_ZERO, REG_A);
+        alu32(e, ALU_AND, REG_ZERO, RCX);
+    }
+}
+
+/* The operation of a read-modify-write instruction on ECX */
+static void emitModify(Emitter* e, const char* m) {
+    if (is(m, "INC") || is(m, "DEC")) {
+        aluImm(e, 0, is(m, "INC") ? ALU_ADD : ALU_SUB, RCX, 1);
+        aluImm(e, 0, ALU_AND, RCX, 0xFF);
+    } else if (is(m, "ASL")) {
+        mov32(e, REG_CARRY, RCX);
+        shift32(e, SHIFT_SHR, REG_CARRY, 7);
+        alu32(e, ALU_ADD, RCX, RCX);
+        aluImm(e, 0, ALU_AND, RCX, 0xFF);
+    } else if (is(m, "LSR")) {
+        mov32(e, REG_CARRY, RCX);
+        aluImm(e, 0, ALU_AND, REG_CARRY, 1);
+        shift32(e, SHIFT_SHR, RCX, 1);
+    } else if (is(m, "ROL")) {
+        mov32(e, RDX, REG_CARRY);
+        mov32(e, REG_CARRY, RCX);
+        shift32(e, SHIFT_SHR, REG_CARRY, 7);
+        alu32(e, ALU_ADD, RCX, RCX);
+        alu32(e, ALU_OR, RCX, RDX);
+        aluImm(e, 0, ALU_AND, RCX, 0xFF);
+    } else {
+        /* ROR */
+        mov32(e, RDX, REG_CARRY);
+        shift32(e, SHIFT_SHL, RDX, 7);
+        mov32(e, REG_CARRY, RCX);
+        aluImm(e, 0, ALU_AND, REG_CARRY, 1);
+        shift32(e, SHIFT_SHR, RCX, 1);
+        alu32(e, ALU_OR, RCX, RDX);
+    }
+    setZN(e, RCX);
+}
+
+/* Pushes the byte in `src` (or `value` when src < 0); clobbers EDX */
+static void emitPush(Emitter* e, int src, uint8_t value) {
+    load8(e, RDX, RBX, -1, OFF(registers.s));
+    if (src >= 0) {
+        store8(e, src, RBX, RDX, OFF(ram) + 0x100);
+    } else {
+        store8Imm(e, RBX, RDX, OFF(ram) + 0x100, value);
+    }
+    aluImm(e, 0, ALU_SUB, RDX, 1);
+    store8(e, RDX, RBX, -1, OFF(registers.s));
+    store8Imm(e, RBX, -1, OFF(idle.clean), 0);
+}
+
+/* Pops a byte into `dst`; clobbers EDX */
+static void emitPop(Emitter* e, int dst) {
+    load8(e, RDX, RBX, -1, OFF(registers.s));
+    aluImm(e, 0, ALU_ADD, RDX, 1);
+    aluImm(e, 0, ALU_AND, RDX, 0xFF);
+    store8(e, RDX, RBX, -1, OFF(registers.s));
+    load8(e, dst, RBX, RDX, OFF(ram) + 0x100);
+}
+
+/* Inline idleLoop for a backward branch or jump to `head`: a repeat visit that would be a fixed point leaves native
+    * code so idleLoop can skip (it also checks interrupts), anything else records the visit the same way
+*/
+static void emitWatch(Emitter* e, uint16_t head, uint16_t next) {
+#ifdef NES_IDLE_SKIP
+    if ((uint16_t)(next - head - 1) >= IDLE_LOOP_BYTES) {
+        return;
+    }
+    size_t record[7];
+    composeStatus(e);
+    cmp8Imm(e, RBX, OFF(idle.clean), 0);
+    record[0] = jcc(e, CC_E);
+    cmp16Imm(e, RBX, OFF(idle.head), head);
+    record[1] = jcc(e, CC_NE);
+    cmp8(e, REG_A, RBX, OFF(idle.acc));
+    record[2] = jcc(e, CC_NE);
+    cmp8(e, REG_X, RBX, OFF(idle.x));
+    record[3] = jcc(e, CC_NE);
+    cmp8(e, REG_Y, RBX, OFF(idle.y));
+    record[4] = jcc(e, CC_NE);
+    load8(e, RCX, RBX, -1, OFF(registers.s));
+    cmp8(e, RCX, RBX, OFF(idle.s));
+    record[5] = jcc(e, CC_NE);
+    cmp8(e, RAX, RBX, OFF(idle.p));
+    record[6] = jcc(e, CC_NE);
+    exitAlways(e, head, JIT_EXIT_WATCH);
+
+    for (int i = 0; i < 7; i++) {
+        patch(e, record[i], e->used);
+    }
+    store16Imm(e, RBX, OFF(idle.head), head);
+    store8Imm(e, RBX, -1, OFF(idle.clean), 1);
+    store8Imm(e, RBX, -1, OFF(idle.polledStatus), 0);
+    store64(e, REG_CYCLES, RBX, OFF(idle.cycles));
+    store8(e, REG_A, RBX, -1, OFF(idle.acc));
+    store8(e, REG_X, RBX, -1, OFF(idle.x));
+    store8(e, REG_Y, RBX, -1, OFF(idle.y));
+    load8(e, RCX, RBX, -1, OFF(registers.s));
+    store8(e, RCX, RBX, -1, OFF(idle.s));
+    store8(e, RAX, RBX, -1, OFF(idle.p));
+#endif
+}
+
+static inline uint32_t slotOf(uint16_t pc, const uint8_t* host) {
+    return ((uint32_t)((uintptr_t) host >> 8) * 0x9E3779B1u + pc) & (BLOCK_CACHE_SIZE - 1);
+}
+
+/* Continues at a constant PC: straight into the native code of the block there if it is still the one its slot
+    * held when this was compiled (same bank mapped), otherwise back to the dispatcher
+*/
+static void emitChain(Emitter* e, CPU* cpu, uint16_t target) {
+    int done = e->done;
+    countDone(e, done);
+    e->done = 0;
+    cmp64(e, REG_CYCLES, RDI, FRAME(target));
+    exitIf(e, CC_AE, target, JIT_EXIT_DONE);
+    if (target == e->pc) {
+        /* A loop on the block being compiled: native code cannot drop the block it runs in (such stores fall back) */
+        patch(e, jmp(e), e->start);
+        e->done = done;
+        return;
+    }
+    const uint8_t* host = cpu->bus.readPages[target >> 8];
+    if (!host) {
+        exitAlways(e, target, JIT_EXIT_DONE);
+        e->done = done;
+        return;
+    }
+    movImm64(e, RDX, (uint64_t)(uintptr_t) &cpu->blocks->blocks[slotOf(target, host)]);
+    load64(e, RAX, RBX, -1, 1, OFF(bus.readPages) + (target >> 8) * 8);
+    cmp64(e, RAX, RDX, (int32_t) offsetof(Block, host));
+    exitIf(e, CC_NE, target, JIT_EXIT_DONE);
+    cmp16Imm(e, RDX, (int32_t) offsetof(Block, pc), target);
+    exitIf(e, CC_NE, target, JIT_EXIT_DONE);
+    load64(e, RAX, RDX, -1, 1, (int32_t) offsetof(Block, native));
+    regOp(e, 1, 0, 0x85, RAX, RAX);
+    exitIf(e, CC_E, target, JIT_EXIT_DONE);
+    jmpReg(e, RAX);
+    e->done = done;
+}
+
+static void emitBranch(Emitter* e, CPU* cpu, const char* m, uint16_t target, uint16_t next) {
+    addCycles(e, 2);
+    e->done++;
+    int set = m[2] == 'S' || m[2] == 'I' || m[2] == 'Q';
+    switch (m[1]) {
+        case 'P':
+        case 'M':
+            testImm32(e, REG_NEGATIVE, 0x80);
+            break;
+        case 'V':
+            test32(e, REG_OVERFLOW, REG_OVERFLOW);
+            break;
+        case 'C':
+            test32(e, REG_CARRY, REG_CARRY);
+            break;
+        default:
+            /* BNE/BEQ: Z is set when the last result was zero */
+            test32(e, REG_ZERO, REG_ZERO);
+            set = !set;
+            break;
+    }
+    size_t notTaken = jcc(e, set ? CC_E : CC_NE);
+    addCycles(e, ((next ^ target) & 0xFF00) ? 2 : 1);
+    emitWatch(e, target, next);
+    emitChain(e, cpu, target);
+    patch(e, notTaken, e->used);
+    emitChain(e, cpu, next);
+}
+
+/* Translates one instruction at `pc`; returns 0 when it ends the block (the rest of the code is unreachable) */
+static int emitOp(Emitter* e, CPU* cpu, const Block* block, const DecodedOp* op, uint16_t pc) {
+    const Opcode* info = &opcodeTable[op->index];
+    const char* m = info->mnemonic;
+    enum AddressingMode mode = info->mode;
+    uint16_t next = op->next;
+
+    if (isOneOf(m, branchOps)) {
+        emitBranch(e, cpu, m, op->operand, next);
+        return 0;
+    }
+    if (is(m, "JMP") || is(m, "JSR")) {
+        if (is(m, "JSR")) {
+            uint16_t ret = next - 1;
+            emitPush(e, -1, ret >> 8);
+            emitPush(e, -1, ret & 0xFF);
+        }
+        addCycles(e, info->cycles);
+        e->done++;
+        if (is(m, "JMP")) {
+            emitWatch(e, op->operand, next);
+        }
+        emitChain(e, cpu, op->operand);
+        return 0;
+    }
+    if (is(m, "RTS")) {
+        emitPop(e, RAX);
+        emitPop(e, RCX);
+        shift32(e, SHIFT_SHL, RCX, 8);
+        alu32(e, ALU_OR, RAX, RCX);
+        aluImm(e, 0, ALU_ADD, RAX, 1);
+        store16(e, RAX, RBX, OFF(registers.pc));
+        addCycles(e, info->cycles);
+        countDone(e, e->done + 1);
+        movImm32(e, RAX, JIT_EXIT_DONE);
+        size_t out = jmp(e);
+        patch(e, out, e->exitStub);
+        return 0;
+    }
+
+    if (isMemory(mode) && !is(m, "NOP")) {
+        int store = isOneOf(m, storeOps);
+        int modify = isOneOf(m, modifyOps);
+        emitAddress(e, mode, op->operand);
+        if (store || modify) {
+            emitPage(e, RBP, 1, pc);
+        }
+        if (!store) {
+            emitPage(e, RDX, 0, pc);
+        }
+        if (info->pageCycle) {
+            emitPageCycle(e, mode, op->operand);
+        }
+        addCycles(e, info->cycles);
+        aluImm(e, 0, ALU_AND, RAX, 0xFF);
+        if (store) {
+            store8(e, registerNamed(m[2]), RBP, RAX, 0);
+        } else {
+            load8(e, RCX, RDX, RAX, 0);
+            if (modify) {
+                emitModify(e, m);
+                store8(e, RCX, RBP, RAX, 0);
+            } else {
+                emitRead(e, m);
+            }
+        }
+        if (store || modify) {
+            store8Imm(e, RBX, -1, OFF(idle.clean), 0);
+        }
+        finishOp(e, next);
+        return 1;
+    }
+
+    if (mode == IMMEDIATE && !is(m, "NOP")) {
+        addCycles(e, info->cycles);
+        movImm32(e, RCX, block->host[op->operand & 0xFF]);
+        emitRead(e, m);
+        finishOp(e, next);
+        return 1;
+    }
+
+    if (mode == ACCUMULATOR) {
+        mov32(e, RCX, REG_A);
+        emitModify(e, m);
+        mov32(e, REG_A, RCX);
+    } else if (is(m, "NOP")) {
+        if (info->pageCycle) {
+            emitAddress(e, mode, op->operand);
+            emitPageCycle(e, mode, op->operand);
+        }
+    } else if (m[0] == 'T') {
+        if (is(m, "TSX")) {
+            load8(e, REG_X, RBX, -1, OFF(registers.s));
+            setZN(e, REG_X);
+        } else if (is(m, "TXS")) {
+            store8(e, REG_X, RBX, -1, OFF(registers.s));
+        } else {
+            int dst = registerNamed(m[2]);
+            mov32(e, dst, registerNamed(m[1]));
+            setZN(e, dst);
+        }
+    } else if (m[0] == 'I' || m[0] == 'D') {
+        int reg = registerNamed(m[2]);
+        aluImm(e, 0, m[0] == 'I' ? ALU_ADD : ALU_SUB, reg, 1);
+        aluImm(e, 0, ALU_AND, reg, 0xFF);
+        setZN(e, reg);
+    } else if (is(m, "CLC")) {
+        alu32(e, ALU_XOR, REG_CARRY, REG_CARRY);
+    } else if (is(m, "SEC")) {
+        movImm32(e, REG_CARRY, 1);
+    } else if (is(m, "CLV")) {
+        alu32(e, ALU_XOR, REG_OVERFLOW, REG_OVERFLOW);
+    } else if (is(m, "CLD")) {
+        alu8Imm(e, ALU_AND, RBX, OFF(registers.p), (uint8_t) ~0b00001000);
+    } else if (is(m, "SED")) {
+        alu8Imm(e, ALU_OR, RBX, OFF(registers.p), 0b00001000);
+    } else if (is(m, "SEI")) {
+        alu8Imm(e, ALU_OR, RBX, OFF(registers.p), 0b00000100);
+    } else if (is(m, "PHA")) {
+        emitPush(e, REG_A, 0);
+    } else if (is(m, "PHP")) {
+        composeStatus(e);
+        aluImm(e, 0, ALU_OR, RAX, STACK_FLAGS);
+        emitPush(e, RAX, 0);
+    } else if (is(m, "PLA")) {
+        emitPop(e, REG_A);
+        setZN(e, REG_A);
+    }
+    addCycles(e, info->cycles);
+    finishOp(e, next);
+    return 1;
+}
+
+/* Emits the exit paths collected while translating: store PC, return the exit code */
+static void emitExits(Emitter* e) {
+    for (int i = 0; i < e->exitCount; i++) {
+        JitExitSite* site = &e->exits[i];
+        patch(e, site->at, e->used);
+        countDone(e, site->executed);
+        store16Imm(e, RBX, OFF(registers.pc), site->pc);
+        movImm32(e, RAX, site->code);
+        patch(e, jmp(e), e->exitStub);
+    }
+}
+
+static const int frameRegisters[] = { REG_A, REG_X, REG_Y, REG_CARRY, REG_ZERO, REG_NEGATIVE, REG_OVERFLOW };
+static const int savedRegisters[] = { RBX, RBP, R12, R13, R14, R15 };
+
+/* entry(cpu, frame, code) saves the callee-saved registers, loads the frame and jumps to the block; every exit
+    * jumps to the shared exit stub with the exit code in EAX
+*/
+static void emitStubs(Jit* jit) {
+    Emitter e = { .code = jit->code, .size = JIT_CODE_SIZE };
+    for (int i = 0; i < 6; i++) {
+        push(&e, savedRegisters[i]);
+    }
+    regOp(&e, 1, 0, 0x89, RDI, RBX);
+    regOp(&e, 1, 0, 0x89, RSI, RDI);
+    load64(&e, REG_CYCLES, RDI, -1, 1, FRAME(cycles));
+    for (int i = 0; i < 7; i++) {
+        load32(&e, frameRegisters[i], RDI, FRAME(acc) + i * 4);
+    }
+    alu32(&e, ALU_XOR, REG_EXECUTED, REG_EXECUTED);
+    jmpReg(&e, RDX);
+
+    jit->exitStub = e.used;
+    store64(&e, REG_CYCLES, RDI, FRAME(cycles));
+    store64(&e, REG_EXECUTED, RDI, FRAME(executed));
+    for (int i = 0; i < 7; i++) {
+        store32(&e, frameRegisters[i], RDI, FRAME(acc) + i * 4);
+    }
+    for (int i = 5; i >= 0; i--) {
+        pop(&e, savedRegisters[i]);
+    }
+    byte(&e, 0xC3);
+    jit->stubs = jit->used = e.used;
+    jit->enter = (JitEntry)(void*) jit->code;
+}
+
+/* Forgets every translation; blocks have to heat up again */
+static void flushNative(Jit* jit, CPU* cpu) {
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        cpu->blocks->blocks[i].native = NULL;
+        cpu->blocks->blocks[i].heat = 0;
+    }
+    jit->used = jit->stubs;
+    jit->stats.flushes++;
+}
+
+/* How many instructions from the start of the block can be translated, and whether the interpreter has to run the
+    * one after them. A single instruction before that does not pay for entering and leaving native code.
+*/
+static int translatedLength(CPU* cpu, const Block* block, int* fallback) {
+    int count = 0;
+    *fallback = 0;
+    for (const DecodedOp* op = block->ops; op->index != BLOCK_END; op++) {
+        if (!translatable(op->index) || !directOperand(cpu, op)) {
+            *fallback = 1;
+            return count < 2 ? 0 : count;
+        }
+        count++;
+    }
+    return count;
+}
+
+static void emitBody(Emitter* e, CPU* cpu, const Block* block, int count, int fallback) {
+    uint16_t pc = block->pc;
+    e->done = 0;
+    for (int i = 0; i < count; i++) {
+        if (!emitOp(e, cpu, block, &block->ops[i], pc)) {
+            return;
+        }
+        pc = block->ops[i].next;
+    }
+    if (fallback) {
+        /* The target check after the previous instruction already passed */
+        exitAlways(e, pc, JIT_EXIT_FALLBACK);
+    } else {
+        /* Cut short at BLOCK_OPS or the end of a page */
+        emitChain(e, cpu, pc);
+    }
+}
+
+/* Blocks of more than one instruction are emitted twice: without the per-instruction target checks, for entries
+    * where even the slowest path through the block ends before the target, and with them
+*/
+static int translate(Jit* jit, CPU* cpu, Block* block) {
+    int fallback;
+    int count = translatedLength(cpu, block, &fallback);
+    if (count == 0) {
+        return 0;
+    }
+    Emitter* e = (Emitter*) malloc(sizeof(Emitter));
+    if (!e) {
+        return 0;
+    }
+    *e = (Emitter) { .code = jit->code, .used = jit->used, .size = JIT_CODE_SIZE, .start = jit->used,
+        .pc = block->pc, .exitStub = jit->exitStub };
+    if (count > 1) {
+        int longest = 0;
+        for (int i = 0; i < count; i++) {
+            const Opcode* info = &opcodeTable[block->ops[i].index];
+            longest += info->cycles + info->pageCycle + (info->mode == RELATIVE ? 2 : 0);
+        }
+        regOp(e, 1, 0, 0x89, REG_CYCLES, RAX);
+        aluImm(e, 1, ALU_ADD, RAX, longest);
+        cmp64(e, RAX, RDI, FRAME(target));
+        size_t checked = jcc(e, CC_AE);
+        emitBody(e, cpu, block, count, fallback);
+        patch(e, checked, e->used);
+    }
+    e->checked = 1;
+    emitBody(e, cpu, block, count, fallback);
+    emitExits(e);
+
+    int full = e->full;
+    size_t used = e->used;
+    free(e);
+    if (full) {
+        return -1;
+    }
+    block->native = jit->code + jit->used;
+    jit->used = used;
+    return 1;
+}
+
+static int compileBlock(Jit* jit, CPU* cpu, Block* block) {
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        return 0;
+    }
+    int result = translate(jit, cpu, block);
+    if (result < 0) {
+        flushNative(jit, cpu);
+        result = translate(jit, cpu, block);
+    }
+    mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+    if (result > 0) {
+        jit->stats.compiled++;
+        return 1;
+    }
+    jit->stats.rejected++;
+    return 0;
+}
+
+static void takeSnapshot(CPU* cpu, JitSnapshot* snapshot) {
+    snapshot->registers = cpu->registers;
+    snapshot->p = getStatus(cpu);
+    snapshot->cycles = cpu->clock.cycles;
+    snapshot->skipCycles = cpu->clock.skipCycles;
+    snapshot->idle = cpu->idle;
+    memcpy(snapshot->ram, cpu->ram, sizeof(cpu->ram));
+    if (cpu->prgRam) {
+        memcpy(snapshot->prgRam, cpu->prgRam, PRG_RAM_SIZE);
+    }
+}
+
+static void restoreSnapshot(CPU* cpu, const JitSnapshot* snapshot) {
+    cpu->registers = snapshot->registers;
+    setStatus(cpu, snapshot->p);
+    cpu->clock.cycles = snapshot->cycles;
+    cpu->clock.skipCycles = snapshot->skipCycles;
+    cpu->idle = snapshot->idle;
+    memcpy(cpu->ram, snapshot->ram, sizeof(cpu->ram));
+    if (cpu->prgRam) {
+        memcpy(cpu->prgRam, snapshot->prgRam, PRG_RAM_SIZE);
+    }
+}
+
+static int sameIdle(const IdleLoop* a, const IdleLoop* b) {
+    return a->cycles == b->cycles && a->skips == b->skips && a->head == b->head && a->clean == b->clean &&
+        a->polledStatus == b->polledStatus && a->status == b->status && a->acc == b->acc && a->x == b->x &&
+        a->y == b->y && a->s == b->s && a->p == b->p;
+}
+
+/* Differential mode: replays what native code just did with the interpreter from the same starting state and
+    * aborts on the first difference in registers, clock, idle-loop state or memory
+*/
+static void checkNative(Jit* jit, CPU* cpu, uint16_t start, uint64_t executed) {
+    JitSnapshot* native = &jit->after;
+    takeSnapshot(cpu, native);
+    restoreSnapshot(cpu, &jit->before);
+    for (uint64_t i = 0; i < executed; i++) {
+        executeInstruction(readByte(cpu, cpu->registers.pc), cpu);
+    }
+    jit->stats.checked++;
+
+    const char* diverged = NULL;
+    if (cpu->registers.acc != native->registers.acc || cpu->registers.x != native->registers.x ||
+        cpu->registers.y != native->registers.y || cpu->registers.s != native->registers.s ||
+        getStatus(cpu) != native->p || cpu->registers.pc != native->registers.pc) {
+        diverged = "registers";
+    } else if (cpu->clock.cycles != native->cycles || cpu->clock.skipCycles != native->skipCycles) {
+        diverged = "clock";
+    } else if (!sameIdle(&cpu->idle, &native->idle)) {
+        diverged = "idle-loop state";
+    } else if (memcmp(cpu->ram, native->ram, sizeof(cpu->ram)) != 0 ||
+        (cpu->prgRam && memcmp(cpu->prgRam, native->prgRam, PRG_RAM_SIZE) != 0)) {
+        diverged = "memory";
+    }
+    if (diverged) {
+        fprintf(stderr, "JIT diverged from the interpreter (%s) in the block at $%04X after %llu instructions\n"
+            "  native:      PC=$%04X A=$%02X X=$%02X Y=$%02X S=$%02X P=$%02X cycles=%llu\n"
+            "  interpreter: PC=$%04X A=$%02X X=$%02X Y=$%02X S=$%02X P=$%02X cycles=%llu\n", diverged, start,
+            (unsigned long long) executed, native->registers.pc, native->registers.acc, native->registers.x,
+            native->registers.y, native->registers.s, native->p, (unsigned long long) native->cycles,
+            cpu->registers.pc, cpu->registers.acc, cpu->registers.x, cpu->registers.y, cpu->registers.s,
+            getStatus(cpu), (unsigned long long) cpu->clock.cycles);
+        abort();
+    }
+}
+
+/* Runs `block` as native code if it has (or now gets) a translation. Returns JIT_EXIT_NONE when it did not, in
+    * which case the caller interprets the block; otherwise JIT_EXIT_DONE, or JIT_EXIT_FALLBACK when the instruction at
+    * PC is left for the interpreter. `executed` is advanced by the instructions run natively.
+*/
+int runNative(CPU* cpu, Block* block, uint64_t* executed) {
+    Jit* jit = cpu->jit;
+    if (!block->native) {
+        if (block->heat > JIT_HOT || ++block->heat < JIT_HOT) {
+            return JIT_EXIT_NONE;
+        }
+        if (!compileBlock(jit, cpu, block)) {
+            block->heat = JIT_HOT + 1;
+            return JIT_EXIT_NONE;
+        }
+    }
+
+    uint16_t start = cpu->registers.pc;
+    if (jit->check) {
+        takeSnapshot(cpu, &jit->before);
+    }
+    uint8_t p = getStatus(cpu);
+    JitFrame frame = {
+        .cycles = cpu->clock.cycles,
+        .target = cpu->clock.target,
+        .acc = cpu->registers.acc,
+        .x = cpu->registers.x,
+        .y = cpu->registers.y,
+        .carry = p & 0b00000001,
+        .zeroResult = !(p & 0b00000010),
+        .negativeResult = p & 0b10000000,
+        .overflow = p & 0b01000000,
+    };
+    int exit = jit->enter(cpu, &frame, block->native);
+    cpu->clock.cycles = frame.cycles;
+    cpu->registers.acc = frame.acc;
+    cpu->registers.x = frame.x;
+    cpu->registers.y = frame.y;
+    setStatus(cpu, (cpu->registers.p & 0b00111100) | frame.carry | (frame.zeroResult ? 0 : 0b00000010) |
+        frame.overflow | (frame.negativeResult & 0b10000000));
+    if (exit == JIT_EXIT_WATCH) {
+        idleLoop(cpu, cpu->registers.pc);
+        exit = JIT_EXIT_DONE;
+    }
+    if (jit->check) {
+        checkNative(jit, cpu, start, frame.executed);
+    }
+
+    *executed += frame.executed;
+    jit->stats.entries++;
+    jit->stats.instructions += frame.executed;
+    jit->stats.fallbacks += exit == JIT_EXIT_FALLBACK;
+    return exit;
+}
+
+/* Gives `cpu` a translator; with `check` set every native run is replayed by the interpreter and compared */
+int enableJit(CPU* cpu, int check) {
+    if (cpu->jit) {
+        cpu->jit->check = check;
+        return 0;
+    }
+    Jit* jit = (Jit*) calloc(1, sizeof(Jit));
+    if (!jit) {
+        return -1;
+    }
+    jit->code = (uint8_t*) mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return -1;
+    }
+    emitStubs(jit);
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        munmap(jit->code, JIT_CODE_SIZE);
+        free(jit);
+        return -1;
+    }
+    jit->check = check;
+    cpu->jit = jit;
+    return 0;
+}
+
+void destroyJit(Jit* jit) {
+    if (!jit) {
+        return;
+    }
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+int getJitStats(const CPU* cpu, JitStats* stats) {
+    if (!cpu->jit) {
+        return -1;
+    }
+    *stats = cpu->jit->stats;
+    return 0;
+}
+
+#else
+
+/* Hosts other than x86-64 Linux (or builds without the block cache) interpret everything */
+int enableJit(CPU* cpu, int check) {
+    return -1;
+}
+
+void destroyJit(Jit* jit) {
+}
+
+int getJitStats(const CPU* cpu, JitStats* stats) {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,731 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NES_X86_LANES 1
+#endif
+
+/* Lockstep machines: up to LANES independent machines whose CPUs run as one.
+    *
+    * The register file is stored lane-wise, one byte per lane, so the 16 accumulators (or X, Y, S and the split flags)
+    * are one 128-bit vector and ADC/AND/CMP/shifts/the flag updates are single vector operations across every lane;
+    * PCs, effective addresses and the cycles run in the current slice are vectors too. GCC vector extensions lower
+    * all of it to SSE2 or, where the CPU has it, AVX2 on x86 and to NEON elsewhere. Each lane still owns a whole machine (RAM, PPU,
+    * mapper, clock), so memory accesses and interrupts stay per lane; a lane's clock is only brought up to date
+    * around I/O handlers, interrupts and the end of the slice.
+    *
+    * Every step picks the lane that has waited longest and runs its next instruction in all lanes that are at the
+    * same PC in the same bank, masking the others out; lanes whose branches went different ways take turns until
+    * they meet again. A lane that keeps running on its own has diverged for good and finishes the slice on the scalar
+    * core (runUntil). Instructions without a vector form (interrupt and status-stack instructions, unofficial opcodes,
+    * JMP indirect) run through executeInstruction lane by lane.
+    *
+    * Lanes produce exactly the state the scalar core would, except that idle loops are run rather than skipped.
+    *
+*/
+
+typedef uint8_t LaneBytes __attribute__((vector_size(LANES)));
+typedef int8_t LaneMask __attribute__((vector_size(LANES)));
+typedef uint16_t LaneWords __attribute__((vector_size(LANES * 2)));
+typedef int16_t LaneWordMask __attribute__((vector_size(LANES * 2)));
+typedef uint32_t LaneLongs __attribute__((vector_size(LANES * 4)));
+
+/* Consecutive steps a lane may run alone before it is handed to the scalar core for the rest of the slice. The count
+    * carries over between slices, so a lane that is still on its own in the next one leaves again after one step.
+*/
+#define LANE_ALONE_LIMIT 32
+
+/* Longest slice, in cycles, so the per-lane cycle counts fit 32 bits; longer ones just take more than one call */
+#define LANE_SLICE_CYCLES (1u << 30)
+
+enum LaneOp {
+    LANE_SCALAR,
+    LANE_LDA, LANE_LDX, LANE_LDY, LANE_STA, LANE_STX, LANE_STY,
+    LANE_ADC, LANE_SBC, LANE_AND, LANE_ORA, LANE_EOR, LANE_CMP, LANE_CPX, LANE_CPY, LANE_BIT,
+    LANE_INC, LANE_DEC, LANE_ASL, LANE_LSR, LANE_ROL, LANE_ROR,
+    LANE_INX, LANE_INY, LANE_DEX, LANE_DEY, LANE_TAX, LANE_TAY, LANE_TXA, LANE_TYA, LANE_TSX, LANE_TXS,
+    LANE_CLC, LANE_SEC, LANE_CLV, LANE_CLD, LANE_SED, LANE_SEI, LANE_NOP,
+    LANE_BPL, LANE_BMI, LANE_BVC, LANE_BVS, LANE_BCC, LANE_BCS, LANE_BNE, LANE_BEQ,
+    LANE_JMP, LANE_JSR, LANE_RTS, LANE_PHA, LANE_PLA
+};
+
+static const char* const laneMnemonics[] = {
+    [LANE_LDA] = "LDA", [LANE_LDX] = "LDX", [LANE_LDY] = "LDY", [LANE_STA] = "STA", [LANE_STX] = "STX",
+    [LANE_STY] = "STY", [LANE_ADC] = "ADC", [LANE_SBC] = "SBC", [LANE_AND] = "AND", [LANE_ORA] = "ORA",
+    [LANE_EOR] = "EOR", [LANE_CMP] = "CMP", [LANE_CPX] = "CPX", [LANE_CPY] = "CPY", [LANE_BIT] = "BIT",
+    [LANE_INC] = "INC", [LANE_DEC] = "DEC", [LANE_ASL] = "ASL", [LANE_LSR] = "LSR", [LANE_ROL] = "ROL",
+    [LANE_ROR] = "ROR", [LANE_INX] = "INX", [LANE_INY] = "INY", [LANE_DEX] = "DEX", [LANE_DEY] = "DEY",
+    [LANE_TAX] = "TAX", [LANE_TAY] = "TAY", [LANE_TXA] = "TXA", [LANE_TYA] = "TYA", [LANE_TSX] = "TSX",
+    [LANE_TXS] = "TXS", [LANE_CLC] = "CLC", [LANE_SEC] = "SEC", [LANE_CLV] = "CLV", [LANE_CLD] = "CLD",
+    [LANE_SED] = "SED", [LANE_SEI] = "SEI", [LANE_NOP] = "NOP", [LANE_BPL] = "BPL", [LANE_BMI] = "BMI",
+    [LANE_BVC] = "BVC", [LANE_BVS] = "BVS", [LANE_BCC] = "BCC", [LANE_BCS] = "BCS", [LANE_BNE] = "BNE",
+    [LANE_BEQ] = "BEQ", [LANE_JMP] = "JMP", [LANE_JSR] = "JSR", [LANE_RTS] = "RTS", [LANE_PHA] = "PHA",
+    [LANE_PLA] = "PLA",
+};
+
+static uint8_t laneOps[256];
+static pthread_once_t laneOpsOnce = PTHREAD_ONCE_INIT;
+
+/* Opcodes are matched to vector forms by mnemonic (the unofficial duplicates share the official handlers); only
+    * JMP indirect is left to the scalar handler
+*/
+static void buildLaneOps(void) {
+    for (int code = 0; code < 256; code++) {
+        const Opcode* info = &opcodeTable[code];
+        for (int op = LANE_LDA; op <= LANE_PLA; op++) {
+            if (strcmp(info->mnemonic, laneMnemonics[op]) == 0) {
+                laneOps[code] = op;
+            }
+        }
+        if (info->mode == INDIRECT) {
+            laneOps[code] = LANE_SCALAR;
+        }
+    }
+}
+
+struct lane_group {
+    LaneBytes acc;
+    LaneBytes x;
+    LaneBytes y;
+    LaneBytes s;
+    /* I, D and the unused bits; the rest of P is split as in the lazy-flag build */
+    LaneBytes p;
+    LaneBytes carry;
+    LaneBytes zeroResult;
+    LaneBytes negativeResult;
+    LaneBytes overflow;
+    LaneWords pc;
+    /* Cycles run since base was taken from the lane's clock, and how many it may run before reaching its target */
+    LaneLongs elapsed;
+    LaneLongs limit;
+    /* Instructions each lane ran in lockstep this slice */
+    LaneLongs executed;
+    uint64_t base[LANES];
+    CPU* cpus[LANES];
+    int count;
+    /* Lanes with NMI pending and with the IRQ line low */
+    uint32_t nmis;
+    uint32_t irqs;
+    /* Lanes known to map the same memory as each other at pages mappedFirst and mappedLast; cleared whenever a lane
+        * goes through anything that can switch banks
+    */
+    uint32_t mapped;
+    uint8_t mappedFirst;
+    uint8_t mappedLast;
+    /* Lanes passed over since they last ran, lanes that last ran alone */
+    uint32_t waiting;
+    uint32_t lonely;
+    uint32_t waits[LANES];
+    uint32_t alone[LANES];
+    void (*run)(LaneGroup* group, uint32_t lanes, uint64_t cycle);
+    LaneStats stats;
+};
+
+#define FOR_EACH_LANE(lane, lanes) \
+    for (uint32_t remaining_ = (lanes), lane; remaining_ && ((lane = __builtin_ctz(remaining_)), 1); \
+        remaining_ &= remaining_ - 1)
+
+/* One bit per lane whose byte in `mask` has its top bit set */
+static inline uint32_t laneBits(LaneMask mask) {
+#ifdef __SSE2__
+    return (uint16_t) _mm_movemask_epi8((__m128i) mask);
+#else
+    uint32_t bits = 0;
+    for (int lane = 0; lane < LANES; lane++) {
+        bits |= (uint32_t)(mask[lane] < 0) << lane;
+    }
+    return bits;
+#endif
+}
+
+/* 0xFF in every lane of `lanes`, 0 elsewhere */
+static inline LaneBytes laneMask(uint32_t lanes) {
+    static const LaneWords bits = { 1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7,
+        1 << 8, 1 << 9, 1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, 1 << 15 };
+    return (LaneBytes) __builtin_convertvector((bits & (uint16_t) lanes) != 0, LaneMask);
+}
+
+/* The lane's cycle count goes back to its clock before anything that reads or moves the clock, and is rebased on
+    * it afterwards (handlers can run cycles, as OAM DMA does, schedule events and raise interrupt lines)
+*/
+static inline void leaveLane(LaneGroup* group, int lane) {
+    group->cpus[lane]->clock.cycles = group->base[lane] + group->elapsed[lane];
+}
+
+static inline void enterLane(LaneGroup* group, int lane) {
+    CPU* cpu = group->cpus[lane];
+    uint64_t cycles = cpu->clock.cycles;
+    uint64_t span = cpu->clock.target > cycles ? cpu->clock.target - cycles : 0;
+    group->base[lane] = cycles;
+    group->elapsed[lane] = 0;
+    group->limit[lane] = span < LANE_SLICE_CYCLES ? span : LANE_SLICE_CYCLES;
+    group->nmis = (group->nmis & ~(1u << lane)) | (uint32_t)(cpu->nmi != 0) << lane;
+    group->irqs = (group->irqs & ~(1u << lane)) | (uint32_t)(cpu->irq != 0) << lane;
+    group->mapped = 0;
+}
+
+static void loadLane(LaneGroup* group, int lane) {
+    CPU* cpu = group->cpus[lane];
+    uint8_t p = getStatus(cpu);
+    group->acc[lane] = cpu->registers.acc;
+    group->x[lane] = cpu->registers.x;
+    group->y[lane] = cpu->registers.y;
+    group->s[lane] = cpu->registers.s;
+    group->p[lane] = p & 0b00111100;
+    group->carry[lane] = p & 0b00000001;
+    group->zeroResult[lane] = !(p & 0b00000010);
+    group->negativeResult[lane] = p & 0b10000000;
+    group->overflow[lane] = (p & 0b01000000) << 1;
+    group->pc[lane] = cpu->registers.pc;
+    enterLane(group, lane);
+}
+
+static void storeLane(LaneGroup* group, int lane) {
+    CPU* cpu = group->cpus[lane];
+    cpu->registers.acc = group->acc[lane];
+    cpu->registers.x = group->x[lane];
+    cpu->registers.y = group->y[lane];
+    cpu->registers.s = group->s[lane];
+    cpu->registers.pc = group->pc[lane];
+    setStatus(cpu, group->p[lane] | (group->carry[lane] & 1) | (group->zeroResult[lane] ? 0 : 0b00000010) |
+        ((group->overflow[lane] & 0x80) >> 1) | (group->negativeResult[lane] & 0x80));
+    leaveLane(group, lane);
+}
+
+/* readByte/writeByte for one lane. Nothing in a lane looks at idle.clean (runUntil clears it on entry), so writes
+    * leave it alone.
+*/
+static inline uint8_t readLane(LaneGroup* group, int lane, uint16_t address) {
+    CPU* cpu = group->cpus[lane];
+    const uint8_t* page = cpu->bus.readPages[address >> 8];
+    if (page) {
+        return page[address & 0xFF];
+    }
+    leaveLane(group, lane);
+    uint8_t value = cpu->bus.readHandlers[address >> 8](cpu, address);
+    enterLane(group, lane);
+    return value;
+}
+
+static inline void writeLane(LaneGroup* group, int lane, uint16_t address, uint8_t value) {
+    CPU* cpu = group->cpus[lane];
+    uint8_t* page = cpu->bus.writePages[address >> 8];
+    if (page) {
+        page[address & 0xFF] = value;
+        return;
+    }
+    leaveLane(group, lane);
+    cpu->bus.writeHandlers[address >> 8](cpu, address, value);
+    enterLane(group, lane);
+}
+
+static inline void pushLane(LaneGroup* group, int lane, uint8_t value) {
+    group->cpus[lane]->ram[0x100 + group->s[lane]] = value;
+    group->s[lane]--;
+}
+
+static inline uint8_t popLane(LaneGroup* group, int lane) {
+    group->s[lane]++;
+    return group->cpus[lane]->ram[0x100 + group->s[lane]];
+}
+
+/* Lanes set in `mask` take `value`, the others keep `old` */
+#define BLEND(old, value) (((value) & mask) | ((old) & ~mask))
+#define SET(reg, value) (group->reg = BLEND(group->reg, (value)))
+#define SET_ZN(value) \
+    do { \
+        LaneBytes result_ = (value); \
+        SET(zeroResult, result_); \
+        SET(negativeResult, result_); \
+    } while (0)
+#define SET_PC(value) (group->pc = ((value) & pcMask) | (group->pc & ~pcMask))
+
+/* Shifts and rotates of `in`; the carry out goes to *carryOut */
+static inline LaneBytes shiftLanes(LaneGroup* group, enum LaneOp op, LaneBytes in, LaneBytes* carryOut) {
+    switch (op) {
+        case LANE_ASL:
+            *carryOut = in >> 7;
+            return in << 1;
+        case LANE_LSR:
+            *carryOut = in & 1;
+            return in >> 1;
+        case LANE_ROL:
+            *carryOut = in >> 7;
+            return (in << 1) | (group->carry & 1);
+        default:
+            *carryOut = in & 1;
+            return (in >> 1) | (group->carry << 7);
+    }
+}
+
+static inline LaneBytes branchTaken(LaneGroup* group, enum LaneOp op) {
+    switch (op) {
+        case LANE_BPL: return (LaneBytes)((group->negativeResult & 0x80) == 0);
+        case LANE_BMI: return (LaneBytes)((group->negativeResult & 0x80) != 0);
+        case LANE_BVC: return (LaneBytes)((group->overflow & 0x80) == 0);
+        case LANE_BVS: return (LaneBytes)((group->overflow & 0x80) != 0);
+        case LANE_BCC: return (LaneBytes)(group->carry == 0);
+        case LANE_BCS: return (LaneBytes)(group->carry != 0);
+        case LANE_BNE: return (LaneBytes)(group->zeroResult != 0);
+        default: return (LaneBytes)(group->zeroResult == 0);
+    }
+}
+
+/* Runs the instruction at `pc` (identical in every lane of `lanes`) in all of them. Each lane resolves its own
+    * effective address and pays its own page-cross cycle, and the operand, the cycles and the access happen in the
+    * same order as in EXECUTE_OPCODE.
+*/
+static inline __attribute__((always_inline)) void executeLanes(LaneGroup* group, uint32_t lanes, int leader,
+    uint16_t pc, uint8_t opcode) {
+    const Opcode* info = &opcodeTable[opcode];
+    enum LaneOp op = laneOps[opcode];
+
+    if (op == LANE_SCALAR) {
+        FOR_EACH_LANE(lane, lanes) {
+            CPU* cpu = group->cpus[lane];
+            storeLane(group, lane);
+            cpu->idle.clean = 0;
+            executeInstruction(opcode, cpu);
+            loadLane(group, lane);
+        }
+        group->stats.fallbacks += __builtin_popcount(lanes);
+        return;
+    }
+
+    uint16_t operand = 0;
+    if (info->length > 1 && info->mode != IMMEDIATE) {
+        operand = readLane(group, leader, pc + 1);
+        if (info->length > 2) {
+            operand |= readLane(group, leader, pc + 2) << 8;
+        }
+    }
+    uint16_t next = pc + info->length;
+    LaneBytes mask = laneMask(lanes);
+    LaneWords pcMask = (LaneWords) __builtin_convertvector((LaneMask) mask, LaneWordMask);
+    LaneBytes cost = (LaneBytes) { 0 } + info->cycles;
+    LaneWords address = (LaneWords) { 0 } + operand;
+    group->executed += __builtin_convertvector(mask & 1, LaneLongs);
+
+    switch (info->mode) {
+        case ZERO_PAGE_X: address = (address + __builtin_convertvector(group->x, LaneWords)) & 0xFF; break;
+        case ZERO_PAGE_Y: address = (address + __builtin_convertvector(group->y, LaneWords)) & 0xFF; break;
+        case ABSOLUTE_X:
+        case ABSOLUTE_Y:
+            address += __builtin_convertvector(info->mode == ABSOLUTE_X ? group->x : group->y, LaneWords);
+            if (info->pageCycle) {
+                cost += (LaneBytes) __builtin_convertvector((address ^ operand) > 0xFF, LaneMask) & 1;
+            }
+            break;
+        case INDIRECT_X:
+            FOR_EACH_LANE(lane, lanes) {
+                const uint8_t* ram = group->cpus[lane]->ram;
+                uint8_t pointer = operand + group->x[lane];
+                address[lane] = ram[pointer] | (ram[(uint8_t)(pointer + 1)] << 8);
+            }
+            break;
+        case INDIRECT_Y:
+            FOR_EACH_LANE(lane, lanes) {
+                const uint8_t* ram = group->cpus[lane]->ram;
+                uint16_t base = ram[operand & 0xFF] | (ram[(uint8_t)(operand + 1)] << 8);
+                address[lane] = base + group->y[lane];
+                cost[lane] += info->pageCycle && ((base ^ address[lane]) & 0xFF00);
+            }
+            break;
+        case RELATIVE: address = (LaneWords) { 0 } + (uint16_t)(next + (int8_t) operand); break;
+        default: break;
+    }
+    group->elapsed += __builtin_convertvector(cost & mask, LaneLongs);
+
+    LaneBytes value = { 0 };
+    if (info->mode == IMMEDIATE) {
+        value += readLane(group, leader, pc + 1);
+    } else if (info->mode != IMPLIED && info->mode != ACCUMULATOR && info->mode != RELATIVE && op != LANE_STA &&
+        op != LANE_STX && op != LANE_STY && op != LANE_NOP && op != LANE_JMP && op != LANE_JSR) {
+        FOR_EACH_LANE(lane, lanes) {
+            value[lane] = readLane(group, lane, address[lane]);
+        }
+    }
+    SET_PC((LaneWords) { 0 } + next);
+
+    switch (op) {
+        case LANE_LDA: SET(acc, value); SET_ZN(value); break;
+        case LANE_LDX: SET(x, value); SET_ZN(value); break;
+        case LANE_LDY: SET(y, value); SET_ZN(value); break;
+        case LANE_STA:
+        case LANE_STX:
+        case LANE_STY: {
+            LaneBytes reg = op == LANE_STA ? group->acc : op == LANE_STX ? group->x : group->y;
+            FOR_EACH_LANE(lane, lanes) {
+                writeLane(group, lane, address[lane], reg[lane]);
+            }
+            break;
+        }
+        case LANE_ADC:
+        case LANE_SBC: {
+            LaneBytes in = op == LANE_SBC ? ~value : value;
+            LaneBytes acc = group->acc;
+            LaneBytes carry = group->carry & 1;
+            LaneBytes sum = acc + in + carry;
+            SET(carry, (LaneBytes)((sum < acc) | ((sum == acc) & (carry != 0))) & 1);
+            SET(overflow, (acc ^ sum) & (in ^ sum));
+            SET(acc, sum);
+            SET_ZN(sum);
+            break;
+        }
+        case LANE_AND: SET(acc, group->acc & value); SET_ZN(group->acc); break;
+        case LANE_ORA: SET(acc, group->acc | value); SET_ZN(group->acc); break;
+        case LANE_EOR: SET(acc, group->acc ^ value); SET_ZN(group->acc); break;
+        case LANE_CMP:
+        case LANE_CPX:
+        case LANE_CPY: {
+            LaneBytes reg = op == LANE_CMP ? group->acc : op == LANE_CPX ? group->x : group->y;
+            SET(carry, (LaneBytes)(reg >= value) & 1);
+            SET_ZN(reg - value);
+            break;
+        }
+        case LANE_BIT:
+            SET(zeroResult, group->acc & value);
+            SET(overflow, value << 1);
+            SET(negativeResult, value);
+            break;
+        case LANE_INC:
+        case LANE_DEC: {
+            LaneBytes result = op == LANE_INC ? value + 1 : value - 1;
+            SET_ZN(result);
+            FOR_EACH_LANE(lane, lanes) {
+                writeLane(group, lane, address[lane], result[lane]);
+            }
+            break;
+        }
+        case LANE_ASL:
+        case LANE_LSR:
+        case LANE_ROL:
+        case LANE_ROR: {
+            LaneBytes carryOut;
+            LaneBytes result = shiftLanes(group, op, info->mode == ACCUMULATOR ? group->acc : value, &carryOut);
+            SET(carry, carryOut);
+            SET_ZN(result);
+            if (info->mode == ACCUMULATOR) {
+                SET(acc, result);
+            } else {
+                FOR_EACH_LANE(lane, lanes) {
+                    writeLane(group, lane, address[lane], result[lane]);
+                }
+            }
+            break;
+        }
+        case LANE_INX: SET(x, group->x + 1); SET_ZN(group->x); break;
+        case LANE_INY: SET(y, group->y + 1); SET_ZN(group->y); break;
+        case LANE_DEX: SET(x, group->x - 1); SET_ZN(group->x); break;
+        case LANE_DEY: SET(y, group->y - 1); SET_ZN(group->y); break;
+        case LANE_TAX: SET(x, group->acc); SET_ZN(group->x); break;
+        case LANE_TAY: SET(y, group->acc); SET_ZN(group->y); break;
+        case LANE_TXA: SET(acc, group->x); SET_ZN(group->acc); break;
+        case LANE_TYA: SET(acc, group->y); SET_ZN(group->acc); break;
+        case LANE_TSX: SET(x, group->s); SET_ZN(group->x); break;
+        case LANE_TXS: SET(s, group->x); break;
+        case LANE_CLC: SET(carry, (LaneBytes) { 0 }); break;
+        case LANE_SEC: SET(carry, (LaneBytes) { 0 } + 1); break;
+        case LANE_CLV: SET(overflow, (LaneBytes) { 0 }); break;
+        case LANE_CLD: SET(p, group->p & ~0b00001000); break;
+        case LANE_SED: SET(p, group->p | 0b00001000); break;
+        case LANE_SEI: SET(p, group->p | 0b00000100); break;
+        case LANE_NOP: break;
+        case LANE_JMP: SET_PC(address); break;
+        case LANE_JSR:
+            FOR_EACH_LANE(lane, lanes) {
+                pushLane(group, lane, (uint8_t)((next - 1) >> 8));
+                pushLane(group, lane, (uint8_t)(next - 1));
+            }
+            SET_PC(address);
+            break;
+        case LANE_RTS:
+            FOR_EACH_LANE(lane, lanes) {
+                uint8_t low = popLane(group, lane);
+                group->pc[lane] = (low | (popLane(group, lane) << 8)) + 1;
+            }
+            break;
+        case LANE_PHA:
+            FOR_EACH_LANE(lane, lanes) {
+                pushLane(group, lane, group->acc[lane]);
+            }
+            break;
+        case LANE_PLA:
+            FOR_EACH_LANE(lane, lanes) {
+                value[lane] = popLane(group, lane);
+            }
+            SET(acc, value);
+            SET_ZN(value);
+            break;
+        default: {
+            /* Branches: the target and its page-cross cycle are the same in every lane */
+            LaneBytes taken = branchTaken(group, op) & mask;
+            uint8_t penalty = ((next ^ address[leader]) & 0xFF00) ? 2 : 1;
+            group->elapsed += __builtin_convertvector(taken & penalty, LaneLongs);
+            pcMask &= (LaneWords) __builtin_convertvector((LaneMask) taken, LaneWordMask);
+            SET_PC(address);
+            break;
+        }
+    }
+}
+
+/* The lanes of `lanes` (all at the leader's PC) that also have the same memory behind every byte of the
+    * instruction; a bank switched differently can hold different code at the same PC
+*/
+static inline uint32_t sameBanks(LaneGroup* group, uint32_t lanes, int leader, uint16_t pc) {
+    uint8_t first = pc >> 8;
+    uint8_t last = (uint16_t)(pc + 2) >> 8;
+    if (!(group->mapped & (1u << leader)) || group->mappedFirst != first || group->mappedLast != last) {
+        const uint8_t* firstPage = group->cpus[leader]->bus.readPages[first];
+        const uint8_t* lastPage = group->cpus[leader]->bus.readPages[last];
+        group->mapped = 1u << leader;
+        group->mappedFirst = first;
+        group->mappedLast = last;
+        if (firstPage && lastPage) {
+            for (int lane = 0; lane < group->count; lane++) {
+                const Bus* bus = &group->cpus[lane]->bus;
+                group->mapped |= (uint32_t)(bus->readPages[first] == firstPage && bus->readPages[last] == lastPage)
+                    << lane;
+            }
+        }
+    }
+    return lanes & group->mapped;
+}
+
+/* runUntil for the lanes in `lanes`: each runs until its own clock reaches `cycle` or its next event. Every lane
+    * goes through the same checks between instructions as the scalar dispatcher (target, then interrupts); a lane
+    * that has passed them is `ready` and runs its instruction in the next step that includes it.
+*/
+static inline __attribute__((always_inline)) void runLanes(LaneGroup* group, uint32_t lanes, uint64_t cycle) {
+    uint32_t running = lanes;
+    uint32_t ready = 0;
+    uint32_t detached = 0;
+    FOR_EACH_LANE(lane, lanes) {
+        CPU* cpu = group->cpus[lane];
+        cpu->clock.target = cycle < cpu->clock.nextEvent ? cycle : cpu->clock.nextEvent;
+        cpu->idle.clean = 0;
+        loadLane(group, lane);
+        group->waits[lane] = 0;
+        group->executed[lane] = 0;
+    }
+    group->waiting = 0;
+
+    while (running) {
+        uint32_t checking = running & ~ready;
+        running &= ~(checking & laneBits(__builtin_convertvector(group->elapsed >= group->limit, LaneMask)));
+        checking &= running;
+        uint32_t masked = laneBits((LaneMask)(group->p << 5));
+        FOR_EACH_LANE(lane, checking & (group->nmis | (group->irqs & ~masked))) {
+            storeLane(group, lane);
+            serviceInterrupts(group->cpus[lane]);
+            loadLane(group, lane);
+        }
+        ready |= checking;
+        if (!ready) {
+            break;
+        }
+
+        int leader = __builtin_ctz(ready);
+        FOR_EACH_LANE(lane, ready & group->waiting) {
+            if (group->waits[lane] > group->waits[leader]) {
+                leader = lane;
+            }
+        }
+        uint16_t pc = group->pc[leader];
+        uint32_t step = ready & laneBits(__builtin_convertvector(group->pc == pc, LaneMask));
+        step = sameBanks(group, step, leader, pc);
+        if (step != ready) {
+            FOR_EACH_LANE(lane, ready & ~step) {
+                group->waits[lane]++;
+            }
+            group->waiting |= ready & ~step;
+        }
+        FOR_EACH_LANE(lane, step & group->waiting) {
+            group->waits[lane] = 0;
+        }
+        group->waiting &= ~step;
+
+        executeLanes(group, step, leader, pc, readLane(group, leader, pc));
+        ready &= ~step;
+        group->stats.steps++;
+
+        if (step != (1u << leader)) {
+            FOR_EACH_LANE(lane, step & group->lonely) {
+                group->alone[lane] = 0;
+            }
+            group->lonely &= ~step;
+        } else if (group->lonely |= step, ++group->alone[leader] > LANE_ALONE_LIMIT) {
+            storeLane(group, leader);
+            group->stats.scalar += runUntil(group->cpus[leader], cycle);
+            group->stats.detaches++;
+            running &= ~step;
+            detached |= step;
+        }
+    }
+
+    FOR_EACH_LANE(lane, lanes & ~detached) {
+        storeLane(group, lane);
+    }
+    FOR_EACH_LANE(lane, lanes) {
+        group->stats.lockstep += group->executed[lane];
+    }
+}
+
+/* The same loop built for the baseline instruction set and for AVX2, where the 16-bit and 32-bit lane vectors take
+    * one register instead of two or four
+*/
+static void runLanesGeneric(LaneGroup* group, uint32_t lanes, uint64_t cycle) {
+    runLanes(group, lanes, cycle);
+}
+
+#ifdef NES_X86_LANES
+__attribute__((target("avx2")))
+static void runLanesAVX2(LaneGroup* group, uint32_t lanes, uint64_t cycle) {
+    runLanes(group, lanes, cycle);
+}
+#endif
+
+/* The machines keep their own state between frames; a group only borrows their CPUs while it runs them */
+LaneGroup* createLaneGroup(CPU* const* cpus, int count) {
+    if (count < 1 || count > LANES) {
+        return NULL;
+    }
+    pthread_once(&laneOpsOnce, buildLaneOps);
+    LaneGroup* group = (LaneGroup*) aligned_alloc(64, (sizeof(LaneGroup) + 63) / 64 * 64);
+    if (!group) {
+        return NULL;
+    }
+    memset(group, 0, sizeof(*group));
+    memcpy(group->cpus, cpus, count * sizeof(CPU*));
+    group->count = count;
+    group->run = runLanesGeneric;
+#ifdef NES_X86_LANES
+    if (__builtin_cpu_supports("avx2")) {
+        group->run = runLanesAVX2;
+    }
+#endif
+    return group;
+}
+
+void destroyLaneGroup(LaneGroup* group) {
+    free(group);
+}
+
+/* runFrame for every machine in the group; machines that finish their frame first wait for the others */
+void runLaneFrame(LaneGroup* group) {
+    uint64_t frames[LANES];
+    uint32_t pending = (uint32_t)((1ULL << group->count) - 1);
+    for (int lane = 0; lane < group->count; lane++) {
+        frames[lane] = group->cpus[lane]->ppu.frame;
+    }
+    while (pending) {
+        group->run(group, pending, NO_EVENT);
+        FOR_EACH_LANE(lane, pending) {
+            CPU* cpu = group->cpus[lane];
+            runEvents(cpu);
+            if (cpu->ppu.frame != frames[lane]) {
+                pending &= ~(1u << lane);
+            }
+        }
+    }
+}
+
+void getLaneStats(const LaneGroup* group, LaneStats* stats) {
+    *stats = group->stats;
+}
+
+/* Everything but the idle-loop skip counter, which only the scalar core has */
+static int sameMachine(CPU* a, CPU* b) {
+    MachineState* states = (MachineState*) malloc(2 * sizeof(MachineState));
+    if (!states) {
+        return 0;
+    }
+    captureState(a, &states[0]);
+    captureState(b, &states[1]);
+    states[0].skipCycles = states[1].skipCycles = 0;
+    int same = memcmp(&states[0], &states[1], sizeof(MachineState)) == 0;
+    free(states);
+    return same;
+}
+
+/* LANES machines seeded differently, run for `frames` frames as LANES scalar instances one after another and as
+    * one lockstep group, on the same core. Both must end in the same states.
+*/
+int benchmarkLanes(const GameInformation* game, uint64_t frames) {
+    CPU* scalar[LANES] = { 0 };
+    CPU* lockstep[LANES] = { 0 };
+    int result = -1;
+    for (int lane = 0; lane < LANES; lane++) {
+        scalar[lane] = createCPU();
+        lockstep[lane] = createCPU();
+        if (!scalar[lane] || !lockstep[lane]) {
+            goto done;
+        }
+        seedRAM(scalar[lane], lane);
+        seedRAM(lockstep[lane], lane);
+        if (loadROM(scalar[lane], game) != 0 || loadROM(lockstep[lane], game) != 0) {
+            goto done;
+        }
+    }
+
+    uint64_t instructions = 0;
+    uint64_t start = nowNanoseconds();
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        for (int lane = 0; lane < LANES; lane++) {
+            CPU* cpu = scalar[lane];
+            uint64_t current = cpu->ppu.frame;
+            while (cpu->ppu.frame == current) {
+                instructions += runUntil(cpu, NO_EVENT);
+                runEvents(cpu);
+            }
+        }
+    }
+    double scalarSeconds = (nowNanoseconds() - start) / 1e9;
+
+    LaneGroup* group = createLaneGroup(lockstep, LANES);
+    if (!group) {
+        goto done;
+    }
+    start = nowNanoseconds();
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        runLaneFrame(group);
+    }
+    double lockstepSeconds = (nowNanoseconds() - start) / 1e9;
+    LaneStats stats = group->stats;
+    destroyLaneGroup(group);
+
+    int mismatches = 0;
+    for (int lane = 0; lane < LANES; lane++) {
+        if (!sameMachine(scalar[lane], lockstep[lane])) {
+            printf("lane %d MISMATCH\n", lane);
+            mismatches++;
+        }
+    }
+    uint64_t laneInstructions = stats.lockstep + stats.fallbacks + stats.scalar;
+    printf("scalar   %2d instances  %8.1f M instructions/s  %8.1f frames/s\n", LANES,
+        instructions / scalarSeconds / 1e6, LANES * frames / scalarSeconds);
+    printf("lockstep %2d lanes      %8.1f M instructions/s  %8.1f frames/s  %5.2fx scalar\n", LANES,
+        laneInstructions / lockstepSeconds / 1e6, LANES * frames / lockstepSeconds, scalarSeconds / lockstepSeconds);
+    printf("         %.1f lanes/step, %.1f%% vector, %.1f%% scalar fallback, %.1f%% detached (%llu detaches)\n",
+        stats.steps ? (double)(stats.lockstep + stats.fallbacks) / stats.steps : 0.0,
+        laneInstructions ? 100.0 * stats.lockstep / laneInstructions : 0.0,
+        laneInstructions ? 100.0 * stats.fallbacks / laneInstructions : 0.0,
+        laneInstructions ? 100.0 * stats.scalar / laneInstructions : 0.0, (unsigned long long) stats.detaches);
+    result = mismatches == 0 ? 0 : -1;
+
+done:
+    for (int lane = 0; lane < LANES; lane++) {
+        destroyCPU(scalar[lane]);
+        destroyCPU(lockstep[lane]);
+    }
+    return result;
+}
@@ -0,0 +1,512 @@
+// Build: cc -std=gnu11 -O2 -pthread c/*.c -lm -o nes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+/* Opens the image at `path` and loads it into a new machine, saying why on stderr when either fails */
+static int openMachine(const char* path, GameInformation* gameInformation, CPU** cpu) {
+    if (openROM(path, gameInformation) != 0) {
+        fprintf(stderr, "%s is not a readable iNES image\n", path);
+        return -1;
+    }
+    *cpu = createCPU();
+    if (!*cpu || loadROM(*cpu, gameInformation) != 0) {
+        /* Anything but a missing mapper is an allocation failure */
+        if (!findMapper(gameInformation->mapper)) {
+            fprintf(stderr, "%s uses unsupported mapper %d\n", path, gameInformation->mapper);
+        } else {
+            fprintf(stderr, "Out of memory\n");
+        }
+        destroyCPU(*cpu);
+        closeROM(gameInformation);
+        return -1;
+    }
+    return 0;
+}
+
+static void closeMachine(CPU* cpu, GameInformation* gameInformation) {
+    destroyCPU(cpu);
+    closeROM(gameInformation);
+}
+
+/* With `ppuThread` the PPU draws on a second thread (pputhread.c) */
+static int runSingle(const char* path, int ppuThread) {
+    GameInformation gameInformation;
+    CPU* cpu;
+    if (openMachine(path, &gameInformation, &cpu) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (ppuThread && startPpuThread(cpu) != 0) {
+        fprintf(stderr, "Can't start the PPU thread, drawing on this one\n");
+    }
+
+    while (1) {
+        runFrame(cpu);
+    }
+
+    closeMachine(cpu, &gameInformation);
+    return EXIT_SUCCESS;
+}
+
+static int runBatchCommand(int argc, char* argv[argc + 1]) {
+    const char* jobFile = NULL;
+    int threads = 0;
+    uint64_t frames = 600;
+    int jit = 0;
+    int headless = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            jobFile = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit = 1;
+        } else if (strcmp(argv[i], "--jit-check") == 0) {
+            jit = 2;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+        } else {
+            fprintf(stderr, "Unknown batch option %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!jobFile) {
+        fprintf(stderr, "--batch needs a job file\n");
+        return EXIT_FAILURE;
+    }
+    return runBatch(jobFile, threads, frames, jit, headless) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int runBenchSuiteCommand(int argc, char* argv[argc + 1]) {
+    const char* json = NULL;
+    uint64_t frames = 600;
+    uint64_t instructions = 50000000;
+    int counters = 0;
+    const char** roms = (const char**) calloc(argc, sizeof(const char*));
+    int romCount = 0;
+    if (!roms) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--instructions") == 0 && i + 1 < argc) {
+            instructions = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            counters = 1;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Unknown bench option %s\n", argv[i]);
+            free(roms);
+            return EXIT_FAILURE;
+        } else {
+            roms[romCount++] = argv[i];
+        }
+    }
+    int result = runBenchSuite(roms, romCount, frames, instructions, counters, json);
+    free(roms);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int runBenchmark(int (*benchmark)(const GameInformation*, uint64_t), const char* path, uint64_t frames) {
+    GameInformation gameInformation;
+    if (openROM(path, &gameInformation) != 0) {
+        fprintf(stderr, "%s is not a readable iNES image\n", path);
+        return EXIT_FAILURE;
+    }
+    int result = benchmark(&gameInformation, frames);
+    closeROM(&gameInformation);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Plays `frames` frames into a video; files ending in .rgb get raw RGB24, everything else (and "-") Y4M. With
+    * `sound`, the audio goes into that WAV file alongside.
+*/
+static int runRecord(const char* path, const char* output, uint64_t frames, uint32_t decimation, const char* sound) {
+    GameInformation gameInformation;
+    CPU* cpu;
+    if (openMachine(path, &gameInformation, &cpu) != 0) {
+        return EXIT_FAILURE;
+    }
+    size_t length = strlen(output);
+    int format = length > 4 && strcmp(output + length - 4, ".rgb") == 0 ? VIDEO_RGB24 : VIDEO_Y4M;
+    VideoWriter* video = openVideo(output, format, decimation, 1);
+    AudioOutput* audio = sound ? openAudio(sound, 48000, 0) : NULL;
+    if (!video || (sound && !audio)) {
+        fprintf(stderr, "Can't write %s\n", video ? sound : output);
+        if (video) {
+            closeVideo(video);
+        }
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+    cpu->audio = audio;
+
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        runFrame(cpu);
+        submitVideoFrame(video, cpu);
+        if (audio) {
+            submitAudioFrame(audio, cpu);
+        }
+    }
+    VideoStats stats;
+    getVideoStats(video, &stats);
+    int result = closeVideo(video);
+    fprintf(stderr, "%llu frames, %llu kept, %llu dropped, queue depth at most %u%s\n",
+        (unsigned long long) stats.frames, (unsigned long long) stats.submitted, (unsigned long long) stats.dropped,
+        stats.maxDepth, result == 0 ? "" : ", write failed");
+    if (audio) {
+        cpu->audio = NULL;
+        result |= closeAudio(audio);
+    }
+    closeMachine(cpu, &gameInformation);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Plays `frames` frames headless and keeps only the sound: a WAV file, or a WAV stream on stdout ("-") paced by
+    * whoever reads it, for which the rate follows the reader
+*/
+static int runRecordAudio(const char* path, const char* output, uint64_t frames) {
+    GameInformation gameInformation;
+    CPU* cpu;
+    if (openMachine(path, &gameInformation, &cpu) != 0) {
+        return EXIT_FAILURE;
+    }
+    AudioOutput* audio = openAudio(output, 48000, strcmp(output, "-") == 0);
+    if (!audio) {
+        fprintf(stderr, "Can't write %s\n", output);
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+    cpu->headless = 1;
+    cpu->audio = audio;
+
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        runFrame(cpu);
+        submitAudioFrame(audio, cpu);
+    }
+    AudioStats stats;
+    getAudioStats(audio, &stats);
+    cpu->audio = NULL;
+    int result = closeAudio(audio);
+    fprintf(stderr, "%llu samples, %llu dropped, queue depth at most %u, rate %+d ppm%s\n",
+        (unsigned long long) stats.samples, (unsigned long long) stats.dropped, stats.maxDepth, stats.rateAdjust,
+        result == 0 ? "" : ", write failed");
+    closeMachine(cpu, &gameInformation);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Plays `frames` frames with the profiler attached and writes its report, plus collapsed stacks when `stacks` is set.
+    * Needs a -DNES_PROFILE build.
+*/
+static int runProfile(const char* path, const char* report, uint64_t frames, const char* stacks) {
+    GameInformation gameInformation;
+    CPU* cpu;
+    if (openMachine(path, &gameInformation, &cpu) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (startProfiler(cpu, 250) != 0) {
+        fprintf(stderr, "This build has no profiler (build with -DNES_PROFILE, or make nes-profile)\n");
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        runFrame(cpu);
+    }
+    Profiler* profile = stopProfiler(cpu);
+    int result = writeProfile(profile, report, stacks);
+    if (result != 0) {
+        fprintf(stderr, "Can't write the profile\n");
+    }
+    destroyProfiler(profile);
+    closeMachine(cpu, &gameInformation);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Plays `frames` frames tracing every instruction into `output`, or only the last `ring` of them when it is set */
+static int runTrace(const char* path, const char* output, uint64_t frames, uint32_t ring) {
+    GameInformation gameInformation;
+    CPU* cpu;
+    if (openMachine(path, &gameInformation, &cpu) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (startTrace(cpu, output, ring) != 0) {
+        fprintf(stderr, "Can't write %s\n", output);
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        runFrame(cpu);
+    }
+    TraceStats stats;
+    getTraceStats(cpu, &stats);
+    int result = stopTrace(cpu);
+    fprintf(stderr, "%llu instructions traced, %llu kept, writer stalls %llu%s\n", (unsigned long long) stats.records,
+        (unsigned long long)(ring && stats.records > ring ? ring : stats.records), (unsigned long long) stats.stalls,
+        result == 0 ? "" : ", write failed");
+    closeMachine(cpu, &gameInformation);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Plays `frames` frames of a movie (0 for all of it) from frame `from`, which is reached by seeking, and reports how
+    * long the seek took and whether playback stayed in sync with the recording
+*/
+static int runMovie(const char* path, const char* moviePath, uint64_t from, uint64_t frames) {
+    GameInformation gameInformation;
+    CPU* cpu;
+    if (openMachine(path, &gameInformation, &cpu) != 0) {
+        return EXIT_FAILURE;
+    }
+    Movie* movie = playMovie(moviePath, cpu);
+    if (!movie) {
+        fprintf(stderr, "%s is not a movie of %s\n", moviePath, path);
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = nowNanoseconds();
+    if (seekMovie(movie, cpu, from) != 0) {
+        fprintf(stderr, "%s has no frame %llu\n", moviePath, (unsigned long long) from);
+        closeMovie(movie);
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+    uint64_t seeked = nowNanoseconds();
+    MovieStats stats;
+    getMovieStats(movie, &stats);
+    uint64_t replayed = stats.replayed;
+    uint64_t played = 0;
+    while ((!frames || played < frames) && movieFrame(movie, cpu) == 0) {
+        runFrame(cpu);
+        played++;
+    }
+    uint64_t end = nowNanoseconds();
+    getMovieStats(movie, &stats);
+    printf("Seek to frame %llu: %.1f ms, %llu frames replayed from a keyframe\n", (unsigned long long) from,
+        (seeked - start) / 1e6, (unsigned long long) replayed);
+    printf("Played frames %llu-%llu of %llu in %.1f ms\n", (unsigned long long) from,
+        (unsigned long long) stats.frame, (unsigned long long) stats.frames, (end - seeked) / 1e6);
+    if (stats.desyncs) {
+        printf("%llu of %llu keyframes out of sync, first at frame %llu\n", (unsigned long long) stats.desyncs,
+            (unsigned long long) stats.keyframesChecked, (unsigned long long) stats.firstDesync);
+    } else {
+        printf("%llu keyframes checked, all in sync\n", (unsigned long long) stats.keyframesChecked);
+    }
+    closeMovie(movie);
+    closeMachine(cpu, &gameInformation);
+    return stats.desyncs ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Plays `frames` frames and saves the machine into `output`; with `input` the machine starts from that state instead
+    * of power-on. Both print where the machine ended up, so a state saved at frame N and played M more frames can be
+    * checked against a run of N + M frames from power-on.
+*/
+static int runState(const char* path, const char* input, const char* output, uint64_t frames) {
+    GameInformation gameInformation;
+    CPU* cpu;
+    if (openMachine(path, &gameInformation, &cpu) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (input && loadStateFile(cpu, input) != 0) {
+        fprintf(stderr, "%s is not a state this build can load\n", input);
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        runFrame(cpu);
+    }
+    int result = output ? saveStateFile(cpu, output) : 0;
+    if (result != 0) {
+        fprintf(stderr, "Can't write %s\n", output);
+    }
+    printf("Frame %llu, cycle %llu, RAM hash %016llx\n", (unsigned long long) cpu->ppu.frame,
+        (unsigned long long) cpu->clock.cycles, (unsigned long long) hashBytes(cpu->ram, sizeof(cpu->ram)));
+    closeMachine(cpu, &gameInformation);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Plays `frames` frames recording a movie the way a frontend would: the buttons held on each frame come from `input`
+    * ("-" for stdin), one line per frame with both controllers as hex SRIKURNES_BUTTON_* bits ("08 00" holds Start on
+    * the first), and are released once it runs out
+*/
+static int runMovieRecord(const char* path, const char* moviePath, const char* input, uint64_t frames,
+    uint32_t keyframeInterval) {
+    GameInformation gameInformation;
+    CPU* cpu;
+    if (openMachine(path, &gameInformation, &cpu) != 0) {
+        return EXIT_FAILURE;
+    }
+    FILE* buttons = strcmp(input, "-") == 0 ? stdin : fopen(input, "r");
+    if (!buttons) {
+        fprintf(stderr, "Can't read %s\n", input);
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+    Movie* movie = recordMovie(moviePath, cpu, keyframeInterval);
+    if (!movie) {
+        fprintf(stderr, "Can't write %s\n", moviePath);
+        if (buttons != stdin) {
+            fclose(buttons);
+        }
+        closeMachine(cpu, &gameInformation);
+        return EXIT_FAILURE;
+    }
+
+    char line[64];
+    int result = 0;
+    uint64_t frame = 0;
+    while (result == 0 && frame < frames) {
+        unsigned held[2] = { 0, 0 };
+        if (fgets(line, sizeof(line), buttons)) {
+            sscanf(line, "%x %x", &held[0], &held[1]);
+        }
+        cpu->buttons[0] = held[0];
+        cpu->buttons[1] = held[1];
+        result = movieFrame(movie, cpu);
+        runFrame(cpu);
+        frame++;
+    }
+    result |= closeMovie(movie);
+    if (buttons != stdin) {
+        fclose(buttons);
+    }
+    printf("Recorded %llu frames, RAM hash %016llx%s\n", (unsigned long long) frame,
+        (unsigned long long) hashBytes(cpu->ram, sizeof(cpu->ram)), result == 0 ? "" : ", write failed");
+    closeMachine(cpu, &gameInformation);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int runMovieImport(const char* path, const char* fm2, const char* output, uint32_t keyframeInterval) {
+    GameInformation gameInformation;
+    if (openROM(path, &gameInformation) != 0) {
+        fprintf(stderr, "%s is not a readable iNES image\n", path);
+        return EXIT_FAILURE;
+    }
+    int result = importFm2(fm2, output, &gameInformation, keyframeInterval);
+    if (result != 0) {
+        fprintf(stderr, "Can't import %s (binary and Four Score movies aren't supported) into %s\n", fm2, output);
+    }
+    closeROM(&gameInformation);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int runFootprint(const char* path) {
+    GameInformation gameInformation;
+    if (openROM(path, &gameInformation) != 0) {
+        fprintf(stderr, "%s is not a readable iNES image\n", path);
+        return EXIT_FAILURE;
+    }
+    printFootprint(&gameInformation);
+    closeROM(&gameInformation);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[argc + 1]) {
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        return runBatchCommand(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "--bench-suite") == 0) {
+        return runBenchSuiteCommand(argc, argv);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-render") == 0) {
+        return runBenchmark(benchmarkRenderKernels, argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 600);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-tiles") == 0) {
+        return runBenchmark(benchmarkTileCache, argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 600);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-ppu-thread") == 0) {
+        return runBenchmark(benchmarkPpuThread, argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 600);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-headless") == 0) {
+        return runBenchmark(benchmarkHeadless, argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 600);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-lanes") == 0) {
+        return runBenchmark(benchmarkLanes, argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 600);
+    }
+    if (argc >= 4 && argc <= 7 && strcmp(argv[1], "--record") == 0) {
+        return runRecord(argv[2], argv[3], argc >= 5 ? strtoull(argv[4], NULL, 10) : 600, argc >= 6 ? atoi(argv[5]) : 1,
+            argc == 7 ? argv[6] : NULL);
+    }
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--record-audio") == 0) {
+        return runRecordAudio(argv[2], argv[3], argc == 5 ? strtoull(argv[4], NULL, 10) : 600);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-run-ahead") == 0) {
+        return runBenchmark(benchmarkRunAhead, argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 600);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-rewind") == 0) {
+        return runBenchmark(benchmarkRewind, argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 600);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-audio") == 0) {
+        return runBenchmark(benchmarkAudio, argv[2], argc == 4 ? strtoull(argv[3], NULL, 10) : 600);
+    }
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "--profile") == 0) {
+        return runProfile(argv[2], argv[3], argc >= 5 ? strtoull(argv[4], NULL, 10) : 600, argc == 6 ? argv[5] : NULL);
+    }
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "--trace") == 0) {
+        return runTrace(argv[2], argv[3], argc >= 5 ? strtoull(argv[4], NULL, 10) : 600,
+            argc == 6 ? strtoul(argv[5], NULL, 10) : 0);
+    }
+    if (argc == 4 && strcmp(argv[1], "--trace-decode") == 0) {
+        if (decodeTrace(argv[2], argv[3]) != 0) {
+            fprintf(stderr, "Can't decode %s into %s\n", argv[2], argv[3]);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "--movie") == 0) {
+        return runMovie(argv[2], argv[3], argc >= 5 ? strtoull(argv[4], NULL, 10) : 0,
+            argc == 6 ? strtoull(argv[5], NULL, 10) : 0);
+    }
+    if (argc >= 5 && argc <= 7 && strcmp(argv[1], "--movie-record") == 0) {
+        return runMovieRecord(argv[2], argv[3], argv[4], argc >= 6 ? strtoull(argv[5], NULL, 10) : 600,
+            argc == 7 ? strtoul(argv[6], NULL, 10) : 0);
+    }
+    if ((argc == 5 || argc == 6) && strcmp(argv[1], "--movie-import") == 0) {
+        return runMovieImport(argv[2], argv[3], argv[4], argc == 6 ? strtoul(argv[5], NULL, 10) : 0);
+    }
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--save-state") == 0) {
+        return runState(argv[2], NULL, argv[3], argc == 5 ? strtoull(argv[4], NULL, 10) : 600);
+    }
+    if ((argc == 4 || argc == 5 || argc == 6) && strcmp(argv[1], "--load-state") == 0) {
+        return runState(argv[2], argv[3], argc == 6 ? argv[5] : NULL, argc >= 5 ? strtoull(argv[4], NULL, 10) : 0);
+    }
+    if (argc == 3 && strcmp(argv[1], "--footprint") == 0) {
+        return runFootprint(argv[2]);
+    }
+    if (argc == 3 && strcmp(argv[2], "--ppu-thread") == 0) {
+        return runSingle(argv[1], 1);
+    }
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <rom> [--ppu-thread]\n       %s --batch <jobs> [--threads N] [--frames N] [--jit | --jit-check] [--headless]\n"
+            "       %s --bench-suite [--json out.json | -] [--frames N] [--instructions N] [--counters] [rom ...]\n"
+            "       %s --bench-render <rom> [frames]\n       %s --bench-tiles <rom> [frames]\n"
+            "       %s --bench-headless <rom> [frames]\n       %s --bench-ppu-thread <rom> [frames]\n"
+            "       %s --bench-lanes <rom> [frames]\n       %s --bench-audio <rom> [frames]\n"
+            "       %s --bench-run-ahead <rom> [frames]\n       %s --bench-rewind <rom> [frames]\n"
+            "       %s --record <rom> <out.y4m | out.rgb | - | |command> [frames] [every] [audio.wav]\n"
+            "       %s --record-audio <rom> <out.wav | -> [frames]\n"
+            "       %s --profile <rom> <report | -> [frames] [stacks.folded]\n"
+            "       %s --trace <rom> <out.trace> [frames] [last]\n       %s --trace-decode <in.trace> <out.log | ->\n"
+            "       %s --movie <rom> <movie> [from frame] [frames]\n"
+            "       %s --movie-record <rom> <out.movie> <buttons | -> [frames] [keyframe every]\n"
+            "       %s --movie-import <rom> <in.fm2> <out.movie> [keyframe every]\n"
+            "       %s --save-state <rom> <out.state> [frames]\n"
+            "       %s --load-state <rom> <in.state> [frames] [out.state]\n       %s --footprint <rom>\n",
+            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    return runSingle(argv[1], 0);
+}
@@ -0,0 +1,263 @@
+#include <stddef.h>
+
+#include "nes.h"
+
+// https://www.nesdev.org/wiki/Mapper
+/* Bank switching only ever rewrites page pointers: PRG through mapPages on the CPU bus, CHR through the eight 1KB
+    * slots in cpu->chrPages. Bank numbers wrap modulo the number of banks in the image, and negative numbers count
+    * from the last bank.
+    *
+*/
+
+/* Maps `size` bytes of PRG-ROM at `start`; images smaller than one bank are mirrored across it */
+static void mapPrg(CPU* cpu, uint16_t start, uint32_t size, int bank) {
+    const GameInformation* game = cpu->game;
+    int banks = game->prgSize / size;
+    if (banks == 0) {
+        mapPages(cpu, start, start + size - 1, game->prg, game->prgSize, 0);
+        return;
+    }
+    bank = ((bank % banks) + banks) % banks;
+    mapPages(cpu, start, start + size - 1, game->prg + (uint32_t) bank * size, size, 0);
+}
+
+/* Points `count` consecutive 1KB CHR slots starting at `slot` at a bank of that size (CHR-RAM when there's no CHR-ROM) */
+static void mapChr(CPU* cpu, int slot, int count, int bank) {
+    uint8_t* chr = cpu->game->chrSize ? cpu->game->chr : cpu->chrRam;
+    uint32_t chrSize = cpu->game->chrSize ? cpu->game->chrSize : CHR_RAM_SIZE;
+    uint32_t size = count * 0x400;
+    int banks = chrSize / size;
+    /* Images smaller than one bank are mirrored across it */
+    uint32_t slots = banks ? (uint32_t) count : (chrSize >= 0x400 ? chrSize / 0x400 : 1);
+    bank = banks ? ((bank % banks) + banks) % banks : 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t offset = (uint32_t) bank * size + (i % slots) * 0x400;
+        cpu->chrPages[slot + i] = chr + offset;
+        if (cpu->tiles) {
+            mapTiles(cpu, slot + i, offset / 0x400, chr + offset);
+        }
+    }
+}
+
+/* Header mirroring, for boards without mirroring control */
+static void powerFixedMirroring(CPU* cpu) {
+    cpu->mapperState.mirroring = cpu->game->mirroring;
+}
+
+// https://www.nesdev.org/wiki/NROM
+static void syncNROM(CPU* cpu) {
+    mapPrg(cpu, 0x8000, 0x8000, 0);
+    mapChr(cpu, 0, 8, 0);
+}
+
+// https://www.nesdev.org/wiki/MMC1
+/* bank[0] = control, bank[1] = CHR bank 0, bank[2] = CHR bank 1, bank[3] = PRG bank; select is the shift register */
+static void powerMMC1(CPU* cpu) {
+    cpu->mapperState.bank[0] = 0x0C;
+}
+
+static void syncMMC1(CPU* cpu) {
+    MapperState* state = &cpu->mapperState;
+    uint8_t control = state->bank[0];
+
+    static const uint8_t mirroring[4] = { MIRROR_SINGLE_LOW, MIRROR_SINGLE_HIGH, MIRROR_VERTICAL, MIRROR_HORIZONTAL };
+    state->mirroring = mirroring[control & 0x03];
+
+    /* SUROM and friends use CHR bank 0 bit 4 to select the 256KB half of a 512KB PRG-ROM */
+    int outer = cpu->game->prgSize > 0x40000 ? (state->bank[1] & 0x10) : 0;
+    int prg = state->bank[3] & 0x0F;
+    switch ((control >> 2) & 0x03) {
+        case 0:
+        case 1:
+            mapPrg(cpu, 0x8000, 0x8000, (outer | (prg & 0x0E)) >> 1);
+            break;
+        case 2:
+            mapPrg(cpu, 0x8000, 0x4000, outer);
+            mapPrg(cpu, 0xC000, 0x4000, outer | prg);
+            break;
+        case 3:
+            mapPrg(cpu, 0x8000, 0x4000, outer | prg);
+            mapPrg(cpu, 0xC000, 0x4000, outer | 0x0F);
+            break;
+    }
+
+    if (control & 0x10) {
+        mapChr(cpu, 0, 4, state->bank[1]);
+        mapChr(cpu, 4, 4, state->bank[2]);
+    } else {
+        mapChr(cpu, 0, 8, state->bank[1] >> 1);
+    }
+}
+
+/* Registers are loaded serially, one bit per write, and the fifth write picks the register from address bits 13-14 */
+static void writeMMC1(CPU* cpu, uint16_t address, uint8_t value) {
+    MapperState* state = &cpu->mapperState;
+    if (value & 0x80) {
+        state->select = 0;
+        state->shiftCount = 0;
+        state->bank[0] |= 0x0C;
+        syncMMC1(cpu);
+        return;
+    }
+
+    state->select |= (value & 0x01) << state->shiftCount;
+    if (++state->shiftCount == 5) {
+        state->bank[(address >> 13) & 0x03] = state->select;
+        state->select = 0;
+        state->shiftCount = 0;
+        syncMMC1(cpu);
+    }
+}
+
+// https://www.nesdev.org/wiki/UxROM
+static void syncUxROM(CPU* cpu) {
+    mapPrg(cpu, 0x8000, 0x4000, cpu->mapperState.bank[0]);
+    mapPrg(cpu, 0xC000, 0x4000, -1);
+    mapChr(cpu, 0, 8, 0);
+}
+
+static void writeUxROM(CPU* cpu, uint16_t address, uint8_t value) {
+    cpu->mapperState.bank[0] = value;
+    syncUxROM(cpu);
+}
+
+// https://www.nesdev.org/wiki/CNROM
+static void syncCNROM(CPU* cpu) {
+    mapPrg(cpu, 0x8000, 0x8000, 0);
+    mapChr(cpu, 0, 8, cpu->mapperState.bank[0]);
+}
+
+static void writeCNROM(CPU* cpu, uint16_t address, uint8_t value) {
+    cpu->mapperState.bank[0] = value;
+    syncCNROM(cpu);
+}
+
+// https://www.nesdev.org/wiki/MMC3
+/* bank[] = R0-R7, select = bank select register ($8000), prgRamProtect = PRG-RAM protect ($A001). What $A001 holds at
+    * power-on is unknown; it starts out with the RAM on, as games that keep saves in it mostly write it before use, but
+    * not all of them.
+*/
+static void powerMMC3(CPU* cpu) {
+    powerFixedMirroring(cpu);
+    cpu->mapperState.prgRamProtect = 0x80;
+}
+
+static void syncMMC3(CPU* cpu) {
+    MapperState* state = &cpu->mapperState;
+
+    int swapPrg = state->select & 0x40;
+    mapPrg(cpu, swapPrg ? 0xC000 : 0x8000, 0x2000, state->bank[6]);
+    mapPrg(cpu, 0xA000, 0x2000, state->bank[7]);
+    mapPrg(cpu, swapPrg ? 0x8000 : 0xC000, 0x2000, -2);
+    mapPrg(cpu, 0xE000, 0x2000, -1);
+
+    /* The two 2KB banks and the four 1KB banks trade halves of pattern memory when bit 7 is set */
+    int low = (state->select & 0x80) ? 4 : 0;
+    int high = low ^ 4;
+    mapChr(cpu, low + 0, 2, state->bank[0] >> 1);
+    mapChr(cpu, low + 2, 2, state->bank[1] >> 1);
+    for (int i = 0; i < 4; i++) {
+        mapChr(cpu, high + i, 1, state->bank[2 + i]);
+    }
+
+    /* Bit 7 turns PRG-RAM on, bit 6 then denies writes. The MMC6 (submapper 1) lays $A001 out differently and
+        * guards its 1KB in halves, which this doesn't model, so there the RAM just stays on.
+    */
+    if (cpu->game->submapper != 1) {
+        uint8_t protect = state->prgRamProtect;
+        mapPrgRam(cpu, !(protect & 0x80) ? PRG_RAM_OFF : (protect & 0x40) ? PRG_RAM_READ_ONLY : PRG_RAM_READ_WRITE);
+    }
+}
+
+static void writeMMC3(CPU* cpu, uint16_t address, uint8_t value) {
+    MapperState* state = &cpu->mapperState;
+    int odd = address & 0x01;
+    switch (address & 0xE000) {
+        case 0x8000:
+            if (odd) {
+                state->bank[state->select & 0x07] = value;
+            } else {
+                state->select = value;
+            }
+            syncMMC3(cpu);
+            break;
+        case 0xA000:
+            if (odd) {
+                state->prgRamProtect = value;
+                syncMMC3(cpu);
+            } else if (cpu->game->mirroring != MIRROR_FOUR_SCREEN) {
+                state->mirroring = (value & 0x01) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL;
+            }
+            break;
+        case 0xC000:
+            if (odd) {
+                state->irqCounter = 0;
+                state->irqReload = 1;
+            } else {
+                state->irqLatch = value;
+            }
+            scheduleMapperIrq(cpu);
+            break;
+        case 0xE000:
+            state->irqEnabled = odd;
+            if (!odd) {
+                cpu->irq &= ~IRQ_MAPPER;
+            }
+            scheduleMapperIrq(cpu);
+            break;
+    }
+}
+
+/* Clocked by PPU A12 rising once per visible and pre-render scanline while rendering is enabled */
+static void scanlineMMC3(CPU* cpu) {
+    MapperState* state = &cpu->mapperState;
+    if (state->irqCounter == 0 || state->irqReload) {
+        state->irqCounter = state->irqLatch;
+        state->irqReload = 0;
+    } else {
+        state->irqCounter--;
+    }
+    if (state->irqCounter == 0 && state->irqEnabled) {
+        cpu->irq |= IRQ_MAPPER;
+    }
+}
+
+/* Mirrors scanlineMMC3: a reload takes one clock and then latch more to count down */
+static uint32_t irqScanlinesMMC3(CPU* cpu) {
+    MapperState* state = &cpu->mapperState;
+    if (!state->irqEnabled) {
+        return 0;
+    }
+    if (state->irqCounter == 0 || state->irqReload) {
+        return state->irqLatch + 1;
+    }
+    return state->irqCounter;
+}
+
+static const Mapper mappers[] = {
+    { 0, "NROM", powerFixedMirroring, NULL, syncNROM, NULL, NULL },
+    { 1, "MMC1", powerMMC1, writeMMC1, syncMMC1, NULL, NULL },
+    { 2, "UxROM", powerFixedMirroring, writeUxROM, syncUxROM, NULL, NULL },
+    { 3, "CNROM", powerFixedMirroring, writeCNROM, syncCNROM, NULL, NULL },
+    { 4, "MMC3", powerMMC3, writeMMC3, syncMMC3, scanlineMMC3, irqScanlinesMMC3 },
+};
+
+const Mapper* findMapper(uint16_t number) {
+    for (size_t i = 0; i < sizeof(mappers) / sizeof(mappers[0]); i++) {
+        if (mappers[i].number == number) {
+            return &mappers[i];
+        }
+    }
+    return NULL;
+}
+
+/* Bus handler for $8000-$FFFF. Bank and mirroring changes must not reach scanlines the PPU has not rendered yet. */
+void writeMapper(CPU* cpu, uint16_t address, uint8_t value) {
+    PROFILE_ENTER(cpu, PROFILE_MAPPER);
+    ppuCatchUp(cpu);
+    cpu->mapper->write(cpu, address, value);
+    if (cpu->ppuThread) {
+        postMapperWrite(cpu, address, value);
+    }
+    PROFILE_LEAVE(cpu);
+}
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes.h"
+
+/* Input movies.
+    *
+    * Recording and playback both go through movieFrame, called before every runFrame: recording stores cpu->buttons,
+    * playback sets them. Everything else a frame depends on is in the machine, and the machine is deterministic, so the
+    * same buttons from the same state give the same frames. Playback checks that at every keyframe by comparing the
+    * state it reached with the one recorded there, and counts the keyframes that differ.
+    *
+    * A seek restores the nearest keyframe at or before the target and replays the frames after it headless, so it
+    * costs at most keyframeInterval - 1 frames however far into the movie it goes.
+    *
+*/
+
+#define MOVIE_DEFAULT_INTERVAL 600
+
+struct movie {
+    FILE* file;
+    int recording;
+    int failed;
+    uint32_t interval;
+    uint64_t frame;
+    uint64_t frames;
+    uint64_t keyframesChecked;
+    uint64_t desyncs;
+    uint64_t firstDesync;
+    uint64_t replayed;
+    /* The machine's state, and the keyframe read back to compare it with */
+    MachineState* current;
+    MachineState* keyframe;
+};
+
+/* FNV-1a over PRG and CHR-ROM, so a movie isn't played against a different game */
+static uint64_t hashGame(const GameInformation* game) {
+    return hashMore(hashBytes(game->prg, game->prgSize), game->chr, game->chrSize);
+}
+
+/* Where frame `frame` starts: its keyframe if it has one, else its buttons */
+static off_t frameOffset(const Movie* movie, uint64_t frame) {
+    uint64_t keyframes = (frame + movie->interval - 1) / movie->interval;
+    return (off_t)(sizeof(MovieHeader) + frame * 2 + keyframes * sizeof(MachineState));
+}
+
+/* Frames whose buttons are all in a file of `size` bytes */
+static uint64_t countFrames(const Movie* movie, off_t size) {
+    uint64_t frames = 0;
+    off_t position = sizeof(MovieHeader);
+    while (1) {
+        if (frames % movie->interval == 0) {
+            if (size - position < (off_t) sizeof(MachineState)) {
+                return frames;
+            }
+            position += sizeof(MachineState);
+        }
+        uint64_t available = (uint64_t)(size - position) / 2;
+        uint64_t run = movie->interval - frames % movie->interval;
+        if (available < run) {
+            return frames + available;
+        }
+        frames += run;
+        position += run * 2;
+    }
+}
+
+/* The PPU and APU run behind the CPU by however much their last catch-up left, which restoring a state doesn't
+    * reproduce (resetEvents catches them up), so keyframes are taken with both caught up to compare equal. skipCycles
+    * only counts what idle skipping saved, which differs with a PPU thread, so keyframes leave it out.
+*/
+static void captureKeyframe(CPU* cpu, MachineState* state) {
+    ppuCatchUp(cpu);
+    apuCatchUp(cpu);
+    captureState(cpu, state);
+    state->skipCycles = 0;
+}
+
+static Movie* createMovie(FILE* file) {
+    Movie* movie = (Movie*) calloc(1, sizeof(Movie));
+    if (!movie) {
+        return NULL;
+    }
+    movie->current = (MachineState*) malloc(sizeof(MachineState));
+    movie->keyframe = (MachineState*) malloc(sizeof(MachineState));
+    if (!movie->current || !movie->keyframe) {
+        free(movie->current);
+        free(movie->keyframe);
+        free(movie);
+        return NULL;
+    }
+    movie->file = file;
+    return movie;
+}
+
+static void freeMovie(Movie* movie) {
+    free(movie->current);
+    free(movie->keyframe);
+    free(movie);
+}
+
+/* Starts recording from the machine's current state, with a keyframe every `keyframeInterval` frames (0 picks ten
+    * seconds' worth). Returns NULL if the file can't be created.
+*/
+Movie* recordMovie(const char* path, CPU* cpu, uint32_t keyframeInterval) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return NULL;
+    }
+    Movie* movie = createMovie(file);
+    if (!movie) {
+        fclose(file);
+        return NULL;
+    }
+    movie->recording = 1;
+    movie->interval = keyframeInterval ? keyframeInterval : MOVIE_DEFAULT_INTERVAL;
+    MovieHeader header = { MOVIE_MAGIC, MOVIE_VERSION, hashGame(cpu->game), movie->interval, 0 };
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        freeMovie(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+/* Opens a movie recorded from the game the machine has loaded and puts the machine in the state it starts from.
+    * Returns NULL if the file isn't a movie of that game or its first keyframe is from another version of the state.
+*/
+Movie* playMovie(const char* path, CPU* cpu) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    MovieHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != MOVIE_MAGIC ||
+        header.version != MOVIE_VERSION || !header.keyframeInterval || !cpu->game ||
+        header.romHash != hashGame(cpu->game)) {
+        fclose(file);
+        return NULL;
+    }
+    Movie* movie = createMovie(file);
+    if (!movie) {
+        fclose(file);
+        return NULL;
+    }
+    movie->interval = header.keyframeInterval;
+    if (fseeko(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        freeMovie(movie);
+        return NULL;
+    }
+    movie->frames = countFrames(movie, ftello(file));
+    if (seekMovie(movie, cpu, 0) != 0) {
+        fclose(file);
+        freeMovie(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+/* Before every runFrame. Recording stores the buttons held now (and a keyframe when one is due); playback sets them
+    * (and checks the keyframe). Returns -1 once playback is past the last frame or a write failed.
+*/
+int movieFrame(Movie* movie, CPU* cpu) {
+    uint8_t buttons[2];
+    int keyframe = movie->frame % movie->interval == 0;
+    if (movie->recording) {
+        if (keyframe) {
+            captureKeyframe(cpu, movie->current);
+            movie->failed |= fwrite(movie->current, sizeof(MachineState), 1, movie->file) != 1;
+        }
+        memcpy(buttons, cpu->buttons, sizeof(buttons));
+        movie->failed |= fwrite(buttons, sizeof(buttons), 1, movie->file) != 1;
+        movie->frame++;
+        movie->frames = movie->frame;
+        return movie->failed ? -1 : 0;
+    }
+
+    if (movie->frame >= movie->frames) {
+        return -1;
+    }
+    if (keyframe) {
+        if (fread(movie->keyframe, sizeof(MachineState), 1, movie->file) != 1) {
+            return -1;
+        }
+        /* Movies recorded before keyframes dropped skipCycles still have it */
+        movie->keyframe->skipCycles = 0;
+        captureKeyframe(cpu, movie->current);
+        movie->keyframesChecked++;
+        if (memcmp(movie->current, movie->keyframe, sizeof(MachineState)) != 0) {
+            if (!movie->desyncs++) {
+                movie->firstDesync = movie->frame;
+            }
+        }
+    }
+    if (fread(buttons, sizeof(buttons), 1, movie->file) != 1) {
+        return -1;
+    }
+    memcpy(cpu->buttons, buttons, sizeof(buttons));
+    movie->frame++;
+    return 0;
+}
+
+/* Puts the machine where playback is just before frame `frame` (the frame count for the end): restores the nearest
+    * keyframe and replays the frames up to it. All but the last replayed frame are run headless and without sound, so
+    * the picture is that of frame - 1 as usual. Returns -1 when recording or when the frame is out of range.
+*/
+int seekMovie(Movie* movie, CPU* cpu, uint64_t frame) {
+    if (movie->recording || frame > movie->frames) {
+        return -1;
+    }
+    uint64_t keyframe = frame / movie->interval * movie->interval;
+    if (keyframe == movie->frames) {
+        /* The movie ends before that keyframe's frame, so it may not have been written: use the one before */
+        keyframe = keyframe ? keyframe - movie->interval : 0;
+    }
+    if (fseeko(movie->file, frameOffset(movie, keyframe), SEEK_SET) != 0 ||
+        fread(movie->keyframe, sizeof(MachineState), 1, movie->file) != 1 ||
+        restoreState(cpu, movie->keyframe) != 0 ||
+        fseeko(movie->file, frameOffset(movie, keyframe), SEEK_SET) != 0) {
+        return -1;
+    }
+    movie->frame = keyframe;
+
+    uint8_t headless = cpu->headless;
+    AudioOutput* audio = cpu->audio;
+    cpu->headless = 1;
+    cpu->audio = NULL;
+    while (movie->frame < frame) {
+        if (movie->frame + 1 == frame) {
+            cpu->headless = headless;
+            cpu->audio = audio;
+        }
+        if (movieFrame(movie, cpu) != 0) {
+            break;
+        }
+        runFrame(cpu);
+        movie->replayed++;
+    }
+    cpu->headless = headless;
+    cpu->audio = audio;
+    return movie->frame == frame ? 0 : -1;
+}
+
+void getMovieStats(const Movie* movie, MovieStats* stats) {
+    stats->frame = movie->frame;
+    stats->frames = movie->frames;
+    stats->keyframesChecked = movie->keyframesChecked;
+    stats->desyncs = movie->desyncs;
+    stats->firstDesync = movie->firstDesync;
+    stats->replayed = movie->replayed;
+}
+
+/* Returns -1 if any write of a recording failed */
+int closeMovie(Movie* movie) {
+    int failed = movie->failed;
+    failed |= fclose(movie->file) != 0;
+    freeMovie(movie);
+    return failed ? -1 : 0;
+}
+
+// https://fceux.com/web/help/fm2.html
+/* One FM2 gamepad field, "RLDUTSBA" with anything but '.' or ' ' meaning held */
+static uint8_t parseGamepad(const char* field, size_t length) {
+    static const uint8_t bits[8] = {
+        BUTTON_RIGHT, BUTTON_LEFT, BUTTON_DOWN, BUTTON_UP, BUTTON_START, BUTTON_SELECT, BUTTON_B, BUTTON_A,
+    };
+    uint8_t buttons = 0;
+    for (size_t i = 0; i < length && i < 8; i++) {
+        if (field[i] != '.' && field[i] != ' ') {
+            buttons |= bits[i];
+        }
+    }
+    return buttons;
+}
+
+/* Converts an FCEUX text movie of standard gamepads into a movie of `game` from power-on, playing it to build the
+    * keyframes. FM2 reset commands can't be represented and are skipped with a warning; whether the result stays in
+    * sync with the original depends on the two emulators agreeing on power-on state and timing. Returns -1 for binary
+    * or Four Score movies and for files that can't be read or written.
+*/
+int importFm2(const char* fm2, const char* path, const GameInformation* game, uint32_t keyframeInterval) {
+    FILE* in = fopen(fm2, "r");
+    if (!in) {
+        return -1;
+    }
+    CPU* cpu = createCPU();
+    if (!cpu || loadROM(cpu, game) != 0) {
+        destroyCPU(cpu);
+        fclose(in);
+        return -1;
+    }
+    cpu->headless = 1;
+    Movie* movie = recordMovie(path, cpu, keyframeInterval);
+    if (!movie) {
+        destroyCPU(cpu);
+        fclose(in);
+        return -1;
+    }
+
+    char line[512];
+    int result = 0;
+    uint64_t resets = 0;
+    while (result == 0 && fgets(line, sizeof(line), in)) {
+        if (line[0] != '|') {
+            if (strncmp(line, "binary 1", 8) == 0 || strncmp(line, "fourscore 1", 11) == 0) {
+                result = -1;
+            }
+            continue;
+        }
+        /* |commands|port0|port1|port2| */
+        char* fields[4] = { NULL };
+        char* cursor = line + 1;
+        for (int i = 0; i < 4 && cursor; i++) {
+            fields[i] = cursor;
+            cursor = strchr(cursor, '|');
+            if (cursor) {
+                *cursor++ = '\0';
+            }
+        }
+        if (fields[0] && (atoi(fields[0]) & 0x03)) {
+            resets++;
+        }
+        cpu->buttons[0] = fields[1] ? parseGamepad(fields[1], strlen(fields[1])) : 0;
+        cpu->buttons[1] = fields[2] ? parseGamepad(fields[2], strlen(fields[2])) : 0;
+        result = movieFrame(movie, cpu);
+        runFrame(cpu);
+    }
+    if (resets) {
+        fprintf(stderr, "%s: skipped %llu reset commands\n", fm2, (unsigned long long) resets);
+    }
+    result |= ferror(in) ? -1 : 0;
+    result |= closeMovie(movie);
+    fclose(in);
+    destroyCPU(cpu);
+    return result;
+}
@@ -1,747 +1,162 @@
-#include <stddef.h>
-#include <stdlib.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-// https://www.nesdev.org/wiki/Status_flags
-#define SET_CARRY(p, value) ((p) = ((p) & ~0b00000001) | ((value) & 0b00000001))
-#define SET_ZERO(p, value) ((p) = ((p) & ~0b00000010) | ((value) & 0b00000010))
-#define SET_INTERRUPT(p, value) ((p) = ((p) & ~0b00000100) | ((value) & 0b00000100))
-#define SET_DECIMAL(p, value) ((p) = ((p) & ~0b00001000) | ((value) & 0b00001000))
-#define SET_BREAK(p, value) ((p) = ((p) & ~0b00010000) | ((value) & 0b00010000))
-#define SET_OVERFLOW(p, value) ((p) = ((p) & ~0b01000000) | ((value) & 0b01000000))
-#define SET_NEGATIVE(p, value) ((p) = ((p) & ~0b10000000) | ((value) & 0b10000000))
-
-#define GET_CARRY(p) ((p) & 0b00000001)
-#define GET_ZERO(p) ((p) & 0b00000010)
-#define GET_INTERRUPT(p) ((p) & 0b00000100)
-#define GET_DECIMAL(p) ((p) & 0b00001000)
-#define GET_BREAK(p) ((p) & 0b00010000)
-#define GET_OVERFLOW(p) ((p) & 0b01000000)
-#define GET_NEGATIVE(p) ((p) & 0b10000000)
-
-#define PC (cpu->registers.pc)
-
-enum AddressingMode {
-    IMMEDIATE,
-    ABSOLUTE,
-    ABSOLUTE_X,
-    ABSOLUTE_Y,
-    ZERO_PAGE,
-    ZERO_PAGE_X,
-    ZERO_PAGE_Y,
-    INDIRECT_X,
-    INDIRECT_Y
-};
-
-/* Stack */
-#define pushStack(cpu, value) \
-    _Generic((value), \
-        uint8_t: pushStack_u8, \
-        uint16_t: pushStack_u16 \
-    )(cpu, value)
-
-static inline void pushStack_u8(CPU* cpu, uint8_t value) {
-    cpu->memory[0x100 + cpu->registers.s] = value;
-    cpu->registers.s--;
-}
-
-static inline void pushStack_u16(CPU* cpu, uint16_t value) {
-    pushStack_u8(cpu, (value >> 8) & 0xFF);
-    pushStack_u8(cpu, value & 0xFF);
-}
-
-uint8_t popStack(CPU* cpu) {
-    cpu->registers.s++;
-    return cpu->memory[0x100 + cpu->registers.s];
-}
-
-typedef void (*instrFunc)();
-
-// https://www.nesdev.org/wiki/CPU_addressing_modes
-uint8_t readByte(uint16_t address);
-uint16_t readWord(uint16_t address);
-void writeByte(uint16_t address, uint8_t value);
-void writeWord(uint16_t address, uint16_t value);
-uint8_t getImmediate(uint16_t address);
-uint16_t getAbsolute(uint16_t address);
-uint16_t getAbsoluteX(uint16_t address);
-uint16_t getAbsoluteY(uint16_t address);
-uint16_t getZeroPage(uint16_t address);
-uint16_t getZeroPageX(uint16_t address);
-uint16_t getZeroPageY(uint16_t address);
-uint16_t getIndirectX(uint16_t address);
-uint16_t getIndirectY(uint16_t address);
-
-// Instructions: https://www.masswerk.at/6502/6502_instruction_set.html#SLO
-void ADC();
-
-void ADD();
-
-void AND(CPU* cpu, uint8_t value, uint8_t cycles) {
-    cpu->registers.acc &= value;
-    SET_ZERO(cpu->registers.p, cpu->registers.acc);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.acc);
-    cpu->clock->skipCycles += cycles;
-}
-
-void ASL(CPU* cpu, uint8_t value, uint8_t cycles) {
-    SET_CARRY(cpu->registers.p, cpu->registers.acc & 0x80);
-    cpu->registers.acc <<= 1;
-    SET_ZERO(cpu->registers.p, cpu->registers.acc);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.acc);
-    cpu->clock->skipCycles += cycles;
-}
+#include "nes.h"
 
-void BCC(CPU* cpu) {
-    if (!GET_CARRY(cpu->registers.p)) {
-        cpu->registers.pc += getImmediate(cpu->registers.pc);
+/* Everything a machine owns hangs off its CPU, so any number of instances can run side by side on different threads.
+    * The frame buffer comes with the first frame drawn (getGraphics) and the block cache with the first block looked
+    * up, so headless machines and PPU shadows never pay for what they don't use.
+*/
+CPU* createCPU(void) {
+    size_t size = (sizeof(CPU) + 63) & ~(size_t) 63;
+    CPU* cpu = (CPU*) aligned_alloc(64, size);
+    if (!cpu) {
+        return NULL;
     }
-}
-
-void BCS(CPU* cpu) {
-    if (GET_CARRY(cpu->registers.p)) {
-        cpu->registers.pc += getImmediate(cpu->registers.pc);
+    memset(cpu, 0, size);
+#ifndef NES_NO_TILE_CACHE
+    cpu->tiles = (TileCache*) calloc(1, sizeof(TileCache));
+    if (!cpu->tiles) {
+        destroyCPU(cpu);
+        return NULL;
     }
+#endif
+    cpu->renderKernel = findRenderKernel(NULL);
+    initBus(cpu);
+    return cpu;
 }
 
-void BEQ(CPU* cpu) {
-    if (GET_ZERO(cpu->registers.p)) {
-        cpu->registers.pc += getImmediate(cpu->registers.pc);
+void destroyCPU(CPU* cpu) {
+    if (!cpu) {
+        return;
     }
-}
-
-void BIT(CPU* cpu, uint8_t value, uint8_t cycles) {
-    SET_ZERO(cpu->registers.p, cpu->registers.acc & value);
-    SET_OVERFLOW(cpu->registers.p, value & 0x40);
-    SET_NEGATIVE(cpu->registers.p, value & 0x80);
-    cpu->clock->skipCycles += cycles;
-}
-
-void BMI(CPU* cpu) {
-    if (GET_NEGATIVE(cpu->registers.p)) {
-        cpu->registers.pc += getImmediate(cpu->registers.pc);
+    stopPpuThread(cpu);
+    stopTrace(cpu);
+    destroyProfiler(cpu->profile);
+    destroyJit(cpu->jit);
+    free(cpu->blocks);
+    destroyTileCache(cpu->tiles);
+    free(cpu->graphics);
+    free(cpu->prgRam);
+    free(cpu->chrRam);
+    free(cpu);
+}
+
+/* Returns -1 for boards without a mapper implementation, or when the board's RAM can't be allocated.
+    *
+    * The image is only ever read, so every machine running the same ROM can share one GameInformation; each machine
+    * only gets the PRG-RAM and CHR-RAM the header says the board has.
+    *
+*/
+int loadROM(CPU* cpu, const GameInformation* game) {
+    const Mapper* mapper = findMapper(game->mapper);
+    if (!mapper) {
+        return -1;
     }
-}
-
-void BNE(CPU* cpu) {
-    if (!GET_ZERO(cpu->registers.p)) {
-        cpu->registers.pc += getImmediate(cpu->registers.pc);
+    stopPpuThread(cpu);
+    destroyProfiler(cpu->profile);
+    cpu->profile = NULL;
+    flushBlocks(cpu);
+    free(cpu->prgRam);
+    free(cpu->chrRam);
+    cpu->prgRam = game->prgRamSize ? (uint8_t*) calloc(1, PRG_RAM_SIZE) : NULL;
+    cpu->chrRam = game->chrSize ? NULL : (uint8_t*) calloc(1, CHR_RAM_SIZE);
+    initBus(cpu);
+    if ((game->prgRamSize && !cpu->prgRam) || (!game->chrSize && !cpu->chrRam)) {
+        return -1;
     }
-}
-
-void BPL(CPU* cpu) {
-    if (!GET_NEGATIVE(cpu->registers.p)) {
-        cpu->registers.pc += getImmediate(cpu->registers.pc);
+    // https://www.nesdev.org/wiki/INES#Trainer
+    if (game->trainer) {
+        memcpy(cpu->prgRam + 0x1000, game->trainer, TRAINER_SIZE);
+    }
+    cpu->game = game;
+    cpu->mapper = mapper;
+    resetTileCache(cpu);
+    memset(&cpu->mapperState, 0, sizeof(cpu->mapperState));
+    mapper->power(cpu);
+    if (mapper->write) {
+        mapHandlers(cpu, 0x8000, 0xFFFF, NULL, writeMapper);
     }
+    mapper->sync(cpu);
+    resetPPU(cpu);
+    resetCPU(cpu);
+    resetAPU(cpu);
+    resetEvents(cpu);
+    return 0;
 }
 
-/* From: http://www.6502.org/users/obelisk/6502/reference.html
-    * 
-    * BRK - Break
-    * Description: The BRK instruction forces the generation of an interrupt request. 
-    * The program counter and processor status are pushed on the stack then the IRQ interrupt vector at $FFFE/F is loaded into the PC 
-    * and the break flag in the status set to one.
-    *
+/* The machine's frame buffer, allocated blank the first time anybody draws into it or asks for it. NULL only when
+    * there is no memory for it; it then stays where it is until the machine is destroyed (or a recording swaps it).
 */
-void BRK(CPU* cpu) {
-    pushStack(cpu, cpu->registers.pc);
-    pushStack(cpu, cpu->registers.p);
-    cpu->registers.pc = readWord(0xFFFE);
-    SET_BREAK(cpu->registers.p, 1);
-    cpu->clock->skipCycles += 7;
-}
-
-void BVC(CPU* cpu) {
-    if (!GET_OVERFLOW(cpu->registers.p)) {
-        cpu->registers.pc += getImmediate(cpu->registers.pc);
+Graphics* getGraphics(CPU* cpu) {
+    if (!cpu->graphics) {
+        cpu->graphics = (Graphics*) calloc(1, sizeof(Graphics));
     }
-}
-
-void BVS(CPU* cpu) {
-    if (GET_OVERFLOW(cpu->registers.p)) {
-        cpu->registers.pc += getImmediate(cpu->registers.pc);
+    return cpu->graphics;
+}
+
+// https://www.nesdev.org/wiki/CPU_power_up_state
+/* Power-on RAM contents are unspecified, so batch runs pick them from a seed (splitmix64) to stay reproducible */
+void seedRAM(CPU* cpu, uint64_t seed) {
+    for (size_t i = 0; i < sizeof(cpu->ram); i += 8) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        for (int byte = 0; byte < 8; byte++) {
+            cpu->ram[i + byte] = z >> (byte * 8);
+        }
     }
 }
 
-void CLC(CPU* cpu) {
-    SET_CARRY(cpu->registers.p, 0);
-}
-
-void CLD(CPU* cpu) {
-    SET_DECIMAL(cpu->registers.p, 0);
-}
-
-void CLI(CPU* cpu) {
-    SET_INTERRUPT(cpu->registers.p, 0);
-}
-
-void CLV(CPU* cpu) {
-    SET_OVERFLOW(cpu->registers.p, 0);
-}
-
-void CMP(CPU* cpu, uint8_t value, uint8_t cycles) {
-    uint8_t result = cpu->registers.acc - value;
-    SET_CARRY(cpu->registers.p, cpu->registers.acc >= value);
-    SET_ZERO(cpu->registers.p, result == 0);
-    SET_NEGATIVE(cpu->registers.p, result);
-    cpu->clock->skipCycles += cycles;
-}
-
-void CPX(CPU* cpu, uint8_t value, uint8_t cycles) {
-    uint8_t result = cpu->registers.x - value;
-    SET_CARRY(cpu->registers.p, cpu->registers.x >= value);
-    SET_ZERO(cpu->registers.p, result == 0);
-    SET_NEGATIVE(cpu->registers.p, result);
-    cpu->clock->skipCycles += cycles;
-}
-
-void CPY(CPU* cpu, uint8_t value, uint8_t cycles) {
-    uint8_t result = cpu->registers.y - value;
-    SET_CARRY(cpu->registers.p, cpu->registers.y >= value);
-    SET_ZERO(cpu->registers.p, result == 0);
-    SET_NEGATIVE(cpu->registers.p, result);
-    cpu->clock->skipCycles += cycles;
-}
-
-void DEC(CPU* cpu, uint16_t address, uint8_t cycles) {
-    uint8_t value = readByte(address) - 1;
-    writeByte(address, value);
-    SET_ZERO(cpu->registers.p, value == 0);
-    SET_NEGATIVE(cpu->registers.p, value);
-    cpu->clock->skipCycles += cycles;
-}
-
-void DEX(CPU* cpu) {
-    cpu->registers.x--;
-    SET_ZERO(cpu->registers.p, cpu->registers.x == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.x);
-}
-
-void DEY(CPU* cpu) {
-    cpu->registers.y--;
-    SET_ZERO(cpu->registers.p, cpu->registers.y == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.y);
-}
-
-void EOR(CPU* cpu, uint8_t value, uint8_t cycles) {
-    cpu->registers.acc ^= value;
-    SET_ZERO(cpu->registers.p, cpu->registers.acc == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.acc);
-    cpu->clock->skipCycles += cycles;
-}
-
-void INC(CPU* cpu, uint16_t address, uint8_t cycles) {
-    uint8_t value = readByte(address) + 1;
-    writeByte(address, value);
-    SET_ZERO(cpu->registers.p, value == 0);
-    SET_NEGATIVE(cpu->registers.p, value);
-    cpu->clock->skipCycles += cycles;
-}
-
-void INX(CPU* cpu) {
-    cpu->registers.x++;
-    SET_ZERO(cpu->registers.p, cpu->registers.x == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.x);
-}
-
-void INY(CPU* cpu) {
-    cpu->registers.y++;
-    SET_ZERO(cpu->registers.p, cpu->registers.y == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.y);
-}
-
-void JMP(CPU* cpu, uint16_t address) {
-    cpu->registers.pc = address;
-}
-
-void JSR(CPU* cpu, uint16_t address) {
-    pushStack(cpu, (uint16_t)(cpu->registers.pc - 1));
-    cpu->registers.pc = address;
-}
-
-void LDA(CPU* cpu, uint8_t value, uint8_t cycles) {
-    cpu->registers.acc = value;
-    SET_ZERO(cpu->registers.p, cpu->registers.acc == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.acc);
-    cpu->clock->skipCycles += cycles;
-}
-
-void LDX(CPU* cpu, uint8_t value, uint8_t cycles) {
-    cpu->registers.x = value;
-    SET_ZERO(cpu->registers.p, cpu->registers.x == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.x);
-    cpu->clock->skipCycles += cycles;
-}
-
-void LDY(CPU* cpu, uint8_t value, uint8_t cycles) {
-    cpu->registers.y = value;
-    SET_ZERO(cpu->registers.p, cpu->registers.y == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.y);
-    cpu->clock->skipCycles += cycles;
-}
-
-void LSR(CPU* cpu, uint8_t value, uint8_t cycles) {
-    SET_CARRY(cpu->registers.p, value & 0x01);
-    value >>= 1;
-    SET_ZERO(cpu->registers.p, value == 0);
-    SET_NEGATIVE(cpu->registers.p, value);
-    cpu->clock->skipCycles += cycles;
-}
-
-void NOP(CPU* cpu) {
-    // No operation
+/* Runs until the PPU enters vertical blank, i.e. until the frame in cpu->graphics is complete */
+void runFrame(CPU* cpu) {
+    uint64_t frame = cpu->ppu.frame;
+    while (cpu->ppu.frame == frame) {
+        runUntil(cpu, NO_EVENT);
+        runEvents(cpu);
+    }
+    if (cpu->ppuThread) {
+        syncPpuThread(cpu);
+    }
 }
 
-/* From: http://www.6502.org/users/obelisk/6502/reference.html
-    * 
-    * ORA - Logical inclusive OR
-    * An inclusive OR is performed, bit by bit, on the accumulator contents using the contents of a byte of memory.
-    * A, Z, N = A | M
-    *
+/* What one machine running `game` costs, and how many of them fit in a gigabyte: everything it allocates, with the
+    * decoded tiles at their most, for a machine that draws and for a headless one. The state that has to be copied,
+    * hashed or kept per instance is broken out below; the ROM image is paid once per process however many machines
+    * run it.
 */
-void ORA(CPU* cpu, uint8_t value, uint8_t cycles) {
-    cpu->registers.acc |= value;
-    SET_ZERO(cpu->registers.p, cpu->registers.acc);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.acc);
-    cpu->clock->skipCycles += cycles;
-}
-
-void PHA(CPU* cpu) {
-    pushStack(cpu, cpu->registers.acc);
-}
-
-void PHP(CPU* cpu) {
-    pushStack(cpu, cpu->registers.p);
-}
-
-void PLA(CPU* cpu) {
-    cpu->registers.acc = popStack(cpu);
-    SET_ZERO(cpu->registers.p, cpu->registers.acc == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.acc);
-}
-
-void PLP(CPU* cpu) {
-    cpu->registers.p = popStack(cpu);
-}
-
-void ROL(CPU* cpu, uint8_t value, uint8_t cycles) {
-    uint8_t carry = GET_CARRY(cpu->registers.p);
-    SET_CARRY(cpu->registers.p, value & 0x80);
-    value = (value << 1) | carry;
-    SET_ZERO(cpu->registers.p, value == 0);
-    SET_NEGATIVE(cpu->registers.p, value);
-    cpu->clock->skipCycles += cycles;
-}
-
-void ROR(CPU* cpu, uint8_t value, uint8_t cycles) {
-    uint8_t carry = GET_CARRY(cpu->registers.p);
-    SET_CARRY(cpu->registers.p, value & 0x01);
-    value = (value >> 1) | (carry << 7);
-    SET_ZERO(cpu->registers.p, value == 0);
-    SET_NEGATIVE(cpu->registers.p, value);
-    cpu->clock->skipCycles += cycles;
-}
-
-void RTI(CPU* cpu) {
-    cpu->registers.p = popStack(cpu);
-    cpu->registers.pc = popStack(cpu);
-}
-
-void RTS(CPU* cpu) {
-    cpu->registers.pc = popStack(cpu) + 1;
+void printFootprint(const GameInformation* game) {
+    size_t core = (sizeof(CPU) + 63) & ~(size_t) 63;
+    size_t prgRam = game->prgRamSize ? PRG_RAM_SIZE : 0;
+    size_t chrRam = game->chrSize ? 0 : CHR_RAM_SIZE;
+    size_t state = core + prgRam + chrRam;
+#ifdef NES_NO_TILE_CACHE
+    size_t tiles = 0;
+#else
+    size_t tiles = sizeof(TileCache) + ((game->chrSize ? game->chrSize : CHR_RAM_SIZE) / 0x400) * sizeof(TilePage);
+#endif
+#ifdef NES_BLOCK_CACHE
+    size_t blocks = sizeof(BlockCache);
+#else
+    size_t blocks = 0;
+#endif
+    size_t headless = state + blocks + tiles;
+    size_t drawing = headless + sizeof(Graphics);
+    size_t other = sizeof(CPU) - sizeof(Bus) - sizeof(((CPU*) 0)->ram) - sizeof(PPU);
+    double gigabyte = 1024.0 * 1024.0 * 1024.0;
+
+    printf("Per machine         %8zu bytes (%.0f per GB)\n", drawing, gigabyte / drawing);
+    printf("Per headless one    %8zu bytes (%.0f per GB)\n", headless, gigabyte / headless);
+    printf("Machine state       %8zu bytes\n", state);
+    printf("  CPU block         %8zu bytes (bus %zu, RAM %zu, PPU %zu, other %zu)\n", core, sizeof(Bus),
+        sizeof(((CPU*) 0)->ram), sizeof(PPU), other);
+    printf("  PRG-RAM           %8zu bytes\n", prgRam);
+    printf("  CHR-RAM           %8zu bytes\n", chrRam);
+    printf("Frame buffer        %8zu bytes (not for headless machines)\n", sizeof(Graphics));
+    printf("Decoded blocks      %8zu bytes%s\n", blocks, blocks ? "" : " (no block cache in this build)");
+    printf("Decoded tiles       %8zu bytes at most (pages are allocated as CHR banks are mapped)\n", tiles);
+    printf("Shared ROM          %8u bytes (PRG %u, CHR %u, once per process)\n", game->prgSize + game->chrSize,
+        game->prgSize, game->chrSize);
 }
-
-void SBC(CPU* cpu, uint8_t value, uint8_t cycles) {
-    uint16_t result = cpu->registers.acc - value - (1 - GET_CARRY(cpu->registers.p));
-    SET_CARRY(cpu->registers.p, result < 0x100);
-    SET_ZERO(cpu->registers.p, (result & 0xFF) == 0);
-    SET_OVERFLOW(cpu->registers.p, ((cpu->registers.acc ^ result) & (cpu->registers.acc ^ value) & 0x80) != 0);
-    SET_NEGATIVE(cpu->registers.p, result);
-    cpu->registers.acc = result & 0xFF;
-    cpu->clock->skipCycles += cycles;
-}
-
-void SEC(CPU* cpu) {
-    SET_CARRY(cpu->registers.p, 1);
-}
-
-void SED(CPU* cpu) {
-    SET_DECIMAL(cpu->registers.p, 1);
-}
-
-void SEI(CPU* cpu) {
-    SET_INTERRUPT(cpu->registers.p, 1);
-}
-
-void STA(CPU* cpu, uint16_t address, uint8_t cycles) {
-    writeByte(address, cpu->registers.acc);
-    cpu->clock->skipCycles += cycles;
-}
-
-void STX(CPU* cpu, uint16_t address, uint8_t cycles) {
-    writeByte(address, cpu->registers.x);
-    cpu->clock->skipCycles += cycles;
-}
-
-void STY(CPU* cpu, uint16_t address, uint8_t cycles) {
-    writeByte(address, cpu->registers.y);
-    cpu->clock->skipCycles += cycles;
-}
-
-void TAX(CPU* cpu) {
-    cpu->registers.x = cpu->registers.acc;
-    SET_ZERO(cpu->registers.p, cpu->registers.x == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.x);
-}
-
-void TAY(CPU* cpu) {
-    cpu->registers.y = cpu->registers.acc;
-    SET_ZERO(cpu->registers.p, cpu->registers.y == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.y);
-}
-
-void TSX(CPU* cpu) {
-    cpu->registers.x = cpu->registers.s;
-    SET_ZERO(cpu->registers.p, cpu->registers.x == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.x);
-}
-
-void TXA(CPU* cpu) {
-    cpu->registers.acc = cpu->registers.x;
-    SET_ZERO(cpu->registers.p, cpu->registers.acc == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.acc);
-}
-
-void TXS(CPU* cpu) {
-    cpu->registers.s = cpu->registers.x;
-}
-
-void TYA(CPU* cpu) {
-    cpu->registers.acc = cpu->registers.y;
-    SET_ZERO(cpu->registers.p, cpu->registers.acc == 0);
-    SET_NEGATIVE(cpu->registers.p, cpu->registers.acc);
-}
-
-typedef struct clock {
-    uint64_t cycles;
-    uint64_t skipCycles;
-} Clock;
-
-typedef struct game_info {
-
-} GameInformation;
-
-typedef struct registers {
-    uint8_t acc;
-    uint8_t x;
-    uint8_t y;
-    uint16_t pc;
-    uint8_t s;
-    uint8_t p;
-} regs;
-
-typedef struct cpu {
-    regs registers;
-    uint8_t memory[0xFFFF];
-    Graphics* graphics;
-    Clock* clock;
-} CPU;
-
-typedef struct graphics {
-    uint8_t screen[0xF000];
-} Graphics;
-
-void executeInstruction(uint8_t opcode, CPU* cpu) {
-    switch (opcode) {
-        case 0x00: { BRK(cpu); break; }
-
-        // ADC
-        case 0x69: { PC++; ADC(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0x65: { PC++; ADC(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0x75: { PC++; ADC(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0x6D: { PC++; ADC(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0x7D: { PC++; ADC(cpu, getAbsoluteX(PC), 4); PC += 2; break; }
-        case 0x79: { PC++; ADC(cpu, getAbsoluteY(PC), 4); PC += 2; break; }
-        case 0x61: { PC++; ADC(cpu, getIndirectX(PC), 6); PC++; break; }
-        case 0x71: { PC++; ADC(cpu, getIndirectY(PC), 5); PC++; break; }
-
-        // AND
-        case 0x29: { PC++; AND(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0x25: { PC++; AND(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0x35: { PC++; AND(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0x2D: { PC++; AND(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0x3D: { PC++; AND(cpu, getAbsoluteX(PC), 4); PC += 2; break; }
-        case 0x39: { PC++; AND(cpu, getAbsoluteY(PC), 4); PC += 2; break; }
-        case 0x21: { PC++; AND(cpu, getIndirectX(PC), 6); PC++; break; }
-        case 0x31: { PC++; AND(cpu, getIndirectY(PC), 5); PC++; break; }
-
-        // ASL
-        case 0x0A: { PC++; ASL(cpu, getImmediate(PC), 2); break; }
-        case 0x06: { PC++; ASL(cpu, getZeroPage(PC), 5); PC++; break; }
-        case 0x16: { PC++; ASL(cpu, getZeroPageX(PC), 6); PC++; break; }
-        case 0x0E: { PC++; ASL(cpu, getAbsolute(PC), 6); PC += 2; break; }
-        case 0x1E: { PC++; ASL(cpu, getAbsoluteX(PC), 7); PC += 2; break; }
-
-        // BCC
-        case 0x90: { PC++; BCC(cpu); PC++; break; }
-
-        // BCS
-        case 0xB0: { PC++; BCS(cpu); PC++; break; }
-
-        // BEQ
-        case 0xF0: { PC++; BEQ(cpu); PC++; break; }
-
-        // BIT
-        case 0x24: { PC++; BIT(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0x2C: { PC++; BIT(cpu, getAbsolute(PC), 4); PC += 2; break; }
-
-        // BMI
-        case 0x30: { PC++; BMI(cpu); PC++; break; }
-
-        // BNE
-        case 0xD0: { PC++; BNE(cpu); PC++; break; }
-
-        // BPL
-        case 0x10: { PC++; BPL(cpu); PC++; break; }
-
-        // BVC
-        case 0x50: { PC++; BVC(cpu); PC++; break; }
-
-        // BVS
-        case 0x70: { PC++; BVS(cpu); PC++; break; }
-
-        // CLC
-        case 0x18: { PC++; CLC(cpu); break; }
-
-        // CLD
-        case 0xD8: { PC++; CLD(cpu); break; }
-
-        // CLI
-        case 0x58: { PC++; CLI(cpu); break; }
-
-        // CLV
-        case 0xB8: { PC++; CLV(cpu); break; }
-
-        // CMP
-        case 0xC9: { PC++; CMP(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0xC5: { PC++; CMP(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0xD5: { PC++; CMP(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0xCD: { PC++; CMP(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0xDD: { PC++; CMP(cpu, getAbsoluteX(PC), 4); PC += 2; break; }
-        case 0xD9: { PC++; CMP(cpu, getAbsoluteY(PC), 4); PC += 2; break; }
-        case 0xC1: { PC++; CMP(cpu, getIndirectX(PC), 6); PC++; break; }
-        case 0xD1: { PC++; CMP(cpu, getIndirectY(PC), 5); PC++; break; }
-
-        // CPX
-        case 0xE0: { PC++; CPX(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0xE4: { PC++; CPX(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0xEC: { PC++; CPX(cpu, getAbsolute(PC), 4); PC += 2; break; }
-
-        // CPY
-        case 0xC0: { PC++; CPY(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0xC4: { PC++; CPY(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0xCC: { PC++; CPY(cpu, getAbsolute(PC), 4); PC += 2; break; }
-
-        // DEC
-        case 0xC6: { PC++; DEC(cpu, getZeroPage(PC), 5); PC++; break; }
-        case 0xD6: { PC++; DEC(cpu, getZeroPageX(PC), 6); PC++; break; }
-        case 0xCE: { PC++; DEC(cpu, getAbsolute(PC), 6); PC += 2; break; }
-        case 0xDE: { PC++; DEC(cpu, getAbsoluteX(PC), 7); PC += 2; break; }
-
-        // DEX
-        case 0xCA: { DEX(cpu); break; }
-
-        // DEY
-        case 0x88: { DEY(cpu); break; }
-
-        // EOR
-        case 0x49: { PC++; EOR(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0x45: { PC++; EOR(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0x55: { PC++; EOR(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0x4D: { PC++; EOR(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0x5D: { PC++; EOR(cpu, getAbsoluteX(PC), 4); PC += 2; break; }
-        case 0x59: { PC++; EOR(cpu, getAbsoluteY(PC), 4); PC += 2; break; }
-        case 0x41: { PC++; EOR(cpu, getIndirectX(PC), 6); PC++; break; }
-        case 0x51: { PC++; EOR(cpu, getIndirectY(PC), 5); PC++; break; }
-
-        // INC
-        case 0xE6: { PC++; INC(cpu, getZeroPage(PC), 5); PC++; break; }
-        case 0xF6: { PC++; INC(cpu, getZeroPageX(PC), 6); PC++; break; }
-        case 0xEE: { PC++; INC(cpu, getAbsolute(PC), 6); PC += 2; break; }
-        case 0xFE: { PC++; INC(cpu, getAbsoluteX(PC), 7); PC += 2; break; }
-
-        // INX
-        case 0xE8: { INX(cpu); break; }
-
-        // INY
-        case 0xC8: { INY(cpu); break; }
-
-        // JMP
-        case 0x4C: { PC++; JMP(cpu, getAbsolute(PC)); break; }
-        case 0x6C: { PC++; JMP(cpu, getIndirectX(PC)); break; }
-
-        // JSR
-        case 0x20: { PC++; JSR(cpu, getAbsolute(PC)); break; }
-
-        // LDA
-        case 0xA9: { PC++; LDA(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0xA5: { PC++; LDA(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0xB5: { PC++; LDA(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0xAD: { PC++; LDA(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0xBD: { PC++; LDA(cpu, getAbsoluteX(PC), 4); PC += 2; break; }
-        case 0xB9: { PC++; LDA(cpu, getAbsoluteY(PC), 4); PC += 2; break; }
-        case 0xA1: { PC++; LDA(cpu, getIndirectX(PC), 6); PC++; break; }
-        case 0xB1: { PC++; LDA(cpu, getIndirectY(PC), 5); PC++; break; }
-
-        // LDX
-        case 0xA2: { PC++; LDX(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0xA6: { PC++; LDX(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0xB6: { PC++; LDX(cpu, getZeroPageY(PC), 4); PC++; break; }
-        case 0xAE: { PC++; LDX(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0xBE: { PC++; LDX(cpu, getAbsoluteY(PC), 4); PC += 2; break; }
-
-        // LDY
-        case 0xA0: { PC++; LDY(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0xA4: { PC++; LDY(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0xB4: { PC++; LDY(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0xAC: { PC++; LDY(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0xBC: { PC++; LDY(cpu, getAbsoluteX(PC), 4); PC += 2; break; }
-
-        // LSR
-        case 0x4A: { LSR(cpu, cpu->registers.acc, 2); break; }
-        case 0x46: { PC++; LSR(cpu, getZeroPage(PC), 5); PC++; break; }
-        case 0x56: { PC++; LSR(cpu, getZeroPageX(PC), 6); PC++; break; }
-        case 0x4E: { PC++; LSR(cpu, getAbsolute(PC), 6); PC += 2; break; }
-        case 0x5E: { PC++; LSR(cpu, getAbsoluteX(PC), 7); PC += 2; break; }
-
-        // NOP
-        case 0xEA: { NOP(cpu); break; }
-
-        // ORA
-        case 0x09: { PC++; ORA(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0x05: { PC++; ORA(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0x15: { PC++; ORA(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0x0D: { PC++; ORA(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0x1D: { PC++; ORA(cpu, getAbsoluteX(PC), 4); PC += 2; break; }
-        case 0x19: { PC++; ORA(cpu, getAbsoluteY(PC), 4); PC += 2; break; }
-        case 0x01: { PC++; ORA(cpu, getIndirectX(PC), 6); PC++; break; }
-        case 0x11: { PC++; ORA(cpu, getIndirectY(PC), 5); PC++; break; }
-
-        // PHA
-        case 0x48: { PHA(cpu); break; }
-
-        // PHP
-        case 0x08: { PHP(cpu); break; }
-
-        // PLA
-        case 0x68: { PLA(cpu); break; }
-
-        // PLP
-        case 0x28: { PLP(cpu); break; }
-
-        // ROL
-        case 0x2A: { ROL(cpu, cpu->registers.acc, 2); break; }
-        case 0x26: { PC++; ROL(cpu, getZeroPage(PC), 5); PC++; break; }
-        case 0x36: { PC++; ROL(cpu, getZeroPageX(PC), 6); PC++; break; }
-        case 0x2E: { PC++; ROL(cpu, getAbsolute(PC), 6); PC += 2; break; }
-        case 0x3E: { PC++; ROL(cpu, getAbsoluteX(PC), 7); PC += 2; break; }
-
-        // ROR
-        case 0x6A: { ROR(cpu, cpu->registers.acc, 2); break; }
-        case 0x66: { PC++; ROR(cpu, getZeroPage(PC), 5); PC++; break; }
-        case 0x76: { PC++; ROR(cpu, getZeroPageX(PC), 6); PC++; break; }
-        case 0x6E: { PC++; ROR(cpu, getAbsolute(PC), 6); PC += 2; break; }
-        case 0x7E: { PC++; ROR(cpu, getAbsoluteX(PC), 7); PC += 2; break; }
-
-        // RTI
-        case 0x40: { RTI(cpu); break; }
-
-        // RTS
-        case 0x60: { RTS(cpu); break; }
-
-        // SBC
-        case 0xE9: { PC++; SBC(cpu, getImmediate(PC), 2); PC++; break; }
-        case 0xE5: { PC++; SBC(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0xF5: { PC++; SBC(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0xED: { PC++; SBC(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0xFD: { PC++; SBC(cpu, getAbsoluteX(PC), 4); PC += 2; break; }
-        case 0xF9: { PC++; SBC(cpu, getAbsoluteY(PC), 4); PC += 2; break; }
-        case 0xE1: { PC++; SBC(cpu, getIndirectX(PC), 6); PC++; break; }
-        case 0xF1: { PC++; SBC(cpu, getIndirectY(PC), 5); PC++; break; }
-
-        // SEC
-        case 0x38: { SEC(cpu); break; }
-
-        // SED
-        case 0xF8: { SED(cpu); break; }
-
-        // SEI
-        case 0x78: { SEI(cpu); break; }
-
-        // STA
-        case 0x85: { PC++; STA(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0x95: { PC++; STA(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0x8D: { PC++; STA(cpu, getAbsolute(PC), 4); PC += 2; break; }
-        case 0x9D: { PC++; STA(cpu, getAbsoluteX(PC), 5); PC += 2; break; }
-        case 0x99: { PC++; STA(cpu, getAbsoluteY(PC), 5); PC += 2; break; }
-        case 0x81: { PC++; STA(cpu, getIndirectX(PC), 6); PC++; break; }
-        case 0x91: { PC++; STA(cpu, getIndirectY(PC), 6); PC++; break; }
-
-        // STX
-        case 0x86: { PC++; STX(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0x96: { PC++; STX(cpu, getZeroPageY(PC), 4); PC++; break; }
-        case 0x8E: { PC++; STX(cpu, getAbsolute(PC), 4); PC += 2; break; }
-
-        // STY
-        case 0x84: { PC++; STY(cpu, getZeroPage(PC), 3); PC++; break; }
-        case 0x94: { PC++; STY(cpu, getZeroPageX(PC), 4); PC++; break; }
-        case 0x8C: { PC++; STY(cpu, getAbsolute(PC), 4); PC += 2; break; }
-
-        // TAX
-        case 0xAA: { TAX(cpu); break; }
-
-        // TAY
-        case 0xA8: { TAY(cpu); break; }
-
-        // TSX
-        case 0xBA: { TSX(cpu); break; }
-
-        // TXA
-        case 0x8A: { TXA(cpu); break; }
-
-        // TXS
-        case 0x9A: { TXS(cpu); break; }
-
-        // TYA
-        case 0x98: { TYA(cpu); break; }
-
-        default: { break; };
-    }
-}
-
-int main(int argc, char* argv[argc + 1]) {
-    if (argc != 2) {
-        fprintf(stderr, "Incorrect amount of cmd line arguments. Must only be ROM location\n");
-    }
-    
-    GameInformation* gameInformation = (GameInformation*) malloc(sizeof(GameInformation));
-
-    FILE* fileptr = fopen(argv[1], "rb");
-    fseek(fileptr, 0, SEEK_END);
-    long filelen = ftell(fileptr);
-    rewind(fileptr);
-
-    /* Load the ROM data */
-    uint8_t* romData = (uint8_t*) malloc(filelen * sizeof(uint8_t));
-    fread(romData, filelen, 1, fileptr);
-    fclose(fileptr);
-
-    CPU* cpu = (CPU*) malloc(sizeof(CPU));
-
-    while (1) {
-        uint8_t opcode = readByte(cpu->registers.pc);
-        executeInstruction(opcode, cpu);
-    }
-
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
@@ -0,0 +1,1164 @@
+#ifndef NES_H
+#define NES_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// https://www.nesdev.org/wiki/Status_flags
+#define SET_CARRY(p, value) ((p) = ((p) & ~0b00000001) | ((value) ? 0b00000001 : 0))
+#define SET_ZERO(p, value) ((p) = ((p) & ~0b00000010) | ((value) ? 0b00000010 : 0))
+#define SET_INTERRUPT(p, value) ((p) = ((p) & ~0b00000100) | ((value) ? 0b00000100 : 0))
+#define SET_DECIMAL(p, value) ((p) = ((p) & ~0b00001000) | ((value) ? 0b00001000 : 0))
+#define SET_BREAK(p, value) ((p) = ((p) & ~0b00010000) | ((value) ? 0b00010000 : 0))
+#define SET_OVERFLOW(p, value) ((p) = ((p) & ~0b01000000) | ((value) ? 0b01000000 : 0))
+#define SET_NEGATIVE(p, value) ((p) = ((p) & ~0b10000000) | ((value) ? 0b10000000 : 0))
+
+#define GET_CARRY(p) ((p) & 0b00000001)
+#define GET_ZERO(p) ((p) & 0b00000010)
+#define GET_INTERRUPT(p) ((p) & 0b00000100)
+#define GET_DECIMAL(p) ((p) & 0b00001000)
+#define GET_BREAK(p) ((p) & 0b00010000)
+#define GET_OVERFLOW(p) ((p) & 0b01000000)
+#define GET_NEGATIVE(p) ((p) & 0b10000000)
+
+/* B and the unused bit 5 only exist in copies of P pushed to the stack */
+#define STACK_FLAGS 0b00110000
+
+/* Lazy status flags (-DNES_LAZY_FLAGS).
+    *
+    * Most flag results are overwritten before anything reads them, so instead of merging C, Z, V and N into P after
+    * every instruction the lazy core keeps their raw inputs: Z and N come from the last result written, C is kept as
+    * 0/1 and V as bit 7 of an intermediate value. P itself then only holds I, D and the unused bit, and the real byte
+    * is assembled by getStatus() when something needs it (PHP, BRK and interrupt pushes, debugger, save states).
+    * Branches test the raw inputs directly.
+    *
+    * -DNES_LAZY_FLAGS_CHECK additionally keeps an eagerly updated copy of P and aborts on the first instruction where
+    * the two disagree, which is how the lazy path is checked against the eager one on real ROMs.
+    *
+*/
+#if defined(NES_LAZY_FLAGS_CHECK) && !defined(NES_LAZY_FLAGS)
+#define NES_LAZY_FLAGS 1
+#endif
+
+#ifdef NES_LAZY_FLAGS_CHECK
+#define SHADOW_FLAG(update) (update)
+#else
+#define SHADOW_FLAG(update) ((void) 0)
+#endif
+
+#ifdef NES_LAZY_FLAGS
+#define SET_FLAG_C(cpu, bit) ((cpu)->registers.carry = (bit), SHADOW_FLAG(SET_CARRY((cpu)->registers.shadowStatus, bit)))
+#define SET_FLAG_Z(cpu, value) ((cpu)->registers.zeroResult = (value), SHADOW_FLAG(SET_ZERO((cpu)->registers.shadowStatus, ((value) & 0xFF) == 0)))
+#define SET_FLAG_N(cpu, value) ((cpu)->registers.negativeResult = (value), SHADOW_FLAG(SET_NEGATIVE((cpu)->registers.shadowStatus, (value) & 0x80)))
+#define SET_FLAG_V(cpu, value) ((cpu)->registers.overflow = (value), SHADOW_FLAG(SET_OVERFLOW((cpu)->registers.shadowStatus, (value) & 0x80)))
+
+#define FLAG_C(cpu) ((cpu)->registers.carry)
+#define FLAG_Z(cpu) ((cpu)->registers.zeroResult == 0)
+#define FLAG_N(cpu) ((cpu)->registers.negativeResult & 0x80)
+#define FLAG_V(cpu) ((cpu)->registers.overflow & 0x80)
+#else
+#define SET_FLAG_C(cpu, bit) SET_CARRY((cpu)->registers.p, bit)
+#define SET_FLAG_Z(cpu, value) SET_ZERO((cpu)->registers.p, ((value) & 0xFF) == 0)
+#define SET_FLAG_N(cpu, value) SET_NEGATIVE((cpu)->registers.p, (value) & 0x80)
+#define SET_FLAG_V(cpu, value) SET_OVERFLOW((cpu)->registers.p, (value) & 0x80)
+
+#define FLAG_C(cpu) GET_CARRY((cpu)->registers.p)
+#define FLAG_Z(cpu) GET_ZERO((cpu)->registers.p)
+#define FLAG_N(cpu) GET_NEGATIVE((cpu)->registers.p)
+#define FLAG_V(cpu) GET_OVERFLOW((cpu)->registers.p)
+#endif
+
+/* SET_FLAG_C takes 0 or 1, SET_FLAG_V looks at bit 7, Z and N at the 8-bit result */
+#define SET_FLAGS_ZN(cpu, value) (SET_FLAG_Z(cpu, value), SET_FLAG_N(cpu, value))
+
+// https://www.nesdev.org/wiki/Cycle_reference_chart
+#define CYCLES_PER_FRAME 29781
+
+enum AddressingMode {
+    IMPLIED,
+    ACCUMULATOR,
+    IMMEDIATE,
+    RELATIVE,
+    ABSOLUTE,
+    ABSOLUTE_X,
+    ABSOLUTE_Y,
+    INDIRECT,
+    ZERO_PAGE,
+    ZERO_PAGE_X,
+    ZERO_PAGE_Y,
+    INDIRECT_X,
+    INDIRECT_Y
+};
+
+/* Components that need the CPU to stop at a given cycle, one scheduler slot each */
+enum ClockEvent {
+    EVENT_PPU,
+    EVENT_MAPPER_IRQ,
+    EVENT_FRAME_COUNTER,
+    EVENT_PPU_THREAD,
+    EVENT_DMC,
+    EVENT_COUNT
+};
+
+#define NO_EVENT UINT64_MAX
+
+/* Scheduler.
+    *
+    * Each event source keeps at most one pending timestamp in events[]; nextEvent is the earliest of them. The CPU
+    * runs flat out until `target` (the earlier of the caller's limit and nextEvent), the due events run, and everything
+    * else (PPU, mapper IRQ counter) catches up lazily when the CPU touches its registers. Scheduling an event earlier
+    * than the running slice's target pulls the target in, so a register write can shorten the slice it happens in.
+    *
+*/
+typedef struct clock {
+    uint64_t cycles;
+    uint64_t skipCycles;
+    uint64_t target;
+    uint64_t nextEvent;
+    uint64_t events[EVENT_COUNT];
+} Clock;
+
+/* Idle-loop detection (cpu.c).
+    *
+    * Every taken backward branch or jump records where it lands and the registers. Writes, stack pushes and register
+    * reads with side effects clear `clean`. Landing on the same head again, still clean and with the same registers,
+    * means the pass just finished changed nothing, so every further pass up to the next event would repeat it exactly:
+    * the clock jumps forward by whole passes instead (clock->skipCycles counts them). A pass that polls $2002 is also
+    * held to the next dot the status could change on, and `status` is what that poll will read if nothing has.
+    *
+*/
+typedef struct idle_loop {
+    uint64_t cycles;
+    uint64_t skips;
+    uint16_t head;
+    uint8_t clean;
+    uint8_t polledStatus;
+    uint8_t status;
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t s;
+    uint8_t p;
+} IdleLoop;
+
+/* Idle-loop skipping; -DNES_NO_IDLE_SKIP runs every pass, as the reference to check it against */
+#ifndef NES_NO_IDLE_SKIP
+#define NES_IDLE_SKIP 1
+#endif
+
+/* Longest loop body, in bytes from the head to the end of the branch or jump, that is watched */
+#define IDLE_LOOP_BYTES 32
+
+// https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring
+enum Mirroring {
+    MIRROR_HORIZONTAL,
+    MIRROR_VERTICAL,
+    MIRROR_FOUR_SCREEN,
+    MIRROR_SINGLE_LOW,
+    MIRROR_SINGLE_HIGH
+};
+
+/* A parsed iNES / NES 2.0 image.
+    *
+    * prg, chr and trainer point straight into the read-only file mapping (or the caller's buffer for parseROM), so
+    * every machine running the same ROM shares the same page-cache pages. chrSize is 0 for boards with CHR-RAM.
+    *
+*/
+typedef struct game_info {
+    uint16_t mapper;
+    uint8_t submapper;
+    uint8_t nes2;
+    enum Mirroring mirroring;
+    uint8_t battery;
+    uint8_t* trainer;
+    uint8_t* prg;
+    uint32_t prgSize;
+    uint8_t* chr;
+    uint32_t chrSize;
+    uint32_t prgRamSize;
+    uint32_t chrRamSize;
+    void* mapping;
+    size_t mappingSize;
+} GameInformation;
+
+typedef struct registers {
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint16_t pc;
+    uint8_t s;
+    uint8_t p;
+#ifdef NES_LAZY_FLAGS
+    uint8_t carry;
+    uint8_t zeroResult;
+    uint8_t negativeResult;
+    uint8_t overflow;
+#ifdef NES_LAZY_FLAGS_CHECK
+    uint8_t shadowStatus;
+#endif
+#endif
+} regs;
+
+// https://www.nesdev.org/wiki/PPU_rendering
+#define SCREEN_WIDTH 256
+#define SCREEN_HEIGHT 240
+#define DOTS_PER_SCANLINE 341
+#define SCANLINES_PER_FRAME 262
+#define VBLANK_SCANLINE 241
+#define PRE_RENDER_SCANLINE 261
+
+/* One byte per pixel holding the 6-bit NES colour (palette RAM value, after greyscale); conversion to RGB is left to
+    * whoever displays or encodes the frame
+*/
+typedef struct graphics {
+    uint8_t screen[SCREEN_HEIGHT * SCREEN_WIDTH];
+} Graphics;
+
+/* PPU registers, memories and position. Pointer-free so it can be embedded in save states as is.
+    *
+    * The PPU runs behind the CPU and is caught up (ppuCatchUp) whenever the CPU touches one of its registers or
+    * reaches a PPU event, so `dots` is always <= cpu cycles * 3. v, t, fineX and writeToggle are the loopy registers.
+    *
+*/
+typedef struct ppu {
+    uint64_t dots;
+    uint64_t frame;
+    uint16_t v;
+    uint16_t t;
+    uint16_t scanline;
+    uint16_t dot;
+    uint16_t spriteZeroDot;
+    uint8_t ctrl;
+    uint8_t mask;
+    uint8_t status;
+    uint8_t oamAddress;
+    uint8_t fineX;
+    uint8_t writeToggle;
+    uint8_t readBuffer;
+    uint8_t openBus;
+    uint8_t padding[6];
+    uint8_t palette[0x20];
+    uint8_t oam[0x100];
+    uint8_t vram[0x1000];
+} PPU;
+
+/* Scanline kernels, chosen at run time (findRenderKernel).
+    *
+    * decodeTiles expands `count` (a multiple of 4) background tiles from their two bit planes and 2-bit attribute into
+    * one byte per pixel: bits 0-1 colour, bits 2-3 palette. composite merges 256 background pixels with the sprite
+    * line (bits 0-1 colour, bits 2-3 palette, bit 4 set, bit 5 behind background, bit 6 sprite 0; 0 is transparent),
+    * looks every pixel up in palette RAM, applies colorMask and returns the first x where sprite 0 hit, or -1.
+    *
+*/
+typedef struct render_kernel {
+    const char* name;
+    void (*decodeTiles)(const uint8_t* low, const uint8_t* high, const uint8_t* attributes, int count, uint8_t* pixels);
+    int (*composite)(const uint8_t* background, const uint8_t* sprites, const uint8_t* palette, uint8_t colorMask,
+        uint8_t* out);
+} RenderKernel;
+
+/* Decoded CHR tiles (tiles.c).
+    *
+    * Pattern data keeps each 8-pixel row of a tile as two bit planes, so every background and sprite fetch would take
+    * them apart again. The cache holds CHR decoded to one byte per pixel (0-3), in 1KB pages of 64 tiles with a
+    * mirrored copy for horizontally flipped sprites, and decodes a tile the first time it is fetched. Pages belong to
+    * the CHR memory they decode, not to a PPU slot: mapChr points slots at them as it points chrPages at the memory,
+    * so a bank switch is a pointer swap. CHR-ROM never changes; a CHR-RAM write through $2007 drops the tile it lands
+    * in. Without a cache (cpu->tiles NULL, or -DNES_NO_TILE_CACHE) the PPU decodes every fetch.
+    *
+*/
+typedef struct tile_page {
+    const uint8_t* source;
+    uint64_t valid;
+    uint8_t rows[64][8][8];
+    uint8_t flipped[64][8][8];
+} TilePage;
+
+typedef struct tile_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    uint64_t pages;
+} TileStats;
+
+typedef struct tile_cache {
+    TilePage* slots[8];
+    TilePage** pages;
+    uint32_t pageCount;
+    TileStats stats;
+} TileCache;
+
+typedef struct cpu CPU;
+
+/* Cartridge registers, shared by every mapper so states stay fixed-size and pointer-free.
+    *
+    * bank[] holds whatever bank registers the board has (MMC3 R0-R7; MMC1 control, CHR 0, CHR 1, PRG; the single
+    * bank latch of UxROM and CNROM in bank[0]). prgRamProtect is the MMC3's $A001. The page pointers on the bus are
+    * always rebuilt from these.
+    *
+*/
+typedef struct mapper_state {
+    uint8_t bank[8];
+    uint8_t select;
+    uint8_t shiftCount;
+    uint8_t mirroring;
+    uint8_t prgRamProtect;
+    uint8_t irqLatch;
+    uint8_t irqCounter;
+    uint8_t irqEnabled;
+    uint8_t irqReload;
+} MapperState;
+
+typedef struct mapper Mapper;
+
+/* Sources that can hold the IRQ line low, OR-ed into cpu->irq */
+#define IRQ_MAPPER 0b00000001
+#define IRQ_FRAME_COUNTER 0b00000010
+
+#define IRQ_DMC 0b00000100
+
+// https://www.nesdev.org/wiki/APU
+/* Sound channels. Every counter is in CPU cycles until the channel's timer next clocks its sequencer, so a channel
+    * can be moved forward by any number of cycles in one step (apu.c). Register bytes are kept as written.
+*/
+typedef struct pulse {
+    uint16_t period;
+    uint16_t counter;
+    uint8_t control;
+    uint8_t sweep;
+    uint8_t step;
+    uint8_t length;
+    uint8_t envelopeStart;
+    uint8_t envelopeDivider;
+    uint8_t envelopeDecay;
+    uint8_t sweepDivider;
+    uint8_t sweepReload;
+    uint8_t padding[3];
+} Pulse;
+
+typedef struct triangle {
+    uint16_t period;
+    uint16_t counter;
+    uint8_t control;
+    uint8_t step;
+    uint8_t length;
+    uint8_t linear;
+    uint8_t linearReload;
+    uint8_t padding[3];
+} Triangle;
+
+/* period is $400E as written: the mode in bit 7, the period index in the low nibble */
+typedef struct noise {
+    uint16_t lfsr;
+    uint16_t counter;
+    uint8_t control;
+    uint8_t period;
+    uint8_t length;
+    uint8_t envelopeStart;
+    uint8_t envelopeDivider;
+    uint8_t envelopeDecay;
+    uint8_t padding[2];
+} Noise;
+
+/* The sample buffer is refilled as soon as it empties while bytes remain, so it only sits empty once they run out */
+typedef struct dmc {
+    uint16_t address;
+    uint16_t bytesRemaining;
+    uint16_t counter;
+    uint8_t control;
+    uint8_t level;
+    uint8_t sampleAddress;
+    uint8_t sampleLength;
+    uint8_t buffer;
+    uint8_t bufferFull;
+    uint8_t shift;
+    uint8_t bitsRemaining;
+    uint8_t silence;
+    uint8_t padding;
+} Dmc;
+
+/* The APU runs behind the CPU like the PPU and is caught up (apuCatchUp) when the CPU touches its registers, at frame
+    * IRQs and DMC fetches, and at the end of every frame that is being listened to; `cycles` is how far it has got.
+    * frameSequenceStart is the cycle the frame counter's current sequence started on, so the next frame IRQ and the
+    * next envelope and length clocks can be found from any point in time.
+    *
+*/
+typedef struct apu {
+    uint64_t frameSequenceStart;
+    uint64_t cycles;
+    Pulse pulse[2];
+    Triangle triangle;
+    Noise noise;
+    Dmc dmc;
+    uint8_t enabled;
+    uint8_t padding[7];
+} APU;
+
+/* Audio output (audio.c): band-limited synthesis of the APU's output into 16-bit mono PCM, written as WAV by a
+    * consumer thread
+*/
+typedef struct audio_output AudioOutput;
+
+/* samples counts every sample synthesised; depth is how many wait in the ring for the writer; rateAdjust is the
+    * current dynamic rate correction in parts per million
+*/
+typedef struct audio_stats {
+    uint64_t samples;
+    uint64_t written;
+    uint64_t dropped;
+    uint32_t depth;
+    uint32_t maxDepth;
+    int32_t rateAdjust;
+} AudioStats;
+
+/* Profiling (profile.c), built with -DNES_PROFILE; without it the hooks below are empty and startProfiler fails.
+    *
+    * Counted exactly: executions and clock cycles per byte of PRG-ROM, so that each bank gets its own histogram and
+    * the opcode of every count is known from the image; the per-opcode and per-addressing-mode tables are summed from
+    * it when the report is written. Code run from RAM or PRG-RAM is counted per opcode, and by CPU address without
+    * cycles. Each instruction does one lookup and one update: `last` is the entry of the instruction running, and the
+    * next one to start (or profileSettle) adds it a count and the cycles since `start`. Counting happens in the
+    * interpreter, so a profiled machine never runs JIT-compiled code.
+    *
+    * Sampled: the host time spent in each subsystem. Entering one pushes it on `stack` (3 bits a level) and leaving
+    * pops it; a timer on the profiled thread's CPU clock records the stack and the running instruction every
+    * sampleMicroseconds, which is all the hot path pays for it.
+    *
+*/
+enum ProfileSubsystem {
+    PROFILE_NONE,
+    PROFILE_CPU,
+    PROFILE_PPU,
+    PROFILE_APU,
+    PROFILE_MAPPER,
+    PROFILE_IO,
+    PROFILE_SUBSYSTEMS
+};
+
+typedef struct profile_sampler ProfileSampler;
+
+typedef struct profile_count {
+    uint64_t count;
+    uint64_t cycles;
+} ProfileCount;
+
+typedef struct profiler {
+    ProfileCount* prg;
+    uint32_t prgSize;
+    volatile uint32_t stack;
+    ProfileCount* volatile last;
+    uint64_t start;
+    const uint8_t* image;
+    ProfileCount discard;
+    ProfileCount ramOpcodes[256];
+    uint64_t ramCounts[0x10000];
+    ProfileSampler* sampler;
+} Profiler;
+
+/* Execution traces (trace.c).
+    *
+    * One fixed-size record per instruction, taken just before it runs: the registers as nestest.log shows them, the
+    * instruction's bytes, the CPU cycle and where the PPU is at that cycle. A trace file is a TraceHeader followed by
+    * records; `skipped` counts the records a ring-only trace let go before the ones it kept. Fields are laid out without
+    * padding so files can be written and read as is.
+    *
+*/
+#define TRACE_MAGIC 0x4352544E
+#define TRACE_VERSION 1
+
+typedef struct trace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t skipped;
+} TraceHeader;
+
+typedef struct trace_record {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t scanline;
+    uint16_t dot;
+    uint8_t opcode;
+    uint8_t operand[2];
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t s;
+    uint8_t padding[2];
+} TraceRecord;
+
+typedef struct tracer Tracer;
+
+/* records counts every instruction traced; stalls counts the times the machine waited for the writer */
+typedef struct trace_stats {
+    uint64_t records;
+    uint64_t written;
+    uint64_t stalls;
+} TraceStats;
+
+typedef uint8_t (*readHandler)(CPU* cpu, uint16_t address);
+typedef void (*writeHandler)(CPU* cpu, uint16_t address, uint8_t value);
+
+/* One entry per 256-byte page of the CPU address space.
+    *
+    * A page is either backed by host memory, in which case loads and stores are a single indexed access through
+    * readPages/writePages, or owned by a handler (I/O registers, mapper writes) when the pointer is NULL.
+    * ROM pages have a read pointer and a write handler.
+    *
+*/
+#define PRG_RAM_OFF 0
+#define PRG_RAM_READ_ONLY 1
+#define PRG_RAM_READ_WRITE 2
+
+typedef struct bus {
+    uint8_t* readPages[0x100];
+    uint8_t* writePages[0x100];
+    readHandler readHandlers[0x100];
+    writeHandler writeHandlers[0x100];
+    uint8_t prgRamAccess;
+} Bus;
+
+/* Pre-decoded basic blocks (blocks.c).
+    *
+    * A block is the run of instructions from `pc` up to and including the first branch, jump, return or BRK, cut short
+    * at the end of its 256-byte page or after BLOCK_OPS instructions. Operands are read once when it is decoded: modes
+    * with a fixed effective address store it, indexed and indirect ones store their base. The cache is direct mapped
+    * and keyed by PC and the host page the code was read from, so a bank switch just stops blocks from matching until
+    * the bank comes back. Pages of RAM holding decoded code lose their fast write pointer, and a store that lands on
+    * decoded bytes drops the blocks it overlaps; dropping a block also ends it if it is the one running.
+    *
+*/
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NES_NO_THREADED_DISPATCH) && !defined(NES_NO_BLOCK_CACHE)
+#define NES_BLOCK_CACHE 1
+#endif
+
+#define BLOCK_OPS 16
+#define BLOCK_CACHE_SIZE 1024
+#define BLOCK_END 0x100
+
+/* index is the opcode, or BLOCK_END after the last instruction; next is the PC after the instruction */
+typedef struct decoded_op {
+    uint16_t index;
+    uint16_t operand;
+    uint16_t next;
+} DecodedOp;
+
+/* native is the block's x86-64 translation (jit.c), if any; heat counts entries until it is worth compiling */
+typedef struct block {
+    const uint8_t* host;
+    void* native;
+    uint16_t pc;
+    uint16_t length;
+    uint16_t heat;
+    DecodedOp ops[BLOCK_OPS + 1];
+} Block;
+
+typedef struct block_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    uint64_t uncached;
+} BlockStats;
+
+/* codeWrites keeps the write pointer of every page guarded for decoded code; codeBytes has one bit per byte of RAM
+    * and PRG-RAM that some block was decoded from, and writableBlocks counts the blocks decoded from either
+*/
+typedef struct block_cache {
+    Block blocks[BLOCK_CACHE_SIZE];
+    Block* running;
+    uint32_t writableBlocks;
+    uint8_t* codeWrites[0x100];
+    uint8_t codeBytes[(0x800 + 0x2000) / 8];
+    BlockStats stats;
+} BlockCache;
+
+/* Native translation of hot blocks (jit.c) needs the block cache, an x86-64 host and mmap; anywhere else
+    * enableJit fails and everything is interpreted. -DNES_NO_JIT leaves it out.
+*/
+#if defined(NES_BLOCK_CACHE) && defined(__x86_64__) && defined(__linux__) && !defined(NES_NO_JIT)
+#define NES_JIT 1
+#endif
+
+typedef struct jit Jit;
+
+/* What runNative tells the dispatcher: the block was not run natively, it was, or it stopped at an instruction
+    * (PC) that the interpreter has to run
+*/
+enum {
+    JIT_EXIT_NONE,
+    JIT_EXIT_DONE,
+    JIT_EXIT_FALLBACK
+};
+
+typedef struct jit_stats {
+    uint64_t compiled;
+    uint64_t rejected;
+    uint64_t entries;
+    uint64_t instructions;
+    uint64_t fallbacks;
+    uint64_t flushes;
+    uint64_t checked;
+} JitStats;
+
+static inline uint64_t clockNanoseconds(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* What the benches time with */
+static inline uint64_t nowNanoseconds(void) {
+    return clockNanoseconds(CLOCK_MONOTONIC);
+}
+
+/* FNV-1a, which the benches and batch print so runs can be compared. hashMore carries on from an earlier hash, so
+    * hashing pieces one after another gives the same as hashing them joined.
+*/
+#define FNV_BASIS 0xCBF29CE484222325ULL
+
+static inline uint64_t hashMore(uint64_t hash, const void* bytes, size_t size) {
+    const uint8_t* byte = bytes;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ byte[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static inline uint64_t hashBytes(const void* bytes, size_t size) {
+    return hashMore(FNV_BASIS, bytes, size);
+}
+
+/* A single-producer single-consumer ring of buffer pointers, for writer threads that take filled buffers from the
+    * emulation thread and hand empty ones back (video.c, trace.c). It is sized for a whole pool, so a pool of at most
+    * PTR_RING buffers never finds it full; only the producer pushes and only the consumer pops.
+*/
+#define PTR_RING 16
+
+typedef struct ptr_ring {
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    void* slots[PTR_RING];
+} PtrRing;
+
+static inline void pushPtr(PtrRing* ring, void* buffer) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring->slots[tail % PTR_RING] = buffer;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/* NULL means the ring is empty */
+static inline void* popPtr(PtrRing* ring) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+        return NULL;
+    }
+    void* buffer = ring->slots[head % PTR_RING];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return buffer;
+}
+
+/* How many buffers wait in the ring, as seen from either side */
+static inline uint32_t ptrRingDepth(PtrRing* ring) {
+    return atomic_load_explicit(&ring->tail, memory_order_relaxed) -
+        atomic_load_explicit(&ring->head, memory_order_relaxed);
+}
+
+/* Recording (video.c): Y4M is 4:4:4 YUV with a stream header, RGB24 is headerless packed R, G, B */
+#define VIDEO_Y4M 0
+#define VIDEO_RGB24 1
+
+typedef struct video_writer VideoWriter;
+
+/* frames counts every submitted frame, decimated or not; depth is how many kept frames wait for the writer */
+typedef struct video_stats {
+    uint64_t frames;
+    uint64_t submitted;
+    uint64_t written;
+    uint64_t dropped;
+    uint32_t depth;
+    uint32_t maxDepth;
+} VideoStats;
+
+/* PPU co-simulation (pputhread.c): the machine stays headless and a shadow on another thread draws its frames */
+typedef struct ppu_thread PpuThread;
+
+/* messages counts everything posted to the shadow; stalls counts posts that found the queue full */
+typedef struct ppu_thread_stats {
+    uint64_t messages;
+    uint64_t syncs;
+    uint64_t stalls;
+} PpuThreadStats;
+
+/* Lockstep machines (lanes.c): one byte per lane, so LANES 8-bit registers fill a 128-bit vector */
+#define LANES 16
+
+typedef struct lane_group LaneGroup;
+
+/* Instructions run per lane: by the vector path, by executeInstruction inside a step, and by runUntil after a lane
+    * was detached; steps counts vector dispatches
+*/
+typedef struct lane_stats {
+    uint64_t steps;
+    uint64_t lockstep;
+    uint64_t fallbacks;
+    uint64_t scalar;
+    uint64_t detaches;
+} LaneStats;
+
+// https://www.nesdev.org/wiki/Standard_controller
+/* Bits of CPU.buttons, in the order the controller reports them */
+#define BUTTON_A 0x01
+#define BUTTON_B 0x02
+#define BUTTON_SELECT 0x04
+#define BUTTON_START 0x08
+#define BUTTON_UP 0x10
+#define BUTTON_DOWN 0x20
+#define BUTTON_LEFT 0x40
+#define BUTTON_RIGHT 0x80
+
+/* Cartridge RAM a board has at most: 8KB of PRG-RAM at $6000-$7FFF and 8KB of CHR-RAM in place of CHR-ROM */
+#define PRG_RAM_SIZE 0x2000
+#define CHR_RAM_SIZE 0x2000
+/* A trainer sits between the header and PRG-ROM and is loaded at $7000 */
+#define TRAINER_SIZE 0x200
+
+/* A machine's mutable state, in one 64-byte aligned block (createCPU) with what every instruction touches first. The
+    * cartridge is shared: PRG/CHR-ROM are read through game, and only the RAM the board actually has is allocated
+    * (loadROM). The frame buffer and the decoded-block cache are per machine but live outside the block and are only
+    * allocated once the machine draws or runs cached blocks, so a headless machine never has a frame buffer
+    * (printFootprint).
+*/
+struct cpu {
+    regs registers;
+    uint8_t irq;
+    uint8_t nmi;
+    IdleLoop idle;
+    Clock clock;
+    Bus bus;
+    uint8_t ram[0x800];
+    PPU ppu;
+    APU apu;
+    MapperState mapperState;
+    uint8_t ioRegisters[0x18];
+    /* Buttons held on each standard controller (set by the host), and the shift registers $4016/$4017 read from */
+    uint8_t buttons[2];
+    uint8_t controllers[2];
+    uint8_t* chrPages[8];
+    uint8_t* prgRam;
+    uint8_t* chrRam;
+    const GameInformation* game;
+    const Mapper* mapper;
+    const RenderKernel* renderKernel;
+    /* Set for machines nobody watches: the PPU keeps every flag and interrupt exact but draws nothing into graphics */
+    uint8_t headless;
+    Graphics* graphics;
+    TileCache* tiles;
+    BlockCache* blocks;
+    Jit* jit;
+    PpuThread* ppuThread;
+    /* Where the APU's output goes while somebody listens; NULL skips synthesis but keeps every channel exact */
+    AudioOutput* audio;
+    Profiler* profile;
+    Tracer* trace;
+};
+
+/* A cartridge board.
+    *
+    * write receives every CPU write to $8000-$FFFF. sync rebuilds the PRG page pointers on the bus and the 1KB CHR
+    * pages in cpu->chrPages from cpu->mapperState, so a bank switch only swaps pointers and a restored state only
+    * needs another sync. scanline is clocked once per rendered scanline for boards that count them (MMC3), and
+    * irqScanlines tells the scheduler how many more clocks it takes until the board raises IRQ (0 for never).
+    *
+*/
+struct mapper {
+    uint16_t number;
+    const char* name;
+    void (*power)(CPU* cpu);
+    writeHandler write;
+    void (*sync)(CPU* cpu);
+    void (*scanline)(CPU* cpu);
+    uint32_t (*irqScanlines)(CPU* cpu);
+};
+
+/* Save state: a fixed-size, pointer-free image of everything a machine needs to resume.
+    *
+    * Fields are laid out without padding so the struct can be compared, XORed and written byte for byte.
+    * New components append their state here and bump STATE_VERSION.
+    *
+*/
+#define STATE_MAGIC 0x5453454E
+#define STATE_VERSION 6
+
+typedef struct machine_state {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t cycles;
+    uint64_t skipCycles;
+    uint16_t pc;
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t s;
+    uint8_t p;
+    uint8_t reserved;
+    uint8_t ram[0x800];
+    uint8_t prgRam[PRG_RAM_SIZE];
+    PPU ppu;
+    APU apu;
+    uint8_t ioRegisters[0x18];
+    uint8_t chrRam[CHR_RAM_SIZE];
+    MapperState mapper;
+    uint8_t irq;
+    uint8_t nmi;
+    uint8_t controllers[2];
+    uint8_t padding[4];
+} MachineState;
+
+typedef struct rewind_buffer RewindBuffer;
+
+/* What the CLI and the rewind check give a ring: a few MB keeps minutes of history at 60 fps */
+#define REWIND_BUDGET (4u << 20)
+#define REWIND_KEYFRAME_INTERVAL 60
+
+/* Run-ahead (runahead.c): frames are shown from a few frames in the future, then the machine goes back */
+typedef struct run_ahead RunAhead;
+
+/* speculative counts frames run ahead and thrown away; the times add up every snapshot and restore */
+typedef struct run_ahead_stats {
+    uint64_t frames;
+    uint64_t speculative;
+    uint64_t snapshotNanoseconds;
+    uint64_t restoreNanoseconds;
+} RunAheadStats;
+
+/* Input movies (movie.c).
+    *
+    * A movie is the buttons held on both controllers for every frame, starting from a saved state. The file is a
+    * MovieHeader followed by two bytes per frame (controller 1, controller 2), with a MachineState in front of the
+    * buttons of every keyframeInterval'th frame starting at frame 0. Where everything lives follows from the frame
+    * number alone, so seeking needs no index and a recording can be cut short at any frame.
+    *
+*/
+#define MOVIE_MAGIC 0x4D53454E
+#define MOVIE_VERSION 1
+
+typedef struct movie_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t romHash;
+    uint32_t keyframeInterval;
+    uint32_t reserved;
+} MovieHeader;
+
+typedef struct movie Movie;
+
+/* desyncs counts keyframes that playback reached in a different state than the recording; replayed counts the frames
+    * seeks had to run from a keyframe
+*/
+typedef struct movie_stats {
+    uint64_t frame;
+    uint64_t frames;
+    uint64_t keyframesChecked;
+    uint64_t desyncs;
+    uint64_t firstDesync;
+    uint64_t replayed;
+} MovieStats;
+
+/* Every handler receives the effective address produced by its addressing mode (unused for implied ones) */
+typedef void (*instrFunc)(CPU* cpu, uint16_t address);
+
+typedef struct opcode {
+    const char* mnemonic;
+    instrFunc handler;
+    enum AddressingMode mode;
+    uint8_t length;
+    uint8_t cycles;
+    uint8_t pageCycle;
+} Opcode;
+
+extern const Opcode opcodeTable[256];
+
+/* The architectural P byte; in the lazy build this is the only place it is assembled */
+static inline uint8_t getStatus(CPU* cpu) {
+#ifdef NES_LAZY_FLAGS
+    return (cpu->registers.p & 0b00111100)
+        | cpu->registers.carry
+        | (FLAG_Z(cpu) ? 0b00000010 : 0)
+        | (FLAG_V(cpu) ? 0b01000000 : 0)
+        | FLAG_N(cpu);
+#else
+    return cpu->registers.p;
+#endif
+}
+
+static inline void setStatus(CPU* cpu, uint8_t p) {
+    cpu->registers.p = p;
+#ifdef NES_LAZY_FLAGS
+    cpu->registers.carry = GET_CARRY(p);
+    cpu->registers.zeroResult = !GET_ZERO(p);
+    cpu->registers.negativeResult = GET_NEGATIVE(p);
+    cpu->registers.overflow = GET_OVERFLOW(p) << 1;
+#ifdef NES_LAZY_FLAGS_CHECK
+    cpu->registers.shadowStatus = p;
+#endif
+#endif
+}
+
+// https://www.nesdev.org/wiki/CPU_memory_map
+static inline uint8_t readByte(CPU* cpu, uint16_t address) {
+    uint8_t* page = cpu->bus.readPages[address >> 8];
+    if (page) {
+        return page[address & 0xFF];
+    }
+    return cpu->bus.readHandlers[address >> 8](cpu, address);
+}
+
+static inline uint16_t readWord(CPU* cpu, uint16_t address) {
+    return readByte(cpu, address) | (readByte(cpu, (uint16_t)(address + 1)) << 8);
+}
+
+static inline void writeByte(CPU* cpu, uint16_t address, uint8_t value) {
+    cpu->idle.clean = 0;
+    uint8_t* page = cpu->bus.writePages[address >> 8];
+    if (page) {
+        page[address & 0xFF] = value;
+        return;
+    }
+    cpu->bus.writeHandlers[address >> 8](cpu, address, value);
+}
+
+static inline void writeWord(CPU* cpu, uint16_t address, uint16_t value) {
+    writeByte(cpu, address, value & 0xFF);
+    writeByte(cpu, (uint16_t)(address + 1), value >> 8);
+}
+
+#ifdef NES_PROFILE
+#define PROFILE_ENTER(cpu, subsystem) \
+    do { \
+        if ((cpu)->profile) (cpu)->profile->stack = ((cpu)->profile->stack << 3) | (subsystem); \
+    } while (0)
+#define PROFILE_LEAVE(cpu) \
+    do { \
+        if ((cpu)->profile) (cpu)->profile->stack >>= 3; \
+    } while (0)
+
+/* Charges the instruction that ran last with its count and the cycles up to now */
+static inline void profileSettle(CPU* cpu) {
+    Profiler* profile = cpu->profile;
+    if (profile) {
+        profile->last->count++;
+        profile->last->cycles += cpu->clock.cycles - profile->start;
+        profile->last = &profile->discard;
+        profile->start = cpu->clock.cycles;
+    }
+}
+
+/* Starts the clock for the next instruction without charging what came before it (other slices, interrupts) */
+static inline void profileRestart(CPU* cpu) {
+    if (cpu->profile) {
+        cpu->profile->start = cpu->clock.cycles;
+    }
+}
+
+/* Before `opcode` runs at PC: charges the previous instruction and looks up the entry for this one. Nothing is carried
+    * across the instruction itself.
+*/
+static inline void profileInstruction(CPU* cpu, uint8_t opcode) {
+    Profiler* profile = cpu->profile;
+    if (!profile) {
+        return;
+    }
+    ProfileCount* last = profile->last;
+    last->count++;
+    last->cycles += cpu->clock.cycles - profile->start;
+    profile->start = cpu->clock.cycles;
+    uint16_t pc = cpu->registers.pc;
+    const uint8_t* host = cpu->bus.readPages[pc >> 8];
+    uintptr_t offset = (uintptr_t) host + (pc & 0xFF) - (uintptr_t) profile->image;
+    if (host && offset < profile->prgSize) {
+        profile->last = &profile->prg[offset];
+    } else {
+        profile->ramCounts[pc]++;
+        profile->last = &profile->ramOpcodes[opcode];
+    }
+}
+#define PROFILE_ACTIVE(cpu) ((cpu)->profile != NULL)
+#else
+#define PROFILE_ENTER(cpu, subsystem) ((void) 0)
+#define PROFILE_LEAVE(cpu) ((void) 0)
+#define PROFILE_ACTIVE(cpu) 0
+#endif
+
+/* bus.c */
+void mapPages(CPU* cpu, uint16_t start, uint16_t end, uint8_t* memory, uint32_t size, int writable);
+void mapHandlers(CPU* cpu, uint16_t start, uint16_t end, readHandler read, writeHandler write);
+void mapPrgRam(CPU* cpu, uint8_t access);
+void initBus(CPU* cpu);
+
+/* cpu.c */
+void executeInstruction(uint8_t opcode, CPU* cpu);
+uint64_t runUntil(CPU* cpu, uint64_t cycle);
+void resetCPU(CPU* cpu);
+int serviceInterrupts(CPU* cpu);
+void idleLoop(CPU* cpu, uint16_t head);
+
+/* ppu.c */
+uint8_t readPPURegister(CPU* cpu, uint16_t address);
+void writePPURegister(CPU* cpu, uint16_t address, uint8_t value);
+void writeOamDma(CPU* cpu, uint8_t page);
+void resetPPU(CPU* cpu);
+void ppuCatchUp(CPU* cpu);
+uint64_t ppuStatusStableUntil(CPU* cpu);
+void ppuEvent(CPU* cpu);
+void mapperIrqEvent(CPU* cpu);
+void scheduleMapperIrq(CPU* cpu);
+
+/* apu.c */
+void apuCatchUp(CPU* cpu);
+uint8_t readApuStatus(CPU* cpu);
+void writeApuRegister(CPU* cpu, uint16_t address, uint8_t value);
+void writeFrameCounter(CPU* cpu, uint8_t value);
+void frameCounterEvent(CPU* cpu);
+void dmcEvent(CPU* cpu);
+void resetAPU(CPU* cpu);
+
+/* audio.c */
+AudioOutput* openAudio(const char* path, uint32_t rate, int dynamic);
+void mixAudio(AudioOutput* audio, uint64_t cycle, int pulse, int tnd);
+void submitAudioFrame(AudioOutput* audio, CPU* cpu);
+void getAudioStats(AudioOutput* audio, AudioStats* stats);
+int closeAudio(AudioOutput* audio);
+int benchmarkAudio(const GameInformation* game, uint64_t frames);
+
+/* blocks.c */
+Block* decodeBlock(CPU* cpu, Block* block, uint16_t pc, const uint8_t* host);
+void invalidateBlocks(CPU* cpu, const uint8_t* memory, size_t size);
+void flushBlocks(CPU* cpu);
+void remapBlocks(CPU* cpu, uint16_t start, uint16_t end);
+
+/* jit.c */
+int enableJit(CPU* cpu, int check);
+void destroyJit(Jit* jit);
+int getJitStats(const CPU* cpu, JitStats* stats);
+int runNative(CPU* cpu, Block* block, uint64_t* executed);
+
+/* lanes.c */
+LaneGroup* createLaneGroup(CPU* const* cpus, int count);
+void destroyLaneGroup(LaneGroup* group);
+void runLaneFrame(LaneGroup* group);
+void getLaneStats(const LaneGroup* group, LaneStats* stats);
+int benchmarkLanes(const GameInformation* game, uint64_t frames);
+
+/* scheduler.c */
+void scheduleEvent(CPU* cpu, enum ClockEvent event, uint64_t cycle);
+void runEvents(CPU* cpu);
+void resetEvents(CPU* cpu);
+
+/* pputhread.c */
+int startPpuThread(CPU* cpu);
+void stopPpuThread(CPU* cpu);
+void syncPpuThread(CPU* cpu);
+void reseedPpuThread(CPU* cpu);
+void postPpuRead(CPU* cpu, uint16_t address);
+void postPpuWrite(CPU* cpu, uint16_t address, uint8_t value);
+void postOamDma(CPU* cpu);
+void postMapperWrite(CPU* cpu, uint16_t address, uint8_t value);
+void ppuThreadEvent(CPU* cpu);
+void getPpuThreadStats(const CPU* cpu, PpuThreadStats* stats);
+int benchmarkPpuThread(const GameInformation* game, uint64_t frames);
+
+/* tiles.c */
+void destroyTileCache(TileCache* cache);
+void resetTileCache(CPU* cpu);
+void mapTiles(CPU* cpu, int slot, uint32_t page, const uint8_t* source);
+void decodeTile(TileCache* cache, TilePage* page, int tile);
+void invalidateTile(CPU* cpu, uint16_t address);
+void invalidateTiles(CPU* cpu);
+int benchmarkTileCache(const GameInformation* game, uint64_t frames);
+
+/* render.c */
+const RenderKernel* findRenderKernel(const char* name);
+int benchmarkRenderKernels(const GameInformation* game, uint64_t frames);
+int benchmarkHeadless(const GameInformation* game, uint64_t frames);
+
+/* mapper.c */
+const Mapper* findMapper(uint16_t number);
+void writeMapper(CPU* cpu, uint16_t address, uint8_t value);
+
+/* rom.c */
+int parseROM(uint8_t* data, size_t size, GameInformation* game);
+int openROM(const char* path, GameInformation* game);
+void closeROM(GameInformation* game);
+
+/* nes.c */
+CPU* createCPU(void);
+void destroyCPU(CPU* cpu);
+int loadROM(CPU* cpu, const GameInformation* game);
+Graphics* getGraphics(CPU* cpu);
+void seedRAM(CPU* cpu, uint64_t seed);
+void runFrame(CPU* cpu);
+void printFootprint(const GameInformation* game);
+
+/* state.c */
+void captureState(CPU* cpu, MachineState* state);
+int restoreState(CPU* cpu, const MachineState* state);
+int saveStateFile(CPU* cpu, const char* path);
+int loadStateFile(CPU* cpu, const char* path);
+
+/* rewind.c */
+RewindBuffer* createRewindBuffer(size_t budget, uint32_t keyframeInterval);
+void destroyRewindBuffer(RewindBuffer* rewind);
+void rewindCapture(RewindBuffer* rewind, CPU* cpu);
+int rewindRestore(RewindBuffer* rewind, CPU* cpu, uint64_t frame);
+uint64_t rewindOldestFrame(const RewindBuffer* rewind);
+uint64_t rewindNewestFrame(const RewindBuffer* rewind);
+size_t rewindBytesUsed(const RewindBuffer* rewind);
+int benchmarkRewind(const GameInformation* game, uint64_t frames);
+
+/* runahead.c */
+RunAhead* createRunAhead(CPU* cpu, uint32_t frames, int secondary);
+void destroyRunAhead(RunAhead* ahead);
+const Graphics* runAheadFrame(RunAhead* ahead);
+void getRunAheadStats(const RunAhead* ahead, RunAheadStats* stats);
+int benchmarkRunAhead(const GameInformation* game, uint64_t frames);
+
+/* movie.c */
+Movie* recordMovie(const char* path, CPU* cpu, uint32_t keyframeInterval);
+Movie* playMovie(const char* path, CPU* cpu);
+int movieFrame(Movie* movie, CPU* cpu);
+int seekMovie(Movie* movie, CPU* cpu, uint64_t frame);
+void getMovieStats(const Movie* movie, MovieStats* stats);
+int closeMovie(Movie* movie);
+int importFm2(const char* fm2, const char* path, const GameInformation* game, uint32_t keyframeInterval);
+
+/* video.c */
+VideoWriter* openVideo(const char* path, int format, uint32_t decimation, int lossless);
+void submitVideoFrame(VideoWriter* video, CPU* cpu);
+void getVideoStats(VideoWriter* video, VideoStats* stats);
+int closeVideo(VideoWriter* video);
+
+/* profile.c */
+int startProfiler(CPU* cpu, uint32_t sampleMicroseconds);
+Profiler* stopProfiler(CPU* cpu);
+void destroyProfiler(Profiler* profile);
+int writeProfile(const Profiler* profile, const char* report, const char* stacks);
+
+/* trace.c */
+int startTrace(CPU* cpu, const char* path, uint32_t ring);
+int stopTrace(CPU* cpu);
+uint64_t runTraced(CPU* cpu);
+void getTraceStats(const CPU* cpu, TraceStats* stats);
+int decodeTrace(const char* input, const char* output);
+
+/* batch.c */
+int runBatch(const char* jobFile, int threads, uint64_t defaultFrames, int jit, int headless);
+
+/* bench.c */
+int runBenchSuite(const char* const* roms, int romCount, uint64_t frames, uint64_t instructions, int counters,
+    const char* json);
+
+#endif
@@ -0,0 +1,641 @@
+#include <string.h>
+
+#include "nes.h"
+
+// https://www.nesdev.org/wiki/PPU
+/* Catch-up PPU.
+    *
+    * Registers, flags and interrupts follow the real dot timing: the PPU is advanced to the CPU's clock before every
+    * register access, mapper write and scheduled PPU or mapper IRQ event, and vblank, sprite 0 hit, the loopy v/t updates and the
+    * MMC3 scanline clock all happen on the dot they happen on in hardware. Pixels are not: a visible scanline is
+    * rendered in one go when the PPU reaches its first dot, from the registers as they are at that point, which is
+    * all that scroll splits done in horizontal blank need.
+    *
+*/
+
+#define CTRL_INCREMENT_32 0x04
+#define CTRL_SPRITE_TABLE 0x08
+#define CTRL_BACKGROUND_TABLE 0x10
+#define CTRL_TALL_SPRITES 0x20
+#define CTRL_NMI 0x80
+
+#define MASK_GREYSCALE 0x01
+#define MASK_BACKGROUND_LEFT 0x02
+#define MASK_SPRITES_LEFT 0x04
+#define MASK_BACKGROUND 0x08
+#define MASK_SPRITES 0x10
+
+#define STATUS_OVERFLOW 0x20
+#define STATUS_SPRITE_ZERO 0x40
+#define STATUS_VBLANK 0x80
+
+/* 36 tiles cover 256 pixels plus up to 7 of fine X scroll, rounded up to the 4-tile step of the kernels */
+#define LINE_TILES 36
+
+static inline int renderingEnabled(const PPU* ppu) {
+    return ppu->mask & (MASK_BACKGROUND | MASK_SPRITES);
+}
+
+// https://www.nesdev.org/wiki/Mirroring
+/* Physical 1KB nametable for logical table 0-3 under the cartridge's current mirroring */
+static inline uint8_t* nametable(CPU* cpu, int table) {
+    switch (cpu->mapperState.mirroring) {
+        case MIRROR_HORIZONTAL:
+            table >>= 1;
+            break;
+        case MIRROR_VERTICAL:
+            table &= 1;
+            break;
+        case MIRROR_SINGLE_LOW:
+            table = 0;
+            break;
+        case MIRROR_SINGLE_HIGH:
+            table = 1;
+            break;
+    }
+    return cpu->ppu.vram + table * 0x400;
+}
+
+static inline uint8_t readChr(CPU* cpu, uint16_t address) {
+    return cpu->chrPages[(address >> 10) & 0x07][address & 0x3FF];
+}
+
+/* $3F10/$3F14/$3F18/$3F1C are mirrors of $3F00/$3F04/$3F08/$3F0C */
+static inline uint8_t paletteIndex(uint16_t address) {
+    address &= 0x1F;
+    return (address & 0x13) == 0x10 ? address & ~0x10 : address;
+}
+
+// https://www.nesdev.org/wiki/PPU_memory_map
+static uint8_t readVideoMemory(CPU* cpu, uint16_t address) {
+    address &= 0x3FFF;
+    if (address < 0x2000) {
+        return readChr(cpu, address);
+    }
+    if (address < 0x3F00) {
+        return nametable(cpu, (address >> 10) & 0x03)[address & 0x3FF];
+    }
+    return cpu->ppu.palette[paletteIndex(address)];
+}
+
+static void writeVideoMemory(CPU* cpu, uint16_t address, uint8_t value) {
+    address &= 0x3FFF;
+    if (address < 0x2000) {
+        /* CHR-ROM ignores writes */
+        if (cpu->chrRam) {
+            cpu->chrPages[address >> 10][address & 0x3FF] = value;
+            if (cpu->tiles) {
+                invalidateTile(cpu, address);
+            }
+        }
+    } else if (address < 0x3F00) {
+        nametable(cpu, (address >> 10) & 0x03)[address & 0x3FF] = value;
+    } else {
+        cpu->ppu.palette[paletteIndex(address)] = value & 0x3F;
+    }
+}
+
+static inline uint8_t reverseBits(uint8_t value) {
+    value = (value & 0xF0) >> 4 | (value & 0x0F) << 4;
+    value = (value & 0xCC) >> 2 | (value & 0x33) << 2;
+    return (value & 0xAA) >> 1 | (value & 0x55) << 1;
+}
+
+/* Nametable holding tile `tile` of the current line, counting from the tile v points at, and that tile's column */
+static inline const uint8_t* lineTile(CPU* cpu, int tile, int* coarseX) {
+    PPU* ppu = &cpu->ppu;
+    int column = (ppu->v & 0x1F) + tile;
+    const uint8_t* names = nametable(cpu, ((ppu->v >> 10) & 0x03) ^ ((column >> 5) & 0x01));
+    *coarseX = column & 0x1F;
+    return names;
+}
+
+/* Address of the low plane of the current line's row in the background tile `name` */
+static inline uint16_t backgroundPattern(const PPU* ppu, uint8_t name) {
+    return ((ppu->ctrl & CTRL_BACKGROUND_TABLE) ? 0x1000 : 0) + name * 16 + ((ppu->v >> 12) & 0x07);
+}
+
+/* The 8 pixels (0-3) of the row of the tile at pattern address `address`, from the tile cache */
+static inline const uint8_t* cachedRow(CPU* cpu, uint16_t address, int flipped) {
+    TileCache* cache = cpu->tiles;
+    TilePage* page = cache->slots[(address >> 10) & 0x07];
+    int tile = (address >> 4) & 0x3F;
+    if (__builtin_expect(!((page->valid >> tile) & 1), 0)) {
+        decodeTile(cache, page, tile);
+    } else {
+        cache->stats.hits++;
+    }
+    return flipped ? page->flipped[tile][address & 0x07] : page->rows[tile][address & 0x07];
+}
+
+// https://www.nesdev.org/wiki/PPU_scrolling
+/* Cached rows only need their palette bits added; otherwise the kernel decodes the planes of the whole line at once */
+static void renderBackground(CPU* cpu, uint8_t* line) {
+    PPU* ppu = &cpu->ppu;
+    uint8_t low[LINE_TILES], high[LINE_TILES], attributes[LINE_TILES];
+    uint8_t pixels[LINE_TILES * 8];
+    int coarseY = (ppu->v >> 5) & 0x1F;
+
+    for (int tile = 0; tile < LINE_TILES; tile++) {
+        int coarseX;
+        const uint8_t* names = lineTile(cpu, tile, &coarseX);
+        uint16_t pattern = backgroundPattern(ppu, names[(coarseY << 5) | coarseX]);
+        uint8_t attribute = names[0x3C0 | ((coarseY >> 2) << 3) | (coarseX >> 2)];
+        attribute = (attribute >> (((coarseY & 0x02) << 1) | (coarseX & 0x02))) & 0x03;
+        if (cpu->tiles) {
+            uint64_t row;
+            memcpy(&row, cachedRow(cpu, pattern, 0), 8);
+            row |= 0x0101010101010101ULL * (uint8_t)(attribute << 2);
+            memcpy(pixels + tile * 8, &row, 8);
+        } else {
+            low[tile] = readChr(cpu, pattern);
+            high[tile] = readChr(cpu, pattern + 8);
+            attributes[tile] = attribute;
+        }
+    }
+
+    if (!cpu->tiles) {
+        cpu->renderKernel->decodeTiles(low, high, attributes, LINE_TILES, pixels);
+    }
+    memcpy(line, pixels + ppu->fineX, SCREEN_WIDTH);
+}
+
+/* Pattern address of the current scanline's row of a sprite that is on it, after vertical flip */
+static inline uint16_t spritePattern(CPU* cpu, const uint8_t* entry, int height) {
+    uint8_t tile = entry[1];
+    int row = cpu->ppu.scanline - (entry[0] + 1);
+    if (entry[2] & 0x80) {
+        row = height - 1 - row;
+    }
+    if (height == 16) {
+        return ((tile & 0x01) ? 0x1000 : 0) + (tile & 0xFE) * 16 + (row >= 8 ? 16 : 0) + (row & 0x07);
+    }
+    return ((cpu->ppu.ctrl & CTRL_SPRITE_TABLE) ? 0x1000 : 0) + tile * 16 + row;
+}
+
+/* The two planes of that row, flipped so bit 7 is its leftmost pixel */
+static inline void fetchSpriteRow(CPU* cpu, const uint8_t* entry, int height, uint8_t* low, uint8_t* high) {
+    uint16_t pattern = spritePattern(cpu, entry, height);
+    *low = readChr(cpu, pattern);
+    *high = readChr(cpu, pattern + 8);
+    if (entry[2] & 0x40) {
+        *low = reverseBits(*low);
+        *high = reverseBits(*high);
+    }
+}
+
+// https://www.nesdev.org/wiki/PPU_sprite_evaluation
+/* Evaluates OAM for the current scanline and draws its first eight sprites. Lower OAM indices win, so sprites are
+    * drawn from the back and each opaque pixel overwrites.
+*/
+static void renderSprites(CPU* cpu, uint8_t* line) {
+    PPU* ppu = &cpu->ppu;
+    int height = (ppu->ctrl & CTRL_TALL_SPRITES) ? 16 : 8;
+    uint8_t found[8];
+    int count = 0;
+
+    for (int sprite = 0; sprite < 64; sprite++) {
+        int row = ppu->scanline - (ppu->oam[sprite * 4] + 1);
+        if (row < 0 || row >= height) {
+            continue;
+        }
+        if (count == 8) {
+            ppu->status |= STATUS_OVERFLOW;
+            break;
+        }
+        found[count++] = sprite;
+    }
+
+    for (int i = count - 1; i >= 0; i--) {
+        const uint8_t* entry = &ppu->oam[found[i] * 4];
+        uint8_t attributes = entry[2];
+        uint8_t pixels[8];
+        if (cpu->tiles) {
+            memcpy(pixels, cachedRow(cpu, spritePattern(cpu, entry, height), attributes & 0x40), 8);
+        } else {
+            uint8_t low, high;
+            fetchSpriteRow(cpu, entry, height, &low, &high);
+            for (int bit = 0; bit < 8; bit++) {
+                pixels[bit] = ((low >> (7 - bit)) & 0x01) | (((high >> (7 - bit)) & 0x01) << 1);
+            }
+        }
+
+        uint8_t flags = 0x10 | ((attributes & 0x03) << 2) | ((attributes & 0x20) ? 0x20 : 0) | (found[i] == 0 ? 0x40 : 0);
+        for (int bit = 0; bit < 8; bit++) {
+            int x = entry[3] + bit;
+            uint8_t colour = pixels[bit];
+            if (x < SCREEN_WIDTH && colour) {
+                line[x] = flags | colour;
+            }
+        }
+    }
+}
+
+/* A scanline without pixels, for headless machines: only what the CPU can observe is worked out, the same way
+    * renderScanline would. Sprite overflow needs the OAM scan, and sprite 0 hit only needs sprite 0's row and the two
+    * background tiles under it.
+*/
+static void scanScanline(CPU* cpu) {
+    PPU* ppu = &cpu->ppu;
+    if (!(ppu->mask & MASK_SPRITES)) {
+        return;
+    }
+    int height = (ppu->ctrl & CTRL_TALL_SPRITES) ? 16 : 8;
+    int count = 0;
+    for (int sprite = 0; sprite < 64; sprite++) {
+        int row = ppu->scanline - (ppu->oam[sprite * 4] + 1);
+        if (row < 0 || row >= height) {
+            continue;
+        }
+        if (count == 8) {
+            ppu->status |= STATUS_OVERFLOW;
+            break;
+        }
+        count++;
+    }
+
+    int row = ppu->scanline - (ppu->oam[0] + 1);
+    if (!(ppu->mask & MASK_BACKGROUND) || (ppu->status & STATUS_SPRITE_ZERO) || row < 0 || row >= height) {
+        return;
+    }
+    uint8_t low, high;
+    fetchSpriteRow(cpu, ppu->oam, height, &low, &high);
+    int x = ppu->oam[3];
+    /* Bit 7 - i of each mask is pixel x + i */
+    uint8_t sprite = low | high;
+    if (!sprite) {
+        return;
+    }
+
+    int position = ppu->fineX + x;
+    int coarseY = (ppu->v >> 5) & 0x1F;
+    uint16_t background = 0;
+    for (int tile = 0; tile < 2; tile++) {
+        int coarseX;
+        const uint8_t* names = lineTile(cpu, (position >> 3) + tile, &coarseX);
+        uint16_t pattern = backgroundPattern(ppu, names[(coarseY << 5) | coarseX]);
+        background = (background << 8) | readChr(cpu, pattern) | readChr(cpu, pattern + 8);
+    }
+    uint8_t opaque = sprite & (uint8_t)((background << (position & 0x07)) >> 8);
+
+    /* Left-column clipping, the right edge, and no hit at x = 255 */
+    int clipLeft = (ppu->mask & (MASK_BACKGROUND_LEFT | MASK_SPRITES_LEFT)) != (MASK_BACKGROUND_LEFT | MASK_SPRITES_LEFT);
+    for (int bit = 0; bit < 8; bit++) {
+        int pixel = x + bit;
+        if ((opaque & (0x80 >> bit)) && pixel < 255 && !(clipLeft && pixel < 8)) {
+            ppu->spriteZeroDot = pixel + 1;
+            return;
+        }
+    }
+}
+
+static void renderScanline(CPU* cpu) {
+    PPU* ppu = &cpu->ppu;
+    /* Without memory for a frame buffer the machine carries on as if headless */
+    if (cpu->headless || (!cpu->graphics && !getGraphics(cpu))) {
+        if (renderingEnabled(ppu)) {
+            scanScanline(cpu);
+        }
+        return;
+    }
+    uint8_t* out = cpu->graphics->screen + ppu->scanline * SCREEN_WIDTH;
+    uint8_t colorMask = (ppu->mask & MASK_GREYSCALE) ? 0x30 : 0x3F;
+
+    if (!renderingEnabled(ppu)) {
+        memset(out, ppu->palette[0] & colorMask, SCREEN_WIDTH);
+        return;
+    }
+
+    uint8_t background[SCREEN_WIDTH];
+    uint8_t sprites[SCREEN_WIDTH];
+    memset(background, 0, sizeof(background));
+    memset(sprites, 0, sizeof(sprites));
+    if (ppu->mask & MASK_BACKGROUND) {
+        renderBackground(cpu, background);
+        if (!(ppu->mask & MASK_BACKGROUND_LEFT)) {
+            memset(background, 0, 8);
+        }
+    }
+    if (ppu->mask & MASK_SPRITES) {
+        renderSprites(cpu, sprites);
+        if (!(ppu->mask & MASK_SPRITES_LEFT)) {
+            memset(sprites, 0, 8);
+        }
+    }
+
+    /* Pixel x is output on dot x + 1, and sprite 0 never hits at x = 255 */
+    int hit = cpu->renderKernel->composite(background, sprites, ppu->palette, colorMask, out);
+    if (hit >= 0 && hit < 255 && !(ppu->status & STATUS_SPRITE_ZERO)) {
+        ppu->spriteZeroDot = hit + 1;
+    }
+}
+
+static void incrementY(PPU* ppu) {
+    if ((ppu->v & 0x7000) != 0x7000) {
+        ppu->v += 0x1000;
+        return;
+    }
+    ppu->v &= ~0x7000;
+    int coarseY = (ppu->v >> 5) & 0x1F;
+    if (coarseY == 29) {
+        coarseY = 0;
+        ppu->v ^= 0x0800;
+    } else if (coarseY == 31) {
+        coarseY = 0;
+    } else {
+        coarseY++;
+    }
+    ppu->v = (ppu->v & ~0x03E0) | (coarseY << 5);
+}
+
+/* The pre-render line is one dot shorter on odd frames while rendering */
+static inline uint16_t scanlineLength(const PPU* ppu, uint16_t scanline, uint64_t frame) {
+    if (scanline == PRE_RENDER_SCANLINE && (frame & 1) && renderingEnabled(ppu)) {
+        return DOTS_PER_SCANLINE - 1;
+    }
+    return DOTS_PER_SCANLINE;
+}
+
+/* The next dot after the current one where the PPU does something the CPU can see */
+static uint16_t nextEventDot(const PPU* ppu) {
+    static const uint16_t dots[] = { 1, 256, 257, 260, 280 };
+    uint16_t next = scanlineLength(ppu, ppu->scanline, ppu->frame);
+    for (size_t i = 0; i < sizeof(dots) / sizeof(dots[0]); i++) {
+        if (dots[i] > ppu->dot && dots[i] < next) {
+            next = dots[i];
+            break;
+        }
+    }
+    if (ppu->spriteZeroDot > ppu->dot && ppu->spriteZeroDot < next) {
+        next = ppu->spriteZeroDot;
+    }
+    return next;
+}
+
+static void runEvent(CPU* cpu) {
+    PPU* ppu = &cpu->ppu;
+    int visible = ppu->scanline < SCREEN_HEIGHT;
+    int prerender = ppu->scanline == PRE_RENDER_SCANLINE;
+
+    if (ppu->dot == scanlineLength(ppu, ppu->scanline, ppu->frame)) {
+        ppu->dot = 0;
+        ppu->scanline = (ppu->scanline + 1) % SCANLINES_PER_FRAME;
+        ppu->spriteZeroDot = 0;
+        return;
+    }
+
+    switch (ppu->dot) {
+        case 1:
+            if (visible) {
+                renderScanline(cpu);
+            } else if (ppu->scanline == VBLANK_SCANLINE) {
+                ppu->status |= STATUS_VBLANK;
+                ppu->frame++;
+                if (ppu->ctrl & CTRL_NMI) {
+                    cpu->nmi = 1;
+                }
+            } else if (prerender) {
+                ppu->status &= ~(STATUS_VBLANK | STATUS_SPRITE_ZERO | STATUS_OVERFLOW);
+            }
+            break;
+        case 256:
+            if ((visible || prerender) && renderingEnabled(ppu)) {
+                incrementY(ppu);
+            }
+            break;
+        case 257:
+            if ((visible || prerender) && renderingEnabled(ppu)) {
+                ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+            }
+            break;
+        case 260:
+            if ((visible || prerender) && renderingEnabled(ppu) && cpu->mapper && cpu->mapper->scanline) {
+                cpu->mapper->scanline(cpu);
+            }
+            break;
+        case 280:
+            if (prerender && renderingEnabled(ppu)) {
+                ppu->v = (ppu->v & ~0x7BE0) | (ppu->t & 0x7BE0);
+            }
+            break;
+    }
+
+    /* After the switch, since the line rendered on dot 1 can hit on dot 1 itself */
+    if (ppu->dot == ppu->spriteZeroDot) {
+        ppu->status |= STATUS_SPRITE_ZERO;
+    }
+}
+
+/* Advances the PPU to the CPU's clock (3 dots per CPU cycle), stopping at every event on the way */
+void ppuCatchUp(CPU* cpu) {
+    PPU* ppu = &cpu->ppu;
+    uint64_t target = cpu->clock.cycles * 3;
+    PROFILE_ENTER(cpu, PROFILE_PPU);
+    while (ppu->dots < target) {
+        uint16_t next = nextEventDot(ppu);
+        uint64_t distance = next - ppu->dot;
+        if (ppu->dots + distance > target) {
+            ppu->dot += target - ppu->dots;
+            ppu->dots = target;
+            break;
+        }
+        ppu->dots += distance;
+        ppu->dot = next;
+        runEvent(cpu);
+    }
+    PROFILE_LEAVE(cpu);
+}
+
+static int isVblankScanline(uint16_t scanline) {
+    return scanline == VBLANK_SCANLINE;
+}
+
+static int isRenderScanline(uint16_t scanline) {
+    return scanline < SCREEN_HEIGHT || scanline == PRE_RENDER_SCANLINE;
+}
+
+/* Walks the timeline forward from the PPU's position and returns the CPU cycle of the `count`th upcoming `dot` on a
+    * scanline `matches` accepts, assuming rendering stays enabled or disabled as it is now
+*/
+static uint64_t cycleOfDot(const PPU* ppu, int (*matches)(uint16_t scanline), uint16_t dot, uint32_t count) {
+    uint64_t dots = ppu->dots;
+    uint64_t frame = ppu->frame;
+    uint16_t scanline = ppu->scanline;
+    uint16_t position = ppu->dot;
+    while (1) {
+        if (matches(scanline) && position < dot && --count == 0) {
+            return (dots + dot - position + 2) / 3;
+        }
+        if (scanline == VBLANK_SCANLINE && position < 1) {
+            frame++;
+        }
+        dots += scanlineLength(ppu, scanline, frame) - position;
+        position = 0;
+        scanline = (scanline + 1) % SCANLINES_PER_FRAME;
+    }
+}
+
+static int isStatusScanline(uint16_t scanline) {
+    return scanline < SCREEN_HEIGHT || scanline == VBLANK_SCANLINE || scanline == PRE_RENDER_SCANLINE;
+}
+
+static int isVblankOrPreRenderScanline(uint16_t scanline) {
+    return scanline == VBLANK_SCANLINE || scanline == PRE_RENDER_SCANLINE;
+}
+
+/* The first CPU cycle on which $2002 could read differently. Vblank sets and the pre-render line clears on dot 1;
+    * visible lines only matter while rendering can still raise sprite 0 hit or overflow, which happens on dot 1 or the
+    * hit dot of the current line.
+*/
+uint64_t ppuStatusStableUntil(CPU* cpu) {
+    PPU* ppu = &cpu->ppu;
+    ppuCatchUp(cpu);
+    int spritesPending = (ppu->status & (STATUS_SPRITE_ZERO | STATUS_OVERFLOW)) != (STATUS_SPRITE_ZERO | STATUS_OVERFLOW);
+    uint64_t until = cycleOfDot(ppu, renderingEnabled(ppu) && spritesPending ? isStatusScanline :
+        isVblankOrPreRenderScanline, 1, 1);
+    if (ppu->spriteZeroDot > ppu->dot) {
+        uint64_t hit = (ppu->dots + ppu->spriteZeroDot - ppu->dot + 2) / 3;
+        until = hit < until ? hit : until;
+    }
+    return until;
+}
+
+/* EVENT_PPU: the start of vertical blank, which raises NMI and ends the frame */
+void ppuEvent(CPU* cpu) {
+    ppuCatchUp(cpu);
+    scheduleEvent(cpu, EVENT_PPU, cycleOfDot(&cpu->ppu, isVblankScanline, 1, 1));
+}
+
+/* Scanline-counting boards only need the CPU to stop on the clock that raises their IRQ; the clocks before it are
+    * applied by catch-up. The PPU must already be caught up.
+*/
+void scheduleMapperIrq(CPU* cpu) {
+    uint32_t scanlines = 0;
+    if (renderingEnabled(&cpu->ppu) && cpu->mapper && cpu->mapper->irqScanlines) {
+        scanlines = cpu->mapper->irqScanlines(cpu);
+    }
+    uint64_t cycle = scanlines ? cycleOfDot(&cpu->ppu, isRenderScanline, 260, scanlines) : NO_EVENT;
+    scheduleEvent(cpu, EVENT_MAPPER_IRQ, cycle);
+}
+
+void mapperIrqEvent(CPU* cpu) {
+    PROFILE_ENTER(cpu, PROFILE_MAPPER);
+    ppuCatchUp(cpu);
+    scheduleMapperIrq(cpu);
+    PROFILE_LEAVE(cpu);
+}
+
+// https://www.nesdev.org/wiki/PPU_registers
+uint8_t readPPURegister(CPU* cpu, uint16_t address) {
+    PPU* ppu = &cpu->ppu;
+    ppuCatchUp(cpu);
+    switch (address & 0x07) {
+        case 2:
+            ppu->openBus = (ppu->status & 0xE0) | (ppu->openBus & 0x1F);
+            ppu->status &= ~STATUS_VBLANK;
+            ppu->writeToggle = 0;
+            cpu->idle.polledStatus = 1;
+            cpu->idle.status = ppu->status;
+            if (cpu->ppuThread) {
+                postPpuRead(cpu, address);
+            }
+            break;
+        case 4:
+            ppu->openBus = ppu->oam[ppu->oamAddress];
+            break;
+        case 7: {
+            /* Reads below the palette come through a one-byte buffer; palette reads are immediate but still refill
+                * the buffer from the nametable underneath
+            */
+            uint16_t vramAddress = ppu->v & 0x3FFF;
+            if (vramAddress < 0x3F00) {
+                ppu->openBus = ppu->readBuffer;
+                ppu->readBuffer = readVideoMemory(cpu, vramAddress);
+            } else {
+                ppu->openBus = (readVideoMemory(cpu, vramAddress) & 0x3F) | (ppu->openBus & 0xC0);
+                ppu->readBuffer = readVideoMemory(cpu, vramAddress - 0x1000);
+            }
+            ppu->v += (ppu->ctrl & CTRL_INCREMENT_32) ? 32 : 1;
+            cpu->idle.clean = 0;
+            if (cpu->ppuThread) {
+                postPpuRead(cpu, address);
+            }
+            break;
+        }
+    }
+    return ppu->openBus;
+}
+
+void writePPURegister(CPU* cpu, uint16_t address, uint8_t value) {
+    PPU* ppu = &cpu->ppu;
+    ppuCatchUp(cpu);
+    ppu->openBus = value;
+    switch (address & 0x07) {
+        case 0:
+            /* Enabling NMI during vblank raises one straight away */
+            if ((value & CTRL_NMI) && !(ppu->ctrl & CTRL_NMI) && (ppu->status & STATUS_VBLANK)) {
+                cpu->nmi = 1;
+            }
+            ppu->ctrl = value;
+            ppu->t = (ppu->t & ~0x0C00) | ((value & 0x03) << 10);
+            break;
+        case 1:
+            /* Turning rendering on or off moves the odd-frame dot and starts or stops the MMC3 counter */
+            ppu->mask = value;
+            ppuEvent(cpu);
+            scheduleMapperIrq(cpu);
+            break;
+        case 3:
+            ppu->oamAddress = value;
+            break;
+        case 4:
+            ppu->oam[ppu->oamAddress++] = value;
+            break;
+        case 5:
+            if (ppu->writeToggle) {
+                ppu->t = (ppu->t & ~0x73E0) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+            } else {
+                ppu->t = (ppu->t & ~0x001F) | (value >> 3);
+                ppu->fineX = value & 0x07;
+            }
+            ppu->writeToggle ^= 1;
+            break;
+        case 6:
+            if (ppu->writeToggle) {
+                ppu->t = (ppu->t & 0xFF00) | value;
+                ppu->v = ppu->t;
+            } else {
+                ppu->t = (ppu->t & 0x00FF) | ((value & 0x3F) << 8);
+            }
+            ppu->writeToggle ^= 1;
+            break;
+        case 7:
+            writeVideoMemory(cpu, ppu->v, value);
+            ppu->v += (ppu->ctrl & CTRL_INCREMENT_32) ? 32 : 1;
+            break;
+    }
+    if (cpu->ppuThread) {
+        postPpuWrite(cpu, address, value);
+    }
+}
+
+// https://www.nesdev.org/wiki/PPU_registers#OAMDMA
+/* $4014: copies a CPU page into OAM, stalling the CPU for 513 cycles (514 when it starts on an odd cycle) */
+void writeOamDma(CPU* cpu, uint8_t page) {
+    ppuCatchUp(cpu);
+    for (int i = 0; i < 0x100; i++) {
+        cpu->ppu.oam[(uint8_t)(cpu->ppu.oamAddress + i)] = readByte(cpu, (page << 8) | i);
+    }
+    if (cpu->ppuThread) {
+        postOamDma(cpu);
+    }
+    cpu->clock.cycles += 513 + (cpu->clock.cycles & 1);
+}
+
+// https://www.nesdev.org/wiki/PPU_power_up_state
+/* Registers and position only; palette, OAM and nametables keep their contents. Pairs with resetCPU, which restarts
+    * the CPU clock.
+*/
+void resetPPU(CPU* cpu) {
+    memset(&cpu->ppu, 0, offsetof(PPU, palette));
+}
@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define spinPause() _mm_pause()
+#else
+#define spinPause() ((void) 0)
+#endif
+
+/* PPU co-simulation on a second host thread.
+    *
+    * The machine itself goes headless: its PPU still runs on the CPU thread and keeps every flag, interrupt and
+    * sprite 0 hit exact, so nothing the CPU reads ever waits for the other thread. Drawing is left to a shadow machine
+    * on the PPU thread, which owns a copy of everything pixels depend on (PPU registers and memories, CHR-RAM, the
+    * mapper's CHR banks and mirroring) and replays, at the cycle it happened, everything the CPU does to them: PPU
+    * register writes and the reads that change state ($2002, $2007), OAM DMA bytes and mapper writes. It catches up
+    * through the same ppuCatchUp and register code, so it draws exactly what the machine would have drawn itself.
+    *
+    * Messages go through a single-producer single-consumer ring. EVENT_PPU_THREAD posts one every PPU_THREAD_SLICE
+    * cycles so the shadow draws while the CPU runs instead of all at once, and the only wait is at the end of a frame
+    * (syncPpuThread): the CPU thread waits for the shadow to reach its cycle, then copies the shadow's finished frame
+    * into cpu->graphics. The machine's buffer is never handed to the shadow, so it stays where it was allocated and
+    * only the machine's thread ever touches it.
+    *
+*/
+#define PPU_QUEUE_SIZE 4096
+#define PPU_THREAD_SLICE (8 * DOTS_PER_SCANLINE / 3)
+#define PPU_THREAD_SPINS 256
+
+enum {
+    PPU_MESSAGE_READ,
+    PPU_MESSAGE_WRITE,
+    PPU_MESSAGE_OAM,
+    PPU_MESSAGE_MAPPER,
+    PPU_MESSAGE_ADVANCE,
+    PPU_MESSAGE_SYNC,
+    PPU_MESSAGE_STOP
+};
+
+/* address is the OAM offset from oamAddress for PPU_MESSAGE_OAM */
+typedef struct ppu_message {
+    uint64_t cycle;
+    uint16_t address;
+    uint8_t value;
+    uint8_t kind;
+} PpuMessage;
+
+struct ppu_thread {
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    _Alignas(64) atomic_int sleeping;
+    sem_t wake;
+    sem_t synced;
+    pthread_t thread;
+    CPU* shadow;
+    PpuThreadStats stats;
+    PpuMessage messages[PPU_QUEUE_SIZE];
+};
+
+/* The consumer announces it is about to sleep and looks at the ring once more; the producer looks for the
+    * announcement after publishing. The fences order each side's store before its load, so one of them always sees
+    * the other and no message is left behind a sleeping thread.
+*/
+static void wakeShadow(PpuThread* thread) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&thread->sleeping, memory_order_relaxed) &&
+        atomic_exchange_explicit(&thread->sleeping, 0, memory_order_relaxed)) {
+        sem_post(&thread->wake);
+    }
+}
+
+/* Only flushes wake the shadow: anything else is sure to be followed by one within PPU_THREAD_SLICE cycles */
+static void post(PpuThread* thread, uint64_t cycle, uint8_t kind, uint16_t address, uint8_t value) {
+    unsigned tail = atomic_load_explicit(&thread->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&thread->head, memory_order_acquire) == PPU_QUEUE_SIZE) {
+        thread->stats.stalls++;
+        wakeShadow(thread);
+        for (int spins = 0; tail - atomic_load_explicit(&thread->head, memory_order_acquire) == PPU_QUEUE_SIZE;) {
+            if (++spins < PPU_THREAD_SPINS) {
+                spinPause();
+            } else {
+                sched_yield();
+            }
+        }
+    }
+    PpuMessage* message = &thread->messages[tail % PPU_QUEUE_SIZE];
+    message->cycle = cycle;
+    message->address = address;
+    message->value = value;
+    message->kind = kind;
+    atomic_store_explicit(&thread->tail, tail + 1, memory_order_release);
+    thread->stats.messages++;
+    if (kind >= PPU_MESSAGE_ADVANCE) {
+        wakeShadow(thread);
+    }
+}
+
+static PpuMessage* waitForMessage(PpuThread* thread, unsigned head) {
+    for (int spins = 0; head == atomic_load_explicit(&thread->tail, memory_order_acquire); spins++) {
+        if (spins < PPU_THREAD_SPINS) {
+            spinPause();
+            continue;
+        }
+        atomic_store_explicit(&thread->sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (head != atomic_load_explicit(&thread->tail, memory_order_acquire)) {
+            atomic_store_explicit(&thread->sleeping, 0, memory_order_relaxed);
+            break;
+        }
+        sem_wait(&thread->wake);
+        spins = 0;
+    }
+    return &thread->messages[head % PPU_QUEUE_SIZE];
+}
+
+static void* runShadow(void* argument) {
+    PpuThread* thread = (PpuThread*) argument;
+    CPU* shadow = thread->shadow;
+    unsigned head = atomic_load_explicit(&thread->head, memory_order_relaxed);
+    while (1) {
+        PpuMessage message = *waitForMessage(thread, head);
+        atomic_store_explicit(&thread->head, ++head, memory_order_release);
+        shadow->clock.cycles = message.cycle;
+        switch (message.kind) {
+            case PPU_MESSAGE_READ:
+                readPPURegister(shadow, message.address);
+                break;
+            case PPU_MESSAGE_WRITE:
+                writePPURegister(shadow, message.address, message.value);
+                break;
+            case PPU_MESSAGE_OAM:
+                ppuCatchUp(shadow);
+                shadow->ppu.oam[(uint8_t)(shadow->ppu.oamAddress + message.address)] = message.value;
+                break;
+            case PPU_MESSAGE_MAPPER:
+                writeMapper(shadow, message.address, message.value);
+                break;
+            case PPU_MESSAGE_ADVANCE:
+                ppuCatchUp(shadow);
+                break;
+            case PPU_MESSAGE_SYNC:
+                ppuCatchUp(shadow);
+                sem_post(&thread->synced);
+                break;
+            case PPU_MESSAGE_STOP:
+                return NULL;
+        }
+    }
+}
+
+/* Copies everything the shadow draws from out of the machine; the shadow must be idle */
+static void seedShadow(CPU* shadow, CPU* cpu) {
+    shadow->ppu = cpu->ppu;
+    if (cpu->chrRam) {
+        memcpy(shadow->chrRam, cpu->chrRam, CHR_RAM_SIZE);
+        if (shadow->tiles) {
+            invalidateTiles(shadow);
+        }
+    }
+    shadow->mapperState = cpu->mapperState;
+    shadow->mapper->sync(shadow);
+    shadow->clock.cycles = cpu->clock.cycles;
+    memcpy(shadow->graphics, cpu->graphics, sizeof(Graphics));
+    resetEvents(shadow);
+}
+
+/* Returns -1 without a ROM, for a headless machine (there is nothing to draw) or when the thread can't be started */
+int startPpuThread(CPU* cpu) {
+    if (cpu->ppuThread) {
+        return 0;
+    }
+    if (!cpu->game || cpu->headless) {
+        return -1;
+    }
+    PpuThread* thread = (PpuThread*) aligned_alloc(64, (sizeof(PpuThread) + 63) & ~(size_t) 63);
+    if (!thread) {
+        return -1;
+    }
+    memset(thread, 0, sizeof(PpuThread));
+    thread->shadow = createCPU();
+    if (!thread->shadow || loadROM(thread->shadow, cpu->game) != 0 || !getGraphics(cpu) || !getGraphics(thread->shadow)) {
+        destroyCPU(thread->shadow);
+        free(thread);
+        return -1;
+    }
+    thread->shadow->renderKernel = cpu->renderKernel;
+    seedShadow(thread->shadow, cpu);
+    sem_init(&thread->wake, 0, 0);
+    sem_init(&thread->synced, 0, 0);
+    if (pthread_create(&thread->thread, NULL, runShadow, thread) != 0) {
+        sem_destroy(&thread->wake);
+        sem_destroy(&thread->synced);
+        destroyCPU(thread->shadow);
+        free(thread);
+        return -1;
+    }
+    cpu->ppuThread = thread;
+    cpu->headless = 1;
+    ppuThreadEvent(cpu);
+    return 0;
+}
+
+/* Waits until the shadow has drawn everything up to the CPU's clock, then copies its frame into the machine's */
+void syncPpuThread(CPU* cpu) {
+    PpuThread* thread = cpu->ppuThread;
+    post(thread, cpu->clock.cycles, PPU_MESSAGE_SYNC, 0, 0);
+    /* The machine's thread may be taking profiler signals */
+    while (sem_wait(&thread->synced) != 0 && errno == EINTR) {
+    }
+    thread->stats.syncs++;
+    memcpy(cpu->graphics, thread->shadow->graphics, sizeof(Graphics));
+}
+
+/* The machine draws for itself again from where the shadow left off */
+void stopPpuThread(CPU* cpu) {
+    PpuThread* thread = cpu->ppuThread;
+    if (!thread) {
+        return;
+    }
+    syncPpuThread(cpu);
+    post(thread, cpu->clock.cycles, PPU_MESSAGE_STOP, 0, 0);
+    pthread_join(thread->thread, NULL);
+    sem_destroy(&thread->wake);
+    sem_destroy(&thread->synced);
+    destroyCPU(thread->shadow);
+    free(thread);
+    cpu->ppuThread = NULL;
+    cpu->headless = 0;
+    scheduleEvent(cpu, EVENT_PPU_THREAD, NO_EVENT);
+}
+
+/* After a state load the shadow starts over from the restored machine */
+void reseedPpuThread(CPU* cpu) {
+    syncPpuThread(cpu);
+    seedShadow(cpu->ppuThread->shadow, cpu);
+}
+
+void postPpuRead(CPU* cpu, uint16_t address) {
+    post(cpu->ppuThread, cpu->clock.cycles, PPU_MESSAGE_READ, address, 0);
+}
+
+void postPpuWrite(CPU* cpu, uint16_t address, uint8_t value) {
+    post(cpu->ppuThread, cpu->clock.cycles, PPU_MESSAGE_WRITE, address, value);
+}
+
+/* OAM DMA, as the 256 bytes it just stored from oamAddress on */
+void postOamDma(CPU* cpu) {
+    for (int i = 0; i < 0x100; i++) {
+        post(cpu->ppuThread, cpu->clock.cycles, PPU_MESSAGE_OAM, i, cpu->ppu.oam[(uint8_t)(cpu->ppu.oamAddress + i)]);
+    }
+}
+
+void postMapperWrite(CPU* cpu, uint16_t address, uint8_t value) {
+    post(cpu->ppuThread, cpu->clock.cycles, PPU_MESSAGE_MAPPER, address, value);
+}
+
+/* EVENT_PPU_THREAD: lets the shadow draw up to here */
+void ppuThreadEvent(CPU* cpu) {
+    if (!cpu->ppuThread) {
+        return;
+    }
+    post(cpu->ppuThread, cpu->clock.cycles, PPU_MESSAGE_ADVANCE, 0, 0);
+    scheduleEvent(cpu, EVENT_PPU_THREAD, cpu->clock.cycles + PPU_THREAD_SLICE);
+}
+
+void getPpuThreadStats(const CPU* cpu, PpuThreadStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (cpu->ppuThread) {
+        *stats = cpu->ppuThread->stats;
+    }
+}
+
+/* Runs the same ROM on one thread and with the PPU on its own, and prints the time per frame of each. Both must draw
+    * the same frames and end every frame in the same state (the skipped-cycle count aside, since the extra event
+    * slices idle loops differently), so the run also checks both.
+*/
+int benchmarkPpuThread(const GameInformation* game, uint64_t frames) {
+    CPU* machines[2] = { createCPU(), createCPU() };
+    if (!machines[0] || !machines[1] || loadROM(machines[0], game) != 0 || loadROM(machines[1], game) != 0 ||
+        startPpuThread(machines[1]) != 0) {
+        destroyCPU(machines[0]);
+        destroyCPU(machines[1]);
+        return -1;
+    }
+
+    uint64_t elapsed[2] = { 0, 0 };
+    uint64_t hashes[2] = { FNV_BASIS, FNV_BASIS };
+    uint64_t diverged = 0;
+    MachineState states[2];
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < 2; i++) {
+            uint64_t start = nowNanoseconds();
+            runFrame(machines[i]);
+            elapsed[i] += nowNanoseconds() - start;
+            hashes[i] = hashMore(hashes[i], machines[i]->graphics->screen, sizeof(machines[i]->graphics->screen));
+            captureState(machines[i], &states[i]);
+            states[i].skipCycles = 0;
+        }
+        if (!diverged && memcmp(&states[0], &states[1], sizeof(MachineState)) != 0) {
+            diverged = frame + 1;
+        }
+    }
+
+    PpuThreadStats stats;
+    getPpuThreadStats(machines[1], &stats);
+    double single = (double) elapsed[0] / frames;
+    double threaded = (double) elapsed[1] / frames;
+    int match = hashes[0] == hashes[1] && !diverged;
+    printf("one thread   %10.0f ns/frame  frames %016llx\n", single, (unsigned long long) hashes[0]);
+    printf("PPU thread   %10.0f ns/frame  frames %016llx  %5.2fx one thread%s\n", threaded,
+        (unsigned long long) hashes[1], single / threaded, match ? "" : "  MISMATCH");
+    printf("             %.1f messages/frame, %llu full-queue stalls\n", (double) stats.messages / frames,
+        (unsigned long long) stats.stalls);
+    if (diverged) {
+        printf("             state diverged in frame %llu\n", (unsigned long long) diverged);
+    }
+    destroyCPU(machines[0]);
+    destroyCPU(machines[1]);
+    return match ? 0 : -1;
+}
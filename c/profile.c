@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+#ifdef NES_PROFILE
+#include <pthread.h>
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+/* Sampled stacks are kept in an open-addressed table keyed by (stack, opcode); samples that find it full are lost */
+#define PROFILE_SLOTS 4096
+#define PROFILE_HOT_PCS 32
+#define PROFILE_BANK_SIZE 0x2000
+
+typedef struct profile_slot {
+    uint64_t key;
+    uint64_t count;
+} ProfileSlot;
+
+/* A thread CPU-time timer only expires on a scheduler tick, and periods that pass in between are merged into one
+    * signal, so every sample is weighted by the periods it stands for: samples and the slot counts are in periods,
+    * signals counts the samples actually taken
+*/
+struct profile_sampler {
+    ProfileSlot slots[PROFILE_SLOTS];
+    volatile uint64_t samples;
+    volatile uint64_t signals;
+    volatile uint64_t lost;
+    uint32_t microseconds;
+    int armed;
+    uint64_t wallStart;
+    uint64_t wallNanoseconds;
+    uint64_t threadStart;
+    uint64_t threadNanoseconds;
+#ifdef __linux__
+    timer_t timer;
+#endif
+};
+
+static const char* const subsystemNames[PROFILE_SUBSYSTEMS] = {
+    [PROFILE_NONE] = "nes",
+    [PROFILE_CPU] = "cpu",
+    [PROFILE_PPU] = "ppu",
+    [PROFILE_APU] = "apu",
+    [PROFILE_MAPPER] = "mapper",
+    [PROFILE_IO] = "io",
+};
+
+static const char* const modeNames[] = {
+    [IMPLIED] = "implied",
+    [ACCUMULATOR] = "accumulator",
+    [IMMEDIATE] = "immediate",
+    [RELATIVE] = "relative",
+    [ABSOLUTE] = "absolute",
+    [ABSOLUTE_X] = "absolute,x",
+    [ABSOLUTE_Y] = "absolute,y",
+    [INDIRECT] = "indirect",
+    [ZERO_PAGE] = "zeropage",
+    [ZERO_PAGE_X] = "zeropage,x",
+    [ZERO_PAGE_Y] = "zeropage,y",
+    [INDIRECT_X] = "(indirect,x)",
+    [INDIRECT_Y] = "(indirect),y",
+};
+
+#define MODE_COUNT (sizeof(modeNames) / sizeof(modeNames[0]))
+
+/* The profiler whose timer fires on this thread */
+static __thread Profiler* sampledProfiler;
+
+/* The running instruction only means something when the CPU is on the stack; the sample is charged to it then */
+static int cpuOnStack(uint32_t stack) {
+    for (; stack; stack >>= 3) {
+        if ((stack & 0x07) == PROFILE_CPU) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* The opcode `entry` counts, or -1 for the entry of nothing */
+static int entryOpcode(const Profiler* profile, const ProfileCount* entry) {
+    if (entry >= profile->prg && entry < profile->prg + profile->prgSize) {
+        return profile->image[entry - profile->prg];
+    }
+    if (entry >= profile->ramOpcodes && entry < profile->ramOpcodes + 256) {
+        return entry - profile->ramOpcodes;
+    }
+    return -1;
+}
+
+#ifdef __linux__
+/* SIGPROF handler: only touches the profiler's own memory, so it is safe wherever the thread was interrupted */
+static void takeSample(int signal) {
+    Profiler* profile = sampledProfiler;
+    if (!profile) {
+        return;
+    }
+    ProfileSampler* sampler = profile->sampler;
+    int overrun = timer_getoverrun(sampler->timer);
+    uint64_t periods = 1 + (overrun > 0 ? overrun : 0);
+    uint32_t stack = profile->stack;
+    int opcode = cpuOnStack(stack) ? entryOpcode(profile, profile->last) : -1;
+    uint64_t key = (uint64_t) stack << 9 | (uint64_t)(opcode + 1);
+    uint32_t slot = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 52);
+    for (int probe = 0; probe < PROFILE_SLOTS; probe++) {
+        ProfileSlot* entry = &sampler->slots[(slot + probe) & (PROFILE_SLOTS - 1)];
+        if (entry->count == 0 || entry->key == key) {
+            entry->key = key;
+            entry->count += periods;
+            sampler->samples += periods;
+            sampler->signals++;
+            return;
+        }
+    }
+    sampler->lost += periods;
+}
+
+static void installHandler(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = takeSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+}
+
+/* A timer on the calling thread's CPU clock, delivered to that thread alone, so machines profiled on different
+    * threads sample only themselves
+*/
+static int armSampler(ProfileSampler* sampler) {
+    static pthread_once_t installed = PTHREAD_ONCE_INIT;
+    pthread_once(&installed, installHandler);
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = (pid_t) syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &sampler->timer) != 0) {
+        return -1;
+    }
+    struct itimerspec period;
+    period.it_interval.tv_sec = sampler->microseconds / 1000000;
+    period.it_interval.tv_nsec = (sampler->microseconds % 1000000) * 1000L;
+    period.it_value = period.it_interval;
+    if (timer_settime(sampler->timer, 0, &period, NULL) != 0) {
+        timer_delete(sampler->timer);
+        return -1;
+    }
+    return 0;
+}
+
+static void disarmSampler(ProfileSampler* sampler) {
+    timer_delete(sampler->timer);
+}
+#else
+/* Elsewhere only the exact counts are kept */
+static int armSampler(ProfileSampler* sampler) {
+    return -1;
+}
+
+static void disarmSampler(ProfileSampler* sampler) {
+}
+#endif
+
+/* Attaches a fresh profiler to the machine, which must already have a ROM loaded and be run on the calling thread
+    * from here on (that is the thread the sampling timer follows). 0 means no host-time sampling, only counts.
+*/
+int startProfiler(CPU* cpu, uint32_t sampleMicroseconds) {
+    if (!cpu->game || cpu->profile) {
+        return -1;
+    }
+    Profiler* profile = (Profiler*) calloc(1, sizeof(Profiler));
+    ProfileSampler* sampler = (ProfileSampler*) calloc(1, sizeof(ProfileSampler));
+    ProfileCount* prg = (ProfileCount*) calloc(cpu->game->prgSize, sizeof(ProfileCount));
+    if (!profile || !sampler || !prg) {
+        free(profile);
+        free(sampler);
+        free(prg);
+        return -1;
+    }
+    profile->prg = prg;
+    profile->prgSize = cpu->game->prgSize;
+    profile->image = cpu->game->prg;
+    profile->last = &profile->discard;
+    profile->start = cpu->clock.cycles;
+    profile->sampler = sampler;
+    sampler->microseconds = sampleMicroseconds;
+    sampler->wallStart = clockNanoseconds(CLOCK_MONOTONIC);
+    sampler->threadStart = clockNanoseconds(CLOCK_THREAD_CPUTIME_ID);
+    cpu->profile = profile;
+    if (sampleMicroseconds) {
+        sampledProfiler = profile;
+        sampler->armed = armSampler(sampler) == 0;
+        if (!sampler->armed) {
+            sampledProfiler = NULL;
+        }
+    }
+    return 0;
+}
+
+/* Stops sampling (from the thread that started it) and counting, and hands over what was gathered */
+Profiler* stopProfiler(CPU* cpu) {
+    Profiler* profile = cpu->profile;
+    if (!profile) {
+        return NULL;
+    }
+    ProfileSampler* sampler = profile->sampler;
+    if (sampler->armed) {
+        if (sampledProfiler == profile) {
+            sampledProfiler = NULL;
+        }
+        disarmSampler(sampler);
+        sampler->armed = 0;
+    }
+    sampler->threadNanoseconds = clockNanoseconds(CLOCK_THREAD_CPUTIME_ID) - sampler->threadStart;
+    sampler->wallNanoseconds = clockNanoseconds(CLOCK_MONOTONIC) - sampler->wallStart;
+    cpu->profile = NULL;
+    return profile;
+}
+
+void destroyProfiler(Profiler* profile) {
+    if (!profile) {
+        return;
+    }
+    if (profile->sampler->armed) {
+        if (sampledProfiler == profile) {
+            sampledProfiler = NULL;
+        }
+        disarmSampler(profile->sampler);
+    }
+    free(profile->prg);
+    free(profile->sampler);
+    free(profile);
+}
+
+typedef struct hot_pc {
+    uint64_t count;
+    uint32_t index;
+    int prg;
+} HotPc;
+
+static void offerHotPc(HotPc* hot, uint64_t count, uint32_t index, int prg) {
+    if (count <= hot[PROFILE_HOT_PCS - 1].count) {
+        return;
+    }
+    int i = PROFILE_HOT_PCS - 1;
+    for (; i > 0 && hot[i - 1].count < count; i--) {
+        hot[i] = hot[i - 1];
+    }
+    hot[i] = (HotPc) { count, index, prg };
+}
+
+static int compareSlots(const void* a, const void* b) {
+    uint64_t x = ((const ProfileSlot*) a)->count;
+    uint64_t y = ((const ProfileSlot*) b)->count;
+    return (x < y) - (x > y);
+}
+
+static double share(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void writeReport(FILE* file, const Profiler* profile) {
+    const ProfileSampler* sampler = profile->sampler;
+    uint64_t counts[256] = { 0 };
+    uint64_t cycles[256] = { 0 };
+    for (uint32_t i = 0; i < profile->prgSize; i++) {
+        counts[profile->image[i]] += profile->prg[i].count;
+        cycles[profile->image[i]] += profile->prg[i].cycles;
+    }
+    for (int i = 0; i < 256; i++) {
+        counts[i] += profile->ramOpcodes[i].count;
+        cycles[i] += profile->ramOpcodes[i].cycles;
+    }
+    uint64_t instructions = 0;
+    uint64_t totalCycles = 0;
+    for (int i = 0; i < 256; i++) {
+        instructions += counts[i];
+        totalCycles += cycles[i];
+    }
+    fprintf(file, "%llu instructions, %llu cycles, %.3f s wall\n", (unsigned long long) instructions,
+        (unsigned long long) totalCycles, sampler->wallNanoseconds / 1e9);
+
+    /* Host time: every sample is charged to the innermost subsystem on its stack */
+    if (sampler->samples) {
+        uint64_t exclusive[PROFILE_SUBSYSTEMS] = { 0 };
+        for (int i = 0; i < PROFILE_SLOTS; i++) {
+            if (sampler->slots[i].count) {
+                exclusive[(sampler->slots[i].key >> 9) & 0x07] += sampler->slots[i].count;
+            }
+        }
+        /* The timer fires when it can rather than every period, so times are shares of the thread's measured time */
+        fprintf(file, "\nHost time by subsystem: %llu samples (one every %.0f us on average, asked for %u) of %.3f s on "
+            "this thread", (unsigned long long) sampler->signals, sampler->threadNanoseconds / 1000.0 / sampler->signals,
+            sampler->microseconds, sampler->threadNanoseconds / 1e9);
+        if (sampler->lost) {
+            fprintf(file, ", %llu periods lost", (unsigned long long) sampler->lost);
+        }
+        fprintf(file, "\n");
+        for (int i = 0; i < PROFILE_SUBSYSTEMS; i++) {
+            fprintf(file, "  %-8s %6.2f%%  %8.3f ms\n", i == PROFILE_NONE ? "other" : subsystemNames[i],
+                share(exclusive[i], sampler->samples), share(exclusive[i], sampler->samples) *
+                sampler->threadNanoseconds / 1e8);
+        }
+    } else {
+        fprintf(file, "\nHost time was not sampled\n");
+    }
+
+    uint8_t order[256];
+    for (int i = 0; i < 256; i++) {
+        int j = i;
+        for (; j > 0 && cycles[order[j - 1]] < cycles[i]; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    fprintf(file, "\nOpcodes by cycles\n  op  mnemonic mode                 count  count%%          cycles cycles%%  cyc/op\n");
+    for (int i = 0; i < 256 && cycles[order[i]]; i++) {
+        const Opcode* info = &opcodeTable[order[i]];
+        uint64_t count = counts[order[i]];
+        fprintf(file, "  %02X  %-8s %-14s %12llu %6.2f%% %15llu %6.2f%% %7.2f\n", order[i], info->mnemonic,
+            modeNames[info->mode], (unsigned long long) count, share(count, instructions),
+            (unsigned long long) cycles[order[i]], share(cycles[order[i]], totalCycles),
+            count ? (double) cycles[order[i]] / count : 0.0);
+    }
+
+    uint64_t modeCounts[MODE_COUNT] = { 0 };
+    uint64_t modeCycles[MODE_COUNT] = { 0 };
+    for (int i = 0; i < 256; i++) {
+        modeCounts[opcodeTable[i].mode] += counts[i];
+        modeCycles[opcodeTable[i].mode] += cycles[i];
+    }
+    fprintf(file, "\nAddressing modes\n  mode                    count  count%%          cycles cycles%%\n");
+    for (size_t i = 0; i < MODE_COUNT; i++) {
+        fprintf(file, "  %-14s %15llu %6.2f%% %15llu %6.2f%%\n", modeNames[i], (unsigned long long) modeCounts[i],
+            share(modeCounts[i], instructions), (unsigned long long) modeCycles[i], share(modeCycles[i], totalCycles));
+    }
+
+    /* PRG histogram, a bank being 8KB of the image whatever the board switches in */
+    HotPc hot[PROFILE_HOT_PCS];
+    memset(hot, 0, sizeof(hot));
+    fprintf(file, "\nPRG-ROM banks (8KB)\n  bank           count  count%%          cycles cycles%%  addresses\n");
+    for (uint32_t bank = 0; bank * PROFILE_BANK_SIZE < profile->prgSize; bank++) {
+        uint64_t count = 0;
+        uint64_t bankCycles = 0;
+        uint32_t addresses = 0;
+        for (uint32_t i = bank * PROFILE_BANK_SIZE; i < (bank + 1) * PROFILE_BANK_SIZE && i < profile->prgSize; i++) {
+            count += profile->prg[i].count;
+            bankCycles += profile->prg[i].cycles;
+            addresses += profile->prg[i].count != 0;
+            offerHotPc(hot, profile->prg[i].count, i, 1);
+        }
+        if (count) {
+            fprintf(file, "  %4u %15llu %6.2f%% %15llu %6.2f%%  %9u\n", bank, (unsigned long long) count,
+                share(count, instructions), (unsigned long long) bankCycles, share(bankCycles, totalCycles), addresses);
+        }
+    }
+    uint64_t other = 0;
+    for (uint32_t i = 0; i < 0x10000; i++) {
+        other += profile->ramCounts[i];
+        offerHotPc(hot, profile->ramCounts[i], i, 0);
+    }
+    if (other) {
+        fprintf(file, "  RAM  %15llu %6.2f%%\n", (unsigned long long) other, share(other, instructions));
+    }
+
+    fprintf(file, "\nHottest PCs\n  where                 count  count%%  opcode\n");
+    for (int i = 0; i < PROFILE_HOT_PCS && hot[i].count; i++) {
+        char where[32];
+        const char* mnemonic = "";
+        if (hot[i].prg) {
+            snprintf(where, sizeof(where), "bank %u +$%04X", hot[i].index / PROFILE_BANK_SIZE,
+                hot[i].index % PROFILE_BANK_SIZE);
+            mnemonic = opcodeTable[profile->image[hot[i].index]].mnemonic;
+        } else {
+            snprintf(where, sizeof(where), "$%04X", hot[i].index);
+        }
+        fprintf(file, "  %-14s %12llu %6.2f%%  %s\n", where, (unsigned long long) hot[i].count,
+            share(hot[i].count, instructions), mnemonic);
+    }
+}
+
+/* One line per sampled stack, outermost frame first, for flamegraph.pl and friends */
+static void writeStacks(FILE* file, const Profiler* profile) {
+    ProfileSlot slots[PROFILE_SLOTS];
+    memcpy(slots, profile->sampler->slots, sizeof(slots));
+    qsort(slots, PROFILE_SLOTS, sizeof(ProfileSlot), compareSlots);
+    for (int i = 0; i < PROFILE_SLOTS && slots[i].count; i++) {
+        uint32_t stack = (uint32_t)(slots[i].key >> 9);
+        uint32_t opcode = slots[i].key & 0x1FF;
+        uint8_t frames[10];
+        int depth = 0;
+        for (; stack && depth < 10; stack >>= 3) {
+            frames[depth++] = stack & 0x07;
+        }
+        fprintf(file, "nes");
+        int charged = 0;
+        while (depth--) {
+            fprintf(file, ";%s", subsystemNames[frames[depth] < PROFILE_SUBSYSTEMS ? frames[depth] : PROFILE_NONE]);
+            if (frames[depth] == PROFILE_CPU && opcode && !charged) {
+                const Opcode* info = &opcodeTable[opcode - 1];
+                fprintf(file, ";%s %s", info->mnemonic, modeNames[info->mode]);
+                charged = 1;
+            }
+        }
+        fprintf(file, " %llu\n", (unsigned long long) slots[i].count);
+    }
+}
+
+static FILE* openOutput(const char* path) {
+    return strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+}
+
+static int closeOutput(FILE* file) {
+    return file == stdout ? fflush(file) : fclose(file);
+}
+
+/* Writes the flat report to `report` and, unless NULL, the collapsed stacks to `stacks` ("-" is stdout) */
+int writeProfile(const Profiler* profile, const char* report, const char* stacks) {
+    int result = 0;
+    FILE* file = openOutput(report);
+    if (!file) {
+        return -1;
+    }
+    writeReport(file, profile);
+    result |= closeOutput(file);
+    if (stacks) {
+        file = openOutput(stacks);
+        if (!file) {
+            return -1;
+        }
+        writeStacks(file, profile);
+        result |= closeOutput(file);
+    }
+    return result == 0 ? 0 : -1;
+}
+
+#else
+
+/* Built without -DNES_PROFILE: the hooks are compiled out and there is nothing to attach */
+int startProfiler(CPU* cpu, uint32_t sampleMicroseconds) {
+    return -1;
+}
+
+Profiler* stopProfiler(CPU* cpu) {
+    return NULL;
+}
+
+void destroyProfiler(Profiler* profile) {
+}
+
+int writeProfile(const Profiler* profile, const char* report, const char* stacks) {
+    return -1;
+}
+
+#endif
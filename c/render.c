@@ -0,0 +1,289 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NES_X86_KERNELS 1
+#endif
+
+/* Scanline kernels.
+    *
+    * The scalar kernel is the reference: the SIMD ones must produce byte-identical lines. The x86 kernels are built
+    * with per-function target attributes, so the whole emulator still compiles for the baseline ISA and the AVX2
+    * kernel is only picked when the CPU reports it.
+    *
+*/
+
+static void decodeTilesScalar(const uint8_t* low, const uint8_t* high, const uint8_t* attributes, int count,
+    uint8_t* pixels) {
+    for (int tile = 0; tile < count; tile++) {
+        for (int bit = 0; bit < 8; bit++) {
+            uint8_t colour = ((low[tile] >> (7 - bit)) & 0x01) | (((high[tile] >> (7 - bit)) & 0x01) << 1);
+            pixels[tile * 8 + bit] = colour | (attributes[tile] << 2);
+        }
+    }
+}
+
+static int compositeScalar(const uint8_t* background, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t colorMask, uint8_t* out) {
+    int spriteZeroHit = -1;
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        uint8_t bg = background[x];
+        uint8_t sprite = sprites[x];
+        uint8_t index = (bg & 0x03) ? bg : 0;
+        if ((sprite & 0x03) && (!(bg & 0x03) || !(sprite & 0x20))) {
+            index = sprite & 0x1F;
+        }
+        if (spriteZeroHit < 0 && (sprite & 0x40) && (sprite & 0x03) && (bg & 0x03)) {
+            spriteZeroHit = x;
+        }
+        out[x] = palette[index] & colorMask;
+    }
+    return spriteZeroHit;
+}
+
+#ifdef NES_X86_KERNELS
+/* A byte repeated across all eight bytes of a 64-bit lane */
+#define SPREAD_BYTE(value) ((uint64_t)(value) * 0x0101010101010101ULL)
+
+__attribute__((target("sse2")))
+static void decodeTilesSSE2(const uint8_t* low, const uint8_t* high, const uint8_t* attributes, int count,
+    uint8_t* pixels) {
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i one = _mm_set1_epi8(1);
+    for (int tile = 0; tile < count; tile += 2) {
+        __m128i lo = _mm_set_epi64x(SPREAD_BYTE(low[tile + 1]), SPREAD_BYTE(low[tile]));
+        __m128i hi = _mm_set_epi64x(SPREAD_BYTE(high[tile + 1]), SPREAD_BYTE(high[tile]));
+        __m128i attribute = _mm_set_epi64x(SPREAD_BYTE(attributes[tile + 1] << 2), SPREAD_BYTE(attributes[tile] << 2));
+        __m128i plane0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), one);
+        __m128i plane1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), _mm_add_epi8(one, one));
+        __m128i pixel = _mm_or_si128(_mm_or_si128(plane0, plane1), attribute);
+        _mm_storeu_si128((__m128i*)(pixels + tile * 8), pixel);
+    }
+}
+
+/* Builds the palette index of 16 pixels and returns a bit mask of where sprite 0 hit */
+__attribute__((target("sse2")))
+static inline int compositeIndicesSSE2(__m128i bg, __m128i sprite, __m128i* index) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i three = _mm_set1_epi8(0x03);
+    const __m128i behind = _mm_set1_epi8(0x20);
+    const __m128i spriteZero = _mm_set1_epi8(0x40);
+
+    __m128i bgClear = _mm_cmpeq_epi8(_mm_and_si128(bg, three), zero);
+    __m128i spriteClear = _mm_cmpeq_epi8(_mm_and_si128(sprite, three), zero);
+    __m128i inFront = _mm_cmpeq_epi8(_mm_and_si128(sprite, behind), zero);
+    __m128i useSprite = _mm_andnot_si128(spriteClear, _mm_or_si128(bgClear, inFront));
+    __m128i bgIndex = _mm_andnot_si128(bgClear, bg);
+    __m128i spriteIndex = _mm_and_si128(sprite, _mm_set1_epi8(0x1F));
+    *index = _mm_or_si128(_mm_and_si128(useSprite, spriteIndex), _mm_andnot_si128(useSprite, bgIndex));
+
+    __m128i hit = _mm_andnot_si128(_mm_or_si128(bgClear, spriteClear),
+        _mm_cmpeq_epi8(_mm_and_si128(sprite, spriteZero), spriteZero));
+    return _mm_movemask_epi8(hit);
+}
+
+/* SSE2 has no byte shuffle, so the palette lookup stays a scalar loop over the computed indices */
+__attribute__((target("sse2")))
+static int compositeSSE2(const uint8_t* background, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t colorMask, uint8_t* out) {
+    uint8_t indices[SCREEN_WIDTH];
+    int spriteZeroHit = -1;
+    for (int x = 0; x < SCREEN_WIDTH; x += 16) {
+        __m128i index;
+        int hit = compositeIndicesSSE2(_mm_loadu_si128((const __m128i*)(background + x)),
+            _mm_loadu_si128((const __m128i*)(sprites + x)), &index);
+        if (hit && spriteZeroHit < 0) {
+            spriteZeroHit = x + __builtin_ctz(hit);
+        }
+        _mm_storeu_si128((__m128i*)(indices + x), index);
+    }
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        out[x] = palette[indices[x]] & colorMask;
+    }
+    return spriteZeroHit;
+}
+
+__attribute__((target("avx2")))
+static void decodeTilesAVX2(const uint8_t* low, const uint8_t* high, const uint8_t* attributes, int count,
+    uint8_t* pixels) {
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    for (int tile = 0; tile < count; tile += 4) {
+        __m256i lo = _mm256_set_epi64x(SPREAD_BYTE(low[tile + 3]), SPREAD_BYTE(low[tile + 2]),
+            SPREAD_BYTE(low[tile + 1]), SPREAD_BYTE(low[tile]));
+        __m256i hi = _mm256_set_epi64x(SPREAD_BYTE(high[tile + 3]), SPREAD_BYTE(high[tile + 2]),
+            SPREAD_BYTE(high[tile + 1]), SPREAD_BYTE(high[tile]));
+        __m256i attribute = _mm256_set_epi64x(SPREAD_BYTE(attributes[tile + 3] << 2),
+            SPREAD_BYTE(attributes[tile + 2] << 2), SPREAD_BYTE(attributes[tile + 1] << 2),
+            SPREAD_BYTE(attributes[tile] << 2));
+        __m256i plane0 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), one);
+        __m256i plane1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), two);
+        __m256i pixel = _mm256_or_si256(_mm256_or_si256(plane0, plane1), attribute);
+        _mm256_storeu_si256((__m256i*)(pixels + tile * 8), pixel);
+    }
+}
+
+/* Palette RAM is 32 bytes: vpshufb looks the index up in both 16-byte halves and bit 4 picks one */
+__attribute__((target("avx2")))
+static int compositeAVX2(const uint8_t* background, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t colorMask, uint8_t* out) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i three = _mm256_set1_epi8(0x03);
+    const __m256i behind = _mm256_set1_epi8(0x20);
+    const __m256i spriteZero = _mm256_set1_epi8(0x40);
+    const __m256i upperHalf = _mm256_set1_epi8(0x10);
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) palette));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(palette + 16)));
+    const __m256i mask = _mm256_set1_epi8(colorMask);
+
+    int spriteZeroHit = -1;
+    for (int x = 0; x < SCREEN_WIDTH; x += 32) {
+        __m256i bg = _mm256_loadu_si256((const __m256i*)(background + x));
+        __m256i sprite = _mm256_loadu_si256((const __m256i*)(sprites + x));
+
+        __m256i bgClear = _mm256_cmpeq_epi8(_mm256_and_si256(bg, three), zero);
+        __m256i spriteClear = _mm256_cmpeq_epi8(_mm256_and_si256(sprite, three), zero);
+        __m256i inFront = _mm256_cmpeq_epi8(_mm256_and_si256(sprite, behind), zero);
+        __m256i useSprite = _mm256_andnot_si256(spriteClear, _mm256_or_si256(bgClear, inFront));
+        __m256i bgIndex = _mm256_andnot_si256(bgClear, bg);
+        __m256i spriteIndex = _mm256_and_si256(sprite, _mm256_set1_epi8(0x1F));
+        __m256i index = _mm256_blendv_epi8(bgIndex, spriteIndex, useSprite);
+
+        __m256i hit = _mm256_andnot_si256(_mm256_or_si256(bgClear, spriteClear),
+            _mm256_cmpeq_epi8(_mm256_and_si256(sprite, spriteZero), spriteZero));
+        uint32_t hitMask = _mm256_movemask_epi8(hit);
+        if (hitMask && spriteZeroHit < 0) {
+            spriteZeroHit = x + __builtin_ctz(hitMask);
+        }
+
+        __m256i colour = _mm256_blendv_epi8(_mm256_shuffle_epi8(low, index), _mm256_shuffle_epi8(high, index),
+            _mm256_cmpeq_epi8(_mm256_and_si256(index, upperHalf), upperHalf));
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_and_si256(colour, mask));
+    }
+    return spriteZeroHit;
+}
+#endif
+
+static const RenderKernel renderKernels[] = {
+#ifdef NES_X86_KERNELS
+    { "avx2", decodeTilesAVX2, compositeAVX2 },
+    { "sse2", decodeTilesSSE2, compositeSSE2 },
+#endif
+    { "scalar", decodeTilesScalar, compositeScalar },
+};
+
+static int kernelSupported(const RenderKernel* kernel) {
+#ifdef NES_X86_KERNELS
+    if (strcmp(kernel->name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(kernel->name, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return 1;
+}
+
+/* NULL picks the fastest kernel this CPU supports; a name that is unknown or unsupported here returns NULL */
+const RenderKernel* findRenderKernel(const char* name) {
+    for (size_t i = 0; i < sizeof(renderKernels) / sizeof(renderKernels[0]); i++) {
+        const RenderKernel* kernel = &renderKernels[i];
+        if ((!name || strcmp(kernel->name, name) == 0) && kernelSupported(kernel)) {
+            return kernel;
+        }
+    }
+    return NULL;
+}
+
+/* Runs the same ROM for `frames` frames with every kernel this CPU supports and prints the time per frame next to the
+    * scalar kernel's. Every kernel must produce the same frames, so the run also checks that the screen hashes agree.
+*/
+int benchmarkRenderKernels(const GameInformation* game, uint64_t frames) {
+    double scalarNanoseconds = 0;
+    uint64_t scalarHash = 0;
+    int mismatches = 0;
+
+    for (int i = sizeof(renderKernels) / sizeof(renderKernels[0]) - 1; i >= 0; i--) {
+        const RenderKernel* kernel = &renderKernels[i];
+        if (!kernelSupported(kernel)) {
+            printf("%-8s not supported on this CPU\n", kernel->name);
+            continue;
+        }
+        CPU* cpu = createCPU();
+        if (!cpu || loadROM(cpu, game) != 0) {
+            destroyCPU(cpu);
+            return -1;
+        }
+        cpu->renderKernel = kernel;
+
+        uint64_t hash = FNV_BASIS;
+        uint64_t elapsed = 0;
+        for (uint64_t frame = 0; frame < frames; frame++) {
+            uint64_t start = nowNanoseconds();
+            runFrame(cpu);
+            elapsed += nowNanoseconds() - start;
+            hash = hashMore(hash, cpu->graphics->screen, sizeof(cpu->graphics->screen));
+        }
+        destroyCPU(cpu);
+
+        double perFrame = (double) elapsed / frames;
+        if (kernel->decodeTiles == decodeTilesScalar) {
+            scalarNanoseconds = perFrame;
+            scalarHash = hash;
+        }
+        int match = hash == scalarHash;
+        mismatches += !match;
+        printf("%-8s %10.0f ns/frame  %5.2fx scalar  frames %016llx%s\n", kernel->name, perFrame,
+            scalarNanoseconds / perFrame, (unsigned long long) hash, match ? "" : "  MISMATCH");
+    }
+    return mismatches == 0 ? 0 : -1;
+}
+
+/* Runs the same ROM drawn and headless side by side and prints the time per frame of each. Only the pictures may
+    * differ, so the run also checks that the two machines' states agree after every frame.
+*/
+int benchmarkHeadless(const GameInformation* game, uint64_t frames) {
+    CPU* machines[2] = { createCPU(), createCPU() };
+    MachineState* states = (MachineState*) malloc(2 * sizeof(MachineState));
+    if (!machines[0] || !machines[1] || !states || loadROM(machines[0], game) != 0 || loadROM(machines[1], game) != 0) {
+        destroyCPU(machines[0]);
+        destroyCPU(machines[1]);
+        free(states);
+        return -1;
+    }
+    machines[1]->headless = 1;
+
+    uint64_t elapsed[2] = { 0, 0 };
+    uint64_t mismatch = 0;
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < 2; i++) {
+            uint64_t start = nowNanoseconds();
+            runFrame(machines[i]);
+            elapsed[i] += nowNanoseconds() - start;
+            captureState(machines[i], &states[i]);
+        }
+        if (!mismatch && memcmp(&states[0], &states[1], sizeof(MachineState)) != 0) {
+            mismatch = frame + 1;
+        }
+    }
+    destroyCPU(machines[0]);
+    destroyCPU(machines[1]);
+    free(states);
+
+    double drawn = (double) elapsed[0] / frames;
+    double headless = (double) elapsed[1] / frames;
+    printf("drawn    %10.0f ns/frame\n", drawn);
+    printf("headless %10.0f ns/frame  %5.2fx drawn%s\n", headless, drawn / headless, mismatch ? "" : "  states match");
+    if (mismatch) {
+        printf("MISMATCH: states differ after frame %llu\n", (unsigned long long) mismatch);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+/* Rewind history: one entry per captured frame, all stored in a single preallocated byte ring.
+    *
+    * Every keyframeInterval frames the full MachineState is stored; the frames in between store the XOR of their state
+    * with the previous frame's. Both are run-length coded the same way (a keyframe is the XOR against an all-zero
+    * state), so unchanged RAM costs nothing and a typical frame shrinks to a few hundred bytes.
+    *
+    * When the ring is full the oldest keyframe is evicted together with the deltas that depend on it. Restoring a
+    * frame decodes its keyframe and replays at most keyframeInterval - 1 deltas, and drops everything newer so
+    * capturing continues from the restored frame.
+    *
+*/
+
+/* Each entry costs at least a few bytes of data, so one slot per 64 bytes of budget never runs out first in practice */
+#define BYTES_PER_ENTRY_SLOT 64
+#define KEYFRAME_BIT 0x80000000u
+
+typedef struct rewind_entry {
+    uint32_t offset;
+    uint32_t size;
+} RewindEntry;
+
+struct rewind_buffer {
+    uint8_t* data;
+    size_t capacity;
+    size_t writeOffset;
+    size_t used;
+
+    RewindEntry* entries;
+    uint32_t maxEntries;
+    uint32_t first;
+    uint32_t count;
+
+    uint32_t keyframeInterval;
+    uint32_t sinceKeyframe;
+    uint64_t nextFrame;
+
+    MachineState* previous;
+    MachineState* current;
+    uint8_t* scratch;
+};
+
+#define DELTA_BOUND (2 * sizeof(MachineState) + 16)
+
+static size_t writeVarint(uint8_t* out, size_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+static size_t readVarint(const uint8_t* in, size_t* value) {
+    size_t length = 0;
+    size_t shift = 0;
+    *value = 0;
+    do {
+        *value |= (size_t)(in[length] & 0x7F) << shift;
+        shift += 7;
+    } while (in[length++] & 0x80);
+    return length;
+}
+
+static inline uint64_t load64(const uint8_t* bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+/* Encodes current ^ base (base NULL means zero) as pairs of (unchanged run, changed run) lengths followed by the
+    * changed bytes XORed with the base. A changed run only ends at four unchanged bytes in a row, so isolated equal
+    * bytes don't cost a pair header. Unchanged stretches are skipped eight bytes at a time.
+*/
+static size_t encodeDelta(const uint8_t* current, const uint8_t* base, size_t size, uint8_t* out) {
+    size_t length = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t same = i;
+        if (base) {
+            while (i + 8 <= size && load64(current + i) == load64(base + i)) {
+                i += 8;
+            }
+            while (i < size && current[i] == base[i]) {
+                i++;
+            }
+        } else {
+            while (i + 8 <= size && load64(current + i) == 0) {
+                i += 8;
+            }
+            while (i < size && current[i] == 0) {
+                i++;
+            }
+        }
+
+        size_t changed = i;
+        size_t equalRun = 0;
+        while (i < size && equalRun < 4) {
+            equalRun = current[i] == (base ? base[i] : 0) ? equalRun + 1 : 0;
+            i++;
+        }
+        i -= equalRun;
+
+        length += writeVarint(out + length, changed - same);
+        length += writeVarint(out + length, i - changed);
+        for (size_t j = changed; j < i; j++) {
+            out[length++] = current[j] ^ (base ? base[j] : 0);
+        }
+    }
+    return length;
+}
+
+static void applyDelta(uint8_t* state, const uint8_t* delta, size_t deltaSize) {
+    size_t position = 0;
+    size_t i = 0;
+    while (i < deltaSize) {
+        size_t same, changed;
+        i += readVarint(delta + i, &same);
+        i += readVarint(delta + i, &changed);
+        position += same;
+        for (size_t j = 0; j < changed; j++) {
+            state[position++] ^= delta[i++];
+        }
+    }
+}
+
+RewindBuffer* createRewindBuffer(size_t budget, uint32_t keyframeInterval) {
+    if (budget < 4 * DELTA_BOUND || keyframeInterval == 0) {
+        return NULL;
+    }
+
+    RewindBuffer* rewind = (RewindBuffer*) calloc(1, sizeof(RewindBuffer));
+    if (!rewind) {
+        return NULL;
+    }
+    rewind->maxEntries = budget / BYTES_PER_ENTRY_SLOT;
+    rewind->capacity = budget - rewind->maxEntries * sizeof(RewindEntry);
+    rewind->keyframeInterval = keyframeInterval;
+    rewind->data = (uint8_t*) malloc(rewind->capacity);
+    rewind->entries = (RewindEntry*) calloc(rewind->maxEntries, sizeof(RewindEntry));
+    rewind->previous = (MachineState*) calloc(1, sizeof(MachineState));
+    rewind->current = (MachineState*) calloc(1, sizeof(MachineState));
+    rewind->scratch = (uint8_t*) malloc(DELTA_BOUND);
+    if (!rewind->data || !rewind->entries || !rewind->previous || !rewind->current || !rewind->scratch) {
+        destroyRewindBuffer(rewind);
+        return NULL;
+    }
+    return rewind;
+}
+
+void destroyRewindBuffer(RewindBuffer* rewind) {
+    if (!rewind) {
+        return;
+    }
+    free(rewind->data);
+    free(rewind->entries);
+    free(rewind->previous);
+    free(rewind->current);
+    free(rewind->scratch);
+    free(rewind);
+}
+
+static inline RewindEntry* entryAt(RewindBuffer* rewind, uint32_t index) {
+    return &rewind->entries[(rewind->first + index) % rewind->maxEntries];
+}
+
+/* Drops the oldest keyframe and every delta that was built on top of it */
+static void evictOldest(RewindBuffer* rewind) {
+    do {
+        RewindEntry* oldest = entryAt(rewind, 0);
+        rewind->used -= oldest->size & ~KEYFRAME_BIT;
+        rewind->first = (rewind->first + 1) % rewind->maxEntries;
+        rewind->count--;
+    } while (rewind->count > 0 && !(entryAt(rewind, 0)->size & KEYFRAME_BIT));
+
+    if (rewind->count == 0) {
+        rewind->writeOffset = 0;
+        rewind->used = 0;
+    }
+}
+
+/* Finds room for `size` bytes, evicting old history until the live region [oldest, writeOffset) leaves a gap */
+static size_t reserve(RewindBuffer* rewind, size_t size) {
+    while (1) {
+        if (rewind->count == rewind->maxEntries) {
+            evictOldest(rewind);
+            continue;
+        }
+        if (rewind->count == 0) {
+            return 0;
+        }
+        size_t oldest = entryAt(rewind, 0)->offset;
+        if (rewind->writeOffset > oldest) {
+            if (rewind->writeOffset + size <= rewind->capacity) {
+                return rewind->writeOffset;
+            }
+            if (size <= oldest) {
+                return 0;
+            }
+        } else if (rewind->writeOffset + size <= oldest) {
+            return rewind->writeOffset;
+        }
+        evictOldest(rewind);
+    }
+}
+
+void rewindCapture(RewindBuffer* rewind, CPU* cpu) {
+    captureState(cpu, rewind->current);
+
+    int keyframe = rewind->count == 0 || rewind->sinceKeyframe >= rewind->keyframeInterval;
+    size_t size = encodeDelta((const uint8_t*) rewind->current, keyframe ? NULL : (const uint8_t*) rewind->previous,
+        sizeof(MachineState), rewind->scratch);
+
+    size_t offset = reserve(rewind, size);
+    if (rewind->count == 0 && !keyframe) {
+        /* Making room evicted the frame this delta was built on */
+        keyframe = 1;
+        size = encodeDelta((const uint8_t*) rewind->current, NULL, sizeof(MachineState), rewind->scratch);
+        offset = 0;
+    }
+    memcpy(rewind->data + offset, rewind->scratch, size);
+
+    RewindEntry* entry = entryAt(rewind, rewind->count);
+    entry->offset = offset;
+    entry->size = size | (keyframe ? KEYFRAME_BIT : 0);
+    rewind->count++;
+    rewind->used += size;
+    rewind->writeOffset = offset + size;
+    rewind->sinceKeyframe = keyframe ? 1 : rewind->sinceKeyframe + 1;
+    rewind->nextFrame++;
+
+    MachineState* swap = rewind->previous;
+    rewind->previous = rewind->current;
+    rewind->current = swap;
+}
+
+/* Frames are numbered by capture, starting at 0 */
+uint64_t rewindOldestFrame(const RewindBuffer* rewind) {
+    return rewind->nextFrame - rewind->count;
+}
+
+uint64_t rewindNewestFrame(const RewindBuffer* rewind) {
+    return rewind->nextFrame - 1;
+}
+
+size_t rewindBytesUsed(const RewindBuffer* rewind) {
+    return rewind->used;
+}
+
+int rewindRestore(RewindBuffer* rewind, CPU* cpu, uint64_t frame) {
+    if (rewind->count == 0 || frame < rewindOldestFrame(rewind) || frame > rewindNewestFrame(rewind)) {
+        return -1;
+    }
+
+    uint32_t target = frame - rewindOldestFrame(rewind);
+    uint32_t keyframe = target;
+    while (!(entryAt(rewind, keyframe)->size & KEYFRAME_BIT)) {
+        keyframe--;
+    }
+
+    /* Rebuild into `previous`, which is also the base the next capture will be XORed against */
+    MachineState* state = rewind->previous;
+    memset(state, 0, sizeof(*state));
+    for (uint32_t i = keyframe; i <= target; i++) {
+        RewindEntry* entry = entryAt(rewind, i);
+        applyDelta((uint8_t*) state, rewind->data + entry->offset, entry->size & ~KEYFRAME_BIT);
+    }
+    if (restoreState(cpu, state) != 0) {
+        return -1;
+    }
+
+    for (uint32_t i = target + 1; i < rewind->count; i++) {
+        rewind->used -= entryAt(rewind, i)->size & ~KEYFRAME_BIT;
+    }
+    RewindEntry* last = entryAt(rewind, target);
+    rewind->writeOffset = last->offset + (last->size & ~KEYFRAME_BIT);
+    rewind->nextFrame -= rewind->count - (target + 1);
+    rewind->count = target + 1;
+    rewind->sinceKeyframe = target - keyframe + 1;
+    return 0;
+}
+
+/* Captures the power-on state and every one of `frames` frames into a REWIND_BUDGET ring, then restores every frame
+    * still in it, newest first, and checks each against a plain machine: RAM right after the restore, and RAM and
+    * screen after running one more frame from it. Last, the machine runs on from the oldest frame to the end and must
+    * finish where the plain one does.
+*/
+int benchmarkRewind(const GameInformation* game, uint64_t frames) {
+    CPU* plain = createCPU();
+    CPU* cpu = createCPU();
+    RewindBuffer* rewind = createRewindBuffer(REWIND_BUDGET, REWIND_KEYFRAME_INTERVAL);
+    uint64_t* ram = (uint64_t*) calloc(frames + 1, sizeof(uint64_t));
+    uint64_t* screens = (uint64_t*) calloc(frames + 1, sizeof(uint64_t));
+    if (!plain || !cpu || !rewind || !ram || !screens || loadROM(plain, game) != 0 || loadROM(cpu, game) != 0) {
+        free(ram);
+        free(screens);
+        destroyRewindBuffer(rewind);
+        destroyCPU(cpu);
+        destroyCPU(plain);
+        return -1;
+    }
+
+    /* Frame f is the state after f frames, so both machines start out identical at frame 0 (with nothing drawn yet) */
+    ram[0] = hashBytes(plain->ram, sizeof(plain->ram));
+    for (uint64_t frame = 1; frame <= frames; frame++) {
+        runFrame(plain);
+        ram[frame] = hashBytes(plain->ram, sizeof(plain->ram));
+        screens[frame] = hashBytes(plain->graphics->screen, sizeof(plain->graphics->screen));
+    }
+
+    uint64_t captureTime = 0;
+    size_t mostUsed = 0;
+    for (uint64_t frame = 0; frame <= frames; frame++) {
+        if (frame) {
+            runFrame(cpu);
+        }
+        uint64_t start = nowNanoseconds();
+        rewindCapture(rewind, cpu);
+        captureTime += nowNanoseconds() - start;
+        if (rewindBytesUsed(rewind) > mostUsed) {
+            mostUsed = rewindBytesUsed(rewind);
+        }
+    }
+    uint64_t oldest = rewindOldestFrame(rewind);
+    uint64_t newest = rewindNewestFrame(rewind);
+    size_t used = rewindBytesUsed(rewind);
+
+    uint64_t restoreTime = 0;
+    uint64_t mismatches = 0;
+    uint64_t firstMismatch = 0;
+    for (uint64_t frame = newest + 1; frame-- > oldest;) {
+        uint64_t start = nowNanoseconds();
+        int restored = rewindRestore(rewind, cpu, frame);
+        restoreTime += nowNanoseconds() - start;
+        int wrong = restored != 0 || hashBytes(cpu->ram, sizeof(cpu->ram)) != ram[frame];
+        if (frame < frames) {
+            runFrame(cpu);
+            wrong |= hashBytes(cpu->ram, sizeof(cpu->ram)) != ram[frame + 1] ||
+                hashBytes(cpu->graphics->screen, sizeof(cpu->graphics->screen)) != screens[frame + 1];
+        }
+        if (wrong && !mismatches++) {
+            firstMismatch = frame;
+        }
+    }
+    for (uint64_t frame = oldest + 1; frame < frames; frame++) {
+        runFrame(cpu);
+    }
+    int diverged = hashBytes(cpu->ram, sizeof(cpu->ram)) != ram[frames];
+
+    uint64_t restores = newest - oldest + 1;
+    printf("Captured %llu frames in %zu of %u bytes (%.0f bytes per frame, at most %zu used), frames %llu-%llu kept\n",
+        (unsigned long long)(frames + 1), used, REWIND_BUDGET, (double) used / restores, mostUsed,
+        (unsigned long long) oldest, (unsigned long long) newest);
+    printf("Capture %8.2f us per frame\n", captureTime / 1000.0 / (frames + 1));
+    printf("Restore %8.2f us per frame (keyframe every %u frames)\n", restoreTime / 1000.0 / restores,
+        REWIND_KEYFRAME_INTERVAL);
+    if (mismatches) {
+        printf("%llu of %llu restored frames wrong, first at frame %llu\n", (unsigned long long) mismatches,
+            (unsigned long long) restores, (unsigned long long) firstMismatch);
+    } else {
+        printf("%llu restored frames match the plain machine\n", (unsigned long long) restores);
+    }
+    if (diverged) {
+        printf("Running on from frame %llu diverged from the plain machine\n", (unsigned long long) oldest);
+    }
+    free(ram);
+    free(screens);
+    destroyRewindBuffer(rewind);
+    destroyCPU(cpu);
+    destroyCPU(plain);
+    return mismatches || diverged ? -1 : 0;
+}
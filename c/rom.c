@@ -0,0 +1,122 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nes.h"
+
+#define HEADER_SIZE 16
+
+/* NES 2.0 stores sizes as a 12-bit count of units, or as 2^E * (MM * 2 + 1) bytes when the high nibble is $F */
+static uint64_t nes2RomSize(uint8_t lsb, uint8_t msb, uint32_t unit) {
+    if (msb == 0x0F) {
+        return (1ULL << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
+    }
+    return (uint64_t)((msb << 8) | lsb) * unit;
+}
+
+/* RAM sizes are 64 << shift bytes, with 0 meaning none */
+static uint32_t nes2RamSize(uint8_t shift) {
+    return shift ? 64u << shift : 0;
+}
+
+// https://www.nesdev.org/wiki/INES
+// https://www.nesdev.org/wiki/NES_2.0
+/* Fills `game` from an image in memory without copying it; the pointers stay valid as long as `data` does */
+int parseROM(uint8_t* data, size_t size, GameInformation* game) {
+    memset(game, 0, sizeof(*game));
+    if (size < HEADER_SIZE || memcmp(data, "NES\x1A", 4) != 0) {
+        return -1;
+    }
+
+    uint8_t flags6 = data[6];
+    uint8_t flags7 = data[7];
+    uint64_t prgSize, chrSize;
+    game->nes2 = (flags7 & 0x0C) == 0x08;
+    if (game->nes2) {
+        game->mapper = (flags6 >> 4) | (flags7 & 0xF0) | ((data[8] & 0x0F) << 8);
+        game->submapper = data[8] >> 4;
+        prgSize = nes2RomSize(data[4], data[9] & 0x0F, 0x4000);
+        chrSize = nes2RomSize(data[5], data[9] >> 4, 0x2000);
+        game->prgRamSize = nes2RamSize(data[10] & 0x0F) + nes2RamSize(data[10] >> 4);
+        game->chrRamSize = nes2RamSize(data[11] & 0x0F) + nes2RamSize(data[11] >> 4);
+    } else {
+        /* Old dumps often have a signature ("DiskDude!") in bytes 7-15, which makes the upper mapper nibble garbage */
+        int dirty = data[12] || data[13] || data[14] || data[15];
+        game->mapper = (flags6 >> 4) | (dirty ? 0 : (flags7 & 0xF0));
+        prgSize = data[4] * 0x4000;
+        chrSize = data[5] * 0x2000;
+        game->prgRamSize = (!dirty && data[8] ? data[8] : 1) * 0x2000;
+        game->chrRamSize = chrSize ? 0 : 0x2000;
+    }
+
+    if (flags6 & 0x08) {
+        game->mirroring = MIRROR_FOUR_SCREEN;
+    } else {
+        game->mirroring = (flags6 & 0x01) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+    }
+    game->battery = (flags6 & 0x02) != 0;
+
+    size_t offset = HEADER_SIZE;
+    if (flags6 & 0x04) {
+        if (size < offset + TRAINER_SIZE) {
+            return -1;
+        }
+        /* loadROM copies the trainer to $7000, so the board needs PRG-RAM even if the header claims none */
+        game->trainer = data + offset;
+        offset += TRAINER_SIZE;
+        if (!game->prgRamSize) {
+            game->prgRamSize = PRG_RAM_SIZE;
+        }
+    }
+    /* Exponent-form sizes go up to 2^63 * 7, so each is checked against what's left of the file before they're added,
+        * and GameInformation keeps them in 32 bits; the bus maps PRG in whole 256-byte pages
+    */
+    uint64_t remaining = size - offset < UINT32_MAX ? size - offset : UINT32_MAX;
+    if (prgSize == 0 || prgSize > remaining || chrSize > remaining - prgSize || prgSize % 0x100 != 0) {
+        return -1;
+    }
+    /* CHR is mapped in 1KB slots over the whole 8KB of pattern tables */
+    if (chrSize && (chrSize < 0x2000 || chrSize % 0x400 != 0)) {
+        return -1;
+    }
+    game->prg = data + offset;
+    game->prgSize = prgSize;
+    game->chr = chrSize ? data + offset + prgSize : NULL;
+    game->chrSize = chrSize;
+    return 0;
+}
+
+/* Maps the file read-only and shared, so every instance (and process) running it uses the same page-cache pages */
+int openROM(const char* path, GameInformation* game) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+
+    if (parseROM((uint8_t*) mapping, info.st_size, game) != 0) {
+        munmap(mapping, info.st_size);
+        return -1;
+    }
+    game->mapping = mapping;
+    game->mappingSize = info.st_size;
+    return 0;
+}
+
+void closeROM(GameInformation* game) {
+    if (game->mapping) {
+        munmap(game->mapping, game->mappingSize);
+    }
+    memset(game, 0, sizeof(*game));
+}
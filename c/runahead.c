@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+/* Run-ahead.
+    *
+    * Every host frame the machine runs the real frame with the current input, then `frames` more frames with the same
+    * input, and the picture shown is the last of those; the speculative frames are then thrown away. A game that reacts
+    * to a button on the frame after it is read then shows the reaction `frames` frames earlier. A state is a MachineState
+    * in a buffer allocated once, so a snapshot is a plain copy and a restore is that copy back plus dropping the caches
+    * the copied memory could have made stale.
+    *
+    * The single-instance variant snapshots the machine after the real frame and restores it after the speculative ones,
+    * with sound off and drawing off until the frame that is shown. The secondary-instance variant never touches the
+    * machine: it copies its state into a second machine on the same game and speculates there, so the primary keeps its
+    * decode caches, its sound and its timing and draws nothing, and the second machine draws and never makes a sound.
+    *
+*/
+
+struct run_ahead {
+    CPU* cpu;
+    CPU* secondary;
+    uint32_t frames;
+    uint8_t headless;
+    MachineState* state;
+    RunAheadStats stats;
+};
+
+/* Runs `cpu` `frames` frames ahead of the state it's in and from `frames` frames away; only the last one is drawn, and
+    * only if the machine being shown isn't headless
+*/
+static void speculate(RunAhead* ahead, CPU* cpu) {
+    for (uint32_t i = 1; i <= ahead->frames; i++) {
+        cpu->headless = i < ahead->frames ? 1 : ahead->headless;
+        runFrame(cpu);
+    }
+    ahead->stats.speculative += ahead->frames;
+}
+
+/* Runs `frames` frames ahead of `cpu`, on a second machine when `secondary` is set. The machine must have a game loaded
+    * and stays the one the game runs on: its input is read from cpu->buttons and it keeps the audio output. Returns
+    * NULL for machines drawing on a PPU thread, whose shadow can't follow a machine that jumps back every frame.
+*/
+RunAhead* createRunAhead(CPU* cpu, uint32_t frames, int secondary) {
+    if (!cpu->game || cpu->ppuThread) {
+        return NULL;
+    }
+    RunAhead* ahead = (RunAhead*) calloc(1, sizeof(RunAhead));
+    if (!ahead) {
+        return NULL;
+    }
+    ahead->cpu = cpu;
+    ahead->frames = frames;
+    ahead->headless = cpu->headless;
+    ahead->state = (MachineState*) malloc(sizeof(MachineState));
+    if (!ahead->state) {
+        free(ahead);
+        return NULL;
+    }
+    if (secondary) {
+        ahead->secondary = createCPU();
+        if (!ahead->secondary || loadROM(ahead->secondary, cpu->game) != 0) {
+            destroyCPU(ahead->secondary);
+            free(ahead->state);
+            free(ahead);
+            return NULL;
+        }
+        ahead->secondary->renderKernel = cpu->renderKernel;
+        cpu->headless = 1;
+    }
+    return ahead;
+}
+
+/* Gives the machine back as it was, drawing again if it did before */
+void destroyRunAhead(RunAhead* ahead) {
+    if (!ahead) {
+        return;
+    }
+    ahead->cpu->headless = ahead->headless;
+    destroyCPU(ahead->secondary);
+    free(ahead->state);
+    free(ahead);
+}
+
+/* One host frame: the real frame with the current input, then the speculative ones. Returns the frame to show. */
+const Graphics* runAheadFrame(RunAhead* ahead) {
+    CPU* cpu = ahead->cpu;
+    ahead->stats.frames++;
+    if (!ahead->frames) {
+        runFrame(cpu);
+        return getGraphics(cpu);
+    }
+    if (!ahead->secondary) {
+        cpu->headless = 1;
+    }
+    runFrame(cpu);
+
+    uint64_t start = nowNanoseconds();
+    captureState(cpu, ahead->state);
+    uint64_t captured = nowNanoseconds();
+    ahead->stats.snapshotNanoseconds += captured - start;
+
+    if (ahead->secondary) {
+        CPU* secondary = ahead->secondary;
+        restoreState(secondary, ahead->state);
+        ahead->stats.restoreNanoseconds += nowNanoseconds() - captured;
+        memcpy(secondary->buttons, cpu->buttons, sizeof(secondary->buttons));
+        speculate(ahead, secondary);
+        return getGraphics(secondary);
+    }
+
+    AudioOutput* audio = cpu->audio;
+    cpu->audio = NULL;
+    speculate(ahead, cpu);
+    cpu->audio = audio;
+    cpu->headless = ahead->headless;
+    start = nowNanoseconds();
+    restoreState(cpu, ahead->state);
+    ahead->stats.restoreNanoseconds += nowNanoseconds() - start;
+    return getGraphics(cpu);
+}
+
+void getRunAheadStats(const RunAhead* ahead, RunAheadStats* stats) {
+    *stats = ahead->stats;
+}
+
+/* Times `frames` host frames without run-ahead and with one and two frames of it, in both variants, and checks the
+    * results: with unchanging input, the frame shown on host frame f must be the one a plain machine draws on frame
+    * f + N, and the machine itself must end where the plain one does.
+*/
+int benchmarkRunAhead(const GameInformation* game, uint64_t frames) {
+    CPU* plain = createCPU();
+    uint64_t* screens = (uint64_t*) calloc(frames + 3, sizeof(uint64_t));
+    if (!plain || !screens || loadROM(plain, game) != 0) {
+        destroyCPU(plain);
+        free(screens);
+        return -1;
+    }
+    uint64_t start = nowNanoseconds();
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        runFrame(plain);
+        screens[frame] = hashBytes(plain->graphics->screen, sizeof(plain->graphics->screen));
+    }
+    double plainTime = (nowNanoseconds() - start) / (double) frames;
+    uint64_t plainRAM = hashBytes(plain->ram, sizeof(plain->ram));
+    for (uint64_t frame = frames; frame < frames + 2; frame++) {
+        runFrame(plain);
+        screens[frame] = hashBytes(plain->graphics->screen, sizeof(plain->graphics->screen));
+    }
+    destroyCPU(plain);
+    printf("No run-ahead            %8.1f us per host frame\n", plainTime / 1000.0);
+
+    int result = 0;
+    for (int secondary = 0; secondary < 2; secondary++) {
+        for (uint32_t ahead = 1; ahead <= 2; ahead++) {
+            CPU* cpu = createCPU();
+            RunAhead* runAhead = NULL;
+            if (!cpu || loadROM(cpu, game) != 0 || !(runAhead = createRunAhead(cpu, ahead, secondary))) {
+                destroyCPU(cpu);
+                free(screens);
+                return -1;
+            }
+            uint64_t mismatches = 0;
+            start = nowNanoseconds();
+            for (uint64_t frame = 0; frame < frames; frame++) {
+                const Graphics* shown = runAheadFrame(runAhead);
+                mismatches += hashBytes(shown->screen, sizeof(shown->screen)) != screens[frame + ahead];
+            }
+            double time = (nowNanoseconds() - start) / (double) frames;
+            RunAheadStats stats;
+            getRunAheadStats(runAhead, &stats);
+            int diverged = hashBytes(cpu->ram, sizeof(cpu->ram)) != plainRAM;
+            printf("%s, %u ahead  %8.1f us per host frame, snapshot %.2f us, restore %.2f us, %llu frames shown "
+                "wrong%s\n", secondary ? "Secondary" : "Single   ", ahead, time / 1000.0,
+                stats.snapshotNanoseconds / 1000.0 / stats.frames, stats.restoreNanoseconds / 1000.0 / stats.frames,
+                (unsigned long long) mismatches, diverged ? ", machine diverged" : "");
+            result |= mismatches || diverged ? -1 : 0;
+            destroyRunAhead(runAhead);
+            destroyCPU(cpu);
+        }
+    }
+    free(screens);
+    return result;
+}
@@ -0,0 +1,56 @@
+#include "nes.h"
+
+static void (*const eventHandlers[EVENT_COUNT])(CPU* cpu) = {
+    [EVENT_PPU] = ppuEvent,
+    [EVENT_MAPPER_IRQ] = mapperIrqEvent,
+    [EVENT_FRAME_COUNTER] = frameCounterEvent,
+    [EVENT_PPU_THREAD] = ppuThreadEvent,
+    [EVENT_DMC] = dmcEvent,
+};
+
+/* There are only a handful of sources, so the queue is one slot per source and a linear scan for the minimum */
+static void updateNextEvent(Clock* clock) {
+    uint64_t next = NO_EVENT;
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (clock->events[i] < next) {
+            next = clock->events[i];
+        }
+    }
+    clock->nextEvent = next;
+    if (next < clock->target) {
+        clock->target = next;
+    }
+}
+
+/* Replaces the pending time of `event`; NO_EVENT cancels it */
+void scheduleEvent(CPU* cpu, enum ClockEvent event, uint64_t cycle) {
+    cpu->clock.events[event] = cycle;
+    updateNextEvent(&cpu->clock);
+}
+
+/* Runs every event that is due. Handlers reschedule themselves, and one that is due again straight away runs again. */
+void runEvents(CPU* cpu) {
+    Clock* clock = &cpu->clock;
+    while (clock->nextEvent <= clock->cycles) {
+        for (int i = 0; i < EVENT_COUNT; i++) {
+            if (clock->events[i] <= clock->cycles) {
+                clock->events[i] = NO_EVENT;
+                updateNextEvent(clock);
+                eventHandlers[i](cpu);
+            }
+        }
+    }
+}
+
+/* Rebuilds every slot from component state, after a reset or a state load */
+void resetEvents(CPU* cpu) {
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        cpu->clock.events[i] = NO_EVENT;
+    }
+    cpu->clock.target = NO_EVENT;
+    updateNextEvent(&cpu->clock);
+    ppuEvent(cpu);
+    scheduleMapperIrq(cpu);
+    frameCounterEvent(cpu);
+    ppuThreadEvent(cpu);
+}
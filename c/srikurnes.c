@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes.h"
+#include "srikurnes.h"
+
+/* A SrikurNES is the machine's CPU itself, so every call is one cast away from the emulator and views need no copy */
+static inline CPU* machine(const SrikurNES* nes) {
+    return (CPU*) nes;
+}
+
+/* And a SrikurNESRewind is the RewindBuffer */
+static inline RewindBuffer* history(const SrikurNESRewind* rewind) {
+    return (RewindBuffer*) rewind;
+}
+
+/* And a SrikurNESMovie is the Movie */
+static inline Movie* movieOf(const SrikurNESMovie* movie) {
+    return (Movie*) movie;
+}
+
+_Static_assert(SRIKURNES_SCREEN_WIDTH == SCREEN_WIDTH && SRIKURNES_SCREEN_HEIGHT == SCREEN_HEIGHT, "screen size");
+_Static_assert(SRIKURNES_RAM_SIZE == sizeof(((CPU*) 0)->ram), "RAM size");
+_Static_assert(SRIKURNES_BUTTON_A == BUTTON_A && SRIKURNES_BUTTON_RIGHT == BUTTON_RIGHT, "button bits");
+
+/* `copy` is the image for ROMs loaded from memory (NULL for mapped files, which closeROM unmaps) */
+struct srikurnes_rom {
+    GameInformation game;
+    uint8_t* copy;
+};
+
+SRIKURNES_API SrikurNESRom* srikurnes_rom_open(const char* path) {
+    SrikurNESRom* rom = (SrikurNESRom*) calloc(1, sizeof(SrikurNESRom));
+    if (!rom) {
+        return NULL;
+    }
+    if (openROM(path, &rom->game) != 0) {
+        free(rom);
+        return NULL;
+    }
+    return rom;
+}
+
+SRIKURNES_API SrikurNESRom* srikurnes_rom_from_memory(const void* data, size_t size) {
+    SrikurNESRom* rom = (SrikurNESRom*) calloc(1, sizeof(SrikurNESRom));
+    if (!rom) {
+        return NULL;
+    }
+    rom->copy = (uint8_t*) malloc(size ? size : 1);
+    if (!rom->copy) {
+        free(rom);
+        return NULL;
+    }
+    memcpy(rom->copy, data, size);
+    if (parseROM(rom->copy, size, &rom->game) != 0) {
+        free(rom->copy);
+        free(rom);
+        return NULL;
+    }
+    return rom;
+}
+
+SRIKURNES_API void srikurnes_rom_close(SrikurNESRom* rom) {
+    if (!rom) {
+        return;
+    }
+    if (rom->copy) {
+        free(rom->copy);
+    } else {
+        closeROM(&rom->game);
+    }
+    free(rom);
+}
+
+SRIKURNES_API SrikurNES* srikurnes_create(void) {
+    return (SrikurNES*) createCPU();
+}
+
+SRIKURNES_API void srikurnes_destroy(SrikurNES* nes) {
+    destroyCPU(machine(nes));
+}
+
+SRIKURNES_API int srikurnes_load(SrikurNES* nes, const SrikurNESRom* rom, uint64_t seed) {
+    CPU* cpu = machine(nes);
+    seedRAM(cpu, seed);
+    return loadROM(cpu, &rom->game);
+}
+
+SRIKURNES_API void srikurnes_step_frame(SrikurNES* nes) {
+    runFrame(machine(nes));
+}
+
+SRIKURNES_API void srikurnes_step_n_frames(SrikurNES* nes, uint32_t frames) {
+    CPU* cpu = machine(nes);
+    for (uint32_t i = 0; i < frames; i++) {
+        runFrame(cpu);
+    }
+}
+
+SRIKURNES_API void srikurnes_step_many(SrikurNES* const* machines, size_t count, uint32_t frames) {
+    for (size_t i = 0; i < count; i++) {
+        /* The next machine's registers and clock share the first cache lines of its block */
+        if (i + 1 < count) {
+            __builtin_prefetch(machines[i + 1]);
+        }
+        srikurnes_step_n_frames(machines[i], frames);
+    }
+}
+
+SRIKURNES_API void srikurnes_set_headless(SrikurNES* nes, int headless) {
+    CPU* cpu = machine(nes);
+    stopPpuThread(cpu);
+    cpu->headless = headless != 0;
+}
+
+SRIKURNES_API int srikurnes_set_ppu_thread(SrikurNES* nes, int enabled) {
+    CPU* cpu = machine(nes);
+    if (!enabled) {
+        stopPpuThread(cpu);
+        return 0;
+    }
+    return startPpuThread(cpu);
+}
+
+SRIKURNES_API void srikurnes_set_input(SrikurNES* nes, int port, uint8_t buttons) {
+    machine(nes)->buttons[port & 1] = buttons;
+}
+
+SRIKURNES_API int srikurnes_save_state(SrikurNES* nes, const char* path) {
+    return saveStateFile(machine(nes), path);
+}
+
+SRIKURNES_API int srikurnes_load_state(SrikurNES* nes, const char* path) {
+    return loadStateFile(machine(nes), path);
+}
+
+SRIKURNES_API SrikurNESRewind* srikurnes_rewind_create(size_t budget, uint32_t keyframe_interval) {
+    return (SrikurNESRewind*) createRewindBuffer(budget, keyframe_interval);
+}
+
+SRIKURNES_API void srikurnes_rewind_destroy(SrikurNESRewind* rewind) {
+    destroyRewindBuffer(history(rewind));
+}
+
+SRIKURNES_API void srikurnes_rewind_capture(SrikurNESRewind* rewind, SrikurNES* nes) {
+    rewindCapture(history(rewind), machine(nes));
+}
+
+SRIKURNES_API int srikurnes_rewind_restore(SrikurNESRewind* rewind, SrikurNES* nes, uint64_t frame) {
+    return rewindRestore(history(rewind), machine(nes), frame);
+}
+
+SRIKURNES_API uint64_t srikurnes_rewind_oldest(const SrikurNESRewind* rewind) {
+    return rewindOldestFrame(history(rewind));
+}
+
+SRIKURNES_API uint64_t srikurnes_rewind_newest(const SrikurNESRewind* rewind) {
+    return rewindNewestFrame(history(rewind));
+}
+
+SRIKURNES_API size_t srikurnes_rewind_bytes_used(const SrikurNESRewind* rewind) {
+    return rewindBytesUsed(history(rewind));
+}
+
+SRIKURNES_API SrikurNESMovie* srikurnes_movie_record(SrikurNES* nes, const char* path, uint32_t keyframe_interval) {
+    return (SrikurNESMovie*) recordMovie(path, machine(nes), keyframe_interval);
+}
+
+SRIKURNES_API SrikurNESMovie* srikurnes_movie_play(SrikurNES* nes, const char* path) {
+    return (SrikurNESMovie*) playMovie(path, machine(nes));
+}
+
+SRIKURNES_API int srikurnes_movie_frame(SrikurNESMovie* movie, SrikurNES* nes) {
+    return movieFrame(movieOf(movie), machine(nes));
+}
+
+SRIKURNES_API int srikurnes_movie_seek(SrikurNESMovie* movie, SrikurNES* nes, uint64_t frame) {
+    return seekMovie(movieOf(movie), machine(nes), frame);
+}
+
+SRIKURNES_API uint64_t srikurnes_movie_desyncs(const SrikurNESMovie* movie) {
+    MovieStats stats;
+    getMovieStats(movieOf(movie), &stats);
+    return stats.desyncs;
+}
+
+SRIKURNES_API int srikurnes_movie_close(SrikurNESMovie* movie) {
+    return closeMovie(movieOf(movie));
+}
+
+SRIKURNES_API const uint8_t* srikurnes_framebuffer(SrikurNES* nes) {
+    Graphics* graphics = getGraphics(machine(nes));
+    return graphics ? graphics->screen : NULL;
+}
+
+SRIKURNES_API const uint8_t* srikurnes_ram(const SrikurNES* nes) {
+    return machine(nes)->ram;
+}
+
+SRIKURNES_API uint64_t srikurnes_frame_count(const SrikurNES* nes) {
+    return machine(nes)->ppu.frame;
+}
+
+SRIKURNES_API uint64_t srikurnes_cycles(const SrikurNES* nes) {
+    return machine(nes)->clock.cycles;
+}
@@ -0,0 +1,130 @@
+#ifndef SRIKURNES_H
+#define SRIKURNES_H
+
+/* libsrikurnes: the emulator as a library, for harnesses that drive many machines from their own loop.
+    *
+    * Build: make libsrikurnes.a libsrikurnes.so compiles every source in c/ except main.c with -fPIC
+    * -fvisibility=hidden, so only the functions below are exported; link with -pthread -lm. make check-lib builds and
+    * runs examples/embed.c against the shared library.
+    *
+    * A ROM is opened once and can be loaded into any number of machines, which only read it; it must outlive them.
+    * Machines are independent, so different machines can be stepped on different threads at the same time. The
+    * framebuffer and RAM views point into the machine itself: they are never copied, stay valid until the machine is
+    * destroyed, and change as it runs.
+    *
+*/
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define SRIKURNES_API __attribute__((visibility("default")))
+#else
+#define SRIKURNES_API
+#endif
+
+typedef struct srikurnes SrikurNES;
+typedef struct srikurnes_rom SrikurNESRom;
+typedef struct srikurnes_rewind SrikurNESRewind;
+typedef struct srikurnes_movie SrikurNESMovie;
+
+#define SRIKURNES_SCREEN_WIDTH 256
+#define SRIKURNES_SCREEN_HEIGHT 240
+#define SRIKURNES_RAM_SIZE 0x800
+
+/* Controller buttons, one bit each, in the order the standard controller reports them */
+#define SRIKURNES_BUTTON_A 0x01
+#define SRIKURNES_BUTTON_B 0x02
+#define SRIKURNES_BUTTON_SELECT 0x04
+#define SRIKURNES_BUTTON_START 0x08
+#define SRIKURNES_BUTTON_UP 0x10
+#define SRIKURNES_BUTTON_DOWN 0x20
+#define SRIKURNES_BUTTON_LEFT 0x40
+#define SRIKURNES_BUTTON_RIGHT 0x80
+
+/* ROMs. Both return NULL for anything that isn't an iNES/NES 2.0 image; a buffer is copied, a file is mapped. */
+SRIKURNES_API SrikurNESRom* srikurnes_rom_open(const char* path);
+SRIKURNES_API SrikurNESRom* srikurnes_rom_from_memory(const void* data, size_t size);
+SRIKURNES_API void srikurnes_rom_close(SrikurNESRom* rom);
+
+/* Machines. load powers the machine on with `rom` inserted and returns -1 for unsupported boards; the power-on RAM
+    * contents are picked from `seed`, so the same seed always starts from the same state.
+*/
+SRIKURNES_API SrikurNES* srikurnes_create(void);
+SRIKURNES_API void srikurnes_destroy(SrikurNES* nes);
+SRIKURNES_API int srikurnes_load(SrikurNES* nes, const SrikurNESRom* rom, uint64_t seed);
+
+/* Running. A frame ends when the PPU enters vertical blank, i.e. when the framebuffer holds a complete picture. */
+SRIKURNES_API void srikurnes_step_frame(SrikurNES* nes);
+SRIKURNES_API void srikurnes_step_n_frames(SrikurNES* nes, uint32_t frames);
+/* Steps every machine in `machines` by `frames` frames, one machine after another on the calling thread */
+SRIKURNES_API void srikurnes_step_many(SrikurNES* const* machines, size_t count, uint32_t frames);
+
+/* Headless machines keep everything the game can observe exact (flags, interrupts, timing, sprite 0 hit) but never
+    * draw, so the framebuffer stops changing. Worth it for workloads that only look at RAM; can be switched any time,
+    * and a machine switched before srikurnes_load never allocates a framebuffer at all.
+*/
+SRIKURNES_API void srikurnes_set_headless(SrikurNES* nes, int headless);
+
+/* Moves drawing to a second thread owned by the machine, so stepping a frame costs the calling thread only the CPU
+    * and the PPU's timing. Frames, RAM and timing are exactly those of the one-thread machine. Returns -1 for headless
+    * machines and when the thread can't be started; loading a ROM or going headless turns it off again.
+*/
+SRIKURNES_API int srikurnes_set_ppu_thread(SrikurNES* nes, int enabled);
+
+/* Input: the buttons held on controller `port` (0 or 1) from now on, as SRIKURNES_BUTTON_* bits */
+SRIKURNES_API void srikurnes_set_input(SrikurNES* nes, int port, uint8_t buttons);
+
+/* Save states: everything the machine needs to resume, in a file only this build reads back. load_state returns -1 for
+    * unreadable files and states of another version, and leaves the machine as it was.
+*/
+SRIKURNES_API int srikurnes_save_state(SrikurNES* nes, const char* path);
+SRIKURNES_API int srikurnes_load_state(SrikurNES* nes, const char* path);
+
+/* Rewind: a history of states in a fixed `budget` of bytes (a few MB hold minutes), with a full state every
+    * `keyframe_interval` captures and compressed differences in between; the oldest history goes when it fills up.
+    * Captures are numbered from 0. restore puts `nes` back exactly as it was at capture `frame` and forgets every later
+    * one, so capturing carries on from there; it returns -1 for frames no longer (or not yet) kept. A history may be
+    * used with one machine at a time and any ROM, but restoring only makes sense into a machine running the same one.
+*/
+SRIKURNES_API SrikurNESRewind* srikurnes_rewind_create(size_t budget, uint32_t keyframe_interval);
+SRIKURNES_API void srikurnes_rewind_destroy(SrikurNESRewind* rewind);
+SRIKURNES_API void srikurnes_rewind_capture(SrikurNESRewind* rewind, SrikurNES* nes);
+SRIKURNES_API int srikurnes_rewind_restore(SrikurNESRewind* rewind, SrikurNES* nes, uint64_t frame);
+SRIKURNES_API uint64_t srikurnes_rewind_oldest(const SrikurNESRewind* rewind);
+SRIKURNES_API uint64_t srikurnes_rewind_newest(const SrikurNESRewind* rewind);
+SRIKURNES_API size_t srikurnes_rewind_bytes_used(const SrikurNESRewind* rewind);
+
+/* Input movies: the buttons of every frame from a starting state, with a full state at every `keyframe_interval`th
+    * frame (0 picks ten seconds' worth). Call srikurnes_movie_frame before every srikurnes_step_frame: recording stores
+    * the buttons set with srikurnes_set_input, playback sets them and returns -1 past the last frame. record starts
+    * from the machine's current state; play puts the machine in the movie's starting state and returns NULL for a
+    * movie of another game. seek (playback only) goes to just before `frame` in at most keyframe_interval frames.
+    * desyncs counts the keyframes playback reached in a different state than the recording; close returns -1 if a
+    * write of the recording failed.
+*/
+SRIKURNES_API SrikurNESMovie* srikurnes_movie_record(SrikurNES* nes, const char* path, uint32_t keyframe_interval);
+SRIKURNES_API SrikurNESMovie* srikurnes_movie_play(SrikurNES* nes, const char* path);
+SRIKURNES_API int srikurnes_movie_frame(SrikurNESMovie* movie, SrikurNES* nes);
+SRIKURNES_API int srikurnes_movie_seek(SrikurNESMovie* movie, SrikurNES* nes, uint64_t frame);
+SRIKURNES_API uint64_t srikurnes_movie_desyncs(const SrikurNESMovie* movie);
+SRIKURNES_API int srikurnes_movie_close(SrikurNESMovie* movie);
+
+/* Views. The framebuffer is SRIKURNES_SCREEN_WIDTH * SRIKURNES_SCREEN_HEIGHT bytes, row-major, each a 6-bit NES
+    * colour index. It is allocated when the machine first draws or when srikurnes_framebuffer is first called (hence
+    * the non-const machine), so headless machines never have one otherwise, and it is only NULL when there is no
+    * memory for it. RAM is the SRIKURNES_RAM_SIZE bytes at $0000-$07FF.
+*/
+SRIKURNES_API const uint8_t* srikurnes_framebuffer(SrikurNES* nes);
+SRIKURNES_API const uint8_t* srikurnes_ram(const SrikurNES* nes);
+SRIKURNES_API uint64_t srikurnes_frame_count(const SrikurNES* nes);
+SRIKURNES_API uint64_t srikurnes_cycles(const SrikurNES* nes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "nes.h"
+
+/* P goes through getStatus/setStatus so states are interchangeable between the eager and lazy-flag builds */
+void captureState(CPU* cpu, MachineState* state) {
+    state->magic = STATE_MAGIC;
+    state->version = STATE_VERSION;
+    state->cycles = cpu->clock.cycles;
+    state->skipCycles = cpu->clock.skipCycles;
+    state->pc = cpu->registers.pc;
+    state->acc = cpu->registers.acc;
+    state->x = cpu->registers.x;
+    state->y = cpu->registers.y;
+    state->s = cpu->registers.s;
+    state->p = getStatus(cpu);
+    state->reserved = 0;
+    memcpy(state->ram, cpu->ram, sizeof(state->ram));
+    if (cpu->prgRam) {
+        memcpy(state->prgRam, cpu->prgRam, sizeof(state->prgRam));
+    } else {
+        memset(state->prgRam, 0, sizeof(state->prgRam));
+    }
+    state->ppu = cpu->ppu;
+    state->apu = cpu->apu;
+    memcpy(state->ioRegisters, cpu->ioRegisters, sizeof(state->ioRegisters));
+    if (cpu->chrRam) {
+        memcpy(state->chrRam, cpu->chrRam, sizeof(state->chrRam));
+    } else {
+        memset(state->chrRam, 0, sizeof(state->chrRam));
+    }
+    state->mapper = cpu->mapperState;
+    state->irq = cpu->irq;
+    state->nmi = cpu->nmi;
+    memcpy(state->controllers, cpu->controllers, sizeof(state->controllers));
+    memset(state->padding, 0, sizeof(state->padding));
+}
+
+int restoreState(CPU* cpu, const MachineState* state) {
+    if (state->magic != STATE_MAGIC || state->version != STATE_VERSION) {
+        return -1;
+    }
+    cpu->clock.cycles = state->cycles;
+    cpu->clock.skipCycles = state->skipCycles;
+    cpu->registers.pc = state->pc;
+    cpu->registers.acc = state->acc;
+    cpu->registers.x = state->x;
+    cpu->registers.y = state->y;
+    cpu->registers.s = state->s;
+    setStatus(cpu, state->p);
+    memcpy(cpu->ram, state->ram, sizeof(cpu->ram));
+    invalidateBlocks(cpu, cpu->ram, sizeof(cpu->ram));
+    if (cpu->prgRam) {
+        memcpy(cpu->prgRam, state->prgRam, PRG_RAM_SIZE);
+        invalidateBlocks(cpu, cpu->prgRam, PRG_RAM_SIZE);
+    }
+    cpu->ppu = state->ppu;
+    cpu->apu = state->apu;
+    memcpy(cpu->ioRegisters, state->ioRegisters, sizeof(cpu->ioRegisters));
+    if (cpu->chrRam) {
+        memcpy(cpu->chrRam, state->chrRam, CHR_RAM_SIZE);
+        if (cpu->tiles) {
+            invalidateTiles(cpu);
+        }
+    }
+    cpu->mapperState = state->mapper;
+    cpu->irq = state->irq;
+    cpu->nmi = state->nmi;
+    memcpy(cpu->controllers, state->controllers, sizeof(cpu->controllers));
+    if (cpu->mapper) {
+        cpu->mapper->sync(cpu);
+    }
+    if (cpu->ppuThread) {
+        reseedPpuThread(cpu);
+    }
+    resetEvents(cpu);
+    return 0;
+}
+
+/* Files hold the raw struct in host byte order */
+int saveStateFile(CPU* cpu, const char* path) {
+    MachineState state;
+    captureState(cpu, &state);
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return -1;
+    }
+    int written = fwrite(&state, sizeof(state), 1, file) == 1;
+    return (fclose(file) == 0 && written) ? 0 : -1;
+}
+
+int loadStateFile(CPU* cpu, const char* path) {
+    MachineState state;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    int read = fread(&state, sizeof(state), 1, file) == 1;
+    fclose(file);
+    return read ? restoreState(cpu, &state) : -1;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+
+static void freePages(TileCache* cache) {
+    for (uint32_t i = 0; i < cache->pageCount; i++) {
+        free(cache->pages[i]);
+    }
+    free(cache->pages);
+    cache->pages = NULL;
+    cache->pageCount = 0;
+    memset(cache->slots, 0, sizeof(cache->slots));
+}
+
+void destroyTileCache(TileCache* cache) {
+    if (!cache) {
+        return;
+    }
+    freePages(cache);
+    free(cache);
+}
+
+/* The PPU decodes every fetch from here on, for when a page can't be allocated */
+static void dropTileCache(CPU* cpu) {
+    destroyTileCache(cpu->tiles);
+    cpu->tiles = NULL;
+}
+
+/* Called by loadROM before the mapper maps CHR: one page slot per KB of CHR-ROM, or of CHR-RAM without it. Pages
+    * themselves are only allocated once something maps them.
+*/
+void resetTileCache(CPU* cpu) {
+    TileCache* cache = cpu->tiles;
+    if (!cache) {
+        return;
+    }
+    freePages(cache);
+    memset(&cache->stats, 0, sizeof(cache->stats));
+    uint32_t size = cpu->game->chrSize ? cpu->game->chrSize : CHR_RAM_SIZE;
+    cache->pages = (TilePage**) calloc(size / 0x400, sizeof(TilePage*));
+    if (!cache->pages) {
+        dropTileCache(cpu);
+        return;
+    }
+    cache->pageCount = size / 0x400;
+}
+
+/* Points PPU slot `slot` at the decoded copy of CHR page `page` (KB `page` of CHR-ROM or CHR-RAM) */
+void mapTiles(CPU* cpu, int slot, uint32_t page, const uint8_t* source) {
+    TileCache* cache = cpu->tiles;
+    if (page >= cache->pageCount) {
+        dropTileCache(cpu);
+        return;
+    }
+    if (!cache->pages[page]) {
+        TilePage* decoded = (TilePage*) malloc(sizeof(TilePage));
+        if (!decoded) {
+            dropTileCache(cpu);
+            return;
+        }
+        decoded->source = source;
+        decoded->valid = 0;
+        cache->pages[page] = decoded;
+        cache->stats.pages++;
+    }
+    cache->slots[slot] = cache->pages[page];
+}
+
+void decodeTile(TileCache* cache, TilePage* page, int tile) {
+    const uint8_t* planes = page->source + tile * 16;
+    for (int row = 0; row < 8; row++) {
+        for (int bit = 0; bit < 8; bit++) {
+            uint8_t colour = ((planes[row] >> (7 - bit)) & 0x01) | (((planes[row + 8] >> (7 - bit)) & 0x01) << 1);
+            page->rows[tile][row][bit] = colour;
+            page->flipped[tile][row][7 - bit] = colour;
+        }
+    }
+    page->valid |= 1ULL << tile;
+    cache->stats.misses++;
+}
+
+/* A CHR-RAM write to pattern address `address` (through whatever page is mapped there) */
+void invalidateTile(CPU* cpu, uint16_t address) {
+    TilePage* page = cpu->tiles->slots[(address >> 10) & 0x07];
+    uint64_t bit = 1ULL << ((address >> 4) & 0x3F);
+    if (page && (page->valid & bit)) {
+        page->valid &= ~bit;
+        cpu->tiles->stats.invalidations++;
+    }
+}
+
+/* CHR-RAM was replaced wholesale (state loads) */
+void invalidateTiles(CPU* cpu) {
+    TileCache* cache = cpu->tiles;
+    for (uint32_t i = 0; i < cache->pageCount; i++) {
+        if (cache->pages[i]) {
+            cache->pages[i]->valid = 0;
+        }
+    }
+}
+
+/* Runs the same ROM with and without the tile cache and prints the time per frame of each, plus how the cache did.
+    * Both must draw the same frames, so the run also checks that the screen hashes agree.
+*/
+int benchmarkTileCache(const GameInformation* game, uint64_t frames) {
+    CPU* machines[2] = { createCPU(), createCPU() };
+    if (!machines[0] || !machines[1] || loadROM(machines[0], game) != 0 || loadROM(machines[1], game) != 0) {
+        destroyCPU(machines[0]);
+        destroyCPU(machines[1]);
+        return -1;
+    }
+    dropTileCache(machines[0]);
+
+    uint64_t elapsed[2] = { 0, 0 };
+    uint64_t hashes[2] = { FNV_BASIS, FNV_BASIS };
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < 2; i++) {
+            uint64_t start = nowNanoseconds();
+            runFrame(machines[i]);
+            elapsed[i] += nowNanoseconds() - start;
+            hashes[i] = hashMore(hashes[i], machines[i]->graphics->screen, sizeof(machines[i]->graphics->screen));
+        }
+    }
+
+    double decoded = (double) elapsed[0] / frames;
+    double cached = (double) elapsed[1] / frames;
+    int match = hashes[0] == hashes[1];
+    printf("%s, %u KB\n", game->chrSize ? "CHR-ROM" : "CHR-RAM", (game->chrSize ? game->chrSize : CHR_RAM_SIZE) / 0x400);
+    printf("decoded  %10.0f ns/frame  frames %016llx\n", decoded, (unsigned long long) hashes[0]);
+    printf("cached   %10.0f ns/frame  frames %016llx  %5.2fx decoded%s\n", cached, (unsigned long long) hashes[1],
+        decoded / cached, match ? "" : "  MISMATCH");
+    if (machines[1]->tiles) {
+        const TileStats* stats = &machines[1]->tiles->stats;
+        uint64_t fetches = stats->hits + stats->misses;
+        printf("         %.3f%% hit, %llu decoded, %llu invalidated, %llu pages\n",
+            fetches ? 100.0 * stats->hits / fetches : 0.0, (unsigned long long) stats->misses,
+            (unsigned long long) stats->invalidations, (unsigned long long) stats->pages);
+    } else {
+        printf("         no tile cache in this build\n");
+    }
+    destroyCPU(machines[0]);
+    destroyCPU(machines[1]);
+    return match ? 0 : -1;
+}
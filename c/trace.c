@@ -0,0 +1,484 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nes.h"
+
+/* Execution trace recorder.
+    *
+    * A traced machine runs the plain interpreter (runTraced) and appends one TraceRecord per instruction to a buffer
+    * owned by the thread running it, so recording is a handful of stores and never takes a lock. Streaming traces hand
+    * full chunks to a writer thread through a pair of PtrRings, as video recording does, and take an empty one back;
+    * nothing is dropped, so a machine that outruns the disk waits for it (counted as a stall). Ring-only traces keep the last N records in one buffer and write them when the trace stops, or from a
+    * fatal signal handler when the process crashes or an assert aborts it. decodeTrace turns a file into nestest.log
+    * lines for diffing against other emulators.
+    *
+*/
+
+#define TRACE_CHUNK 4096
+#define TRACE_BUFFERS 8
+_Static_assert(TRACE_BUFFERS <= PTR_RING, "every buffer fits in a ring");
+/* Ring-only traces that a crash can dump, across every machine in the process */
+#define TRACE_CRASH_SLOTS 16
+
+typedef struct trace_chunk {
+    uint32_t count;
+    TraceRecord records[TRACE_CHUNK];
+} TraceChunk;
+
+struct tracer {
+    /* The buffer being filled: the current chunk's records, or the whole ring */
+    TraceRecord* records;
+    uint32_t used;
+    uint32_t capacity;
+    uint64_t total;
+    uint64_t stalls;
+
+    /* The PPU's position projected to the last traced cycle (projectPpu), and the ppu.dots it was projected from */
+    uint64_t ppuDots;
+    uint64_t dots;
+    uint64_t frame;
+    uint16_t scanline;
+    uint16_t dot;
+
+    /* Ring-only: the records wrapped at least once; slot is its place in crashTracers */
+    int ring;
+    int wrapped;
+    int slot;
+
+    /* Streaming: chunks on their way to the writer and back, posted once per chunk in filled and spare */
+    TraceChunk* chunk;
+    PtrRing filled;
+    PtrRing spare;
+    sem_t ready;
+    sem_t returned;
+    pthread_t thread;
+
+    int fd;
+    atomic_ullong written;
+    atomic_int failed;
+};
+
+static Tracer* _Atomic crashTracers[TRACE_CRASH_SLOTS];
+static pthread_once_t crashHandlersOnce = PTHREAD_ONCE_INIT;
+static const int crashSignals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+/* write() until everything is out; async-signal-safe, since the crash handler uses it too */
+static int writeAll(int fd, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    while (size) {
+        ssize_t done = write(fd, bytes, size);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return -1;
+        }
+        bytes += done;
+        size -= done;
+    }
+    return 0;
+}
+
+/* Rewrites a ring-only trace's file with what the ring holds, oldest first. Only async-signal-safe calls. */
+static int dumpRing(Tracer* trace) {
+    uint32_t kept = trace->wrapped ? trace->capacity : trace->used;
+    TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), 0, trace->total - kept };
+    if (lseek(trace->fd, 0, SEEK_SET) != 0 || ftruncate(trace->fd, 0) != 0 ||
+        writeAll(trace->fd, &header, sizeof(header)) != 0) {
+        return -1;
+    }
+    if (trace->wrapped && writeAll(trace->fd, trace->records + trace->used,
+            (size_t)(trace->capacity - trace->used) * sizeof(TraceRecord)) != 0) {
+        return -1;
+    }
+    return writeAll(trace->fd, trace->records, (size_t) trace->used * sizeof(TraceRecord));
+}
+
+/* Installed with SA_RESETHAND, so raising the signal again once the rings are out gets its default action */
+static void dumpOnCrash(int signal) {
+    int saved = errno;
+    for (int i = 0; i < TRACE_CRASH_SLOTS; i++) {
+        Tracer* trace = atomic_load(&crashTracers[i]);
+        if (trace) {
+            dumpRing(trace);
+        }
+    }
+    errno = saved;
+    raise(signal);
+}
+
+static void installCrashHandlers(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = dumpOnCrash;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < sizeof(crashSignals) / sizeof(crashSignals[0]); i++) {
+        sigaction(crashSignals[i], &action, NULL);
+    }
+}
+
+/* One post per queued chunk plus one from stopTrace, so a post that finds the ring empty means there's nothing left */
+static void* runWriter(void* argument) {
+    Tracer* trace = (Tracer*) argument;
+    while (1) {
+        sem_wait(&trace->ready);
+        TraceChunk* chunk = popPtr(&trace->filled);
+        if (!chunk) {
+            break;
+        }
+        if (!atomic_load_explicit(&trace->failed, memory_order_relaxed) &&
+            writeAll(trace->fd, chunk->records, (size_t) chunk->count * sizeof(TraceRecord)) != 0) {
+            atomic_store_explicit(&trace->failed, 1, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&trace->written, chunk->count, memory_order_relaxed);
+        pushPtr(&trace->spare, chunk);
+        sem_post(&trace->returned);
+    }
+    return NULL;
+}
+
+static void freeTracer(Tracer* trace) {
+    if (trace->ring) {
+        free(trace->records);
+    } else {
+        TraceChunk* chunk;
+        while ((chunk = popPtr(&trace->spare))) {
+            free(chunk);
+        }
+        free(trace->chunk);
+    }
+    free(trace);
+}
+
+/* Traces every instruction the machine runs from now on into `path`. With `ring` set only the last `ring` records
+    * are kept, and written when the trace stops or the process dies of a fatal signal. Returns -1 if the machine is
+    * already traced, the file can't be created or, for a ring, every crash slot is taken.
+*/
+int startTrace(CPU* cpu, const char* path, uint32_t ring) {
+    if (cpu->trace) {
+        return -1;
+    }
+    Tracer* trace = (Tracer*) calloc(1, sizeof(Tracer));
+    if (!trace) {
+        return -1;
+    }
+    trace->ring = ring != 0;
+    trace->slot = -1;
+    trace->ppuDots = UINT64_MAX;
+    if (trace->ring) {
+        trace->records = (TraceRecord*) malloc((size_t) ring * sizeof(TraceRecord));
+        trace->capacity = ring;
+    } else {
+        /* One chunk is always the machine's, the others go round */
+        trace->chunk = (TraceChunk*) malloc(sizeof(TraceChunk));
+        for (int i = 1; i < TRACE_BUFFERS && trace->chunk; i++) {
+            TraceChunk* chunk = (TraceChunk*) malloc(sizeof(TraceChunk));
+            if (!chunk) {
+                free(trace->chunk);
+                trace->chunk = NULL;
+                break;
+            }
+            pushPtr(&trace->spare, chunk);
+        }
+        trace->records = trace->chunk ? trace->chunk->records : NULL;
+        trace->capacity = TRACE_CHUNK;
+    }
+    if (!trace->records) {
+        freeTracer(trace);
+        return -1;
+    }
+
+    trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (trace->fd < 0) {
+        freeTracer(trace);
+        return -1;
+    }
+    if (trace->ring) {
+        for (int i = 0; i < TRACE_CRASH_SLOTS && trace->slot < 0; i++) {
+            Tracer* empty = NULL;
+            if (atomic_compare_exchange_strong(&crashTracers[i], &empty, trace)) {
+                trace->slot = i;
+            }
+        }
+        if (trace->slot < 0) {
+            close(trace->fd);
+            freeTracer(trace);
+            return -1;
+        }
+        pthread_once(&crashHandlersOnce, installCrashHandlers);
+    } else {
+        TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), 0, 0 };
+        sem_init(&trace->ready, 0, 0);
+        sem_init(&trace->returned, 0, TRACE_BUFFERS - 1);
+        if (writeAll(trace->fd, &header, sizeof(header)) != 0 ||
+            pthread_create(&trace->thread, NULL, runWriter, trace) != 0) {
+            sem_destroy(&trace->ready);
+            sem_destroy(&trace->returned);
+            close(trace->fd);
+            freeTracer(trace);
+            return -1;
+        }
+    }
+    cpu->trace = trace;
+    return 0;
+}
+
+/* Writes out whatever the trace still holds and detaches it. Returns -1 if any write failed. */
+int stopTrace(CPU* cpu) {
+    Tracer* trace = cpu->trace;
+    if (!trace) {
+        return 0;
+    }
+    cpu->trace = NULL;
+    int failed;
+    if (trace->ring) {
+        atomic_store(&crashTracers[trace->slot], NULL);
+        failed = dumpRing(trace) != 0;
+    } else {
+        if (trace->used) {
+            trace->chunk->count = trace->used;
+            pushPtr(&trace->filled, trace->chunk);
+            trace->chunk = NULL;
+            sem_post(&trace->ready);
+        }
+        sem_post(&trace->ready);
+        pthread_join(trace->thread, NULL);
+        sem_destroy(&trace->ready);
+        sem_destroy(&trace->returned);
+        failed = atomic_load(&trace->failed);
+    }
+    failed |= close(trace->fd) != 0;
+    freeTracer(trace);
+    return failed ? -1 : 0;
+}
+
+/* From the machine's thread */
+void getTraceStats(const CPU* cpu, TraceStats* stats) {
+    const Tracer* trace = cpu->trace;
+    memset(stats, 0, sizeof(*stats));
+    if (trace) {
+        stats->records = trace->total;
+        stats->written = atomic_load_explicit(&trace->written, memory_order_relaxed);
+        stats->stalls = trace->stalls;
+    }
+}
+
+/* Queues the full chunk and carries on in a spare one, waiting for the writer if there is none */
+static void handOffChunk(Tracer* trace) {
+    trace->chunk->count = trace->used;
+    pushPtr(&trace->filled, trace->chunk);
+    sem_post(&trace->ready);
+    if (sem_trywait(&trace->returned) != 0) {
+        trace->stalls++;
+        /* The machine's thread may be taking profiler signals */
+        while (sem_wait(&trace->returned) != 0 && errno == EINTR) {
+        }
+    }
+    trace->chunk = popPtr(&trace->spare);
+    trace->records = trace->chunk->records;
+    trace->used = 0;
+}
+
+/* Where the PPU is at the CPU's clock. It runs behind and only moves at its events and register accesses, so the
+    * tracer keeps its own copy of the position, starts over from the PPU's whenever that moved and walks it forward
+    * the few dots an instruction takes, a scanline at a time so the short pre-render line of odd frames is kept.
+*/
+static inline void projectPpu(Tracer* trace, const CPU* cpu) {
+    const PPU* ppu = &cpu->ppu;
+    if (ppu->dots != trace->ppuDots) {
+        trace->ppuDots = ppu->dots;
+        trace->dots = ppu->dots;
+        trace->frame = ppu->frame;
+        trace->scanline = ppu->scanline;
+        trace->dot = ppu->dot;
+    }
+    uint64_t target = cpu->clock.cycles * 3;
+    while (trace->dots < target) {
+        /* Bits 3-4 of PPUMASK: background or sprites on */
+        uint32_t length = DOTS_PER_SCANLINE;
+        if (trace->scanline == PRE_RENDER_SCANLINE && (trace->frame & 1) && (ppu->mask & 0x18)) {
+            length--;
+        }
+        uint64_t rest = length - trace->dot;
+        if (rest > target - trace->dots) {
+            trace->dot += target - trace->dots;
+            trace->dots = target;
+            break;
+        }
+        trace->dots += rest;
+        trace->dot = 0;
+        trace->scanline = (trace->scanline + 1) % SCANLINES_PER_FRAME;
+        if (trace->scanline == VBLANK_SCANLINE) {
+            trace->frame++;
+        }
+    }
+}
+
+/* Operand bytes are only read where the bus has plain memory, so tracing never touches a register */
+static inline uint8_t peekByte(const CPU* cpu, uint16_t address) {
+    const uint8_t* page = cpu->bus.readPages[address >> 8];
+    return page ? page[address & 0xFF] : 0;
+}
+
+static inline void traceInstruction(Tracer* trace, CPU* cpu, uint8_t opcode) {
+    TraceRecord* record = &trace->records[trace->used];
+    uint16_t pc = cpu->registers.pc;
+    uint8_t length = opcodeTable[opcode].length;
+    projectPpu(trace, cpu);
+    record->cycle = cpu->clock.cycles;
+    record->pc = pc;
+    record->scanline = trace->scanline;
+    record->dot = trace->dot;
+    record->opcode = opcode;
+    record->operand[0] = length > 1 ? peekByte(cpu, (uint16_t)(pc + 1)) : 0;
+    record->operand[1] = length > 2 ? peekByte(cpu, (uint16_t)(pc + 2)) : 0;
+    record->acc = cpu->registers.acc;
+    record->x = cpu->registers.x;
+    record->y = cpu->registers.y;
+    record->p = getStatus(cpu);
+    record->s = cpu->registers.s;
+    record->padding[0] = record->padding[1] = 0;
+    trace->total++;
+    if (++trace->used == trace->capacity) {
+        if (trace->ring) {
+            trace->used = 0;
+            trace->wrapped = 1;
+        } else {
+            handOffChunk(trace);
+        }
+    }
+}
+
+/* runUntil for a traced machine: the plain interpreter up to cpu->clock.target, in the same order of checks, with
+    * every instruction recorded just before it runs
+*/
+uint64_t runTraced(CPU* cpu) {
+    Tracer* trace = cpu->trace;
+    uint64_t executed = 0;
+    while (cpu->clock.cycles < cpu->clock.target) {
+        if (cpu->irq | cpu->nmi) {
+            serviceInterrupts(cpu);
+        }
+        uint8_t opcode = readByte(cpu, cpu->registers.pc);
+        traceInstruction(trace, cpu, opcode);
+        executeInstruction(opcode, cpu);
+        executed++;
+    }
+    return executed;
+}
+
+/* The opcode table's name for an instruction, except where nestest.log uses another one */
+static const char* nestestMnemonic(uint8_t opcode) {
+    const char* mnemonic = opcodeTable[opcode].mnemonic;
+    return strcmp(mnemonic, "ISC") == 0 ? "ISB" : mnemonic;
+}
+
+/* nestest.log marks everything outside the 151 documented opcodes with a '*' */
+static int isUndocumented(uint8_t opcode) {
+    static const char* const mnemonics[] = {
+        "ALR", "ANC", "ANE", "ARR", "DCP", "ISB", "JAM", "LAS", "LAX", "LXA",
+        "RLA", "RRA", "SAX", "SBX", "SHA", "SHX", "SHY", "SLO", "SRE", "TAS",
+    };
+    const char* mnemonic = nestestMnemonic(opcode);
+    if (opcode == 0xEB || (strcmp(mnemonic, "NOP") == 0 && opcode != 0xEA)) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]); i++) {
+        if (strcmp(mnemonic, mnemonics[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void formatOperand(const TraceRecord* record, char* text, size_t size) {
+    uint8_t low = record->operand[0];
+    uint16_t word = low | (record->operand[1] << 8);
+    switch (opcodeTable[record->opcode].mode) {
+        case ACCUMULATOR: snprintf(text, size, "A"); break;
+        case IMMEDIATE: snprintf(text, size, "#$%02X", low); break;
+        case RELATIVE: snprintf(text, size, "$%04X", (uint16_t)(record->pc + 2 + (int8_t) low)); break;
+        case ABSOLUTE: snprintf(text, size, "$%04X", word); break;
+        case ABSOLUTE_X: snprintf(text, size, "$%04X,X", word); break;
+        case ABSOLUTE_Y: snprintf(text, size, "$%04X,Y", word); break;
+        case INDIRECT: snprintf(text, size, "($%04X)", word); break;
+        case ZERO_PAGE: snprintf(text, size, "$%02X", low); break;
+        case ZERO_PAGE_X: snprintf(text, size, "$%02X,X", low); break;
+        case ZERO_PAGE_Y: snprintf(text, size, "$%02X,Y", low); break;
+        case INDIRECT_X: snprintf(text, size, "($%02X,X)", low); break;
+        case INDIRECT_Y: snprintf(text, size, "($%02X),Y", low); break;
+        default: text[0] = '\0'; break;
+    }
+}
+
+/* Writes a trace file as nestest.log lines ("-" for stdout). The recorder doesn't keep the memory an instruction
+    * touched, so lines carry no "= XX" annotations; strip those from a reference log before diffing. Returns -1 if the
+    * file isn't a trace or can't be read or written.
+*/
+int decodeTrace(const char* input, const char* output) {
+    FILE* in = fopen(input, "rb");
+    if (!in) {
+        return -1;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION ||
+        header.recordSize != sizeof(TraceRecord)) {
+        fclose(in);
+        return -1;
+    }
+    FILE* out = strcmp(output, "-") == 0 ? stdout : fopen(output, "w");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    if (header.skipped) {
+        fprintf(stderr, "%s starts %llu instructions into the run\n", input, (unsigned long long) header.skipped);
+    }
+
+    uint8_t undocumented[256];
+    for (int i = 0; i < 256; i++) {
+        undocumented[i] = isUndocumented(i);
+    }
+    TraceRecord records[256];
+    size_t count;
+    while ((count = fread(records, sizeof(TraceRecord), 256, in)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            const TraceRecord* record = &records[i];
+            uint8_t length = opcodeTable[record->opcode].length;
+            char bytes[9];
+            char operand[16];
+            char disassembly[32];
+            if (length == 3) {
+                snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record->opcode, record->operand[0],
+                    record->operand[1]);
+            } else if (length == 2) {
+                snprintf(bytes, sizeof(bytes), "%02X %02X", record->opcode, record->operand[0]);
+            } else {
+                snprintf(bytes, sizeof(bytes), "%02X", record->opcode);
+            }
+            formatOperand(record, operand, sizeof(operand));
+            snprintf(disassembly, sizeof(disassembly), "%s%s%s", nestestMnemonic(record->opcode),
+                operand[0] ? " " : "", operand);
+            fprintf(out, "%04X  %-8s %c%-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%llu\n",
+                record->pc, bytes, undocumented[record->opcode] ? '*' : ' ', disassembly, record->acc, record->x,
+                record->y, record->p, record->s, record->scanline, record->dot, (unsigned long long) record->cycle);
+        }
+    }
+    int failed = ferror(in) != 0;
+    fclose(in);
+    if (out == stdout) {
+        failed |= fflush(stdout) != 0;
+    } else {
+        failed |= fclose(out) != 0;
+    }
+    return failed ? -1 : 0;
+}
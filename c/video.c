@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NES_X86_VIDEO 1
+#endif
+
+/* Video recording.
+    *
+    * The emulation thread never converts or writes anything: submitVideoFrame trades the finished Graphics for an empty
+    * one from a pool and queues the finished one, so recording costs it a pointer swap per frame. A writer thread turns
+    * the 6-bit colours into Y4M (4:4:4) or packed RGB with a table lookup kernel and streams them out. Buffers go round
+    * through two PtrRings (nes.h), as trace chunks do. When the writer falls so far behind that the pool is empty, frames
+    * are dropped and counted rather than stalling emulation, unless the recording was opened lossless.
+    *
+*/
+
+#define VIDEO_BUFFERS 8
+_Static_assert(VIDEO_BUFFERS <= PTR_RING, "every buffer fits in a ring");
+
+// https://www.nesdev.org/wiki/PPU_palettes
+/* A 2C02 palette in RGB, indexed by the 6-bit colour in Graphics.screen */
+static const uint8_t nesPalette[64][3] = {
+    { 0x66, 0x66, 0x66 }, { 0x00, 0x2A, 0x88 }, { 0x14, 0x12, 0xA7 }, { 0x3B, 0x00, 0xA4 },
+    { 0x5C, 0x00, 0x7E }, { 0x6E, 0x00, 0x40 }, { 0x6C, 0x06, 0x00 }, { 0x56, 0x1D, 0x00 },
+    { 0x33, 0x35, 0x00 }, { 0x0B, 0x48, 0x00 }, { 0x00, 0x52, 0x00 }, { 0x00, 0x4F, 0x08 },
+    { 0x00, 0x40, 0x4D }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+    { 0xAD, 0xAD, 0xAD }, { 0x15, 0x5F, 0xD9 }, { 0x42, 0x40, 0xFF }, { 0x75, 0x27, 0xFE },
+    { 0xA0, 0x1A, 0xCC }, { 0xB7, 0x1E, 0x7B }, { 0xB5, 0x31, 0x20 }, { 0x99, 0x4E, 0x00 },
+    { 0x6B, 0x6D, 0x00 }, { 0x38, 0x87, 0x00 }, { 0x0C, 0x93, 0x00 }, { 0x00, 0x8F, 0x32 },
+    { 0x00, 0x7C, 0x8D }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFE, 0xFF }, { 0x64, 0xB0, 0xFF }, { 0x92, 0x90, 0xFF }, { 0xC6, 0x76, 0xFF },
+    { 0xF3, 0x6A, 0xFF }, { 0xFE, 0x6E, 0xCC }, { 0xFE, 0x81, 0x70 }, { 0xEA, 0x9E, 0x22 },
+    { 0xBC, 0xBE, 0x00 }, { 0x88, 0xD8, 0x00 }, { 0x5C, 0xE4, 0x30 }, { 0x45, 0xE0, 0x82 },
+    { 0x48, 0xCD, 0xDE }, { 0x4F, 0x4F, 0x4F }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFE, 0xFF }, { 0xC0, 0xDF, 0xFF }, { 0xD3, 0xD2, 0xFF }, { 0xE8, 0xC8, 0xFF },
+    { 0xFB, 0xC2, 0xFF }, { 0xFE, 0xC4, 0xEA }, { 0xFE, 0xCC, 0xC5 }, { 0xF7, 0xD8, 0xA5 },
+    { 0xE4, 0xE5, 0x94 }, { 0xCF, 0xEF, 0x96 }, { 0xBD, 0xF4, 0xAB }, { 0xB3, 0xF3, 0xCC },
+    { 0xB5, 0xEB, 0xF2 }, { 0xB8, 0xB8, 0xB8 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+};
+
+/* Lookup kernels: out[i] = table[colours[i]] for `count` (a multiple of 32) colours below 64 */
+typedef void (*lookupKernel)(const uint8_t* colours, const uint8_t* table, int count, uint8_t* out);
+
+static void lookupScalar(const uint8_t* colours, const uint8_t* table, int count, uint8_t* out) {
+    for (int i = 0; i < count; i++) {
+        out[i] = table[colours[i]];
+    }
+}
+
+#ifdef NES_X86_VIDEO
+/* pshufb looks up 16 entries at a time, so each quarter of the table is looked up and bits 4-5 pick one */
+__attribute__((target("ssse3")))
+static void lookupSSSE3(const uint8_t* colours, const uint8_t* table, int count, uint8_t* out) {
+    __m128i quarters[4];
+    for (int i = 0; i < 4; i++) {
+        quarters[i] = _mm_loadu_si128((const __m128i*)(table + i * 16));
+    }
+    const __m128i select = _mm_set1_epi8(0x30);
+    for (int i = 0; i < count; i += 16) {
+        __m128i colour = _mm_loadu_si128((const __m128i*)(colours + i));
+        __m128i quarter = _mm_and_si128(colour, select);
+        __m128i result = _mm_setzero_si128();
+        for (int q = 0; q < 4; q++) {
+            __m128i hit = _mm_cmpeq_epi8(quarter, _mm_set1_epi8(q << 4));
+            result = _mm_or_si128(result, _mm_and_si128(hit, _mm_shuffle_epi8(quarters[q], colour)));
+        }
+        _mm_storeu_si128((__m128i*)(out + i), result);
+    }
+}
+
+__attribute__((target("avx2")))
+static void lookupAVX2(const uint8_t* colours, const uint8_t* table, int count, uint8_t* out) {
+    __m256i quarters[4];
+    for (int i = 0; i < 4; i++) {
+        quarters[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(table + i * 16)));
+    }
+    const __m256i bit4 = _mm256_set1_epi8(0x10);
+    const __m256i bit5 = _mm256_set1_epi8(0x20);
+    for (int i = 0; i < count; i += 32) {
+        __m256i colour = _mm256_loadu_si256((const __m256i*)(colours + i));
+        __m256i upper = _mm256_cmpeq_epi8(_mm256_and_si256(colour, bit4), bit4);
+        __m256i low = _mm256_blendv_epi8(_mm256_shuffle_epi8(quarters[0], colour),
+            _mm256_shuffle_epi8(quarters[1], colour), upper);
+        __m256i high = _mm256_blendv_epi8(_mm256_shuffle_epi8(quarters[2], colour),
+            _mm256_shuffle_epi8(quarters[3], colour), upper);
+        __m256i result = _mm256_blendv_epi8(low, high, _mm256_cmpeq_epi8(_mm256_and_si256(colour, bit5), bit5));
+        _mm256_storeu_si256((__m256i*)(out + i), result);
+    }
+}
+#endif
+
+static lookupKernel findLookupKernel(void) {
+#ifdef NES_X86_VIDEO
+    if (__builtin_cpu_supports("avx2")) {
+        return lookupAVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return lookupSSSE3;
+    }
+#endif
+    return lookupScalar;
+}
+
+struct video_writer {
+    /* Finished frames on their way to the writer, and written ones on their way back */
+    PtrRing filled;
+    PtrRing spare;
+    /* Posted once per frame in filled and once per frame in spare */
+    sem_t ready;
+    sem_t returned;
+    pthread_t thread;
+
+    FILE* out;
+    int pipe;
+    int format;
+    uint32_t decimation;
+    int lossless;
+    lookupKernel lookup;
+    uint8_t tables[3][64];
+    uint8_t* planes;
+    uint8_t* packed;
+
+    /* Counted by the emulation thread */
+    uint64_t frames;
+    uint64_t submitted;
+    uint64_t dropped;
+    uint32_t maxDepth;
+    /* Counted by the writer */
+    atomic_ullong written;
+    atomic_int failed;
+};
+
+/* BT.601 limited range, which is what players assume for Y4M without a colour-range tag */
+static void buildTables(VideoWriter* video) {
+    for (int i = 0; i < 64; i++) {
+        double r = nesPalette[i][0], g = nesPalette[i][1], b = nesPalette[i][2];
+        if (video->format == VIDEO_RGB24) {
+            video->tables[0][i] = r;
+            video->tables[1][i] = g;
+            video->tables[2][i] = b;
+            continue;
+        }
+        video->tables[0][i] = (uint8_t)(16.5 + 0.257 * r + 0.504 * g + 0.098 * b);
+        video->tables[1][i] = (uint8_t)(128.5 - 0.148 * r - 0.291 * g + 0.439 * b);
+        video->tables[2][i] = (uint8_t)(128.5 + 0.439 * r - 0.368 * g - 0.071 * b);
+    }
+}
+
+static int writeFrame(VideoWriter* video, const Graphics* frame) {
+    const int pixels = SCREEN_WIDTH * SCREEN_HEIGHT;
+    for (int plane = 0; plane < 3; plane++) {
+        video->lookup(frame->screen, video->tables[plane], pixels, video->planes + plane * pixels);
+    }
+    if (video->format == VIDEO_Y4M) {
+        return fputs("FRAME\n", video->out) >= 0 && fwrite(video->planes, 3 * pixels, 1, video->out) == 1 ? 0 : -1;
+    }
+    for (int i = 0; i < pixels; i++) {
+        video->packed[i * 3] = video->planes[i];
+        video->packed[i * 3 + 1] = video->planes[pixels + i];
+        video->packed[i * 3 + 2] = video->planes[2 * pixels + i];
+    }
+    return fwrite(video->packed, 3 * pixels, 1, video->out) == 1 ? 0 : -1;
+}
+
+/* One post per queued frame plus one from closeVideo, so a post that finds the ring empty means there's nothing left */
+static void* runWriter(void* argument) {
+    VideoWriter* video = (VideoWriter*) argument;
+    while (1) {
+        sem_wait(&video->ready);
+        Graphics* frame = popPtr(&video->filled);
+        if (!frame) {
+            break;
+        }
+        if (!atomic_load_explicit(&video->failed, memory_order_relaxed) && writeFrame(video, frame) != 0) {
+            atomic_store_explicit(&video->failed, 1, memory_order_relaxed);
+        }
+        pushPtr(&video->spare, frame);
+        sem_post(&video->returned);
+        atomic_fetch_add_explicit(&video->written, 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+static void freeVideo(VideoWriter* video) {
+    Graphics* frame;
+    while ((frame = popPtr(&video->spare))) {
+        free(frame);
+    }
+    free(video->planes);
+    free(video->packed);
+    free(video);
+}
+
+// https://wiki.multimedia.cx/index.php/YUV4MPEG2
+/* `path` is a file, "-" for stdout or "|command" to pipe into a command (e.g. "|ffmpeg -i - out.mp4"). Every
+    * `decimation`th frame is kept; a lossless recording waits for the writer instead of dropping frames. Returns NULL
+    * if the output can't be opened.
+*/
+VideoWriter* openVideo(const char* path, int format, uint32_t decimation, int lossless) {
+    VideoWriter* video = (VideoWriter*) calloc(1, sizeof(VideoWriter));
+    if (!video) {
+        return NULL;
+    }
+    video->format = format;
+    video->decimation = decimation ? decimation : 1;
+    video->lossless = lossless;
+    video->lookup = findLookupKernel();
+    video->planes = (uint8_t*) malloc(3 * SCREEN_WIDTH * SCREEN_HEIGHT);
+    video->packed = format == VIDEO_RGB24 ? (uint8_t*) malloc(3 * SCREEN_WIDTH * SCREEN_HEIGHT) : NULL;
+    int allocated = video->planes && (format != VIDEO_RGB24 || video->packed);
+    for (int i = 0; i < VIDEO_BUFFERS && allocated; i++) {
+        Graphics* frame = (Graphics*) calloc(1, sizeof(Graphics));
+        if (!frame) {
+            allocated = 0;
+            break;
+        }
+        pushPtr(&video->spare, frame);
+    }
+    if (!allocated) {
+        freeVideo(video);
+        return NULL;
+    }
+    buildTables(video);
+
+    if (strcmp(path, "-") == 0) {
+        video->out = stdout;
+    } else if (path[0] == '|') {
+        video->out = popen(path + 1, "w");
+        video->pipe = 1;
+    } else {
+        video->out = fopen(path, "wb");
+    }
+    if (!video->out) {
+        freeVideo(video);
+        return NULL;
+    }
+    if (format == VIDEO_Y4M) {
+        /* 39375000 / 655171 is the NTSC NES frame rate, about 60.0988 Hz; pixels are 8:7 */
+        fprintf(video->out, "YUV4MPEG2 W%d H%d F39375000:%llu Ip A8:7 C444\n", SCREEN_WIDTH, SCREEN_HEIGHT,
+            655171ULL * video->decimation);
+    }
+
+    sem_init(&video->ready, 0, 0);
+    sem_init(&video->returned, 0, VIDEO_BUFFERS);
+    if (pthread_create(&video->thread, NULL, runWriter, video) != 0) {
+        sem_destroy(&video->ready);
+        sem_destroy(&video->returned);
+        if (video->pipe) {
+            pclose(video->out);
+        } else if (video->out != stdout) {
+            fclose(video->out);
+        }
+        freeVideo(video);
+        return NULL;
+    }
+    return video;
+}
+
+/* Called after runFrame. A kept frame is handed to the writer as is and the machine draws the next one into a spare
+    * buffer; without a spare the frame is dropped (or, lossless, waited for).
+*/
+void submitVideoFrame(VideoWriter* video, CPU* cpu) {
+    if (video->frames++ % video->decimation) {
+        return;
+    }
+    /* A machine that never drew hands over a blank frame */
+    if (!getGraphics(cpu)) {
+        video->dropped++;
+        return;
+    }
+    if (video->lossless) {
+        /* The machine's thread may be taking profiler signals */
+        while (sem_wait(&video->returned) != 0 && errno == EINTR) {
+        }
+    } else if (sem_trywait(&video->returned) != 0) {
+        video->dropped++;
+        return;
+    }
+    Graphics* spare = popPtr(&video->spare);
+    pushPtr(&video->filled, cpu->graphics);
+    cpu->graphics = spare;
+    video->submitted++;
+
+    uint32_t depth = ptrRingDepth(&video->filled);
+    if (depth > video->maxDepth) {
+        video->maxDepth = depth;
+    }
+    sem_post(&video->ready);
+}
+
+/* From the emulation thread */
+void getVideoStats(VideoWriter* video, VideoStats* stats) {
+    stats->frames = video->frames;
+    stats->submitted = video->submitted;
+    stats->written = atomic_load_explicit(&video->written, memory_order_relaxed);
+    stats->dropped = video->dropped;
+    stats->depth = ptrRingDepth(&video->filled);
+    stats->maxDepth = video->maxDepth;
+}
+
+/* Writes out everything still queued and closes the output. Returns -1 if any write failed. The machine keeps the
+    * buffer it is drawing into.
+*/
+int closeVideo(VideoWriter* video) {
+    sem_post(&video->ready);
+    pthread_join(video->thread, NULL);
+    sem_destroy(&video->ready);
+    sem_destroy(&video->returned);
+
+    int failed = atomic_load(&video->failed);
+    if (video->pipe) {
+        failed |= pclose(video->out) != 0;
+    } else if (video->out == stdout) {
+        failed |= fflush(stdout) != 0;
+    } else {
+        failed |= fclose(video->out) != 0;
+    }
+    freeVideo(video);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,82 @@
+// Build: make check-lib
+/* A minimal libsrikurnes host that only sees srikurnes.h: it builds a tiny NROM game in memory whose NMI handler
+    * counts frames in $0000, and checks that running, headless machines, save states and rewind all agree on it
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "srikurnes.h"
+
+#define PRG_SIZE 0x4000
+#define CHR_SIZE 0x2000
+
+static const uint8_t program[] = {
+    0xA9, 0x00,             /* $8000 LDA #$00     power-on RAM is random */
+    0x85, 0x00,             /* $8002 STA $00      */
+    0xA9, 0x80,             /* $8004 LDA #$80     */
+    0x8D, 0x00, 0x20,       /* $8006 STA $2000    NMI on (again and again, past the PPU warm-up) */
+    0x4C, 0x06, 0x80,       /* $8009 JMP $8006    */
+    0xE6, 0x00,             /* $800C INC $00      NMI: one more frame */
+    0x40,                   /* $800E RTI          */
+};
+
+static uint8_t image[16 + PRG_SIZE + CHR_SIZE];
+
+static SrikurNESRom* buildRom(void) {
+    memcpy(image, "NES\x1A\x01\x01", 6);
+    uint8_t* prg = image + 16;
+    memcpy(prg, program, sizeof(program));
+    /* NMI, reset and IRQ vectors */
+    const uint8_t vectors[6] = { 0x0C, 0x80, 0x00, 0x80, 0x00, 0x80 };
+    memcpy(prg + PRG_SIZE - 6, vectors, sizeof(vectors));
+    return srikurnes_rom_from_memory(image, sizeof(image));
+}
+
+static int check(int ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "embed: %s\n", what);
+    }
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[argc + 1]) {
+    const char* statePath = argc > 1 ? argv[1] : "embed.state";
+    SrikurNESRom* rom = buildRom();
+    SrikurNES* machines[2] = { srikurnes_create(), srikurnes_create() };
+    SrikurNESRewind* rewind = srikurnes_rewind_create(1 << 20, 30);
+    if (!rom || !machines[0] || !machines[1] || !rewind) {
+        fprintf(stderr, "embed: can't set up\n");
+        return 1;
+    }
+    srikurnes_set_headless(machines[1], 1);
+    int failures = 0;
+    failures += check(srikurnes_load(machines[0], rom, 1) == 0 && srikurnes_load(machines[1], rom, 1) == 0, "load");
+
+    for (int frame = 0; frame < 100; frame++) {
+        srikurnes_step_frame(machines[0]);
+        srikurnes_rewind_capture(rewind, machines[0]);
+    }
+    srikurnes_step_many(machines + 1, 1, 100);
+    uint8_t counted = srikurnes_ram(machines[0])[0];
+    failures += check(counted >= 95 && counted <= 100, "the NMI handler didn't count frames");
+    failures += check(srikurnes_ram(machines[1])[0] == counted, "the headless machine went its own way");
+    failures += check(srikurnes_frame_count(machines[0]) == 100, "frame count");
+    failures += check(srikurnes_framebuffer(machines[0]) != NULL, "framebuffer");
+
+    failures += check(srikurnes_save_state(machines[0], statePath) == 0, "save state");
+    srikurnes_step_n_frames(machines[0], 10);
+    failures += check(srikurnes_load_state(machines[0], statePath) == 0, "load state");
+    failures += check(srikurnes_ram(machines[0])[0] == counted, "the loaded state isn't the saved one");
+    remove(statePath);
+
+    failures += check(srikurnes_rewind_restore(rewind, machines[0], 49) == 0, "rewind");
+    failures += check(srikurnes_frame_count(machines[0]) == 50, "rewound to the wrong frame");
+    failures += check((uint8_t)(counted - srikurnes_ram(machines[0])[0]) == 50, "rewound RAM");
+
+    srikurnes_rewind_destroy(rewind);
+    srikurnes_destroy(machines[0]);
+    srikurnes_destroy(machines[1]);
+    srikurnes_rom_close(rom);
+    printf("embed: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}